@@ -22,7 +22,9 @@
 #include "ueth.h"
 #include "usys_log.h"
 #include "usys_signals.h"
-#include "usys_time.h"
+#include "usys_trace.h"
+
+#include <fcntl.h>
 
 #define SKEY "5e173f6ac3c669587538e7727cf19b782a4f2fda07c1eaa662c593e5e85e3051"
 #define REMOTE                                                                 \
@@ -46,6 +48,10 @@ main(int argc, char* argv[])
     ((void)argv);
     ueth_context eth;
 
+    // Shards queue log records, a writer thread prints them
+    usys_log_init(STDOUT_FILENO);
+    usys_trace_thread("main");
+
     // Log message
     usys_log_note("Running ping pong demo");
 
@@ -56,14 +62,20 @@ main(int argc, char* argv[])
     ueth_init(&eth, &config);
     ueth_start(&eth, 1, g_test_enode);
 
-    while (usys_running()) {
-        // Poll io
-        usys_msleep(200);
-        ueth_poll(&eth);
-    }
+    // Sleeps until io, a timer (keepalive, redial) or a signal needs us
+    ueth_run(&eth);
 
     // Notify remotes of shutdown and clean
     ueth_stop(&eth);
     ueth_deinit(&eth);
+#if USYS_TRACE
+    // Open in chrome://tracing or ui.perfetto.dev
+    int fd = open("pingpong-trace.json", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        usys_trace_dump(fd);
+        close(fd);
+    }
+#endif
+    usys_log_deinit();
     return 0;
 }
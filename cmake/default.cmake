@@ -2,6 +2,8 @@
 
 # libusys objs
 option (UETH_USE_UNIX "os abstraction layer linkage" ON)
+option (UETH_USE_IO_URING "io_uring reactor when kernel headers support it" ON)
+option (UETH_USE_TRACE "trace spans with chrome trace dumps (usys_trace.h)" OFF)
 
 # libucrypto config
 option(UETH_USE_MBEDTLS "Link with libmbedcrypto.a" ON)
@@ -11,3 +13,7 @@ option(UETH_USE_SECP256K1 "Link with libsecp256k1.a" ON)
 add_definitions(-DURLP_CONFIG_UNIX)
 add_definitions(-DURLPX_CONFIG_UNIX)
 add_definitions(-DUSYS_CONFIG_UNIX)
+
+if (${UETH_USE_TRACE})
+	add_definitions(-DUSYS_TRACE=1)
+endif()
@@ -104,6 +104,112 @@ uaes_crypt_ecb_dec(uaes_ctx* ctx, const uint8_t* in, uint8_t* out)
     return mbedtls_aes_crypt_ecb(&ctx->ctx, MBEDTLS_AES_DECRYPT, in, out);
 }
 
+int
+uaes_crypt_gcm_enc(
+    int keysz,
+    const uint8_t* key,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out)
+{
+    int err;
+    uaes_gcm_ctx gcm;
+    if (uaes_gcm_init(&gcm, keysz, key)) return -1;
+    err = uaes_gcm_enc(&gcm, iv, ad, adlen, in, inlen, out);
+    uaes_gcm_deinit(&gcm);
+    return err;
+}
+
+int
+uaes_crypt_gcm_dec(
+    int keysz,
+    const uint8_t* key,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out)
+{
+    int err;
+    uaes_gcm_ctx gcm;
+    if (uaes_gcm_init(&gcm, keysz, key)) return -1;
+    err = uaes_gcm_dec(&gcm, iv, ad, adlen, in, inlen, out);
+    uaes_gcm_deinit(&gcm);
+    return err;
+}
+
+int
+uaes_gcm_init(uaes_gcm_ctx* ctx, int keysz, const uint8_t* key)
+{
+    mbedtls_gcm_init(ctx);
+    if (mbedtls_gcm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, keysz)) {
+        mbedtls_gcm_free(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+void
+uaes_gcm_deinit(uaes_gcm_ctx* ctx)
+{
+    mbedtls_gcm_free(ctx);
+}
+
+int
+uaes_gcm_enc(
+    uaes_gcm_ctx* ctx,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out)
+{
+    int err = mbedtls_gcm_crypt_and_tag(
+        ctx,
+        MBEDTLS_GCM_ENCRYPT,
+        inlen,
+        iv,
+        12,
+        ad,
+        adlen,
+        in,
+        out,
+        16,
+        &out[inlen]);
+    return err ? -1 : 0;
+}
+
+int
+uaes_gcm_dec(
+    uaes_gcm_ctx* ctx,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out)
+{
+    int err;
+    if (inlen < 16) return -1;
+    err = mbedtls_gcm_auth_decrypt(
+        ctx,
+        inlen - 16,
+        iv,
+        12,
+        ad,
+        adlen,
+        &in[inlen - 16],
+        16,
+        in,
+        out);
+    return err ? -1 : 0;
+}
+
 //
 //
 //
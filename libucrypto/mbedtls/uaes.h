@@ -26,6 +26,7 @@ extern "C" {
 #endif
 
 #include "mbedtls/aes.h"
+#include "mbedtls/gcm.h"
 
 // clang-format off
 typedef struct{uint8_t b[16];} uaes_ctr_128_key;
@@ -40,6 +41,9 @@ typedef struct
     uint8_t iv[16];
 } uaes_ctx;
 
+// A gcm key schedule, zeroed memory is a valid (unkeyed) context
+typedef mbedtls_gcm_context uaes_gcm_ctx;
+
 int uaes_init(uaes_ctx* ctx, int keysz, uint8_t* key);
 void uaes_deinit(uaes_ctx** ctx);
 void uaes_crypt_reset(uaes_ctx* ctx);
@@ -109,6 +113,57 @@ uaes_crypt_ctr_256(
 int uaes_crypt_ecb_enc(uaes_ctx* ctx, const uint8_t* in, uint8_t* out);
 int uaes_crypt_ecb_dec(uaes_ctx* ctx, const uint8_t* in, uint8_t* out);
 
+/**
+ * @brief AES-GCM with a 12 byte iv and a 16 byte tag. enc writes inlen bytes
+ * of cipher text and the tag after it, dec takes the same (inlen counts the
+ * tag) and writes inlen - 16 bytes.
+ *
+ * @return 0 ok, -1 error or (dec) the tag doesn't authenticate
+ */
+int uaes_crypt_gcm_enc(
+    int keysz,
+    const uint8_t* key,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out);
+int uaes_crypt_gcm_dec(
+    int keysz,
+    const uint8_t* key,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out);
+
+/**
+ * @brief Same with the key set once, for a key that seals many messages.
+ * deinit wipes the key.
+ *
+ * @return 0 ok, -1 error or (dec) the tag doesn't authenticate
+ */
+int uaes_gcm_init(uaes_gcm_ctx* ctx, int keysz, const uint8_t* key);
+void uaes_gcm_deinit(uaes_gcm_ctx* ctx);
+int uaes_gcm_enc(
+    uaes_gcm_ctx* ctx,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out);
+int uaes_gcm_dec(
+    uaes_gcm_ctx* ctx,
+    const uint8_t* iv,
+    const uint8_t* ad,
+    size_t adlen,
+    const uint8_t* in,
+    size_t inlen,
+    uint8_t* out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -110,7 +110,11 @@ uecc_qtob(const uecc_public_key* q, byte* b, size_t l)
     secp256k1_context* ctx;
     ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
     ok = secp256k1_ec_pubkey_serialize(
-        ctx, b, &tmp, q, SECP256K1_EC_UNCOMPRESSED);
+        ctx,
+        b,
+        &tmp,
+        q,
+        l == 33 ? SECP256K1_EC_COMPRESSED : SECP256K1_EC_UNCOMPRESSED);
     secp256k1_context_destroy(ctx);
     return ok == 1 ? 0 : -1;
 }
@@ -150,6 +154,21 @@ uecc_sign(uecc_ctx* ctx, const byte* msg, size_t sz, uecc_signature* sig)
     return ok ? 0 : -1;
 }
 
+int
+uecc_sign_bin(uecc_ctx* ctx, const byte* digest, byte* b65)
+{
+    uecc_signature sig;
+    int v;
+    if (!secp256k1_ecdsa_sign_recoverable(
+            ctx->grp, &sig, digest, ctx->d.b, NULL, NULL)) {
+        return -1;
+    }
+    secp256k1_ecdsa_recoverable_signature_serialize_compact(
+        ctx->grp, b65, &v, &sig);
+    b65[64] = v;
+    return 0;
+}
+
 int
 uecc_verify(
     const uecc_public_key* q,
@@ -170,6 +189,20 @@ uecc_verify(
     return ok ? 0 : -1;
 }
 
+int
+uecc_verify_bin(const uecc_public_key* q, const byte* digest, const byte* b64)
+{
+    secp256k1_context* ctx;
+    secp256k1_ecdsa_signature sig;
+    int ok;
+    ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
+    if (!ctx) return -1;
+    ok = secp256k1_ecdsa_signature_parse_compact(ctx, &sig, b64) &&
+         secp256k1_ecdsa_verify(ctx, &sig, digest, q);
+    secp256k1_context_destroy(ctx);
+    return ok ? 0 : -1;
+}
+
 int
 uecc_recover_bin(const byte* b, byte* digest, uecc_public_key* key)
 {
@@ -81,6 +81,11 @@ int uecc_key_init_new(uecc_ctx*);
 void uecc_key_deinit(uecc_ctx*);
 
 int uecc_sig_to_bin(const uecc_signature* sig, byte* b65);
+
+/**
+ * @brief Serialize q, compressed when l is 33 (else uncompressed, 65 bytes).
+ * uecc_btoq parses either.
+ */
 int uecc_qtob(const uecc_public_key* q, byte* b, size_t l);
 int uecc_btoq(const byte*, size_t l, uecc_public_key* q);
 
@@ -106,6 +111,12 @@ int uecc_agree_bin(uecc_ctx* ctx, const byte* bytes, size_t blen);
  */
 int uecc_sign(uecc_ctx* ctx, const byte* b, size_t sz, uecc_signature*);
 
+/**
+ * @brief Sign a 32 byte digest into r|s|v with the key's own context (no
+ * context is created per call, see uecc_sig_to_bin).
+ */
+int uecc_sign_bin(uecc_ctx* ctx, const byte* digest, byte* b65);
+
 int uecc_z_cmp(
     const uecc_shared_secret_w_header* a,
     const uecc_shared_secret_w_header* b);
@@ -128,6 +139,13 @@ int uecc_verify(
     size_t sz,
     uecc_signature*);
 
+/**
+ * @brief Verify a 64 byte r|s signature (no recovery id) of a 32 byte digest
+ *
+ * @return 0 valid, -1 invalid
+ */
+int uecc_verify_bin(const uecc_public_key* q, const byte* digest, const byte*);
+
 /**
  * @brief
  *
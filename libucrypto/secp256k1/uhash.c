@@ -118,6 +118,37 @@ uhash_kdf(uint8_t* z, size_t zlen, uint8_t* b, size_t keylen)
     }
 }
 
+void
+uhash_hkdf(
+    const uint8_t* salt,
+    size_t saltlen,
+    const uint8_t* ikm,
+    size_t ikmlen,
+    const uint8_t* info,
+    size_t infolen,
+    uint8_t* out,
+    size_t outlen)
+{
+    uhmac_sha256_ctx hmac;
+    uint8_t prk[32], t[32], i = 0;
+    size_t n;
+
+    // T(i) = hmac(prk, T(i - 1) | info | i), T(0) empty
+    uhmac_sha256(salt, saltlen, ikm, ikmlen, prk);
+    while (outlen) {
+        uhmac_sha256_init(&hmac, prk, sizeof(prk));
+        if (i++) uhmac_sha256_update(&hmac, t, sizeof(t));
+        uhmac_sha256_update(&hmac, info, infolen);
+        uhmac_sha256_update(&hmac, &i, 1);
+        uhmac_sha256_finish(&hmac, t);
+        uhmac_sha256_free(&hmac);
+        n = outlen < sizeof(t) ? outlen : sizeof(t);
+        memcpy(out, t, n);
+        out += n;
+        outlen -= n;
+    }
+}
+
 //
 //
 //
@@ -50,6 +50,20 @@ void uhmac_sha256(
     uint8_t* hmac);
 void uhash_kdf(uint8_t*, size_t, uint8_t*, size_t);
 
+/**
+ * @brief HKDF-SHA256 (RFC 5869), extract with salt then expand info into
+ * outlen bytes (at most 255 * 32)
+ */
+void uhash_hkdf(
+    const uint8_t* salt,
+    size_t saltlen,
+    const uint8_t* ikm,
+    size_t ikmlen,
+    const uint8_t* info,
+    size_t infolen,
+    uint8_t* out,
+    size_t outlen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -57,6 +57,12 @@ const char* g_hmac = "af6623e52208c596e17c72cea6f1cb09";
 const char* g_hmac_input = "3461282bcedace970df2";
 const char* g_hmac_result =
     "B3CE623BCE08D5793677BA9441B22BB34D3E8A7DE964206D26589DF3E8EB5183";
+const char* g_hkdf_ikm = "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b";
+const char* g_hkdf_salt = "000102030405060708090a0b0c";
+const char* g_hkdf_info = "f0f1f2f3f4f5f6f7f8f9";
+const char* g_hkdf_result =
+    "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208"
+    "d5b887185865";
 const char* alice_pkey_str =
     "5e173f6ac3c669587538e7727cf19b782a4f2fda07c1eaa662c593e5e85e3051";
 const char* alice_ekey_str =
@@ -99,6 +105,7 @@ int test_ecdh(void);
 int test_recover(void);
 int test_kdf(void);
 int test_hmac(void);
+int test_hkdf(void);
 int test_keccak(void);
 int test_ecies_encrypt(void);
 int test_ecies_decrypt(void);
@@ -114,6 +121,7 @@ main(int argc, char* argv[])
     err |= test_recover();
     err |= test_kdf();
     err |= test_hmac();
+    err |= test_hkdf();
     err |= test_keccak();
     err |= test_ecies_encrypt();
     err |= test_ecies_decrypt();
@@ -267,6 +275,27 @@ test_hmac()
     return err;
 }
 
+int
+test_hkdf()
+{
+    // RFC 5869 test case 1
+    uint8_t ikm[22], salt[13], info[10], expect[42], result[42];
+    memcpy(ikm, makebin(g_hkdf_ikm, NULL), sizeof(ikm));
+    memcpy(salt, makebin(g_hkdf_salt, NULL), sizeof(salt));
+    memcpy(info, makebin(g_hkdf_info, NULL), sizeof(info));
+    memcpy(expect, makebin(g_hkdf_result, NULL), sizeof(expect));
+    uhash_hkdf(
+        salt,
+        sizeof(salt),
+        ikm,
+        sizeof(ikm),
+        info,
+        sizeof(info),
+        result,
+        sizeof(result));
+    return memcmp(expect, result, sizeof(expect)) ? -1 : 0;
+}
+
 int
 test_keccak()
 {
@@ -29,33 +29,88 @@ extern "C" {
 #include "ueth_config.h"
 
 #include "rlpx_io.h"
+#include "ueth_shard.h"
+#include "usys_metrics.h"
 
 typedef struct
 {
     const char* p2p_private_key;
-    int p2p_enable;
+    int p2p_enable;           /*!< discovery on the udp port */
     uint32_t udp;
+    uint32_t max_peers;       /*!< 0 for UETH_CONFIG_MAX_PEERS */
+    uint32_t shards;          /*!< reactor threads (0, 1 - poll from caller) */
+    const char* metrics_path; /*!< Prometheus export (file or "unix:path") */
+    uint32_t metrics_ms;      /*!< 0 for UETH_CONFIG_METRICS_MS */
+    const char* nodes_path;   /*!< node database, path.<shard> (NULL none) */
 } ueth_config;
 
 typedef struct ueth_context
 {
     uecc_ctx p2p_static_key;
     ueth_config config;
-    async_io io;
-    int (*poll)(struct ueth_context*);
-    uint32_t n;
-    rlpx_io ch[UETH_CONFIG_NUM_CHANNELS];
+    int (*poll)(struct ueth_context*, uint32_t ms);
+    ueth_shard* shards;            /*!< one reactor per thread */
+    uint32_t nshards;              /*!< number of shards */
+    uint32_t next;                 /*!< round robin for new peers (atomic) */
+    usys_file_fd wake[2];          /*!< wakes ueth_run when threaded */
+    int quit;                      /*!< ueth_break called */
+    usys_metrics_exporter metrics; /*!< when config.metrics_path is set */
 } ueth_context;
 
 int ueth_init(ueth_context* ctx, ueth_config* config);
 void ueth_deinit(ueth_context* ctx);
-int ueth_start(ueth_context* ctx, int, ...);
 int ueth_stop(ueth_context* ctx);
 
+/**
+ * @brief Dial n enodes, spread over the shards. Like ueth_ping_all and
+ * ueth_disconnect_all this only queues commands (see ueth_shard_send), so it
+ * is safe from any thread; they apply in order at the top of the shard's
+ * next iteration.
+ */
+int ueth_start(ueth_context* ctx, int n, ...);
+
+/**
+ * @brief Ping every ready peer on every shard (any thread).
+ */
+int ueth_ping_all(ueth_context* ctx);
+
+/**
+ * @brief Disconnect every peer on every shard (any thread).
+ */
+int ueth_disconnect_all(ueth_context* ctx, RLPX_DEVP2P_DISCONNECT_REASON);
+
+/**
+ * @brief Sum of the stats each shard last published.
+ */
+void ueth_stats(ueth_context* ctx, ueth_shard_stats* stats);
+
+/**
+ * @brief Append every metric (rlpx totals and per shard gauges) in
+ * Prometheus text format (any thread). This is what the exporter writes.
+ */
+void ueth_metrics_text(ueth_context* ctx, usys_metrics_text* text);
+
+/**
+ * @brief Block until ueth_break or a signal (see usys_install_signal_handlers).
+ * With one shard the reactor runs on the calling thread and sleeps until a
+ * socket, timer or wakeup needs it; with more the shards run themselves and
+ * the caller just sleeps.
+ */
+int ueth_run(ueth_context* ctx);
+
+/**
+ * @brief Return ueth_run. Safe from any thread.
+ */
+void ueth_break(ueth_context* ctx);
+
+/**
+ * @brief One bounded step of ueth_run (up to UETH_CONFIG_POLL_MS), for
+ * callers with their own loop.
+ */
 static inline int
 ueth_poll(ueth_context* ctx)
 {
-    return ctx->poll(ctx);
+    return ctx->poll(ctx, UETH_CONFIG_POLL_MS);
 }
 
 #ifdef __cplusplus
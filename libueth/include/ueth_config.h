@@ -26,7 +26,60 @@
 extern "C" {
 #endif
 
-#define UETH_CONFIG_NUM_CHANNELS 8
+// Default peer limit when ueth_config.max_peers is 0
+#ifndef UETH_CONFIG_MAX_PEERS
+#define UETH_CONFIG_MAX_PEERS 1024
+#endif
+
+// Upper bound on ueth_config.shards
+#ifndef UETH_CONFIG_MAX_SHARDS
+#define UETH_CONFIG_MAX_SHARDS 64
+#endif
+
+// Commands a shard can have queued (from any thread)
+#ifndef UETH_CONFIG_SHARD_QUEUE
+#define UETH_CONFIG_SHARD_QUEUE 256
+#endif
+
+// Longest a ueth_poll call blocks (ueth_run blocks until there is work)
+#ifndef UETH_CONFIG_POLL_MS
+#define UETH_CONFIG_POLL_MS 100
+#endif
+
+// Sockets taken from the listener per accept call
+#ifndef UETH_CONFIG_ACCEPT_BATCH
+#define UETH_CONFIG_ACCEPT_BATCH 32
+#endif
+
+// Sockets taken from the listener per reactor iteration (rest wait a turn)
+#ifndef UETH_CONFIG_ACCEPT_MAX
+#define UETH_CONFIG_ACCEPT_MAX 256
+#endif
+
+// Inbound peers told "too many peers" at once (beyond that we just close)
+#ifndef UETH_CONFIG_SHED_MAX
+#define UETH_CONFIG_SHED_MAX 16
+#endif
+
+// Time a refused peer gets to finish its handshake and read our disconnect
+#ifndef UETH_CONFIG_SHED_MS
+#define UETH_CONFIG_SHED_MS 2000
+#endif
+
+// Metrics export interval when ueth_config.metrics_ms is 0
+#ifndef UETH_CONFIG_METRICS_MS
+#define UETH_CONFIG_METRICS_MS 10000
+#endif
+
+// Discovery refresh (lookup of our own id and of a random one) interval
+#ifndef UETH_CONFIG_REFRESH_MS
+#define UETH_CONFIG_REFRESH_MS 30000
+#endif
+
+// Time peers get to take our disconnect when we stop
+#ifndef UETH_CONFIG_QUIT_MS
+#define UETH_CONFIG_QUIT_MS 5000
+#endif
 
 #ifdef __cplusplus
 }
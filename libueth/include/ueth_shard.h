@@ -0,0 +1,181 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file ueth_shard.h
+ *
+ * @brief A shard is one reactor: its own async_loop, peer table, discovery
+ * socket (batched, see async_udp) and table, and (through the per thread
+ * pools) its own rlpx_io, handshake and protocol objects. In threaded mode
+ * each shard runs on a thread pinned to a core and nothing inside it is
+ * shared. Other threads talk to it only through a lock free command queue
+ * (each command wakes the shard's loop, which otherwise blocks until io or a
+ * timer is due) and read back stats published with atomic stores. With a
+ * single shard the owner drives it directly from ueth_poll or ueth_run, and
+ * commands from any thread still go through the queue.
+ *
+ * Every shard also listens on the devp2p port (SO_REUSEPORT) and admits
+ * inbound peers into its own table. When the table is full the remote is
+ * still answered, and told DEVP2P_DISCONNECT_TO_MANY_PEERS once the
+ * handshake completes.
+ *
+ * Discovery runs on one shard only: replies have to reach the table that
+ * asked, and a SO_REUSEPORT socket per shard would hand them to any shard.
+ * Nodes we are told to dial also seed its table. From there it looks up our
+ * own id and a random one every UETH_CONFIG_REFRESH_MS (the first time as
+ * soon as it has a seed) and hands the nodes the lookups converge on round
+ * robin to the shards whose peer table has room (UETH_SHARD_CMD_CONNECT,
+ * transient). With a node database the table starts from the nodes of the
+ * last run, and lookups start right away. discv5 packets on the same port
+ * are answered (rlpx_discv5) from the records it learns, lookups and dials
+ * still go through discv4.
+ */
+#ifndef UETH_SHARD_H_
+#define UETH_SHARD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ueth_config.h"
+
+#include "async_mpsc.h"
+#include "async_udp.h"
+#include "rlpx_discovery.h"
+#include "rlpx_discv5.h"
+#include "rlpx_peers.h"
+#include "usys_thread.h"
+
+// Disconnect target for every peer of a shard
+#define UETH_SHARD_ALL 0xffffffff
+
+typedef enum {
+    UETH_SHARD_CMD_CONNECT = 0, /*!< add a peer, dial and seed with node */
+    UETH_SHARD_CMD_PING,        /*!< ping every ready peer */
+    UETH_SHARD_CMD_DISCONNECT,  /*!< disconnect slot (or UETH_SHARD_ALL) */
+    UETH_SHARD_CMD_STOP,        /*!< disconnect everyone and exit thread */
+    UETH_SHARD_CMD_SEED,        /*!< seed discovery with node, no dial */
+} UETH_SHARD_CMD;
+
+typedef struct
+{
+    uint32_t type;      /*!< UETH_SHARD_CMD */
+    uint32_t slot;      /*!< DISCONNECT target */
+    uint32_t reason;    /*!< DISCONNECT reason */
+    uint32_t transient; /*!< CONNECT of a lookup result (see rlpx_io) */
+    rlpx_node node;     /*!< CONNECT and SEED target */
+} ueth_shard_cmd;
+
+typedef struct
+{
+    uint32_t peers;    /*!< peers in table */
+    uint32_t active;   /*!< peers connected */
+    uint32_t ready;    /*!< peers past handshake */
+    uint32_t cmds;     /*!< commands executed */
+    uint32_t polls;    /*!< reactor iterations */
+    uint32_t accepted; /*!< inbound peers admitted */
+    uint32_t refused;  /*!< inbound peers turned away */
+    uint32_t dgrams;   /*!< discovery datagrams read */
+    uint32_t txq;      /*!< bytes queued to peers, not yet written */
+    uint32_t queued;   /*!< commands waiting (read when stats are) */
+} ueth_shard_stats;
+
+typedef struct ueth_shard
+{
+    uint32_t id;                           /*!< index (core when threaded) */
+    struct ueth_shard* shards;             /*!< every shard, [id] is this */
+    uint32_t nshards;                      /*!< of shards */
+    uint32_t next;                         /*!< shard the next lookup dials */
+    uint32_t threaded;                     /*!< running on its own thread */
+    uint32_t open;                         /*!< reactor created */
+    int32_t state;                         /*!< 0 starting 1 running -1 done */
+    usys_thread thread;                    /*!< reactor thread */
+    uecc_ctx skey;                         /*!< own copy, agree writes ctx */
+    const uint32_t* listen;                /*!< udp/tcp port (0 none) */
+    uint32_t limit;                        /*!< max peers on this shard */
+    const char* nodes;                     /*!< node database (NULL none) */
+    int discovery;                         /*!< discv4/v5 on the udp port */
+    async_loop loop;                       /*!< reactor for this shard */
+    async_udp udp;                         /*!< discovery (SO_REUSEPORT) */
+    rlpx_discovery_table disc;             /*!< nodes heard over udp */
+    rlpx_discv5 disc5;                     /*!< discv5, same port */
+    rlpx_nodedb db;                        /*!< disc across restarts */
+    async_io tcp;                          /*!< listener (SO_REUSEPORT) */
+    uint32_t accepting;                    /*!< listener has sockets pending */
+    uint32_t refreshed;                    /*!< a refresh lookup ran */
+    uint32_t nshed;                        /*!< refused peers in shed */
+    rlpx_io* shed[UETH_CONFIG_SHED_MAX];   /*!< refused peers saying bye */
+    int64_t shed_at[UETH_CONFIG_SHED_MAX]; /*!< when refused (ms) */
+    async_timer shed_timer;                /*!< next refused peer expires */
+    async_timer refresh_timer;             /*!< next discovery refresh */
+    rlpx_peers peers;                      /*!< peers owned by this shard */
+    async_mpsc cmds;                       /*!< any thread -> shard */
+    ueth_shard_stats stats;                /*!< published by shard (atomic) */
+} ueth_shard;
+
+/**
+ * @brief Setup shard id of nshards (shard is shards[id]). With more than one
+ * the reactor is created and driven by a new thread (io_uring wants a single
+ * issuer) and this returns once it is up, otherwise the owner drives it with
+ * ueth_shard_poll. Without discovery the udp port stays closed and peers are
+ * only those dialed or handed over by the discovery shard.
+ */
+int ueth_shard_init(
+    ueth_shard* shard,
+    uint32_t id,
+    const uecc_private_key* d,
+    const uint32_t* udp,
+    uint32_t limit,
+    const char* nodes,
+    int discovery,
+    ueth_shard* shards,
+    uint32_t nshards);
+void ueth_shard_deinit(ueth_shard* shard);
+
+/**
+ * @brief Queue a command (any thread) and wake the shard. Commands run in
+ * queue order at the top of the shard's next iteration.
+ *
+ * @return 0 ok, -1 queue full
+ */
+int ueth_shard_send(ueth_shard* shard, const ueth_shard_cmd* cmd);
+
+/**
+ * @brief Ask the shard to say goodbye to its peers and wait until it has.
+ */
+int ueth_shard_stop(ueth_shard* shard);
+
+/**
+ * @brief One reactor iteration: run queued commands, dispatch ready sockets
+ * and timers, admit inbound peers, drain discovery datagrams and recycle
+ * dropped peers. Blocks up to ms (ASYNC_LOOP_FOREVER until there is work).
+ */
+int ueth_shard_poll(ueth_shard* shard, uint32_t ms);
+
+/**
+ * @brief Read stats published by the shard (any thread).
+ */
+void ueth_shard_stats_get(ueth_shard* shard, ueth_shard_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
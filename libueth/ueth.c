@@ -21,40 +21,61 @@
 
 #include "ueth.h"
 #include "usys_log.h"
+#include "usys_signals.h"
 #include "usys_time.h"
 
-int ueth_poll_tcp(ueth_context* ctx);
-int ueth_poll_udp(ueth_context* ctx);
-int ueth_on_accept(void* ctx);
-int ueth_on_connect(void* ctx);
-int ueth_on_erro(void* ctx);
-int ueth_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
-int ueth_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
-
-async_io_settings g_ueth_io_settings = {
-    .on_accept = NULL,       //
-    .on_connect = NULL,      //
-    .on_erro = ueth_on_erro, //
-    .on_send = ueth_on_send, //
-    .on_recv = ueth_on_recv, //
+#include <stddef.h>
+
+// Per shard samples of ueth_shard_stats
+typedef struct
+{
+    const char* name;
+    const char* type;
+    const char* help;
+    uint32_t off; /*!< field in ueth_shard_stats */
+} ueth_metrics_name;
+
+int ueth_poll_tcp(ueth_context* ctx, uint32_t ms);
+int ueth_poll_shards(ueth_context* ctx, uint32_t ms);
+int ueth_send_all(ueth_context* ctx, const ueth_shard_cmd* cmd);
+usys_file_fd ueth_wake_fd(ueth_context* ctx);
+void ueth_metrics_fill(void* ctx, usys_metrics_text* text);
+
+// clang-format off
+#define UETH_METRICS_NAME(nm, type, help, field)                               \
+    { nm, type, help, offsetof(ueth_shard_stats, field) }
+ueth_metrics_name g_ueth_metrics_names[] = {
+    UETH_METRICS_NAME("ueth_peers", "gauge", "Peers in table", peers),
+    UETH_METRICS_NAME("ueth_peers_active", "gauge", "Peers connected", active),
+    UETH_METRICS_NAME("ueth_peers_ready", "gauge", "Peers past handshake",
+                      ready),
+    UETH_METRICS_NAME("ueth_tx_queued_bytes", "gauge",
+                      "Bytes queued to peers, not yet written", txq),
+    UETH_METRICS_NAME("ueth_commands_queued", "gauge",
+                      "Commands waiting for the shard", queued),
+    UETH_METRICS_NAME("ueth_commands_total", "counter", "Commands executed",
+                      cmds),
+    UETH_METRICS_NAME("ueth_polls_total", "counter", "Reactor iterations",
+                      polls),
+    UETH_METRICS_NAME("ueth_accepted_total", "counter",
+                      "Inbound peers admitted", accepted),
+    UETH_METRICS_NAME("ueth_refused_total", "counter",
+                      "Inbound peers turned away", refused),
+    UETH_METRICS_NAME("ueth_datagrams_total", "counter",
+                      "Discovery datagrams read", dgrams),
 };
+// clang-format on
 
 int
 ueth_init(ueth_context* ctx, ueth_config* config)
 {
+    uint32_t i, n, limit;
     h256 key;
 
     // Copy config.
+    memset(ctx, 0, sizeof(ueth_context));
     ctx->config = *config;
-
-    // Setup udp listener
-    if (ctx->config.udp) {
-        async_io_init_udp(&ctx->io, ctx, &g_ueth_io_settings);
-        usys_listen_udp(&ctx->io.sock, ctx->config.udp);
-    }
-
-    // Polling mode (p2p enable, etc)
-    ctx->poll = config->p2p_enable ? ueth_poll_udp : ueth_poll_tcp;
+    ctx->wake[0] = ctx->wake[1] = -1;
 
     if (config->p2p_private_key) {
         rlpx_node_hex_to_bin(config->p2p_private_key, 0, key.b, NULL);
@@ -63,12 +84,48 @@ ueth_init(ueth_context* ctx, ueth_config* config)
         uecc_key_init_new(&ctx->p2p_static_key);
     }
 
-    // init constants
-    ctx->n = (sizeof(ctx->ch) / sizeof(rlpx_io));
+    // One reactor per shard, peer limit split between them. Discovery runs
+    // on shard 0 alone, its replies have to come back to the table that asked
+    n = config->shards ? config->shards : 1;
+    if (n > UETH_CONFIG_MAX_SHARDS) n = UETH_CONFIG_MAX_SHARDS;
+    limit = config->max_peers ? config->max_peers : UETH_CONFIG_MAX_PEERS;
+    limit = (limit + n - 1) / n;
+    ctx->shards = usys_malloc(sizeof(ueth_shard) * n);
+    if (!ctx->shards) {
+        uecc_key_deinit(&ctx->p2p_static_key);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (ueth_shard_init(
+                &ctx->shards[i],
+                i,
+                &ctx->p2p_static_key.d,
+                &ctx->config.udp,
+                limit,
+                ctx->config.nodes_path,
+                ctx->config.p2p_enable && i == 0,
+                ctx->shards,
+                n)) {
+            break;
+        }
+    }
+
+    // Fewer shards would run with less of the peer limit than configured
+    if ((ctx->nshards = i) < n) {
+        usys_log_err("[SHARD] %d of %d failed to start", i, n);
+        ueth_deinit(ctx);
+        return -1;
+    }
 
-    // Init peer pipes
-    for (uint32_t i = 0; i < ctx->n; i++) {
-        rlpx_io_init(&ctx->ch[i], &ctx->p2p_static_key, &ctx->config.udp);
+    // Polling mode (p2p enable, etc)
+    if (n > 1) {
+        ctx->poll = ueth_poll_shards;
+        if (usys_wake_open(ctx->wake)) {
+            ueth_deinit(ctx);
+            return -1;
+        }
+    } else {
+        ctx->poll = ueth_poll_tcp;
     }
 
     char hex[129];
@@ -76,6 +133,18 @@ ueth_init(ueth_context* ctx, ueth_config* config)
     uecc_qtob(&ctx->p2p_static_key.Q, q, 65);
     rlpx_node_bin_to_hex(&q[1], 64, hex, NULL);
     usys_log_info("enode://%s:%d", hex, ctx->config.udp);
+    usys_log_info("shards: %d", ctx->nshards);
+
+    // Exported from its own thread
+    if (config->metrics_path &&
+        usys_metrics_exporter_init(
+            &ctx->metrics,
+            config->metrics_path,
+            config->metrics_ms ? config->metrics_ms : UETH_CONFIG_METRICS_MS,
+            ueth_metrics_fill,
+            ctx)) {
+        usys_log_err("[METRICS] %s export failed", config->metrics_path);
+    }
 
     return 0;
 }
@@ -83,8 +152,17 @@ ueth_init(ueth_context* ctx, ueth_config* config)
 void
 ueth_deinit(ueth_context* ctx)
 {
+    // Last export sees the shards as they were
+    usys_metrics_exporter_deinit(&ctx->metrics);
+
     // Shutdown any open connections..
-    for (uint32_t i = 0; i < ctx->n; i++) rlpx_io_deinit(&ctx->ch[i]);
+    for (uint32_t i = 0; i < ctx->nshards; i++) {
+        ueth_shard_deinit(&ctx->shards[i]);
+    }
+    if (ctx->shards) usys_free(ctx->shards);
+    ctx->shards = NULL;
+    ctx->nshards = 0;
+    usys_wake_close(ctx->wake);
 
     // Free static key
     uecc_key_deinit(&ctx->p2p_static_key);
@@ -95,10 +173,23 @@ ueth_start(ueth_context* ctx, int n, ...)
 {
     va_list l;
     va_start(l, n);
-    const char* enode;
+    ueth_shard_cmd cmd = {.type = UETH_SHARD_CMD_CONNECT };
+    uint32_t s;
     for (uint32_t i = 0; i < (uint32_t)n; i++) {
-        enode = va_arg(l, const char*);
-        rlpx_io_connect_enode(&ctx->ch[i], enode);
+        if (rlpx_node_init_enode(&cmd.node, va_arg(l, const char*))) continue;
+
+        // Spread peers round robin, the owning shard dials them
+        cmd.type = UETH_SHARD_CMD_CONNECT;
+        s = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED) % ctx->nshards;
+        if (ueth_shard_send(&ctx->shards[s], &cmd)) {
+            usys_log_err("[SHARD] %d queue full", s);
+        }
+
+        // Discovery runs on shard 0, it is seeded wherever the peer went
+        cmd.type = UETH_SHARD_CMD_SEED;
+        if (s && ueth_shard_send(&ctx->shards[0], &cmd)) {
+            usys_log_err("[SHARD] 0 queue full");
+        }
     }
     va_end(l);
     return 0;
@@ -107,86 +198,131 @@ ueth_start(ueth_context* ctx, int n, ...)
 int
 ueth_stop(ueth_context* ctx)
 {
-    uint32_t mask = 0, i, c = 0, b = 0;
-    rlpx_io* ch[ctx->n];
-    for (i = 0; i < ctx->n; i++) {
-        if (rlpx_io_is_connected(&ctx->ch[i])) {
-            mask |= (1 << i);
-            ch[b++] = &ctx->ch[i];
-            rlpx_io_send_disconnect(&ctx->ch[i], DEVP2P_DISCONNECT_QUITTING);
-        }
-    }
-    while (mask && ++c < 50) {
-        usys_msleep(100);
-        rlpx_io_poll(ch, b, 100);
-        for (i = 0; i < ctx->n; i++) {
-            if (rlpx_io_is_shutdown(&ctx->ch[i])) mask &= (~(1 << i));
-        }
+    for (uint32_t i = 0; i < ctx->nshards; i++) {
+        ueth_shard_stop(&ctx->shards[i]);
     }
     return 0;
 }
 
 int
-ueth_poll_tcp(ueth_context* ctx)
-{
-    uint32_t i, b = 0;
-    rlpx_io* ch[ctx->n];
-    for (i = 0; i < ctx->n; i++) {
-        // If this channel has peer
-        if (ctx->ch[i].node.port_tcp) {
-            ch[b++] = &ctx->ch[i];
-            // If this channel is not connected
-            if (!rlpx_io_is_connected(&ctx->ch[i])) {
-                rlpx_io_nonce(&ctx->ch[i]);
-                rlpx_io_connect_node(&ctx->ch[i], &ctx->ch[i].node);
-            }
-        }
+ueth_run(ueth_context* ctx)
+{
+    // Nothing times the wait out, signals wake it
+    usys_signal_wake(ueth_wake_fd(ctx));
+    while (usys_running() && !__atomic_load_n(&ctx->quit, __ATOMIC_ACQUIRE)) {
+        ctx->poll(ctx, ASYNC_LOOP_FOREVER);
     }
-    rlpx_io_poll(ch, b, 100);
+    usys_signal_wake(-1);
+    __atomic_store_n(&ctx->quit, 0, __ATOMIC_RELAXED);
     return 0;
 }
 
+void
+ueth_break(ueth_context* ctx)
+{
+    __atomic_store_n(&ctx->quit, 1, __ATOMIC_RELEASE);
+    if (ctx->poll == ueth_poll_shards) {
+        usys_wake_signal(ctx->wake[1]);
+    } else {
+        async_loop_wake(&ctx->shards[0].loop);
+    }
+}
+
 int
-ueth_poll_udp(ueth_context* ctx)
+ueth_ping_all(ueth_context* ctx)
 {
-    async_io* io = &ctx->io;
-    int err;
+    ueth_shard_cmd cmd = {.type = UETH_SHARD_CMD_PING };
+    return ueth_send_all(ctx, &cmd);
+}
 
-    // Poll tcp
-    err = ueth_poll_tcp(ctx);
+int
+ueth_disconnect_all(ueth_context* ctx, RLPX_DEVP2P_DISCONNECT_REASON reason)
+{
+    ueth_shard_cmd cmd = {.type = UETH_SHARD_CMD_DISCONNECT,
+                          .slot = UETH_SHARD_ALL,
+                          .reason = reason };
+    return ueth_send_all(ctx, &cmd);
+}
 
-    // TODO - poll udp ports
-    async_io_poll_n(&io, 1, 100);
-    return 0;
+void
+ueth_stats(ueth_context* ctx, ueth_shard_stats* stats)
+{
+    ueth_shard_stats s;
+    memset(stats, 0, sizeof(ueth_shard_stats));
+    for (uint32_t i = 0; i < ctx->nshards; i++) {
+        ueth_shard_stats_get(&ctx->shards[i], &s);
+        stats->peers += s.peers;
+        stats->active += s.active;
+        stats->ready += s.ready;
+        stats->cmds += s.cmds;
+        stats->polls += s.polls;
+        stats->accepted += s.accepted;
+        stats->refused += s.refused;
+        stats->dgrams += s.dgrams;
+        stats->txq += s.txq;
+        stats->queued += s.queued;
+    }
+}
+
+void
+ueth_metrics_text(ueth_context* ctx, usys_metrics_text* text)
+{
+    ueth_shard_stats s[UETH_CONFIG_MAX_SHARDS];
+    const ueth_metrics_name* n;
+    rlpx_metrics m;
+    char label[16];
+    uint32_t i, k;
+
+    rlpx_metrics_snapshot(&m);
+    rlpx_metrics_text(text, &m);
+    for (i = 0; i < ctx->nshards; i++) {
+        ueth_shard_stats_get(&ctx->shards[i], &s[i]);
+    }
+    for (k = 0; k < sizeof(g_ueth_metrics_names) / sizeof(*n); k++) {
+        n = &g_ueth_metrics_names[k];
+        usys_metrics_text_family(text, n->name, n->type, n->help);
+        for (i = 0; i < ctx->nshards; i++) {
+            snprintf(label, sizeof(label), "shard=\"%u\"", i);
+            usys_metrics_text_sample(
+                text, n->name, label, *(uint32_t*)((uint8_t*)&s[i] + n->off));
+        }
+    }
 }
 
 int
-ueth_on_erro(void* ctx)
+ueth_send_all(ueth_context* ctx, const ueth_shard_cmd* cmd)
 {
-    ((void)ctx);
-    usys_log("[ IN] [UDP] error");
-    return 0;
+    int err = 0;
+    for (uint32_t i = 0; i < ctx->nshards; i++) {
+        if (ueth_shard_send(&ctx->shards[i], cmd)) err = -1;
+    }
+    return err;
+}
+
+void
+ueth_metrics_fill(void* ctx, usys_metrics_text* text)
+{
+    ueth_metrics_text(ctx, text);
+}
+
+usys_file_fd
+ueth_wake_fd(ueth_context* ctx)
+{
+    if (ctx->poll == ueth_poll_shards) return ctx->wake[1];
+    return ctx->shards[0].loop.wake[1];
 }
 
 int
-ueth_on_send(void* ctx, int err, const uint8_t* b, uint32_t l)
+ueth_poll_tcp(ueth_context* ctx, uint32_t ms)
 {
-    ((void)ctx);
-    ((void)err);
-    ((void)b);
-    ((void)l);
-    usys_log("[ IN] [UDP] send");
-    return 0;
+    return ueth_shard_poll(&ctx->shards[0], ms);
 }
 
 int
-ueth_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+ueth_poll_shards(ueth_context* ctx, uint32_t ms)
 {
-    ueth_context* eth = (ueth_context*)ctx;
-    ((void)err);
-    ((void)b);
-    ((void)l);
-    usys_log("[ IN] [UDP] hit");
+    // Shards poll themselves, the caller sleeps until woken
+    usys_wake_wait(ctx->wake[0], ms == ASYNC_LOOP_FOREVER ? -1 : (int)ms);
     return 0;
 }
 
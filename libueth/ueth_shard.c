@@ -0,0 +1,672 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "ueth_shard.h"
+#include "urand.h"
+#include "usys_log.h"
+#include "usys_time.h"
+#include "usys_trace.h"
+
+// Private
+int ueth_shard_open(ueth_shard* shard);
+void ueth_shard_close(ueth_shard* shard);
+void* ueth_shard_main(void* ctx);
+void ueth_shard_exec(ueth_shard* shard, const ueth_shard_cmd* cmd);
+void ueth_shard_quit(ueth_shard* shard);
+void ueth_shard_publish(ueth_shard* shard);
+void ueth_shard_accept(ueth_shard* shard);
+void ueth_shard_admit(ueth_shard* shard, usys_socket_fd fd);
+int ueth_shard_dial(ueth_shard* shard, const rlpx_node* node, int transient);
+int ueth_shard_hand(ueth_shard* shard, const rlpx_node* node);
+void ueth_shard_seed(ueth_shard* shard, const rlpx_node* node);
+void ueth_shard_load(ueth_shard* shard);
+void ueth_shard_shed(ueth_shard* shard);
+void ueth_shard_on_shed(void* ctx);
+void ueth_shard_on_refresh(void* ctx);
+void ueth_shard_on_lookup(void* ctx, klookup* l);
+int ueth_shard_on_accept(void* ctx);
+void ueth_shard_on_dgrams(void* ctx, const usys_dgram* d, uint32_t n);
+
+async_io_settings g_ueth_shard_tcp_settings = {
+    .on_accept = ueth_shard_on_accept, //
+};
+
+int
+ueth_shard_init(
+    ueth_shard* shard,
+    uint32_t id,
+    const uecc_private_key* d,
+    const uint32_t* udp,
+    uint32_t limit,
+    const char* nodes,
+    int discovery,
+    ueth_shard* shards,
+    uint32_t nshards)
+{
+    int err;
+    memset(shard, 0, sizeof(ueth_shard));
+    shard->id = id;
+    shard->shards = shards;
+    shard->nshards = nshards;
+    shard->listen = udp;
+    shard->limit = limit;
+    shard->nodes = nodes;
+    shard->discovery = discovery;
+    if (uecc_key_init_binary(&shard->skey, d)) return -1;
+    if (async_mpsc_init(
+            &shard->cmds, sizeof(ueth_shard_cmd), UETH_CONFIG_SHARD_QUEUE)) {
+        uecc_key_deinit(&shard->skey);
+        return -1;
+    }
+
+    // The reactor is created on the thread that drives it
+    if (!(nshards > 1)) {
+        err = ueth_shard_open(shard);
+    } else if (usys_thread_create(&shard->thread, ueth_shard_main, shard)) {
+        err = -1;
+    } else {
+        while (!(err = __atomic_load_n(&shard->state, __ATOMIC_ACQUIRE))) {
+            usys_msleep(1);
+        }
+        if (err < 0) {
+            usys_thread_join(&shard->thread);
+        } else {
+            shard->threaded = 1;
+            err = 0;
+        }
+    }
+    if (err) {
+        async_mpsc_deinit(&shard->cmds);
+        uecc_key_deinit(&shard->skey);
+    }
+    return err;
+}
+
+void
+ueth_shard_deinit(ueth_shard* shard)
+{
+    // Threaded shards close their reactor on their own thread
+    if (shard->threaded) {
+        ueth_shard_stop(shard);
+    } else {
+        ueth_shard_close(shard);
+    }
+    async_mpsc_deinit(&shard->cmds);
+    uecc_key_deinit(&shard->skey);
+}
+
+int
+ueth_shard_send(ueth_shard* shard, const ueth_shard_cmd* cmd)
+{
+    // Whoever drives the loop runs it, the wake ends a blocked wait
+    if (async_mpsc_push(&shard->cmds, cmd)) return -1;
+    async_loop_wake(&shard->loop);
+    return 0;
+}
+
+int
+ueth_shard_stop(ueth_shard* shard)
+{
+    ueth_shard_cmd cmd = {.type = UETH_SHARD_CMD_STOP };
+    if (!shard->threaded) {
+        ueth_shard_quit(shard);
+        return 0;
+    }
+
+    // Wait for room rather than lose the stop
+    while (__atomic_load_n(&shard->state, __ATOMIC_ACQUIRE) > 0) {
+        if (!async_mpsc_push(&shard->cmds, &cmd)) {
+            async_loop_wake(&shard->loop);
+            break;
+        }
+        usys_msleep(1);
+    }
+    usys_thread_join(&shard->thread);
+    shard->threaded = 0;
+    return 0;
+}
+
+int
+ueth_shard_poll(ueth_shard* shard, uint32_t ms)
+{
+    ueth_shard_cmd cmd;
+
+    // Commands from other threads first, in the order they were queued
+    while (!async_mpsc_pop(&shard->cmds, &cmd)) ueth_shard_exec(shard, &cmd);
+    if (__atomic_load_n(&shard->state, __ATOMIC_RELAXED) < 0) return 0;
+
+    // Dispatch only the sockets and timers that are ready, then admit new
+    // peers and read datagrams. Don't wait while either has a backlog.
+    async_loop_poll(
+        &shard->loop,
+        shard->accepting || async_udp_busy(&shard->udp) ? 0 : ms);
+    if (shard->accepting) ueth_shard_accept(shard);
+    if (async_udp_busy(&shard->udp) && async_udp_poll(&shard->udp) < 0) {
+        usys_log_err("[SHARD] %d udp read failed", shard->id);
+    }
+
+    // Dropped connections moved to the idle set as they closed and redial on
+    // their own timer. Inbound peers and peers from a lookup that gave up
+    // moved to the done set, they leave the table. Peers from ueth_start stay.
+    if (rlpx_peers_done_count(&shard->peers)) rlpx_peers_reap(&shard->peers);
+
+    // Drop refused peers that are done (or took too long)
+    if (shard->nshed) ueth_shard_shed(shard);
+
+    // Datagrams queued outside of a read (ie: from a timer)
+    if (async_udp_tx_pending(&shard->udp)) async_udp_flush(&shard->udp);
+    ueth_shard_publish(shard);
+    return 0;
+}
+
+void
+ueth_shard_stats_get(ueth_shard* shard, ueth_shard_stats* stats)
+{
+    ueth_shard_stats* s = &shard->stats;
+    stats->peers = __atomic_load_n(&s->peers, __ATOMIC_RELAXED);
+    stats->active = __atomic_load_n(&s->active, __ATOMIC_RELAXED);
+    stats->ready = __atomic_load_n(&s->ready, __ATOMIC_RELAXED);
+    stats->cmds = __atomic_load_n(&s->cmds, __ATOMIC_RELAXED);
+    stats->polls = __atomic_load_n(&s->polls, __ATOMIC_RELAXED);
+    stats->accepted = __atomic_load_n(&s->accepted, __ATOMIC_RELAXED);
+    stats->refused = __atomic_load_n(&s->refused, __ATOMIC_RELAXED);
+    stats->dgrams = __atomic_load_n(&s->dgrams, __ATOMIC_RELAXED);
+    stats->txq = __atomic_load_n(&s->txq, __ATOMIC_RELAXED);
+    stats->queued = async_mpsc_count(&shard->cmds);
+    if (stats->queued > shard->cmds.mask + 1) stats->queued = 0; // mid pop
+}
+
+int
+ueth_shard_open(ueth_shard* shard)
+{
+    rlpx_discovery_endpoint ep = {.iplen = 4 };
+    if (async_loop_init(&shard->loop)) return -1;
+    if (rlpx_discovery_table_init(&shard->disc)) {
+        async_loop_deinit(&shard->loop);
+        return -1;
+    }
+    async_timer_init(&shard->shed_timer, ueth_shard_on_shed, shard);
+    async_timer_init(&shard->refresh_timer, ueth_shard_on_refresh, shard);
+
+    // Discovery shard only, replies come back to the socket that asked
+    if (*shard->listen && shard->discovery) {
+        if (async_udp_init(&shard->udp, shard, ueth_shard_on_dgrams) ||
+            async_udp_listen(&shard->udp, &shard->loop, *shard->listen)) {
+            usys_log_err("[SHARD] %d udp listen failed", shard->id);
+            async_udp_deinit(&shard->udp);
+        } else {
+            ep.udp = ep.tcp = *shard->listen;
+            rlpx_discovery_table_bind(&shard->disc, &shard->skey, &shard->udp);
+            rlpx_discovery_table_endpoint(&shard->disc, &ep);
+
+            // discv5 answers with the same record, a packet unmasks to it
+            if (rlpx_discv5_init(&shard->disc5, shard, NULL, NULL) ||
+                rlpx_discv5_bind(
+                    &shard->disc5,
+                    &shard->skey,
+                    &shard->disc.enr,
+                    &shard->udp)) {
+                usys_log_err("[SHARD] %d discv5 failed", shard->id);
+            }
+            async_loop_timer(
+                &shard->loop, &shard->refresh_timer, UETH_CONFIG_REFRESH_MS);
+            if (shard->nodes) ueth_shard_load(shard);
+        }
+    }
+
+    // Same for the rlpx port, the kernel spreads connections
+    if (*shard->listen) {
+        async_io_init(&shard->tcp, shard, &g_ueth_shard_tcp_settings);
+        if (!async_io_listen(&shard->tcp, *shard->listen)) {
+            async_loop_add(&shard->loop, &shard->tcp);
+        } else {
+            usys_log_err("[SHARD] %d tcp listen failed", shard->id);
+            async_io_deinit(&shard->tcp);
+        }
+    }
+
+    rlpx_peers_init(
+        &shard->peers,
+        &shard->skey,
+        shard->listen,
+        &shard->loop,
+        shard->limit);
+    shard->open = 1;
+    return 0;
+}
+
+void
+ueth_shard_close(ueth_shard* shard)
+{
+    if (!shard->open) return;
+    while (shard->nshed) rlpx_io_free(&shard->shed[--shard->nshed]);
+    rlpx_peers_deinit(&shard->peers);
+    if (shard->tcp.loop) async_io_deinit(&shard->tcp);
+    if (shard->udp.mem) async_udp_deinit(&shard->udp);
+    rlpx_discv5_deinit(&shard->disc5);
+    rlpx_discovery_table_deinit(&shard->disc);
+    rlpx_nodedb_close(&shard->db);
+    async_loop_deinit(&shard->loop);
+    shard->open = 0;
+}
+
+void*
+ueth_shard_main(void* ctx)
+{
+    ueth_shard* shard = ctx;
+
+    usys_trace_thread("shard");
+    if (usys_thread_pin(shard->id)) {
+        usys_log("[SHARD] %d not pinned", shard->id);
+    }
+    if (ueth_shard_open(shard)) {
+        __atomic_store_n(&shard->state, -1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    __atomic_store_n(&shard->state, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&shard->state, __ATOMIC_ACQUIRE) > 0) {
+        // Sleep until io, a timer or a command (see ueth_shard_send)
+        ueth_shard_poll(shard, ASYNC_LOOP_FOREVER);
+    }
+
+    // Everything this thread allocated goes back before it exits
+    ueth_shard_close(shard);
+    rlpx_io_slab_deinit();
+    rlpx_handshake_slab_deinit();
+    rlpx_protocol_slab_deinit();
+    async_io_tx_cache_deinit();
+    return NULL;
+}
+
+void
+ueth_shard_exec(ueth_shard* shard, const ueth_shard_cmd* cmd)
+{
+    uint32_t i, cmds = shard->stats.cmds + 1;
+    rlpx_peers* peers = &shard->peers;
+    rlpx_io* ch;
+
+    __atomic_store_n(&shard->stats.cmds, cmds, __ATOMIC_RELAXED);
+    switch (cmd->type) {
+        case UETH_SHARD_CMD_CONNECT:
+            ueth_shard_seed(shard, &cmd->node);
+            ueth_shard_dial(shard, &cmd->node, cmd->transient);
+            break;
+        case UETH_SHARD_CMD_SEED:
+            ueth_shard_seed(shard, &cmd->node);
+            break;
+        case UETH_SHARD_CMD_PING:
+            for (i = rlpx_peers_active_count(peers); i--;) {
+                ch = rlpx_peers_active(peers, i);
+                if (rlpx_io_is_ready(ch) && rlpx_io_is_writable(ch)) {
+                    rlpx_io_send_ping(ch);
+                }
+            }
+            break;
+        case UETH_SHARD_CMD_DISCONNECT:
+            if (!(cmd->slot == UETH_SHARD_ALL)) {
+                ch = rlpx_peers_get(peers, cmd->slot);
+                if (ch && rlpx_io_is_connected(ch)) {
+                    rlpx_io_send_disconnect(ch, cmd->reason);
+                }
+                break;
+            }
+            for (i = rlpx_peers_active_count(peers); i--;) {
+                rlpx_io_send_disconnect(
+                    rlpx_peers_active(peers, i), cmd->reason);
+            }
+            break;
+        case UETH_SHARD_CMD_STOP:
+            ueth_shard_quit(shard);
+            __atomic_store_n(&shard->state, -1, __ATOMIC_RELEASE);
+            break;
+    }
+}
+
+void
+ueth_shard_quit(ueth_shard* shard)
+{
+    uint32_t i, n;
+    int64_t now = usys_now(), end = now + UETH_CONFIG_QUIT_MS;
+    rlpx_peers* peers = &shard->peers;
+    rlpx_io* ch;
+
+    // Nobody pings or redials while we leave
+    for (i = 0; i < rlpx_peers_idle_count(peers); i++) {
+        async_timer_stop(&rlpx_peers_idle(peers, i)->timer);
+    }
+    for (i = rlpx_peers_active_count(peers); i--;) {
+        ch = rlpx_peers_active(peers, i);
+        async_timer_stop(&ch->timer);
+        if (rlpx_io_is_connected(ch)) {
+            rlpx_io_send_disconnect(ch, DEVP2P_DISCONNECT_QUITTING);
+        }
+    }
+
+    // Wait on io (not a fixed sleep) until every peer has our disconnect
+    while (now < end) {
+        for (n = 0, i = 0; i < rlpx_peers_active_count(peers); i++) {
+            ch = rlpx_peers_active(peers, i);
+            if (rlpx_io_is_connected(ch) && !rlpx_io_is_shutdown(ch)) n++;
+        }
+        if (!n) break;
+        async_loop_poll(&shard->loop, (uint32_t)(end - now));
+        now = usys_now();
+    }
+}
+
+void
+ueth_shard_publish(ueth_shard* shard)
+{
+    uint32_t i, ready = 0, txq = 0, active;
+    ueth_shard_stats* s = &shard->stats;
+    rlpx_peers* peers = &shard->peers;
+    rlpx_io* ch;
+    active = rlpx_peers_active_count(peers);
+    for (i = 0; i < active; i++) {
+        ch = rlpx_peers_active(peers, i);
+        if (rlpx_io_is_ready(ch)) ready++;
+        txq += async_io_tx_pending(&ch->io);
+    }
+    __atomic_store_n(&s->peers, rlpx_peers_count(peers), __ATOMIC_RELAXED);
+    __atomic_store_n(&s->active, active, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->ready, ready, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->polls, s->polls + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->dgrams, shard->udp.nrecv, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->txq, txq, __ATOMIC_RELAXED);
+}
+
+void
+ueth_shard_accept(ueth_shard* shard)
+{
+    usys_socket_fd fds[UETH_CONFIG_ACCEPT_BATCH];
+    uint32_t total = 0;
+    int i, n;
+
+    // Bounded so a connect storm can't starve peers already admitted
+    while (total < UETH_CONFIG_ACCEPT_MAX) {
+        n = async_io_accept(&shard->tcp, fds, UETH_CONFIG_ACCEPT_BATCH);
+        for (i = 0; i < n; i++) ueth_shard_admit(shard, fds[i]);
+        if (n < UETH_CONFIG_ACCEPT_BATCH) {
+            shard->accepting = 0; // drained
+            break;
+        }
+        total += n;
+    }
+}
+
+void
+ueth_shard_admit(ueth_shard* shard, usys_socket_fd fd)
+{
+    rlpx_io* ch;
+    ueth_shard_stats* s = &shard->stats;
+
+    // Room in the table, peer waits for the remote auth
+    if ((ch = rlpx_peers_add(&shard->peers))) {
+        rlpx_io_nonce(ch);
+        rlpx_io_accept(ch, fd, NULL);
+        __atomic_store_n(&s->accepted, s->accepted + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Table full, answer the handshake and say why we hang up
+    __atomic_store_n(&s->refused, s->refused + 1, __ATOMIC_RELAXED);
+    if (shard->nshed < UETH_CONFIG_SHED_MAX &&
+        (ch = rlpx_io_alloc(&shard->skey, shard->listen))) {
+        if (!rlpx_io_attach(ch, &shard->loop)) {
+            rlpx_io_nonce(ch);
+            rlpx_io_accept(ch, fd, NULL);
+            rlpx_io_refuse(ch, DEVP2P_DISCONNECT_TO_MANY_PEERS);
+            shard->shed_at[shard->nshed] = usys_now_cached();
+            shard->shed[shard->nshed++] = ch;
+            if (!async_timer_active(&shard->shed_timer)) {
+                async_loop_timer(
+                    &shard->loop, &shard->shed_timer, UETH_CONFIG_SHED_MS);
+            }
+            return;
+        }
+        rlpx_io_free(&ch);
+    }
+    usys_close_fd(fd);
+}
+
+int
+ueth_shard_dial(ueth_shard* shard, const rlpx_node* node, int transient)
+{
+    rlpx_io* ch;
+    if (!(ch = rlpx_peers_add(&shard->peers))) return -1;
+    ch->transient = transient;
+    rlpx_io_nonce(ch);
+    rlpx_io_connect_node(ch, node);
+    return 0;
+}
+
+int
+ueth_shard_hand(ueth_shard* shard, const rlpx_node* node)
+{
+    ueth_shard_cmd cmd = {.type = UETH_SHARD_CMD_CONNECT, .transient = 1 };
+    ueth_shard* s;
+    uint32_t i;
+
+    // Round robin over running shards with room (as they last published)
+    for (i = 0; i < shard->nshards; i++) {
+        s = &shard->shards[shard->next++ % shard->nshards];
+        if (s == shard) {
+            if (!ueth_shard_dial(shard, node, 1)) return 0;
+        } else if (
+            __atomic_load_n(&s->state, __ATOMIC_ACQUIRE) == 1 &&
+            __atomic_load_n(&s->stats.peers, __ATOMIC_RELAXED) < s->limit) {
+            cmd.node = *node;
+            if (!ueth_shard_send(s, &cmd)) return 0;
+        }
+    }
+    return -1;
+}
+
+void
+ueth_shard_seed(ueth_shard* shard, const rlpx_node* node)
+{
+    rlpx_discovery_node* n;
+    uint32_t a, b, c, d;
+    uint8_t ip[4], pub[65];
+    knode id;
+
+    if (!(shard->disc.udp && node->port_udp) ||
+        !(sscanf(node->ip_v4, "%u.%u.%u.%u", &a, &b, &c, &d) == 4) ||
+        uecc_qtob(&node->id, pub, sizeof(pub))) {
+        return;
+    }
+    ip[0] = a;
+    ip[1] = b;
+    ip[2] = c;
+    ip[3] = d;
+    if (rlpx_discovery_table_add_node(
+            &shard->disc,
+            ip,
+            4,
+            node->port_tcp,
+            node->port_udp,
+            (uecc_public_key*)&node->id,
+            NULL)) {
+        return;
+    }
+
+    // Dialed already, lookups don't dial it again
+    rlpx_discovery_node_id(&pub[1], &id);
+    if (!rlpx_discovery_table_find_node(&shard->disc, &id, &n)) {
+        n->useful = RLPX_USEFUL_TRUE;
+    }
+
+    // First seed, refresh right away
+    if (!shard->refreshed) {
+        async_loop_timer(&shard->loop, &shard->refresh_timer, 0);
+    }
+}
+
+void
+ueth_shard_load(ueth_shard* shard)
+{
+    char path[256];
+    uint32_t n;
+    int64_t start = usys_now();
+
+    // Named after the shard, the one running discovery
+    snprintf(path, sizeof(path), "%s.%u", shard->nodes, shard->id);
+    if (rlpx_nodedb_open(&shard->db, path, RLPX_NODEDB_RECORDS)) {
+        usys_log_err("[SHARD] %d %s not opened", shard->id, path);
+        return;
+    }
+    n = rlpx_discovery_table_attach(&shard->disc, &shard->db);
+    usys_log(
+        "[SHARD] %d %u nodes from %s in %d ms",
+        shard->id,
+        n,
+        path,
+        (int)(usys_now() - start));
+
+    // Warm start, no seed to wait for
+    if (n) async_loop_timer(&shard->loop, &shard->refresh_timer, 0);
+}
+
+void
+ueth_shard_shed(ueth_shard* shard)
+{
+    uint32_t i = 0;
+    int64_t now = usys_now_cached(), next = -1;
+    while (i < shard->nshed) {
+        if (rlpx_io_is_connected(shard->shed[i]) &&
+            now - shard->shed_at[i] < UETH_CONFIG_SHED_MS) {
+            if (next < 0 || shard->shed_at[i] < next) next = shard->shed_at[i];
+            i++;
+            continue;
+        }
+        rlpx_io_free(&shard->shed[i]);
+        shard->nshed--;
+        shard->shed[i] = shard->shed[shard->nshed];
+        shard->shed_at[i] = shard->shed_at[shard->nshed];
+    }
+
+    // Wake for the oldest one left
+    if (next < 0) {
+        async_timer_stop(&shard->shed_timer);
+    } else {
+        async_loop_timer(
+            &shard->loop,
+            &shard->shed_timer,
+            (uint32_t)(next + UETH_CONFIG_SHED_MS - now));
+    }
+}
+
+void
+ueth_shard_on_shed(void* ctx)
+{
+    ueth_shard_shed((ueth_shard*)ctx);
+}
+
+void
+ueth_shard_on_refresh(void* ctx)
+{
+    ueth_shard* shard = ctx;
+    uint8_t target[65];
+
+    // Our own neighbourhood, then somewhere random
+    if (!uecc_qtob(&shard->skey.Q, target, sizeof(target)) &&
+        !rlpx_discovery_table_lookup(
+            &shard->disc, &target[1], ueth_shard_on_lookup, shard)) {
+        shard->refreshed = 1;
+    }
+    urand(target, 64);
+    rlpx_discovery_table_lookup(
+        &shard->disc, target, ueth_shard_on_lookup, shard);
+
+    // What changed since the last refresh goes to disk in the background
+    if (shard->disc.db) rlpx_nodedb_sync(shard->disc.db);
+    async_loop_timer(
+        &shard->loop, &shard->refresh_timer, UETH_CONFIG_REFRESH_MS);
+}
+
+void
+ueth_shard_on_lookup(void* ctx, klookup* l)
+{
+    ueth_shard* shard = ctx;
+    rlpx_discovery_node* n;
+    rlpx_node node;
+    uecc_public_key q;
+    uint32_t idx[KLOOKUP_K], i, c;
+    uint8_t pub[65] = { 0x04 };
+    char host[16];
+    klookup_node* k;
+    kpeer* p;
+
+    // Dial the closest we haven't yet while any shard has room
+    c = klookup_results(l, idx, KLOOKUP_K);
+    for (i = 0; i < c; i++) {
+        k = &l->nodes[idx[i]];
+        p = &k->peer;
+        if (rlpx_discovery_table_find_node(&shard->disc, &k->id, &n) ||
+            !(n->useful == RLPX_USEFUL_PENDING) ||
+            !(p->iplen == 4 && p->tcp)) {
+            continue;
+        }
+        memcpy(&pub[1], p->pub, 64);
+        if (uecc_btoq(pub, sizeof(pub), &q)) continue;
+        snprintf(
+            host,
+            sizeof(host),
+            "%u.%u.%u.%u",
+            p->ip[0],
+            p->ip[1],
+            p->ip[2],
+            p->ip[3]);
+        rlpx_node_init(&node, &q, host, p->tcp, p->udp);
+        if (ueth_shard_hand(shard, &node)) break;
+        n->useful = RLPX_USEFUL_TRUE;
+    }
+}
+
+int
+ueth_shard_on_accept(void* ctx)
+{
+    // Sockets are taken after the loop has dispatched this batch
+    ((ueth_shard*)ctx)->accepting = 1;
+    return 0;
+}
+
+void
+ueth_shard_on_dgrams(void* ctx, const usys_dgram* d, uint32_t n)
+{
+    // One batch per recvmmsg, replies queue on the engine until it flushes.
+    // Both versions share the port, discv5 is told apart by its header.
+    ueth_shard* shard = ctx;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (!d[i].len) continue;
+        if (shard->disc5.udp &&
+            rlpx_discv5_is_packet(&shard->disc5, d[i].b, d[i].len)) {
+            rlpx_discv5_recv(&shard->disc5, d[i].b, d[i].len, &d[i].addr);
+        } else {
+            rlpx_discovery_recv(&shard->disc, d[i].b, d[i].len, &d[i].addr);
+        }
+    }
+}
+
+//
+//
+//
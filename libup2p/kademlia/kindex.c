@@ -0,0 +1,113 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "kindex.h"
+
+// Ids near ours share their leading bytes, spread them anyway
+#define kindex_home(ctx, key)                                                  \
+    ((uint32_t)(((key)*0x9e3779b97f4a7c15ull) >> 32) & (ctx)->mask)
+
+// Private
+uint32_t kindex_seek(kindex* ctx, uint64_t key);
+
+int
+kindex_init(kindex* ctx, uint32_t n)
+{
+    uint32_t cells = 8;
+    uint8_t* b;
+
+    // Power of two, at least twice n
+    memset(ctx, 0, sizeof(kindex));
+    while (cells < n * 2) cells <<= 1;
+    b = rlpx_malloc(cells * (sizeof(uint64_t) + sizeof(uint32_t)));
+    if (!b) return -1;
+    ctx->keys = (uint64_t*)b;
+    ctx->vals = (uint32_t*)&ctx->keys[cells];
+    ctx->mask = cells - 1;
+    ctx->max = cells / 2;
+    memset(ctx->vals, 0xff, cells * sizeof(uint32_t));
+    return 0;
+}
+
+void
+kindex_deinit(kindex* ctx)
+{
+    if (ctx->keys) rlpx_free(ctx->keys);
+    memset(ctx, 0, sizeof(kindex));
+}
+
+int
+kindex_get(kindex* ctx, const knode* id)
+{
+    uint32_t i = kindex_seek(ctx, kindex_key(id));
+    return ctx->vals[i] == KINDEX_NONE ? -1 : (int)ctx->vals[i];
+}
+
+int
+kindex_put(kindex* ctx, const knode* id, uint32_t slot)
+{
+    uint64_t key = kindex_key(id);
+    uint32_t i = kindex_seek(ctx, key);
+    if (ctx->vals[i] == KINDEX_NONE) {
+        if (ctx->size == ctx->max) return -1;
+        ctx->keys[i] = key;
+        ctx->size++;
+    }
+    ctx->vals[i] = slot;
+    return 0;
+}
+
+int
+kindex_del(kindex* ctx, const knode* id)
+{
+    uint32_t i = kindex_seek(ctx, kindex_key(id)), j = i, home;
+    if (ctx->vals[i] == KINDEX_NONE) return -1;
+
+    // Pull back every later cell of the run that may sit in the hole (its
+    // home is not cyclically inside (i, j]), so probes never stop early
+    for (;;) {
+        j = (j + 1) & ctx->mask;
+        if (ctx->vals[j] == KINDEX_NONE) break;
+        home = kindex_home(ctx, ctx->keys[j]);
+        if (((j - home) & ctx->mask) < ((j - i) & ctx->mask)) continue;
+        ctx->keys[i] = ctx->keys[j];
+        ctx->vals[i] = ctx->vals[j];
+        i = j;
+    }
+    ctx->vals[i] = KINDEX_NONE;
+    ctx->size--;
+    return 0;
+}
+
+uint32_t
+kindex_seek(kindex* ctx, uint64_t key)
+{
+    // Cell holding key, else the empty cell ending its run
+    uint32_t i = kindex_home(ctx, key);
+    while (ctx->vals[i] != KINDEX_NONE && ctx->keys[i] != key) {
+        i = (i + 1) & ctx->mask;
+    }
+    return i;
+}
+
+//
+//
+//
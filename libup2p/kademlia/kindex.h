@@ -0,0 +1,88 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file kindex.h
+ *
+ * @brief Node id -> slot hash index. Open addressing with linear probing,
+ * keyed by the first 64 bits of the id (keccak output, so already uniform).
+ * Lookup, update and delete are O(1) and deletes shift the run back instead
+ * of leaving tombstones. Two ids sharing 64 bits collide, callers compare the
+ * full id of the slot they get back.
+ */
+#ifndef KINDEX_H_
+#define KINDEX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "knode.h"
+
+// Value of an empty cell
+#define KINDEX_NONE 0xffffffff
+
+typedef struct
+{
+    uint64_t* keys; /*!< id prefix per cell */
+    uint32_t* vals; /*!< slot per cell, KINDEX_NONE when empty */
+    uint32_t mask;  /*!< cells - 1 */
+    uint32_t size;  /*!< cells in use */
+    uint32_t max;   /*!< most entries, keeps the load at or under half */
+} kindex;
+
+// Init/Deinit routines (room for n entries)
+int kindex_init(kindex* ctx, uint32_t n);
+void kindex_deinit(kindex* ctx);
+
+/**
+ * @brief Slot stored for id
+ *
+ * @return slot, -1 not found
+ */
+int kindex_get(kindex* ctx, const knode* id);
+
+/**
+ * @brief Store or update the slot of id
+ *
+ * @return 0 ok, -1 full
+ */
+int kindex_put(kindex* ctx, const knode* id, uint32_t slot);
+
+/**
+ * @brief Forget id
+ *
+ * @return 0 removed, -1 not found
+ */
+int kindex_del(kindex* ctx, const knode* id);
+
+static inline uint64_t
+kindex_key(const knode* id)
+{
+    uint64_t k;
+    memcpy(&k, id->b, sizeof(k));
+    return k;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,123 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "klookup.h"
+
+void
+klookup_init(klookup* l, const knode* target)
+{
+    memset(l, 0, sizeof(klookup));
+    l->target = *target;
+}
+
+int
+klookup_add(klookup* l, const knode* id, const kpeer* peer)
+{
+    uint32_t i;
+    int c;
+
+    // Find the place of id, closest first
+    for (i = 0; i < l->n; i++) {
+        c = knode_cmp(id, &l->nodes[i].id, &l->target);
+        if (c == 0) return 1;
+        if (c < 0) break;
+    }
+    if (i == KLOOKUP_NODES) return 1;
+
+    // Full, the furthest drops off (an answer from it is ignored)
+    if (l->n == KLOOKUP_NODES) {
+        if (l->nodes[--l->n].state == KLOOKUP_ASKED) l->inflight--;
+    }
+    memmove(
+        &l->nodes[i + 1],
+        &l->nodes[i],
+        (l->n - i) * sizeof(klookup_node));
+    l->nodes[i].id = *id;
+    l->nodes[i].peer = *peer;
+    l->nodes[i].state = KLOOKUP_FRESH;
+    l->n++;
+    return 0;
+}
+
+int
+klookup_next(klookup* l)
+{
+    uint32_t i, k = 0;
+    if (l->inflight >= KLOOKUP_ALPHA) return -1;
+
+    // Only the KLOOKUP_K closest still in the running are worth asking
+    for (i = 0; i < l->n && k < KLOOKUP_K; i++) {
+        if (l->nodes[i].state == KLOOKUP_FAILED) continue;
+        if (l->nodes[i].state == KLOOKUP_FRESH) {
+            l->nodes[i].state = KLOOKUP_ASKED;
+            l->inflight++;
+            return i;
+        }
+        k++;
+    }
+    return -1;
+}
+
+int
+klookup_reply(klookup* l, const knode* id, int ok)
+{
+    int i = klookup_find(l, id);
+    if (i < 0 || !(l->nodes[i].state == KLOOKUP_ASKED)) return -1;
+    l->nodes[i].state = ok ? KLOOKUP_REPLIED : KLOOKUP_FAILED;
+    l->inflight--;
+    return 0;
+}
+
+int
+klookup_find(klookup* l, const knode* id)
+{
+    uint32_t i;
+    for (i = 0; i < l->n; i++) {
+        if (!memcmp(&l->nodes[i].id, id, sizeof(knode))) return i;
+    }
+    return -1;
+}
+
+int
+klookup_done(klookup* l)
+{
+    uint32_t i, k = 0;
+    for (i = 0; i < l->n && k < KLOOKUP_K; i++) {
+        if (l->nodes[i].state == KLOOKUP_FAILED) continue;
+        if (!(l->nodes[i].state == KLOOKUP_REPLIED)) return 0;
+        k++;
+    }
+    return 1;
+}
+
+uint32_t
+klookup_results(klookup* l, uint32_t* idx, uint32_t k)
+{
+    uint32_t i, n = 0;
+    for (i = 0; i < l->n && n < k; i++) {
+        if (l->nodes[i].state == KLOOKUP_REPLIED) idx[n++] = i;
+    }
+    return n;
+}
+
+//
+//
+//
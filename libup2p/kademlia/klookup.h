@@ -0,0 +1,125 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file klookup.h
+ *
+ * @brief Iterative Kademlia lookup, transport free. Candidates are kept
+ * closest to the target first. klookup_next hands out the closest one not yet
+ * asked while fewer than KLOOKUP_ALPHA requests are in flight, the caller
+ * sends the request, adds the nodes the answer carries and marks the
+ * responder with klookup_reply (a timeout is a failed reply). The lookup has
+ * converged once the KLOOKUP_K closest candidates that did not fail have all
+ * answered.
+ */
+#ifndef KLOOKUP_H_
+#define KLOOKUP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "knode.h"
+
+// Requests in flight per lookup
+#ifndef KLOOKUP_ALPHA
+#define KLOOKUP_ALPHA 3
+#endif
+
+// Closest nodes a lookup converges on
+#ifndef KLOOKUP_K
+#define KLOOKUP_K 16
+#endif
+
+// Candidates kept (the furthest drop off)
+#ifndef KLOOKUP_NODES
+#define KLOOKUP_NODES (KLOOKUP_K * 2)
+#endif
+
+typedef enum {
+    KLOOKUP_FRESH = 0,
+    KLOOKUP_ASKED,
+    KLOOKUP_REPLIED,
+    KLOOKUP_FAILED
+} KLOOKUP_STATE;
+
+typedef struct
+{
+    knode id;       /*!< candidate */
+    kpeer peer;     /*!< where to ask */
+    uint32_t state; /*!< KLOOKUP_STATE */
+} klookup_node;
+
+typedef struct
+{
+    knode target;                       /*!< id looked for */
+    klookup_node nodes[KLOOKUP_NODES];  /*!< closest first */
+    uint32_t n;                         /*!< candidates */
+    uint32_t inflight;                  /*!< asked, not answered */
+} klookup;
+
+void klookup_init(klookup* l, const knode* target);
+
+/**
+ * @brief Add a candidate
+ *
+ * @return 0 added, 1 known or further than every candidate kept
+ */
+int klookup_add(klookup* l, const knode* id, const kpeer* peer);
+
+/**
+ * @brief Candidate to ask next (marked asked)
+ *
+ * @return index into nodes, -1 KLOOKUP_ALPHA in flight or nobody left to ask
+ */
+int klookup_next(klookup* l);
+
+/**
+ * @brief Record the answer (ok) or timeout (!ok) of an asked candidate
+ *
+ * @return 0 ok, -1 id was not waited on
+ */
+int klookup_reply(klookup* l, const knode* id, int ok);
+
+/**
+ * @brief Index of a candidate
+ *
+ * @return index into nodes, -1 not a candidate
+ */
+int klookup_find(klookup* l, const knode* id);
+
+/**
+ * @brief True once the KLOOKUP_K closest candidates that did not fail have
+ * answered (or there is nobody left to ask)
+ */
+int klookup_done(klookup* l);
+
+/**
+ * @brief Closest candidates that answered
+ *
+ * @return count written to idx (indexes into nodes), at most k
+ */
+uint32_t klookup_results(klookup* l, uint32_t* idx, uint32_t k);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,224 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+
+#include "knode.h"
+
+#if KNODE_X86
+#include <immintrin.h>
+#endif
+
+// Log distance given the first byte j where a and b differ
+#define KNODE_DISTANCE_AT(a, b, j)                                             \
+    (8 * (31 - (j)) + 32 - __builtin_clz((a)[j] ^ (b)[j]))
+
+typedef void (*knode_distances_fn)(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d);
+
+// Private
+void knode_distances_pick(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d);
+void knode_xor(const knode* a, const knode* b, uint64_t x[4]);
+int knode_xor_cmp(const uint64_t a[4], const uint64_t b[4]);
+
+uint32_t
+knode_distance(const knode* a, const knode* b)
+{
+    uint32_t i;
+    for (i = 0; i < 32; i++) {
+        if (a->b[i] ^ b->b[i]) return KNODE_DISTANCE_AT(a->b, b->b, i);
+    }
+    return 0;
+}
+
+int
+knode_cmp(const knode* a, const knode* b, const knode* target)
+{
+    uint32_t i, x, y;
+    for (i = 0; i < 32; i++) {
+        x = a->b[i] ^ target->b[i];
+        y = b->b[i] ^ target->b[i];
+        if (x != y) return x < y ? -1 : 1;
+    }
+    return 0;
+}
+
+// Kernel for this cpu, resolved by the first call
+static knode_distances_fn g_knode_distances = knode_distances_pick;
+
+void
+knode_distances(const knode* ids, uint32_t n, const knode* target, uint16_t* d)
+{
+    __atomic_load_n(&g_knode_distances, __ATOMIC_RELAXED)(ids, n, target, d);
+}
+
+void
+knode_distances_pick(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d)
+{
+    // Threads racing here all store the same kernel
+    knode_distances_fn fn = knode_distances_words;
+#if KNODE_X86
+    fn = __builtin_cpu_supports("avx2") ? knode_distances_avx2
+                                        : knode_distances_sse2;
+#endif
+    __atomic_store_n(&g_knode_distances, fn, __ATOMIC_RELAXED);
+    fn(ids, n, target, d);
+}
+
+uint32_t
+knode_select(
+    const knode* ids,
+    const uint16_t* d,
+    uint32_t n,
+    const knode* target,
+    uint32_t* out,
+    uint32_t k)
+{
+    uint32_t i, j, found = 0;
+    uint16_t cut = 256;
+    uint64_t x[4], best[k ? k : 1][4];
+
+    // One pass, only ids no further than the k-th best so far (few once the
+    // first k are in) pay for the full compare
+    for (i = 0; i < n; i++) {
+        if (d[i] > cut) continue;
+        knode_xor(&ids[i], target, x);
+        for (j = found; j > 0 && knode_xor_cmp(x, best[j - 1]) < 0; j--) {
+            if (j < k) {
+                memcpy(best[j], best[j - 1], sizeof(x));
+                out[j] = out[j - 1];
+            }
+        }
+        if (j < k) {
+            memcpy(best[j], x, sizeof(x));
+            out[j] = i;
+            if (found < k) found++;
+            if (found == k) cut = d[out[k - 1]];
+        }
+    }
+    return found;
+}
+
+void
+knode_distances_words(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d)
+{
+    uint64_t t[4], x;
+    uint32_t i, w, j;
+    memcpy(t, target->b, sizeof(t));
+    for (i = 0; i < n; i++) {
+        for (d[i] = 0, w = 0; w < 4; w++) {
+            memcpy(&x, &ids[i].b[w * 8], 8);
+            if (!(x ^= t[w])) continue;
+
+            // First differing byte in memory order
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            j = w * 8 + __builtin_ctzll(x) / 8;
+#else
+            j = w * 8 + __builtin_clzll(x) / 8;
+#endif
+            d[i] = KNODE_DISTANCE_AT(ids[i].b, target->b, j);
+            break;
+        }
+    }
+}
+
+#if KNODE_X86
+void
+knode_distances_sse2(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d)
+{
+    const __m128i t0 = _mm_loadu_si128((const __m128i*)target->b),
+                  t1 = _mm_loadu_si128((const __m128i*)&target->b[16]),
+                  z = _mm_setzero_si128();
+    __m128i x0, x1;
+    uint32_t i, m;
+    for (i = 0; i < n; i++) {
+        // Bit j of m is set when byte j differs
+        x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)ids[i].b), t0);
+        x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&ids[i].b[16]), t1);
+        m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x0, z)) |
+            (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x1, z)) << 16;
+        m = ~m;
+        d[i] = m ? KNODE_DISTANCE_AT(ids[i].b, target->b, __builtin_ctz(m)) : 0;
+    }
+}
+
+void
+knode_distances_avx2(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d)
+{
+    const __m256i t = _mm256_loadu_si256((const __m256i*)target->b),
+                  z = _mm256_setzero_si256();
+    __m256i x;
+    uint32_t i, m;
+    for (i = 0; i < n; i++) {
+        x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)ids[i].b), t);
+        m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, z));
+        d[i] = m ? KNODE_DISTANCE_AT(ids[i].b, target->b, __builtin_ctz(m)) : 0;
+    }
+}
+#endif
+
+void
+knode_xor(const knode* a, const knode* b, uint64_t x[4])
+{
+    // Big endian words compare like the ids do
+    uint32_t i, j;
+    for (i = 0; i < 4; i++) {
+        for (x[i] = 0, j = i * 8; j < i * 8 + 8; j++) {
+            x[i] = x[i] << 8 | (a->b[j] ^ b->b[j]);
+        }
+    }
+}
+
+int
+knode_xor_cmp(const uint64_t a[4], const uint64_t b[4])
+{
+    uint32_t i;
+    for (i = 0; i < 4; i++) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+//
+//
+//
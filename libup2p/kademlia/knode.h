@@ -19,9 +19,9 @@
  * @date 2017
  */
 
+
 #ifndef KNODE_H_
 #define KNODE_H_
-#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,11 +29,95 @@ extern "C" {
 
 #include "rlpx_config.h"
 
+// Kademlia id (keccak256 of the node's public key), XOR metric
 typedef struct
 {
     uint8_t b[32];
 } knode;
 
+// How to reach a node
+typedef struct
+{
+    uint8_t pub[64];  /*!< public key (less 0x04 prefix) */
+    uint8_t ip[16];   /*!< big endian, ipv4 in the first 4 */
+    uint32_t iplen;   /*!< 4 or 16 */
+    uint16_t udp;     /*!< discovery port */
+    uint16_t tcp;     /*!< devp2p port */
+    int64_t seen;     /*!< last heard from (ms) */
+} kpeer;
+
+// Vector distance kernels (SSE2/AVX2 on x86_64), else 64 bit words
+#ifndef KNODE_SIMD
+#define KNODE_SIMD 1
+#endif
+#if KNODE_SIMD && defined(__x86_64__)
+#define KNODE_X86 1
+#else
+#define KNODE_X86 0
+#endif
+
+// Distance of an empty slot, knode_select skips it
+#define KNODE_DISTANCE_NONE 0xffff
+
+/**
+ * @brief Log distance (0 same id, 256 furthest). Reference implementation,
+ * use knode_distances for many ids.
+ */
+uint32_t knode_distance(const knode* a, const knode* b);
+
+/**
+ * @brief Order a and b by XOR distance to target
+ *
+ * @return <0 a is closer, 0 same id, >0 b is closer
+ */
+int knode_cmp(const knode* a, const knode* b, const knode* target);
+
+/**
+ * @brief Log distance from target to each of n contiguous ids
+ */
+void knode_distances(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d);
+
+/**
+ * @brief The kernels knode_distances picks from (once, by cpu), for tests
+ */
+void knode_distances_words(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d);
+#if KNODE_X86
+void knode_distances_sse2(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d);
+void knode_distances_avx2(
+    const knode* ids,
+    uint32_t n,
+    const knode* target,
+    uint16_t* d) __attribute__((target("avx2")));
+#endif
+
+/**
+ * @brief Indices of up to k ids closest to target, closest first. d holds
+ * their log distances (knode_distances), ids further than the k-th best so
+ * far are skipped without a full compare.
+ *
+ * @return number of indices written to out
+ */
+uint32_t knode_select(
+    const knode* ids,
+    const uint16_t* d,
+    uint32_t n,
+    const knode* target,
+    uint32_t* out,
+    uint32_t k);
+
 #ifdef __cplusplus
 }
 #endif
+#endif
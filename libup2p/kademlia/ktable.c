@@ -19,30 +19,230 @@
  * @date 2017
  */
 
+
 #include "ktable.h"
-#include "urand.h"
+
+// Private
+int ktable_bucket(ktable* ctx, const knode* id);
+int ktable_seek(const knode* ids, uint32_t n, const knode* id);
+void ktable_touch(
+    ktable* ctx,
+    uint32_t s,
+    uint32_t i,
+    uint32_t n,
+    const knode* id,
+    const kpeer* peer,
+    int keep);
+void ktable_cut(ktable* ctx, uint32_t s, uint32_t i, uint32_t n);
+void ktable_put(
+    ktable* ctx,
+    uint32_t slot,
+    const knode* id,
+    const kpeer* peer,
+    const void* val);
+
+// Replacements follow the live slots in every array
+#define KTABLE_LIVE (KTABLE_BUCKETS * KTABLE_K)
+#define KTABLE_SPARE (KTABLE_BUCKETS * KTABLE_REPLACEMENTS)
 
 int
-ktable_init(ktable* ctx, knode* id)
+ktable_init(ktable* ctx, const knode* id, uint32_t vsize)
 {
-    ctx->node = *id;
+    uint32_t live = KTABLE_LIVE, spare = KTABLE_SPARE;
+    uint8_t* b;
+
+    // One block, buckets are only read up to their count
+    memset(ctx, 0, sizeof(ktable));
+    b = rlpx_malloc(
+        (live + spare) * (sizeof(knode) + sizeof(kpeer) + vsize) +
+        live * sizeof(uint16_t) + vsize);
+    if (!b) return -1;
+    ctx->self = *id;
+    ctx->ids = (knode*)b;
+    ctx->spare_ids = &ctx->ids[live];
+    ctx->peers = (kpeer*)&ctx->spare_ids[spare];
+    ctx->spares = &ctx->peers[live];
+    ctx->dist = (uint16_t*)&ctx->spares[spare];
+    ctx->vals = (uint8_t*)&ctx->dist[live];
+    ctx->scratch = &ctx->vals[(live + spare) * vsize];
+    ctx->vsize = vsize;
     return 0;
 }
 
 void
 ktable_deinit(ktable* ctx)
 {
-    ((void)ctx);
+    if (ctx->ids) rlpx_free(ctx->ids);
+    memset(ctx, 0, sizeof(ktable));
 }
 
 int
-ktable_add_node(ktable* ctx, knode* node)
+ktable_add_node(ktable* ctx, const knode* id, const kpeer* peer)
 {
-    return 0;
+    int b = ktable_bucket(ctx, id), i;
+    uint32_t s;
+    if (b < 0) return -1;
+
+    // Known or room in the bucket, most recently seen goes last
+    s = b * KTABLE_K;
+    if ((i = ktable_seek(&ctx->ids[s], ctx->n[b], id)) >= 0) {
+        ktable_touch(ctx, s, i, ctx->n[b], id, peer, 1);
+        return 0;
+    } else if (ctx->n[b] < KTABLE_K) {
+        ktable_put(ctx, s + ctx->n[b]++, id, peer, NULL);
+        ctx->size++;
+        return 0;
+    }
+
+    // Full, wait for a live node to go. Oldest replacement makes room.
+    s = KTABLE_LIVE + b * KTABLE_REPLACEMENTS;
+    if ((i = ktable_seek(&ctx->ids[s], ctx->nspare[b], id)) >= 0) {
+        ktable_touch(ctx, s, i, ctx->nspare[b], id, peer, 1);
+    } else if (ctx->nspare[b] < KTABLE_REPLACEMENTS) {
+        ktable_put(ctx, s + ctx->nspare[b]++, id, peer, NULL);
+    } else {
+        ktable_touch(ctx, s, 0, KTABLE_REPLACEMENTS, id, peer, 0);
+    }
+    return 1;
+}
+
+int
+ktable_remove_node(ktable* ctx, const knode* id)
+{
+    int b = ktable_bucket(ctx, id), i;
+    uint32_t live, spare;
+    if (b < 0) return -1;
+    live = b * KTABLE_K;
+    spare = KTABLE_LIVE + b * KTABLE_REPLACEMENTS;
+    if ((i = ktable_seek(&ctx->ids[live], ctx->n[b], id)) >= 0) {
+        ktable_cut(ctx, live, i, ctx->n[b]--);
+        ctx->size--;
+        if (ctx->nspare[b]) {
+            // Newest replacement is the most likely to be alive
+            spare += --ctx->nspare[b];
+            ktable_put(
+                ctx,
+                live + ctx->n[b]++,
+                &ctx->ids[spare],
+                &ctx->peers[spare],
+                ktable_value(ctx, spare));
+            ctx->size++;
+        }
+        return 0;
+    } else if ((i = ktable_seek(&ctx->ids[spare], ctx->nspare[b], id)) >= 0) {
+        ktable_cut(ctx, spare, i, ctx->nspare[b]--);
+        return 0;
+    }
+    return -1;
+}
+
+int
+ktable_find(ktable* ctx, const knode* id)
+{
+    int b = ktable_bucket(ctx, id), i;
+    if (b < 0) return -1;
+    i = ktable_seek(&ctx->ids[b * KTABLE_K], ctx->n[b], id);
+    return i < 0 ? -1 : b * KTABLE_K + i;
+}
+
+int
+ktable_oldest(ktable* ctx, const knode* id)
+{
+    int b = ktable_bucket(ctx, id);
+    return b < 0 || !ctx->n[b] ? -1 : b * KTABLE_K;
+}
+
+uint32_t
+ktable_closest(ktable* ctx, const knode* target, uint32_t* slots, uint32_t k)
+{
+    uint32_t b, s, live = KTABLE_LIVE;
+
+    // Distance to every live node, empty slots are skipped
+    memset(ctx->dist, 0xff, live * sizeof(uint16_t));
+    for (b = 0; b < KTABLE_BUCKETS; b++) {
+        s = b * KTABLE_K;
+        if (ctx->n[b]) {
+            knode_distances(&ctx->ids[s], ctx->n[b], target, &ctx->dist[s]);
+        }
+    }
+    return knode_select(ctx->ids, ctx->dist, live, target, slots, k);
+}
+
+uint32_t
+ktable_size(ktable* ctx)
+{
+    return ctx->size;
 }
 
 uint32_t
 ktable_buckets_len(ktable* ctx)
 {
-    return 0;
+    uint32_t b, n = 0;
+    for (b = 0; b < KTABLE_BUCKETS; b++) n += ctx->n[b] ? 1 : 0;
+    return n;
+}
+
+int
+ktable_bucket(ktable* ctx, const knode* id)
+{
+    return (int)knode_distance(&ctx->self, id) - 1;
+}
+
+int
+ktable_seek(const knode* ids, uint32_t n, const knode* id)
+{
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (!memcmp(ids[i].b, id->b, sizeof(knode))) return i;
+    }
+    return -1;
+}
+
+void
+ktable_touch(
+    ktable* ctx,
+    uint32_t s,
+    uint32_t i,
+    uint32_t n,
+    const knode* id,
+    const kpeer* peer,
+    int keep)
+{
+    // Drop slot i and write id to the end, with its value or a new one
+    if (keep) memcpy(ctx->scratch, ktable_value(ctx, s + i), ctx->vsize);
+    ktable_cut(ctx, s, i, n);
+    ktable_put(ctx, s + n - 1, id, peer, keep ? ctx->scratch : NULL);
 }
+
+void
+ktable_cut(ktable* ctx, uint32_t s, uint32_t i, uint32_t n)
+{
+    uint32_t m = n - i - 1;
+    memmove(&ctx->ids[s + i], &ctx->ids[s + i + 1], m * sizeof(knode));
+    memmove(&ctx->peers[s + i], &ctx->peers[s + i + 1], m * sizeof(kpeer));
+    memmove(
+        ktable_value(ctx, s + i),
+        ktable_value(ctx, s + i + 1),
+        m * ctx->vsize);
+}
+
+void
+ktable_put(
+    ktable* ctx,
+    uint32_t slot,
+    const knode* id,
+    const kpeer* peer,
+    const void* val)
+{
+    ctx->ids[slot] = *id;
+    ctx->peers[slot] = *peer;
+    if (val) {
+        memcpy(ktable_value(ctx, slot), val, ctx->vsize);
+    } else {
+        memset(ktable_value(ctx, slot), 0, ctx->vsize);
+    }
+}
+
+//
+//
+//
@@ -19,6 +19,22 @@
  * @date 2017
  */
 
+
+/**
+ * @file ktable.h
+ *
+ * @brief Kademlia routing table. Bucket i holds up to KTABLE_K nodes at log
+ * distance i + 1 from us, least recently seen first. Nodes heard from while
+ * their bucket is full wait in a per bucket replacement cache and take the
+ * place of live nodes that are removed (ie: failed a ping).
+ *
+ * Storage is one allocation made at init. Ids sit in one contiguous array
+ * (distance scans touch nothing else) and endpoints in a parallel one, so
+ * there is no allocation per node. Each slot also holds vsize bytes for the
+ * caller (see ktable_value), zero for a new node and kept while it moves
+ * around, is seen again or replaces a live one. Slots move when a bucket is
+ * reordered, use them right away.
+ */
 #ifndef RLPX_KADEMLIA_H_
 #define RLPX_KADEMLIA_H_
 
@@ -29,28 +45,98 @@ extern "C" {
 #include "knode.h"
 #include "rlpx_config.h"
 
+// One per bit of distance
+#define KTABLE_BUCKETS 256
+
+// Live nodes per bucket
+#ifndef KTABLE_K
+#define KTABLE_K 16
+#endif
+
+// Replacement cache per bucket
+#ifndef KTABLE_REPLACEMENTS
+#define KTABLE_REPLACEMENTS 8
+#endif
+
 typedef struct
 {
-    knode node;
+    knode self;                         /*!< our id */
+    knode* ids;                         /*!< [bucket * KTABLE_K + i] */
+    kpeer* peers;                       /*!< same slots as ids */
+    knode* spare_ids;                   /*!< [bucket * KTABLE_REPLACEMENTS] */
+    kpeer* spares;                      /*!< same slots as spare_ids */
+    uint8_t* vals;                      /*!< vsize per slot, live then spare */
+    uint8_t* scratch;                   /*!< vsize, a value on the move */
+    uint16_t* dist;                     /*!< ktable_closest scratch */
+    uint32_t vsize;                     /*!< caller bytes per slot */
+    uint8_t n[KTABLE_BUCKETS];          /*!< live nodes per bucket */
+    uint8_t nspare[KTABLE_BUCKETS];     /*!< replacements per bucket */
+    uint32_t size;                      /*!< live nodes */
 } ktable;
 
-// Init/Deinit routines
-int ktable_init(ktable* ctx, knode* id);
+// Init/Deinit routines, vsize bytes of ktable_value per slot (may be 0)
+int ktable_init(ktable* ctx, const knode* id, uint32_t vsize);
 void ktable_deinit(ktable* ctx);
 
-// add node to table
-int ktable_add_node(ktable* ctx, knode* node);
+/**
+ * @brief Add a node or mark it seen (moves to the back of its bucket).
+ *
+ * @return 0 live, 1 bucket full so it was cached as a replacement (ping
+ * ktable_oldest and remove it if it doesn't answer), -1 our own id
+ */
+int ktable_add_node(ktable* ctx, const knode* id, const kpeer* peer);
 
-// remove node to table
-int ktable_remove_node(ktable*, knode*);
+/**
+ * @brief Remove a live node, its most recent replacement takes the slot.
+ *
+ * @return 0 removed, -1 not found
+ */
+int ktable_remove_node(ktable* ctx, const knode* id);
+
+/**
+ * @brief Slot of a live node
+ *
+ * @return slot, -1 not found
+ */
+int ktable_find(ktable* ctx, const knode* id);
 
-// Get number of buckets
+/**
+ * @brief Least recently seen node of the bucket id falls in
+ *
+ * @return slot, -1 empty bucket
+ */
+int ktable_oldest(ktable* ctx, const knode* id);
+
+/**
+ * @brief Slots of up to k live nodes closest to target, closest first.
+ *
+ * @return number of slots written
+ */
+uint32_t
+ktable_closest(ktable* ctx, const knode* target, uint32_t* slots, uint32_t k);
+
+// Number of live nodes and of buckets holding any
+uint32_t ktable_size(ktable* ctx);
 uint32_t ktable_buckets_len(ktable* ctx);
 
-// Split a bucket
-int ktable_buckets_split();
+static inline const knode*
+ktable_id(ktable* ctx, uint32_t slot)
+{
+    return &ctx->ids[slot];
+}
+
+static inline kpeer*
+ktable_peer(ktable* ctx, uint32_t slot)
+{
+    return &ctx->peers[slot];
+}
+
+static inline void*
+ktable_value(ktable* ctx, uint32_t slot)
+{
+    return &ctx->vals[slot * ctx->vsize];
+}
 
-// methods
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,185 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_bond.h"
+#include "usys_time.h"
+
+// Private
+void rlpx_bond_arm(rlpx_bond_node* n, int64_t now);
+void rlpx_bond_drop(rlpx_bond* ctx, rlpx_bond_node* n);
+void rlpx_bond_on_timer(void* ctx);
+rlpx_bond_node* rlpx_bond_victim(rlpx_bond* ctx);
+
+int
+rlpx_bond_init(rlpx_bond* ctx, uint32_t size)
+{
+    uint32_t i;
+    memset(ctx, 0, sizeof(rlpx_bond));
+    if (kindex_init(&ctx->index, size)) return -1;
+    if (!(ctx->nodes = rlpx_malloc(size * sizeof(rlpx_bond_node)))) {
+        kindex_deinit(&ctx->index);
+        return -1;
+    }
+    memset(ctx->nodes, 0, size * sizeof(rlpx_bond_node));
+    for (i = 0; i < size; i++) {
+        async_timer_init(
+            &ctx->nodes[i].timer, rlpx_bond_on_timer, &ctx->nodes[i]);
+        ctx->nodes[i].owner = ctx;
+    }
+    ctx->size = size;
+    return 0;
+}
+
+void
+rlpx_bond_deinit(rlpx_bond* ctx)
+{
+    uint32_t i;
+    if (!ctx->nodes) return;
+    for (i = 0; i < ctx->size; i++) async_timer_stop(&ctx->nodes[i].timer);
+    rlpx_free(ctx->nodes);
+    kindex_deinit(&ctx->index);
+    memset(ctx, 0, sizeof(rlpx_bond));
+}
+
+rlpx_bond_node*
+rlpx_bond_find(rlpx_bond* ctx, const knode* id)
+{
+    int i = kindex_get(&ctx->index, id);
+    if (i < 0 || memcmp(&ctx->nodes[i].id, id, sizeof(knode))) return NULL;
+    return &ctx->nodes[i];
+}
+
+rlpx_bond_node*
+rlpx_bond_get(rlpx_bond* ctx, const knode* id, uint32_t ip, int64_t now)
+{
+    rlpx_bond_node* n = rlpx_bond_find(ctx, id);
+
+    // Proofs belong to an endpoint, a node that moved proves itself again
+    if (n) {
+        if (!(n->ip == ip)) {
+            n->ip = ip;
+            n->pong_in = n->pong_out = n->ping = 0;
+        }
+        return n;
+    }
+
+    // A free entry, else the least recently active of a sample
+    if (ctx->n < ctx->size) {
+        while (ctx->nodes[ctx->hand].at) {
+            ctx->hand = (ctx->hand + 1) % ctx->size;
+        }
+        n = &ctx->nodes[ctx->hand];
+    } else {
+        rlpx_bond_drop(ctx, n = rlpx_bond_victim(ctx));
+    }
+    if (kindex_put(&ctx->index, id, n - ctx->nodes)) return NULL;
+    n->id = *id;
+    n->ip = ip;
+    n->at = now;
+    ctx->n++;
+    return n;
+}
+
+void
+rlpx_bond_ping(rlpx_bond_node* n, const uint8_t* echo, int64_t now)
+{
+    memcpy(n->echo, echo, 32);
+    n->ping = n->at = now;
+    rlpx_bond_arm(n, now);
+}
+
+void
+rlpx_bond_ponged(rlpx_bond_node* n, int64_t now)
+{
+    n->pong_out = n->at = now;
+    rlpx_bond_arm(n, now);
+}
+
+int
+rlpx_bond_pong(rlpx_bond_node* n, const uint8_t* echo, int64_t now)
+{
+    if (!rlpx_bond_pinging(n, now) || memcmp(n->echo, echo, 32)) return -1;
+    n->pong_in = n->at = now;
+    n->ping = 0;
+    rlpx_bond_arm(n, now);
+    return 0;
+}
+
+void
+rlpx_bond_arm(rlpx_bond_node* n, int64_t now)
+{
+    int64_t due;
+    if (!n->owner->loop) return;
+
+    // The ping's deadline comes first, else the later proof's expiry
+    if (n->ping) {
+        due = n->ping + RLPX_BOND_PING_MS;
+    } else {
+        due = (n->pong_in > n->pong_out ? n->pong_in : n->pong_out) +
+              RLPX_BOND_MS;
+    }
+    async_loop_timer(
+        n->owner->loop, &n->timer, due > now ? (uint32_t)(due - now) : 0);
+}
+
+void
+rlpx_bond_drop(rlpx_bond* ctx, rlpx_bond_node* n)
+{
+    async_timer_stop(&n->timer);
+    kindex_del(&ctx->index, &n->id);
+    memset(&n->id, 0, sizeof(knode));
+    n->ip = 0;
+    n->pong_in = n->pong_out = n->ping = n->at = 0;
+    ctx->n--;
+}
+
+void
+rlpx_bond_on_timer(void* ctx)
+{
+    rlpx_bond_node* n = ctx;
+    int64_t now = usys_now_cached();
+
+    // An unanswered ping is forgotten, entries without a live proof freed
+    if (!rlpx_bond_pinging(n, now)) n->ping = 0;
+    if (n->ping || rlpx_bond_known(n, now) ||
+        rlpx_bond_proven(n, n->ip, now)) {
+        rlpx_bond_arm(n, now);
+    } else {
+        rlpx_bond_drop(n->owner, n);
+    }
+}
+
+rlpx_bond_node*
+rlpx_bond_victim(rlpx_bond* ctx)
+{
+    rlpx_bond_node *n, *oldest = NULL;
+    uint32_t i;
+    for (i = 0; i < RLPX_BOND_SAMPLE; i++) {
+        n = &ctx->nodes[(ctx->hand + i) % ctx->size];
+        if (!oldest || n->at < oldest->at) oldest = n;
+    }
+    ctx->hand = (ctx->hand + RLPX_BOND_SAMPLE) % ctx->size;
+    return oldest;
+}
+
+//
+//
+//
@@ -0,0 +1,149 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_bond.h
+ *
+ * @brief Endpoint proofs (bonds) of discovery. A node proves its endpoint by
+ * answering our PING with a PONG that echoes the ping's hash, we prove ours
+ * by answering its PING. FINDNODE is only answered for nodes that proved
+ * their endpoint, so a spoofed source can't aim our NEIGHBOURS at someone
+ * else, and we only ask nodes that saw our proof.
+ *
+ * Bonds hold for RLPX_BOND_MS. Each entry keeps a timer on the loop (the
+ * deadline of its ping, then its expiry) that frees it once nothing is left
+ * to prove. Checks compare times themselves, so a table without a loop is
+ * still correct, it only keeps stale entries until they are evicted. When
+ * full, a new node takes the place of the least recently active of
+ * RLPX_BOND_SAMPLE entries from a rotating hand.
+ */
+#ifndef RLPX_BOND_H_
+#define RLPX_BOND_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_loop.h"
+#include "kademlia/kindex.h"
+#include "rlpx_config.h"
+
+// Nodes tracked
+#ifndef RLPX_BOND_NODES
+#define RLPX_BOND_NODES 1024
+#endif
+
+// Time a proof holds (ms)
+#ifndef RLPX_BOND_MS
+#define RLPX_BOND_MS (24 * 60 * 60 * 1000)
+#endif
+
+// Time a ping has to be answered (ms)
+#ifndef RLPX_BOND_PING_MS
+#define RLPX_BOND_PING_MS 1000
+#endif
+
+// Entries weighed per eviction
+#ifndef RLPX_BOND_SAMPLE
+#define RLPX_BOND_SAMPLE 8
+#endif
+
+struct rlpx_bond;
+
+typedef struct
+{
+    knode id;                /*!< keccak(pub) */
+    uint32_t ip;             /*!< endpoint proven (network order) */
+    int64_t pong_in;         /*!< they answered our ping (ms), 0 never */
+    int64_t pong_out;        /*!< we answered their ping (ms), 0 never */
+    int64_t ping;            /*!< our ping in flight since (ms), 0 none */
+    int64_t at;              /*!< last ping or pong (ms), 0 free */
+    uint8_t echo[32];        /*!< hash of our ping, the pong echoes it */
+    async_timer timer;       /*!< ping deadline, then expiry */
+    struct rlpx_bond* owner; /*!< table */
+} rlpx_bond_node;
+
+typedef struct rlpx_bond
+{
+    rlpx_bond_node* nodes; /*!< size entries */
+    kindex index;          /*!< id -> nodes[] */
+    async_loop* loop;      /*!< runs the timers (NULL none) */
+    uint32_t size;         /*!< entries */
+    uint32_t n;            /*!< entries in use */
+    uint32_t hand;         /*!< eviction cursor */
+} rlpx_bond;
+
+// Init/Deinit routines (room for size nodes)
+int rlpx_bond_init(rlpx_bond* ctx, uint32_t size);
+void rlpx_bond_deinit(rlpx_bond* ctx);
+
+/**
+ * @brief Entry of a node
+ *
+ * @return entry, NULL unknown
+ */
+rlpx_bond_node* rlpx_bond_find(rlpx_bond* ctx, const knode* id);
+
+/**
+ * @brief Entry of a node, a new one (evicting when full) if it is unknown.
+ * A node seen from another ip starts over.
+ *
+ * @return entry, NULL out of index space
+ */
+rlpx_bond_node*
+rlpx_bond_get(rlpx_bond* ctx, const knode* id, uint32_t ip, int64_t now);
+
+/**
+ * @brief Our ping with hash echo went out / their ping was answered
+ */
+void rlpx_bond_ping(rlpx_bond_node* n, const uint8_t* echo, int64_t now);
+void rlpx_bond_ponged(rlpx_bond_node* n, int64_t now);
+
+/**
+ * @brief Their pong, proves their endpoint if it echoes our ping in flight
+ *
+ * @return 0 proven, -1 not asked for
+ */
+int rlpx_bond_pong(rlpx_bond_node* n, const uint8_t* echo, int64_t now);
+
+// Node proved ip is theirs / saw our proof, our ping is awaiting its pong
+static inline int
+rlpx_bond_proven(const rlpx_bond_node* n, uint32_t ip, int64_t now)
+{
+    return n && n->ip == ip && n->pong_in && now - n->pong_in < RLPX_BOND_MS;
+}
+
+static inline int
+rlpx_bond_known(const rlpx_bond_node* n, int64_t now)
+{
+    return n && n->pong_out && now - n->pong_out < RLPX_BOND_MS;
+}
+
+static inline int
+rlpx_bond_pinging(const rlpx_bond_node* n, int64_t now)
+{
+    return n && n->ping && now - n->ping < RLPX_BOND_PING_MS;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -29,6 +29,11 @@
 #include "rlpx_config_unix.h"
 #endif
 
+// Storage class for per thread state (object pools)
+#ifndef rlpx_thread_local
+#define rlpx_thread_local
+#endif
+
 // P2P client name
 #define RLPX_CLIENT_ID_STR "tiny-ether"
 #define RLPX_CLIENT_ID_LEN (sizeof(RLPX_CLIENT_ID_STR) - 1)
@@ -37,4 +42,48 @@
 // DEVP2P client string max size (from "hello" packet)
 #define RLPX_CLIENT_MAX_LEN 80
 
+// Fixed size object pools (objects per chunk, max chunks - 0 is no limit)
+#ifndef RLPX_CONFIG_SLAB_HANDSHAKE_N
+#define RLPX_CONFIG_SLAB_HANDSHAKE_N 4
+#endif
+#ifndef RLPX_CONFIG_SLAB_HANDSHAKE_LIMIT
+#define RLPX_CONFIG_SLAB_HANDSHAKE_LIMIT 0
+#endif
+#ifndef RLPX_CONFIG_SLAB_IO_N
+#define RLPX_CONFIG_SLAB_IO_N 4
+#endif
+#ifndef RLPX_CONFIG_SLAB_IO_LIMIT
+#define RLPX_CONFIG_SLAB_IO_LIMIT 0
+#endif
+#ifndef RLPX_CONFIG_SLAB_PROTOCOL_N
+#define RLPX_CONFIG_SLAB_PROTOCOL_N 8
+#endif
+#ifndef RLPX_CONFIG_SLAB_PROTOCOL_LIMIT
+#define RLPX_CONFIG_SLAB_PROTOCOL_LIMIT 0
+#endif
+
+// Peer table slots allocated on first use (doubles as peers are added)
+#ifndef RLPX_CONFIG_PEERS_INIT
+#define RLPX_CONFIG_PEERS_INIT 8
+#endif
+
+// Time a new connection gets to complete auth, ack and hello
+#ifndef RLPX_CONFIG_HANDSHAKE_MS
+#define RLPX_CONFIG_HANDSHAKE_MS 5000
+#endif
+
+// Keepalive ping interval. A peer that hasn't answered by the next ping is
+// dropped (and redialed).
+#ifndef RLPX_CONFIG_PING_MS
+#define RLPX_CONFIG_PING_MS 15000
+#endif
+
+// Delay before redialing a lost peer, doubles per failure up to the max
+#ifndef RLPX_CONFIG_REDIAL_MIN_MS
+#define RLPX_CONFIG_REDIAL_MIN_MS 1000
+#endif
+#ifndef RLPX_CONFIG_REDIAL_MAX_MS
+#define RLPX_CONFIG_REDIAL_MAX_MS 60000
+#endif
+
 #endif
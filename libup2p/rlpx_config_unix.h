@@ -34,4 +34,7 @@
 #define rlpx_free_fn free
 #define rlpx_free(x) rlpx_free_fn(x)
 
+// Object pools are per thread so reactor shards never share a free list
+#define rlpx_thread_local __thread
+
 #endif
@@ -65,8 +65,8 @@ typedef struct
     const rlpx_devp2p_protocol_settings* settings; /*!< user callbacks */
     char client[RLPX_CLIENT_MAX_LEN];              /*!< Hello packet client*/
     uint32_t listen_port;                          /*!< */
-    int64_t ping;                                  /*!< ping now() */
-    uint32_t latency;                              /*!< now() - ping */
+    uint64_t ping;                                 /*!< ping sent (ns) */
+    uint32_t latency;                              /*!< ping to pong (us) */
 } rlpx_devp2p_protocol;
 
 // Heap constructors
@@ -20,63 +20,433 @@
  */
 
 #include "rlpx_discovery.h"
+#include "rlpx_metrics.h"
 #include "ukeccak256.h"
+#include "usys_time.h"
+#include "usys_trace.h"
 
+// Private
 void rlpx_walk_neighbours(const urlp* rlp, int idx, void* ctx);
+int rlpx_discovery_expired(uint32_t timestamp);
+int rlpx_discovery_admit(
+    rlpx_discovery_table* t,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr);
+int rlpx_discovery_send_pong(
+    rlpx_discovery_table* t,
+    const uint8_t* ping,
+    const rlpx_discovery_endpoint* from,
+    const usys_sockaddr* addr);
+int rlpx_discovery_send_ping(
+    rlpx_discovery_table* t,
+    rlpx_bond_node* bond,
+    const usys_sockaddr* addr);
+int rlpx_discovery_send_neighbours(
+    rlpx_discovery_table* t,
+    const uint8_t* target,
+    const usys_sockaddr* addr);
+int rlpx_discovery_send_enr_request(
+    rlpx_discovery_table* t,
+    rlpx_discovery_record* r,
+    const usys_sockaddr* addr);
+int rlpx_discovery_send_enr_response(
+    rlpx_discovery_table* t,
+    const uint8_t* req,
+    const usys_sockaddr* addr);
+void rlpx_discovery_enr_seq(
+    rlpx_discovery_table* t,
+    const knode* id,
+    rlpx_bond_node* bond,
+    uint64_t seq,
+    const usys_sockaddr* addr);
+rlpx_discovery_record* rlpx_discovery_record_find(
+    rlpx_discovery_table* t,
+    const knode* id);
+rlpx_discovery_record* rlpx_discovery_record_get(
+    rlpx_discovery_table* t,
+    const knode* id);
+void rlpx_discovery_table_sort(rlpx_discovery_table* t);
+void rlpx_discovery_seen(rlpx_discovery_table* t, const knode* id);
+void rlpx_discovery_check_oldest(rlpx_discovery_table* t, const knode* id);
+void rlpx_discovery_on_check_timeout(void* ctx);
+int rlpx_discovery_record_parse(const urlp* rlp, rlpx_enr* enr);
+int rlpx_discovery_send_find(
+    rlpx_discovery_table* t,
+    const kpeer* peer,
+    const uint8_t* target);
+int rlpx_discovery_parse_neighbour(
+    const urlp* rlp,
+    kpeer* peer,
+    uecc_public_key* q);
+void rlpx_discovery_lookup_learn(
+    rlpx_discovery_table* t,
+    const knode* id,
+    const kpeer* peer);
+void rlpx_discovery_lookup_answered(rlpx_discovery_table* t, const knode* id);
+void rlpx_discovery_lookup_bonded(rlpx_discovery_table* t, const knode* id);
+int rlpx_discovery_lookup_ask(rlpx_discovery_req* req, const kpeer* peer);
+int rlpx_discovery_lookup_resume(rlpx_discovery_req* req);
+void rlpx_discovery_lookup_pump(rlpx_discovery_lookup* lk);
+void rlpx_discovery_on_find_timeout(void* ctx);
+int rlpx_discovery_put_seq(uint8_t* b, uint32_t* l, uint32_t max, uint64_t seq);
+uint32_t rlpx_discovery_put_endpoint(
+    uint8_t* b,
+    const rlpx_discovery_endpoint* ep);
 
-void
+// Largest rlp of an endpoint and of a neighbour (ipv6)
+#define RLPX_DISCOVERY_ENDPOINT_MAX (3 + 17 + 5 + 5)
+#define RLPX_DISCOVERY_NEIGHBOUR_MAX (RLPX_DISCOVERY_ENDPOINT_MAX + 66)
+
+int
 rlpx_discovery_table_init(rlpx_discovery_table* table)
 {
+    rlpx_discovery_lookup* lk;
+    uint32_t i, r;
     memset(table, 0, sizeof(rlpx_discovery_table));
+    if (rlpx_ratelimit_init(&table->limit, RLPX_RATELIMIT_SOURCES)) return -1;
+    if (rlpx_bond_init(&table->bond, RLPX_BOND_NODES)) {
+        rlpx_ratelimit_deinit(&table->limit);
+        return -1;
+    }
+    table->records =
+        rlpx_malloc(RLPX_DISCOVERY_RECORDS * sizeof(rlpx_discovery_record));
+    if (!table->records) {
+        rlpx_bond_deinit(&table->bond);
+        rlpx_ratelimit_deinit(&table->limit);
+        return -1;
+    }
+    memset(
+        table->records,
+        0,
+        RLPX_DISCOVERY_RECORDS * sizeof(rlpx_discovery_record));
+    for (i = 0; i < RLPX_DISCOVERY_CHECKS; i++) {
+        table->checks[i].table = table;
+        async_timer_init(
+            &table->checks[i].timer,
+            rlpx_discovery_on_check_timeout,
+            &table->checks[i]);
+    }
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS; i++) {
+        lk = &table->lookups[i];
+        lk->table = table;
+        for (r = 0; r < KLOOKUP_ALPHA; r++) {
+            lk->reqs[r].lookup = lk;
+            async_timer_init(
+                &lk->reqs[r].timer,
+                rlpx_discovery_on_find_timeout,
+                &lk->reqs[r]);
+        }
+    }
+    if (ktable_init(
+            &table->nodes, &table->self, sizeof(rlpx_discovery_node))) {
+        rlpx_free(table->records);
+        rlpx_bond_deinit(&table->bond);
+        rlpx_ratelimit_deinit(&table->limit);
+        return -1;
+    }
+    return 0;
+}
+
+void
+rlpx_discovery_table_deinit(rlpx_discovery_table* table)
+{
+    uint32_t i, r;
+    for (i = 0; i < RLPX_DISCOVERY_CHECKS; i++) {
+        async_timer_stop(&table->checks[i].timer);
+    }
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS; i++) {
+        for (r = 0; r < KLOOKUP_ALPHA; r++) {
+            async_timer_stop(&table->lookups[i].reqs[r].timer);
+        }
+    }
+    ktable_deinit(&table->nodes);
+    rlpx_free(table->records);
+    rlpx_bond_deinit(&table->bond);
+    rlpx_ratelimit_deinit(&table->limit);
+    memset(table, 0, sizeof(rlpx_discovery_table));
+}
+
+void
+rlpx_discovery_table_bind(
+    rlpx_discovery_table* table,
+    uecc_ctx* skey,
+    async_udp* udp)
+{
+    uint8_t pub[65];
+    table->skey = skey;
+    table->udp = udp;
+    table->bond.loop = udp->io.loop;
+
+    // Neighbours never list us to ourselves, buckets are by distance to us
+    if (!uecc_qtob(&skey->Q, pub, sizeof(pub))) {
+        rlpx_discovery_node_id(&pub[1], &table->self);
+        rlpx_discovery_table_sort(table);
+    }
+    rlpx_enr_local_init(&table->enr, &skey->Q, usys_epoch());
+}
+
+void
+rlpx_discovery_table_endpoint(
+    rlpx_discovery_table* table,
+    const rlpx_discovery_endpoint* ep)
+{
+    static const uint8_t any[4] = { 0 };
+    table->ep = *ep;
+    if (ep->iplen == 4 && memcmp(ep->ip, any, 4)) {
+        rlpx_enr_local_set_mem(&table->enr, "ip", ep->ip, 4);
+    }
+    rlpx_enr_local_set_u32(&table->enr, "tcp", ep->tcp);
+    rlpx_enr_local_set_u32(&table->enr, "udp", ep->udp);
+}
+
+uint32_t
+rlpx_discovery_table_attach(rlpx_discovery_table* table, rlpx_nodedb* db)
+{
+    rlpx_nodedb_record* r;
+    uecc_public_key q;
+    uint8_t pub[65] = { 0x04 };
+    uint32_t pass, i, n = 0;
+
+    // Nodes that answered a ping first, loading doesn't write back
+    table->db = NULL;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < db->head->size; i++) {
+            r = &db->records[i];
+            if (!r->seen || !(pass == (r->pong ? 0 : 1))) continue;
+            memcpy(&pub[1], r->pub, 64);
+            if (!uecc_btoq(pub, sizeof(pub), &q) &&
+                !rlpx_discovery_table_add_node(
+                    table, r->ip, r->iplen, r->tcp, r->udp, &q, NULL)) {
+                n++;
+            }
+        }
+    }
+    table->db = db;
+    return n;
+}
+
+int
+rlpx_discovery_table_lookup(
+    rlpx_discovery_table* table,
+    const uint8_t* target,
+    rlpx_discovery_lookup_fn fn,
+    void* ctx)
+{
+    rlpx_discovery_lookup* lk = NULL;
+    uint32_t slots[KLOOKUP_K], i, n;
+    knode id;
+
+    if (!(table->udp && table->udp->io.loop)) return -1;
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS && !lk; i++) {
+        if (!table->lookups[i].active) lk = &table->lookups[i];
+    }
+    if (!lk) return -1;
+
+    // Seeded with the closest we know
+    rlpx_discovery_node_id(target, &id);
+    n = ktable_closest(&table->nodes, &id, slots, KLOOKUP_K);
+    if (!n) return -1;
+    klookup_init(&lk->k, &id);
+    for (i = 0; i < n; i++) {
+        klookup_add(
+            &lk->k,
+            ktable_id(&table->nodes, slots[i]),
+            ktable_peer(&table->nodes, slots[i]));
+    }
+    memcpy(lk->target, target, 64);
+    lk->fn = fn;
+    lk->ctx = ctx;
+    lk->active = 1;
+    rlpx_discovery_lookup_pump(lk);
+    return 0;
+}
+
+void
+rlpx_discovery_node_id(const uint8_t* pub, knode* id)
+{
+    ukeccak256((uint8_t*)pub, 64, id->b, sizeof(id->b));
 }
 
 int
 rlpx_discovery_table_find_node(
     rlpx_discovery_table* table,
-    uecc_public_key* target,
-    rlpx_discovery_node* node)
-{
-    uint32_t i = 0, c = sizeof(table->nodes) - sizeof(rlpx_discovery_node);
-    for (i = 0; i < c; i++) {
-        if (memcmp(
-                table->nodes[i].nodeid.data,
-                target->data,
-                sizeof(target->data))) {
-            node = &table->nodes[i];
-            return 0;
+    const knode* id,
+    rlpx_discovery_node** node)
+{
+    int slot = ktable_find(&table->nodes, id);
+    if (slot < 0) return -1;
+    *node = ktable_value(&table->nodes, slot);
+    return 0;
+}
+
+int
+rlpx_discovery_table_remove_node(
+    rlpx_discovery_table* table,
+    const knode* id)
+{
+    // Its record stays until reused, nothing finds it without the node
+    return ktable_remove_node(&table->nodes, id);
+}
+
+const rlpx_enr*
+rlpx_discovery_table_enr(rlpx_discovery_table* table, const knode* id)
+{
+    rlpx_discovery_record* r = rlpx_discovery_record_find(table, id);
+    return r && r->enr.seq ? &r->enr : NULL;
+}
+
+rlpx_discovery_record*
+rlpx_discovery_record_find(rlpx_discovery_table* t, const knode* id)
+{
+    rlpx_discovery_node* n;
+    rlpx_discovery_record* r;
+    if (rlpx_discovery_table_find_node(t, id, &n)) return NULL;
+    r = &t->records[n->record];
+    return memcmp(&r->id, id, sizeof(knode)) ? NULL : r;
+}
+
+rlpx_discovery_record*
+rlpx_discovery_record_get(rlpx_discovery_table* t, const knode* id)
+{
+    rlpx_discovery_node* n;
+    rlpx_discovery_record* r;
+
+    // Fewer records than nodes, the one handed out longest ago is reused
+    if ((r = rlpx_discovery_record_find(t, id))) return r;
+    if (rlpx_discovery_table_find_node(t, id, &n)) return NULL;
+    n->record = t->hand;
+    t->hand = (t->hand + 1) % RLPX_DISCOVERY_RECORDS;
+    r = &t->records[n->record];
+    memset(r, 0, sizeof(rlpx_discovery_record));
+    r->id = *id;
+    return r;
+}
+
+void
+rlpx_discovery_table_sort(rlpx_discovery_table* t)
+{
+    ktable old = t->nodes;
+    uint32_t s;
+    int slot;
+
+    // Nodes added before we knew our id go to their buckets again
+    if (!ktable_size(&old)) {
+        t->nodes.self = t->self;
+        return;
+    }
+    if (ktable_init(&t->nodes, &t->self, sizeof(rlpx_discovery_node))) {
+        t->nodes = old;
+        return;
+    }
+    for (s = 0; s < KTABLE_BUCKETS * KTABLE_K; s++) {
+        if (s % KTABLE_K >= old.n[s / KTABLE_K] ||
+            ktable_add_node(&t->nodes, &old.ids[s], &old.peers[s]) ||
+            (slot = ktable_find(&t->nodes, &old.ids[s])) < 0) {
+            continue;
         }
+        memcpy(
+            ktable_value(&t->nodes, slot),
+            ktable_value(&old, s),
+            sizeof(rlpx_discovery_node));
     }
-    return -1;
+    ktable_deinit(&old);
 }
 
 void
-rlpx_discovery_table_update_recent(
-    rlpx_discovery_table* table,
-    rlpx_discovery_node* node)
+rlpx_discovery_seen(rlpx_discovery_table* t, const knode* id)
+{
+    int slot = ktable_find(&t->nodes, id);
+    kpeer peer;
+
+    // Heard from, to the back of its bucket (a copy, slots move)
+    if (slot < 0) return;
+    peer = *ktable_peer(&t->nodes, slot);
+    peer.seen = usys_now_cached();
+    ktable_add_node(&t->nodes, id, &peer);
+}
+
+void
+rlpx_discovery_check_oldest(rlpx_discovery_table* t, const knode* id)
 {
-    table->recents[2] = table->recents[1];
-    table->recents[1] = table->recents[0];
-    table->recents[0] = node;
+    rlpx_discovery_check* c = NULL;
+    rlpx_bond_node* bond;
+    usys_sockaddr addr;
+    const kpeer* peer;
+    knode oldest;
+    int64_t now = usys_now_cached();
+    int slot = ktable_oldest(&t->nodes, id);
+    uint32_t i;
+
+    // Pinged once, an answer moves it to the back (see rlpx_discovery_seen)
+    if (slot < 0 || !(t->udp && t->udp->io.loop)) return;
+    oldest = *ktable_id(&t->nodes, slot);
+    for (i = 0; i < RLPX_DISCOVERY_CHECKS; i++) {
+        if (!async_timer_active(&t->checks[i].timer)) {
+            if (!c) c = &t->checks[i];
+        } else if (!memcmp(&t->checks[i].id, &oldest, sizeof(knode))) {
+            return;
+        }
+    }
+    peer = ktable_peer(&t->nodes, slot);
+    if (!(c && peer->iplen == 4 && peer->udp)) return;
+    usys_sockaddr_init(&addr, peer->ip, peer->udp);
+    bond = rlpx_bond_get(&t->bond, &oldest, addr.ip, now);
+    if (!bond || (!rlpx_bond_pinging(bond, now) &&
+                  rlpx_discovery_send_ping(t, bond, &addr))) {
+        return;
+    }
+    c->id = oldest;
+    async_loop_timer(t->udp->io.loop, &c->timer, RLPX_BOND_PING_MS);
+}
+
+void
+rlpx_discovery_on_check_timeout(void* ctx)
+{
+    rlpx_discovery_check* c = ctx;
+    rlpx_discovery_table* t = c->table;
+    int slot = ktable_oldest(&t->nodes, &c->id);
+
+    // Still the oldest, it never answered. The newest replacement goes live.
+    if (slot >= 0 &&
+        !memcmp(ktable_id(&t->nodes, slot), &c->id, sizeof(knode))) {
+        if (t->db) rlpx_nodedb_fail(t->db, &c->id);
+        ktable_remove_node(&t->nodes, &c->id);
+    }
 }
 
 int
 rlpx_discovery_table_add_node_rlp(rlpx_discovery_table* table, const urlp* rlp)
+{
+    kpeer peer;
+    uecc_public_key q;
+    if (rlpx_discovery_parse_neighbour(rlp, &peer, &q)) return -1;
+    return rlpx_discovery_table_add_node(
+        table, peer.ip, peer.iplen, peer.tcp, peer.udp, &q, NULL);
+}
+
+int
+rlpx_discovery_parse_neighbour(
+    const urlp* rlp,
+    kpeer* peer,
+    uecc_public_key* q)
 {
     int err = 0;
-    uint32_t n = urlp_children(rlp), udp, tcp, publen = 64, iplen = 16;
-    uint8_t ipbuf[iplen];
+    uint32_t n = urlp_children(rlp), udp, tcp, publen = 64;
     uint8_t pub[65] = { 0x04 };
-    uecc_public_key q;
     if (n < 4) return -1; /*!< invalid rlp */
 
     // short circuit bail. Arrive inside no errors
-    if ((!(err = urlp_idx_to_mem(rlp, 0, ipbuf, &iplen))) &&
+    memset(peer, 0, sizeof(kpeer));
+    peer->iplen = sizeof(peer->ip);
+    if ((!(err = urlp_idx_to_mem(rlp, 0, peer->ip, &peer->iplen))) &&
         (!(err = urlp_idx_to_u32(rlp, 1, &udp))) &&
         (!(err = urlp_idx_to_u32(rlp, 2, &tcp))) &&
         (!(err = urlp_idx_to_mem(rlp, 3, &pub[1], &publen))) &&
-        (!(err = uecc_btoq(pub, publen + 1, &q)))) {
-        err = rlpx_discovery_table_add_node(
-            table, ipbuf, iplen, udp, tcp, &q, NULL);
+        (!(err = uecc_btoq(pub, publen + 1, q)))) {
+        memcpy(peer->pub, &pub[1], 64);
+        peer->udp = udp;
+        peer->tcp = tcp;
     }
     return err;
 }
@@ -91,81 +461,182 @@ rlpx_discovery_table_add_node(
     uecc_public_key* id,
     urlp* meta)
 {
-    rlpx_discovery_node* n = &table->nodes[0];
-    uint32_t i = 0, c = sizeof(table->nodes) - sizeof(rlpx_discovery_node);
-
-    ((void)meta); // potential use in future
-
-    // Seek a free slot in our table and populate
-    for (i = 0; i < c; i++) {
-        if ((n->useful == RLPX_USEFUL_FALSE) ||
-            (n->useful == RLPX_USEFUL_FREE)) {
-            memset(n->ep.ip, 0, 16);
-            memcpy(n->ep.ip, ip, iplen);
-            n->ep.udp = udp;
-            n->ep.tcp = tcp;
-            n->nodeid = *id;
-
-            // Need devp2p hello to figure out if we like this node
-            // This will probably change with introduction of topics in the
-            // udp discovery protocol.
-            //
-            // The rlpx_discovery driver will mark this node as useless if
-            // it doesn't like it - it will then be overwritten with other
-            // nodes when usefulness is set to false.
-            //
-            // Not investing much effort here.
-            n->useful = RLPX_USEFUL_PENDING;
-            break;
-        }
+    rlpx_discovery_record* r;
+    rlpx_enr enr;
+    uint8_t pub[65];
+    kpeer peer;
+    knode nid;
+    int slot, c;
+
+    if (iplen > 16 || uecc_qtob(id, pub, sizeof(pub))) return -1;
+    rlpx_discovery_node_id(&pub[1], &nid);
+    memset(&peer, 0, sizeof(peer));
+    memcpy(peer.pub, &pub[1], 64);
+    memcpy(peer.ip, ip, iplen);
+    peer.iplen = iplen;
+    peer.udp = udp;
+    peer.tcp = tcp;
+
+    // Known nodes are updated in place (hearing of a node is not hearing
+    // from it), a full bucket asks its oldest node whether it is still there
+    if ((slot = ktable_find(&table->nodes, &nid)) >= 0) {
+        peer.seen = ktable_peer(&table->nodes, slot)->seen;
+        *ktable_peer(&table->nodes, slot) = peer;
+    } else if ((c = ktable_add_node(&table->nodes, &nid, &peer)) < 0) {
+        return -1;
+    } else if (c) {
+        rlpx_discovery_check_oldest(table, &nid);
+    }
+    if (table->db) {
+        rlpx_nodedb_update(table->db, &nid, peer.pub, ip, iplen, tcp, udp);
+    }
+
+    // The node's own record, if newer (live nodes only)
+    if (meta && !rlpx_discovery_record_parse(meta, &enr) &&
+        !memcmp(&enr.id, &nid, sizeof(knode)) &&
+        (r = rlpx_discovery_record_get(table, &nid)) && enr.seq > r->enr.seq) {
+        r->enr = enr;
     }
     return 0;
 }
 
 int
-rlpx_discovery_recv(rlpx_discovery_table* t, const uint8_t* b, uint32_t l)
+rlpx_discovery_recv(
+    rlpx_discovery_table* t,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr)
 {
     uecc_public_key pub;
+    knode id, *sender = NULL;
     RLPX_DISCOVERY type;
-    rlpx_discovery_node* node = NULL;
     rlpx_discovery_endpoint from, to;
-    uecc_public_key target;
-    uint32_t timestamp;
-    uint8_t buff32[32];
+    uint32_t timestamp = 0, sz = 32;
+    uint64_t seq = 0;
+    uint8_t buff64[64], raw[65];
     int err = -1;
     urlp* rlp;
     const urlp* crlp;
+    rlpx_bond_node* bond = NULL;
+    rlpx_discovery_record* r = NULL;
+    rlpx_discovery_node* node;
+    rlpx_enr enr;
+    uint32_t ip = addr ? addr->ip : 0;
+    int64_t now = usys_now_cached();
+
+    // Cheap checks first, hashing and recovering a key is what floods cost us
+    if (rlpx_discovery_admit(t, b, l, addr)) return -1;
 
     // Parse (rlp is allocated on success - must free)
     if ((err = rlpx_discovery_parse(b, l, &pub, (int*)&type, &rlp))) {
+        rlpx_metrics_add(RLPX_METRIC_DISC_INVALID, 1);
         return err;
     }
+    if (type >= RLPX_DISCOVERY_PING && type <= RLPX_DISCOVERY_ENR_RESPONSE) {
+        rlpx_metrics_add(RLPX_METRIC_DISC_PING + type - RLPX_DISCOVERY_PING, 1);
+    } else {
+        rlpx_metrics_add(RLPX_METRIC_DISC_INVALID, 1);
+    }
 
-    // Update recently seen if this node is in our table
-    if (rlpx_discovery_table_find_node(t, &pub, node)) {
-        rlpx_discovery_table_update_recent(t, node);
+    // Sender's id, its bond and its record in the database
+    if (!uecc_qtob(&pub, raw, sizeof(raw))) {
+        rlpx_discovery_node_id(&raw[1], sender = &id);
+        bond = rlpx_bond_find(&t->bond, &id);
+        if (t->db) rlpx_nodedb_seen(t->db, &id, 0);
     }
 
     crlp = rlp;
     if (type == RLPX_DISCOVERY_PING) {
 
-        // Received a ping packet
-        // send a pong on device io...
-        err = rlpx_discovery_parse_ping(&crlp, buff32, &from, &to, &timestamp);
-    } else if (type == RLPX_DISCOVERY_PING) {
+        // Received a ping packet, pong echoes its hash
+        err = rlpx_discovery_parse_ping(&crlp, buff64, &from, &to, &timestamp);
+        if (!err && !(err = rlpx_discovery_expired(timestamp)) && t->udp) {
+            err = rlpx_discovery_send_pong(t, b, &from, addr);
+        }
+
+        // Our proof is out, theirs is asked for once (unless it holds)
+        if (!err && t->udp && sender &&
+            (bond = rlpx_bond_get(&t->bond, sender, ip, now))) {
+            rlpx_bond_ponged(bond, now);
+            rlpx_discovery_seen(t, sender);
+            if (!rlpx_bond_proven(bond, ip, now) &&
+                !rlpx_bond_pinging(bond, now)) {
+                rlpx_discovery_send_ping(t, bond, addr);
+            }
+            rlpx_discovery_lookup_bonded(t, sender);
+            if (urlp_children(crlp) > 4) urlp_idx_to_u64(crlp, 4, &seq);
+            rlpx_discovery_enr_seq(t, sender, bond, seq, addr);
+        }
+    } else if (type == RLPX_DISCOVERY_PONG) {
 
-        // Received a pong packet
-        err = rlpx_discovery_parse_pong(&crlp, &to, buff32, &timestamp);
+        // Received a pong packet, proves the endpoint if it echoes our ping
+        err = rlpx_discovery_parse_pong(&crlp, &to, buff64, &timestamp);
+        if (!err) err = rlpx_discovery_expired(timestamp);
+        if (!err && (!bond || !(bond->ip == ip) ||
+                     rlpx_bond_pong(bond, buff64, now))) {
+            rlpx_metrics_add(RLPX_METRIC_DISC_UNBONDED, 1);
+            err = -1;
+        }
+        if (!err && t->db) rlpx_nodedb_seen(t->db, &id, 1);
+        if (!err) rlpx_discovery_seen(t, sender);
+        if (!err && urlp_children(crlp) > 3) {
+            urlp_idx_to_u64(crlp, 3, &seq);
+            rlpx_discovery_enr_seq(t, sender, bond, seq, addr);
+        }
     } else if (type == RLPX_DISCOVERY_FIND) {
 
-        // Received request for our neighbours.
-        // We send empty neighbours since we are not kademlia
-        // We are leech looking for light clients servers
-        err = rlpx_discovery_parse_find(&crlp, &target, &timestamp);
+        // Received request for our neighbours, answer with our closest if
+        // the endpoint is proven (else we'd be an amplifier for spoofers)
+        err = rlpx_discovery_parse_find(&crlp, buff64, &timestamp);
+        if (!err) err = rlpx_discovery_expired(timestamp);
+        if (!err && !rlpx_bond_proven(bond, ip, now)) {
+            rlpx_metrics_add(RLPX_METRIC_DISC_UNBONDED, 1);
+            err = -1;
+        }
+        if (!err && t->udp) {
+            err = rlpx_discovery_send_neighbours(t, buff64, addr);
+        }
     } else if (type == RLPX_DISCOVERY_NEIGHBOURS) {
 
-        // Received some neighbours
+        // Received some neighbours, lookups that asked the sender learn them
+        t->from = sender;
         err = rlpx_discovery_parse_neighbours(t, &crlp);
+        t->from = NULL;
+        if (!err && sender) {
+            if (!rlpx_discovery_table_find_node(t, sender, &node)) {
+                node->fails = 0;
+            }
+            rlpx_discovery_seen(t, sender);
+            rlpx_discovery_lookup_answered(t, sender);
+        }
+    } else if (type == RLPX_DISCOVERY_ENR_REQUEST) {
+
+        // Received a request for our record, proven endpoints only (as find)
+        err = rlpx_discovery_parse_enr_request(&crlp, &timestamp);
+        if (!err) err = rlpx_discovery_expired(timestamp);
+        if (!err && !rlpx_bond_proven(bond, ip, now)) {
+            rlpx_metrics_add(RLPX_METRIC_DISC_UNBONDED, 1);
+            err = -1;
+        }
+        if (!err && t->udp) {
+            err = rlpx_discovery_send_enr_response(t, b, addr);
+        }
+    } else if (type == RLPX_DISCOVERY_ENR_RESPONSE) {
+
+        // Received a record, verified only if it answers our request
+        if (sender) r = rlpx_discovery_record_find(t, sender);
+        err = urlp_idx_to_mem(crlp, 0, buff64, &sz);
+        if (!err && !(r && r->asked && now - r->asked < RLPX_DISCOVERY_ENR_MS &&
+                      sz == 32 && !memcmp(buff64, r->req, 32))) {
+            rlpx_metrics_add(RLPX_METRIC_DISC_UNBONDED, 1);
+            err = -1;
+        }
+        if (!err) err = rlpx_discovery_parse_enr_response(&crlp, buff64, &enr);
+        if (!err && memcmp(&enr.id, sender, sizeof(knode))) err = -1;
+        if (!err) {
+            r->asked = 0;
+            if (enr.seq >= r->enr.seq) r->enr = enr;
+        }
     } else {
         // error
     }
@@ -175,6 +646,422 @@ rlpx_discovery_recv(rlpx_discovery_table* t, const uint8_t* b, uint32_t l)
     return err;
 }
 
+uint32_t
+rlpx_discovery_recv_batch(
+    rlpx_discovery_table* t,
+    const usys_dgram* d,
+    uint32_t n)
+{
+    uint32_t i, ok = 0;
+    for (i = 0; i < n; i++) {
+        if (!d[i].len) continue;
+        if (!rlpx_discovery_recv(t, d[i].b, d[i].len, &d[i].addr)) ok++;
+    }
+    return ok;
+}
+
+int
+rlpx_discovery_admit(
+    rlpx_discovery_table* t,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr)
+{
+    // Hash, signature, type and some rlp, no larger than a datagram
+    if (l <= RLPX_DISCOVERY_HEADER || l > ASYNC_UDP_MTU ||
+        b[RLPX_DISCOVERY_HEADER - 1] < RLPX_DISCOVERY_PING ||
+        b[RLPX_DISCOVERY_HEADER - 1] > RLPX_DISCOVERY_ENR_RESPONSE) {
+        rlpx_metrics_add(RLPX_METRIC_DISC_INVALID, 1);
+        return -1;
+    }
+    if (addr && rlpx_ratelimit_take(&t->limit, addr->ip, usys_now_cached())) {
+        rlpx_metrics_add(RLPX_METRIC_DISC_LIMITED, 1);
+        return -1;
+    }
+    return 0;
+}
+
+int
+rlpx_discovery_expired(uint32_t timestamp)
+{
+    if ((int64_t)timestamp >= usys_epoch()) return 0;
+    rlpx_metrics_add(RLPX_METRIC_DISC_EXPIRED, 1);
+    return -1;
+}
+
+int
+rlpx_discovery_send_pong(
+    rlpx_discovery_table* t,
+    const uint8_t* ping,
+    const rlpx_discovery_endpoint* from,
+    const usys_sockaddr* addr)
+{
+    rlpx_discovery_endpoint to;
+    uint32_t l, max;
+    uint8_t* b;
+
+    // To is where the ping came from (tcp as the peer gave it)
+    memset(&to, 0, sizeof(to));
+    memcpy(to.ip, &addr->ip, 4);
+    to.iplen = 4;
+    to.udp = usys_sockaddr_port(addr);
+    to.tcp = from->tcp;
+
+    // Printed and signed in place, the ping's hash is the echo
+    if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+    max = l -= RLPX_DISCOVERY_HEADER;
+    if (rlpx_discovery_print_pong(
+            usys_epoch() + RLPX_DISCOVERY_EXPIRATION,
+            (const h256*)ping,
+            &to,
+            &b[RLPX_DISCOVERY_HEADER],
+            &l) ||
+        rlpx_discovery_put_seq(
+            &b[RLPX_DISCOVERY_HEADER], &l, max, rlpx_enr_local_seq(&t->enr)) ||
+        rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_PONG, b, &l)) {
+        async_udp_tx_commit(t->udp, 0, addr);
+        return -1;
+    }
+    async_udp_tx_commit(t->udp, l, addr);
+    rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    return 0;
+}
+
+int
+rlpx_discovery_send_ping(
+    rlpx_discovery_table* t,
+    rlpx_bond_node* bond,
+    const usys_sockaddr* addr)
+{
+    rlpx_discovery_endpoint to;
+    uint32_t l, max;
+    uint8_t* b;
+
+    memset(&to, 0, sizeof(to));
+    memcpy(to.ip, &addr->ip, 4);
+    to.iplen = 4;
+    to.udp = usys_sockaddr_port(addr);
+
+    // The bond keeps the hash, its pong has to echo it
+    if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+    max = l -= RLPX_DISCOVERY_HEADER;
+    if (rlpx_discovery_print_ping(
+            4,
+            &t->ep,
+            &to,
+            usys_epoch() + RLPX_DISCOVERY_EXPIRATION,
+            &b[RLPX_DISCOVERY_HEADER],
+            &l) ||
+        rlpx_discovery_put_seq(
+            &b[RLPX_DISCOVERY_HEADER], &l, max, rlpx_enr_local_seq(&t->enr)) ||
+        rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_PING, b, &l)) {
+        async_udp_tx_commit(t->udp, 0, addr);
+        return -1;
+    }
+    rlpx_bond_ping(bond, b, usys_now_cached());
+    async_udp_tx_commit(t->udp, l, addr);
+    rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    return 0;
+}
+
+int
+rlpx_discovery_send_neighbours(
+    rlpx_discovery_table* t,
+    const uint8_t* target,
+    const usys_sockaddr* addr)
+{
+    kpeer nodes[RLPX_DISCOVERY_NEIGHBOURS_MAX];
+    uint32_t slots[RLPX_DISCOVERY_NEIGHBOURS_MAX], i, n, l, ts;
+    uint8_t* b;
+    knode id;
+    int c;
+
+    rlpx_discovery_node_id(target, &id);
+    n = ktable_closest(&t->nodes, &id, slots, RLPX_DISCOVERY_NEIGHBOURS_MAX);
+    for (i = 0; i < n; i++) nodes[i] = *ktable_peer(&t->nodes, slots[i]);
+
+    // As many packets as the nodes need (an empty one when we know nobody,
+    // the asker is waiting on it), each printed and signed in place
+    ts = usys_epoch() + RLPX_DISCOVERY_EXPIRATION;
+    i = 0;
+    do {
+        if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+        l -= RLPX_DISCOVERY_HEADER;
+        c = rlpx_discovery_print_neighbours(
+            &nodes[i], n - i, ts, &b[RLPX_DISCOVERY_HEADER], &l);
+        if (c < 0 ||
+            rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_NEIGHBOURS, b, &l)) {
+            async_udp_tx_commit(t->udp, 0, addr);
+            return -1;
+        }
+        async_udp_tx_commit(t->udp, l, addr);
+        rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    } while ((i += c) < n);
+    return 0;
+}
+
+int
+rlpx_discovery_send_enr_request(
+    rlpx_discovery_table* t,
+    rlpx_discovery_record* r,
+    const usys_sockaddr* addr)
+{
+    uint32_t l;
+    uint8_t* b;
+
+    // The record keeps the hash, the response has to echo it
+    if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+    l -= RLPX_DISCOVERY_HEADER;
+    if (rlpx_discovery_print_enr_request(
+            usys_epoch() + RLPX_DISCOVERY_EXPIRATION,
+            &b[RLPX_DISCOVERY_HEADER],
+            &l) ||
+        rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_ENR_REQUEST, b, &l)) {
+        async_udp_tx_commit(t->udp, 0, addr);
+        return -1;
+    }
+    memcpy(r->req, b, 32);
+    r->asked = usys_now_cached();
+    async_udp_tx_commit(t->udp, l, addr);
+    rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    return 0;
+}
+
+int
+rlpx_discovery_send_enr_response(
+    rlpx_discovery_table* t,
+    const uint8_t* req,
+    const usys_sockaddr* addr)
+{
+    const rlpx_enr* enr;
+    uint32_t l;
+    uint8_t* b;
+
+    // Signed once per change of our record, not per request
+    if (!(enr = rlpx_enr_local_sign(&t->enr, t->skey))) return -1;
+    if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+    l -= RLPX_DISCOVERY_HEADER;
+    if (rlpx_discovery_print_enr_response(
+            (const h256*)req, enr, &b[RLPX_DISCOVERY_HEADER], &l) ||
+        rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_ENR_RESPONSE, b, &l)) {
+        async_udp_tx_commit(t->udp, 0, addr);
+        return -1;
+    }
+    async_udp_tx_commit(t->udp, l, addr);
+    rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    return 0;
+}
+
+void
+rlpx_discovery_enr_seq(
+    rlpx_discovery_table* t,
+    const knode* id,
+    rlpx_bond_node* bond,
+    uint64_t seq,
+    const usys_sockaddr* addr)
+{
+    rlpx_discovery_record* r;
+    int64_t now = usys_now_cached();
+
+    // A newer record is asked for once the node knows us (it won't answer
+    // before), and not again while a request is out
+    if (!(seq && t->udp && id && rlpx_bond_known(bond, now))) return;
+    if ((r = rlpx_discovery_record_find(t, id)) &&
+        (seq <= r->enr.seq ||
+         (r->asked && now - r->asked < RLPX_DISCOVERY_ENR_MS))) {
+        return;
+    }
+    if ((r = rlpx_discovery_record_get(t, id))) {
+        rlpx_discovery_send_enr_request(t, r, addr);
+    }
+}
+
+int
+rlpx_discovery_send_find(
+    rlpx_discovery_table* t,
+    const kpeer* peer,
+    const uint8_t* target)
+{
+    usys_sockaddr addr;
+    uint32_t l;
+    uint8_t* b;
+
+    // Our socket is ipv4
+    if (!(peer->iplen == 4 && peer->udp)) return -1;
+    usys_sockaddr_init(&addr, peer->ip, peer->udp);
+    if (!(b = async_udp_tx_reserve(t->udp, &l))) return -1;
+    l -= RLPX_DISCOVERY_HEADER;
+    if (rlpx_discovery_print_find(
+            target,
+            usys_epoch() + RLPX_DISCOVERY_EXPIRATION,
+            &b[RLPX_DISCOVERY_HEADER],
+            &l) ||
+        rlpx_discovery_sign(t->skey, RLPX_DISCOVERY_FIND, b, &l)) {
+        async_udp_tx_commit(t->udp, 0, &addr);
+        return -1;
+    }
+    async_udp_tx_commit(t->udp, l, &addr);
+    rlpx_metrics_add(RLPX_METRIC_DISC_SENT, 1);
+    return 0;
+}
+
+void
+rlpx_discovery_lookup_learn(
+    rlpx_discovery_table* t,
+    const knode* id,
+    const kpeer* peer)
+{
+    rlpx_discovery_lookup* lk;
+    uint32_t i;
+    int c;
+    if (!memcmp(id, &t->self, sizeof(knode))) return;
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS; i++) {
+        lk = &t->lookups[i];
+        if (!lk->active || (c = klookup_find(&lk->k, t->from)) < 0) continue;
+        if (lk->k.nodes[c].state == KLOOKUP_ASKED ||
+            lk->k.nodes[c].state == KLOOKUP_REPLIED) {
+            klookup_add(&lk->k, id, peer);
+        }
+    }
+}
+
+void
+rlpx_discovery_lookup_answered(rlpx_discovery_table* t, const knode* id)
+{
+    uint32_t i;
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS; i++) {
+        if (!t->lookups[i].active) continue;
+        klookup_reply(&t->lookups[i].k, id, 1);
+        rlpx_discovery_lookup_pump(&t->lookups[i]);
+    }
+}
+
+void
+rlpx_discovery_lookup_pump(rlpx_discovery_lookup* lk)
+{
+    rlpx_discovery_req* req;
+    uint32_t r;
+    int i;
+
+    // Deadlines of nodes that answered (or dropped off) are moot
+    for (r = 0; r < KLOOKUP_ALPHA; r++) {
+        req = &lk->reqs[r];
+        if (!async_timer_active(&req->timer)) continue;
+        i = klookup_find(&lk->k, &req->id);
+        if (i < 0 || !(lk->k.nodes[i].state == KLOOKUP_ASKED)) {
+            async_timer_stop(&req->timer);
+        }
+    }
+
+    // Keep KLOOKUP_ALPHA in flight, a deadline per request
+    while ((i = klookup_next(&lk->k)) >= 0) {
+        for (r = 0; r < KLOOKUP_ALPHA; r++) {
+            if (!async_timer_active(&lk->reqs[r].timer)) break;
+        }
+        if (r < KLOOKUP_ALPHA) lk->reqs[r].id = lk->k.nodes[i].id;
+        if (r == KLOOKUP_ALPHA ||
+            rlpx_discovery_lookup_ask(&lk->reqs[r], &lk->k.nodes[i].peer)) {
+            klookup_reply(&lk->k, &lk->k.nodes[i].id, 0);
+        }
+    }
+
+    // Converged, stragglers outside of the closest are not waited on
+    if (klookup_done(&lk->k)) {
+        for (r = 0; r < KLOOKUP_ALPHA; r++) {
+            async_timer_stop(&lk->reqs[r].timer);
+        }
+        lk->fn(lk->ctx, &lk->k);
+        lk->active = 0;
+    }
+}
+
+int
+rlpx_discovery_lookup_ask(rlpx_discovery_req* req, const kpeer* peer)
+{
+    rlpx_discovery_table* t = req->lookup->table;
+    rlpx_bond_node* bond = rlpx_bond_find(&t->bond, &req->id);
+    int64_t now = usys_now_cached();
+    usys_sockaddr addr;
+
+    // A node that hasn't seen our proof drops FINDNODE, ping it first
+    if (!(req->bonding = !rlpx_bond_known(bond, now))) {
+        if (rlpx_discovery_send_find(t, peer, req->lookup->target)) return -1;
+    } else {
+        if (!(peer->iplen == 4 && peer->udp)) return -1;
+        usys_sockaddr_init(&addr, peer->ip, peer->udp);
+        bond = rlpx_bond_get(&t->bond, &req->id, addr.ip, now);
+        if (!bond || (!rlpx_bond_pinging(bond, now) &&
+                      rlpx_discovery_send_ping(t, bond, &addr))) {
+            return -1;
+        }
+    }
+    async_loop_timer(t->udp->io.loop, &req->timer, RLPX_DISCOVERY_FIND_MS);
+    return 0;
+}
+
+int
+rlpx_discovery_lookup_resume(rlpx_discovery_req* req)
+{
+    rlpx_discovery_lookup* lk = req->lookup;
+    int i = klookup_find(&lk->k, &req->id);
+
+    // Bonded, the FINDNODE goes out with a fresh deadline
+    req->bonding = 0;
+    if (i < 0 || !(lk->k.nodes[i].state == KLOOKUP_ASKED) ||
+        rlpx_discovery_send_find(lk->table, &lk->k.nodes[i].peer, lk->target)) {
+        return -1;
+    }
+    async_loop_timer(
+        lk->table->udp->io.loop, &req->timer, RLPX_DISCOVERY_FIND_MS);
+    return 0;
+}
+
+void
+rlpx_discovery_lookup_bonded(rlpx_discovery_table* t, const knode* id)
+{
+    rlpx_discovery_req* req;
+    uint32_t i, r;
+    for (i = 0; i < RLPX_DISCOVERY_LOOKUPS; i++) {
+        for (r = 0; r < KLOOKUP_ALPHA && t->lookups[i].active; r++) {
+            req = &t->lookups[i].reqs[r];
+            if (!(req->bonding && async_timer_active(&req->timer) &&
+                  !memcmp(&req->id, id, sizeof(knode)))) {
+                continue;
+            }
+            if (rlpx_discovery_lookup_resume(req)) {
+                async_timer_stop(&req->timer);
+                klookup_reply(&t->lookups[i].k, id, 0);
+                rlpx_discovery_lookup_pump(&t->lookups[i]);
+            }
+        }
+    }
+}
+
+void
+rlpx_discovery_on_find_timeout(void* ctx)
+{
+    rlpx_discovery_req* req = ctx;
+    rlpx_discovery_table* t = req->lookup->table;
+    rlpx_bond_node* bond = rlpx_bond_find(&t->bond, &req->id);
+    rlpx_discovery_node* node;
+
+    // Proved itself without pinging back, it holds a proof of ours already
+    if (req->bonding && bond &&
+        rlpx_bond_proven(bond, bond->ip, usys_now_cached()) &&
+        !rlpx_discovery_lookup_resume(req)) {
+        return;
+    }
+    if (t->db) rlpx_nodedb_fail(t->db, &req->id);
+
+    // Gone for good after a few, the newest replacement takes its place
+    if (!rlpx_discovery_table_find_node(t, &req->id, &node) &&
+        ++node->fails >= RLPX_DISCOVERY_FAILS) {
+        rlpx_discovery_table_remove_node(t, &req->id);
+    }
+    klookup_reply(&req->lookup->k, &req->id, 0);
+    rlpx_discovery_lookup_pump(req->lookup);
+}
+
 // h256:32 + Signature:65 + type + RLP
 int
 rlpx_discovery_parse(
@@ -197,11 +1084,29 @@ rlpx_discovery_parse(
 
     // Recover signature from signed hash of type+rlp
     ukeccak256((uint8_t*)&b[32 + 65], l - (32 + 65), shash.b, 32);
-    err = uecc_recover_bin(&b[32], shash.b, node_id);
+    usys_trace(
+        "uecc_recover_bin", err = uecc_recover_bin(&b[32], shash.b, node_id));
+    if (err) return -1;
 
     // Return OK
     *type = b[32 + 65];
-    *rlp = urlp_parse(&b[32 + 65 + 1], l - (32 + 65 + 1));
+    usys_trace(
+        "urlp_parse", *rlp = urlp_parse(&b[32 + 65 + 1], l - (32 + 65 + 1)));
+    return *rlp ? 0 : -1;
+}
+
+int
+rlpx_discovery_sign(uecc_ctx* skey, int type, uint8_t* b, uint32_t* l)
+{
+    // Sign sha3(type, rlp), then hash = sha3(sig, type, rlp)
+    h256 shash;
+    int err;
+    b[RLPX_DISCOVERY_HEADER - 1] = type;
+    ukeccak256(&b[32 + 65], *l + 1, shash.b, 32);
+    usys_trace("uecc_sign", err = uecc_sign_bin(skey, shash.b, &b[32]));
+    if (err) return -1;
+    ukeccak256(&b[32], *l + 65 + 1, b, 32);
+    *l += RLPX_DISCOVERY_HEADER;
     return 0;
 }
 
@@ -240,6 +1145,26 @@ rlpx_discovery_parse_ping(
     return err;
 }
 
+int
+rlpx_discovery_print_ping(
+    uint32_t ver,
+    const rlpx_discovery_endpoint* ep_src,
+    const rlpx_discovery_endpoint* ep_dst,
+    uint32_t timestamp,
+    uint8_t* dst,
+    uint32_t* l)
+{
+    // rlp.list(version, from, to, expiration), lists fill in from dst + 3
+    uint32_t n = 0;
+    if (*l < 3 + 5 + 2 * RLPX_DISCOVERY_ENDPOINT_MAX + 5) return -1;
+    n += urlp_put_u64(&dst[3], ver);
+    n += rlpx_discovery_put_endpoint(&dst[3 + n], ep_src);
+    n += rlpx_discovery_put_endpoint(&dst[3 + n], ep_dst);
+    n += urlp_put_u64(&dst[3 + n], timestamp);
+    *l = urlp_put_list(dst, n);
+    return 0;
+}
+
 int
 rlpx_discovery_parse_pong(
     const urlp** rlp,
@@ -249,30 +1174,64 @@ rlpx_discovery_parse_pong(
 {
     int err;
     uint32_t sz = 32, n = urlp_children(*rlp);
-    if (n < 4) return -1;
+    if (n < 3) return -1;
     if ((!(err = rlpx_discovery_parse_endpoint(urlp_at(*rlp, 0), to))) &&
         (!(err = urlp_idx_to_mem(*rlp, 1, echo32, &sz))) &&
-        (!(err = urlp_idx_to_u32(*rlp, 3, timestamp)))) {
+        (!(err = urlp_idx_to_u32(*rlp, 2, timestamp)))) {
         return err;
     }
     return err;
 }
 
 int
-rlpx_discovery_parse_find(const urlp** rlp, uecc_public_key* q, uint32_t* ts)
+rlpx_discovery_print_pong(
+    uint32_t timestamp,
+    const h256* echo,
+    const rlpx_discovery_endpoint* ep_to,
+    uint8_t* d,
+    uint32_t* l)
 {
+    // rlp.list(to, echo, expiration)
+    uint32_t n = 0;
+    if (*l < 3 + RLPX_DISCOVERY_ENDPOINT_MAX + 33 + 5) return -1;
+    n += rlpx_discovery_put_endpoint(&d[3], ep_to);
+    n += urlp_put_mem(&d[3 + n], echo->b, 32);
+    n += urlp_put_u64(&d[3 + n], timestamp);
+    *l = urlp_put_list(d, n);
+    return 0;
+}
+
+int
+rlpx_discovery_parse_find(const urlp** rlp, uint8_t* nodeid, uint32_t* ts)
+{
+    // Target need not be a key, it is only hashed
     int err = -1;
     uint32_t publen = 64, n = urlp_children(*rlp);
-    uint8_t pub[65] = { 0x04 };
     if (n < 2) return err;
-    if ((!(err = urlp_idx_to_mem(*rlp, 0, &pub[1], &publen))) &&
-        (!(err = uecc_btoq(pub, publen + 1, q))) &&
+    if ((!(err = urlp_idx_to_mem(*rlp, 0, nodeid, &publen))) &&
+        (!(err = publen == 64 ? 0 : -1)) &&
         (!(err = urlp_idx_to_u32(*rlp, 1, ts)))) {
         return err;
     }
     return err;
 }
 
+int
+rlpx_discovery_print_find(
+    const uint8_t* nodeid,
+    uint32_t timestamp,
+    uint8_t* b,
+    uint32_t* l)
+{
+    // rlp.list(target, expiration)
+    uint32_t n = 0;
+    if (*l < 3 + 66 + 5) return -1;
+    n += urlp_put_mem(&b[3], nodeid, 64);
+    n += urlp_put_u64(&b[3 + n], timestamp);
+    *l = urlp_put_list(b, n);
+    return 0;
+}
+
 /**
  * @brief
  *
@@ -295,11 +1254,136 @@ rlpx_discovery_parse_neighbours(rlpx_discovery_table* t, const urlp** rlp)
     return 0;
 }
 
+int
+rlpx_discovery_print_neighbours(
+    const kpeer* nodes,
+    uint32_t n,
+    uint32_t timestamp,
+    uint8_t* b,
+    uint32_t* l)
+{
+    // Neighbours fill in from b + 6 (outer list, then the list of nodes)
+    uint32_t i, m = 0, x;
+    uint8_t* c;
+    if (*l < 6 + 5) return -1;
+    for (i = 0; i < n && 6 + m + RLPX_DISCOVERY_NEIGHBOUR_MAX + 5 <= *l; i++) {
+        c = &b[6 + m];
+        x = urlp_put_mem(&c[3], nodes[i].ip, nodes[i].iplen);
+        x += urlp_put_u64(&c[3 + x], nodes[i].udp);
+        x += urlp_put_u64(&c[3 + x], nodes[i].tcp);
+        x += urlp_put_mem(&c[3 + x], nodes[i].pub, 64);
+        m += urlp_put_list(c, x);
+    }
+    if (!i && n) return -1;
+    m = urlp_put_list(&b[3], m);
+    m += urlp_put_u64(&b[3 + m], timestamp);
+    *l = urlp_put_list(b, m);
+    return i;
+}
+
+int
+rlpx_discovery_parse_enr_request(const urlp** rlp, uint32_t* timestamp)
+{
+    if (urlp_children(*rlp) < 1) return -1;
+    return urlp_idx_to_u32(*rlp, 0, timestamp);
+}
+
+int
+rlpx_discovery_print_enr_request(uint32_t timestamp, uint8_t* b, uint32_t* l)
+{
+    // rlp.list(expiration)
+    uint32_t n;
+    if (*l < 3 + 5) return -1;
+    n = urlp_put_u64(&b[3], timestamp);
+    *l = urlp_put_list(b, n);
+    return 0;
+}
+
+int
+rlpx_discovery_parse_enr_response(
+    const urlp** rlp,
+    uint8_t* echo32,
+    rlpx_enr* enr)
+{
+    int err;
+    uint32_t sz = 32, n = urlp_children(*rlp);
+    if (n < 2) return -1;
+    if ((!(err = urlp_idx_to_mem(*rlp, 0, echo32, &sz))) &&
+        (!(err = sz == 32 ? 0 : -1)) &&
+        (!(err = rlpx_discovery_record_parse(urlp_at(*rlp, 1), enr)))) {
+        return err;
+    }
+    return err;
+}
+
+int
+rlpx_discovery_print_enr_response(
+    const h256* echo,
+    const rlpx_enr* enr,
+    uint8_t* b,
+    uint32_t* l)
+{
+    // rlp.list(echo, record), the record as it was signed
+    uint32_t n;
+    if (*l < 3 + 33 + enr->len) return -1;
+    n = urlp_put_mem(&b[3], echo->b, 32);
+    memcpy(&b[3 + n], enr->b, enr->len);
+    *l = urlp_put_list(b, n + enr->len);
+    return 0;
+}
+
+int
+rlpx_discovery_record_parse(const urlp* rlp, rlpx_enr* enr)
+{
+    // Printed back to the bytes that were signed
+    uint8_t b[RLPX_ENR_MAX];
+    uint32_t l = sizeof(b);
+    if (!rlp || urlp_print(rlp, b, &l)) return -1;
+    return rlpx_enr_parse(enr, b, l);
+}
+
 void
 rlpx_walk_neighbours(const urlp* rlp, int idx, void* ctx)
 {
     // rlp.list(ipv(4|6),udp,tcp,nodeid)
-    ((void)idx);
     rlpx_discovery_table* table = (rlpx_discovery_table*)ctx;
-    rlpx_discovery_table_add_node_rlp(table, rlp);
+    uecc_public_key q;
+    kpeer peer;
+    knode id;
+    ((void)idx);
+    if (rlpx_discovery_parse_neighbour(rlp, &peer, &q)) return;
+    rlpx_discovery_table_add_node(
+        table, peer.ip, peer.iplen, peer.tcp, peer.udp, &q, NULL);
+
+    // Lookups hear of it even when its bucket is full
+    if (table->from) {
+        rlpx_discovery_node_id(peer.pub, &id);
+        rlpx_discovery_lookup_learn(table, &id, &peer);
+    }
+}
+
+int
+rlpx_discovery_put_seq(uint8_t* b, uint32_t* l, uint32_t max, uint64_t seq)
+{
+    // Printed list b is listed again with seq appended (EIP-868)
+    uint32_t h = b[0] <= 0xf7 ? 1 : b[0] - 0xf6, n = *l - h;
+    if (3 + n + 9 > max) return -1;
+    memmove(&b[3], &b[h], n);
+    n += urlp_put_u64(&b[3 + n], seq);
+    *l = urlp_put_list(b, n);
+    return 0;
+}
+
+uint32_t
+rlpx_discovery_put_endpoint(uint8_t* b, const rlpx_discovery_endpoint* ep)
+{
+    // rlp.list(ip, udp, tcp)
+    uint32_t n = urlp_put_mem(&b[3], ep->ip, ep->iplen);
+    n += urlp_put_u64(&b[3 + n], ep->udp);
+    n += urlp_put_u64(&b[3 + n], ep->tcp);
+    return urlp_put_list(b, n);
 }
+
+//
+//
+//
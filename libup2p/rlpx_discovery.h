@@ -26,23 +26,74 @@
 extern "C" {
 #endif
 
+#include "async_udp.h"
+#include "kademlia/klookup.h"
+#include "kademlia/ktable.h"
+#include "rlpx_bond.h"
 #include "rlpx_config.h"
+#include "rlpx_enr.h"
+#include "rlpx_nodedb.h"
+#include "rlpx_ratelimit.h"
 #include "uecc.h"
 #include "urlp.h"
 #include "usys_io.h"
 
+// Records (EIP-778) kept for the nodes of the table, oldest goes first
+#ifndef RLPX_DISCOVERY_RECORDS
+#define RLPX_DISCOVERY_RECORDS 256
+#endif
+
+// Full buckets whose oldest node is being pinged at once
+#ifndef RLPX_DISCOVERY_CHECKS
+#define RLPX_DISCOVERY_CHECKS 8
+#endif
+
+// Most nodes a FINDNODE is answered with (one kademlia bucket)
+#ifndef RLPX_DISCOVERY_NEIGHBOURS_MAX
+#define RLPX_DISCOVERY_NEIGHBOURS_MAX 16
+#endif
+
+// Seconds our packets stay valid
+#ifndef RLPX_DISCOVERY_EXPIRATION
+#define RLPX_DISCOVERY_EXPIRATION 20
+#endif
+
+// Lookups a table runs at once
+#ifndef RLPX_DISCOVERY_LOOKUPS
+#define RLPX_DISCOVERY_LOOKUPS 4
+#endif
+
+// Time a FINDNODE has to be answered (ms)
+#ifndef RLPX_DISCOVERY_FIND_MS
+#define RLPX_DISCOVERY_FIND_MS 500
+#endif
+
+// FINDNODEs a node leaves unanswered in a row before it is removed
+#ifndef RLPX_DISCOVERY_FAILS
+#define RLPX_DISCOVERY_FAILS 4
+#endif
+
+// Time an ENRRequest has to be answered (ms)
+#ifndef RLPX_DISCOVERY_ENR_MS
+#define RLPX_DISCOVERY_ENR_MS 1000
+#endif
+
+// hash(32) | signature(65) | type(1) | rlp
+#define RLPX_DISCOVERY_HEADER (32 + 65 + 1)
+
 typedef enum {
     RLPX_DISCOVERY_PING = 1,
     RLPX_DISCOVERY_PONG = 2,
     RLPX_DISCOVERY_FIND = 3,
-    RLPX_DISCOVERY_NEIGHBOURS = 4
+    RLPX_DISCOVERY_NEIGHBOURS = 4,
+    RLPX_DISCOVERY_ENR_REQUEST = 5,
+    RLPX_DISCOVERY_ENR_RESPONSE = 6
 } RLPX_DISCOVERY;
 
 typedef enum {
-    RLPX_USEFUL_FREE = 0,
-    RLPX_USEFUL_PENDING = 1,
-    RLPX_USEFUL_TRUE = 2,
-    RLPX_USEFUL_FALSE = 3
+    RLPX_USEFUL_PENDING = 0,
+    RLPX_USEFUL_TRUE = 1,
+    RLPX_USEFUL_FALSE = 2
 } RLPX_DISCOVERY_USEFUL;
 
 typedef struct
@@ -53,34 +104,171 @@ typedef struct
     uint32_t udp;   /*!< p2p port */
 } rlpx_discovery_endpoint;
 
+// What we keep of a node besides its endpoint (ktable_value of its slot)
 typedef struct
 {
-    uecc_public_key nodeid;       /*!< pubkey */
-    rlpx_discovery_endpoint ep;   /*!< remote endpoint routing*/
     RLPX_DISCOVERY_USEFUL useful; /*!< usefulness */
+    uint32_t record;              /*!< records[], if the id there matches */
+    uint32_t fails;               /*!< FINDNODEs unanswered in a row */
 } rlpx_discovery_node;
 
+// A node's record (EIP-778) and our request for a newer one (EIP-868)
 typedef struct
 {
-    rlpx_discovery_node nodes[10];   /*!< potential peers */
-    rlpx_discovery_node* recents[3]; /*!< ptrs to most recent pings */
+    knode id;        /*!< owner */
+    rlpx_enr enr;    /*!< latest, seq 0 none */
+    uint8_t req[32]; /*!< hash of our ENRRequest */
+    int64_t asked;   /*!< sent (ms), 0 none */
+} rlpx_discovery_record;
+
+struct rlpx_discovery_table;
+struct rlpx_discovery_lookup;
+
+// Called once a lookup converged (see klookup_results)
+typedef void (*rlpx_discovery_lookup_fn)(void* ctx, klookup* l);
+
+typedef struct
+{
+    async_timer timer;                    /*!< reply deadline */
+    knode id;                             /*!< node asked */
+    uint32_t bonding;                     /*!< FINDNODE waits on a bond */
+    struct rlpx_discovery_lookup* lookup; /*!< owner */
+} rlpx_discovery_req;
+
+// Ping of the oldest node of a full bucket, it makes room if unanswered
+typedef struct
+{
+    async_timer timer;                  /*!< pong deadline */
+    knode id;                           /*!< node pinged */
+    struct rlpx_discovery_table* table; /*!< owner */
+} rlpx_discovery_check;
+
+typedef struct rlpx_discovery_lookup
+{
+    klookup k;                              /*!< candidates */
+    uint8_t target[64];                     /*!< FINDNODE target */
+    rlpx_discovery_req reqs[KLOOKUP_ALPHA]; /*!< one per request in flight */
+    rlpx_discovery_lookup_fn fn;            /*!< converged */
+    void* ctx;                              /*!< passed to fn */
+    uint32_t active;                        /*!< running */
+    struct rlpx_discovery_table* table;     /*!< owner */
+} rlpx_discovery_lookup;
+
+typedef struct rlpx_discovery_table
+{
+    ktable nodes;                   /*!< potential peers, rlpx_discovery_node */
+    knode self;                     /*!< our id (bound) */
+    rlpx_discovery_endpoint ep;     /*!< ours, in pings */
+    rlpx_enr_local enr;             /*!< ours (bound) */
+    rlpx_discovery_record* records; /*!< theirs, RLPX_DISCOVERY_RECORDS */
+    uint32_t hand;                  /*!< next record to reuse */
+    uecc_ctx* skey;                 /*!< signs replies */
+    async_udp* udp;                 /*!< replies (NULL none) */
+    rlpx_nodedb* db;                /*!< NULL not persisted */
+    rlpx_ratelimit limit;           /*!< admission budgets */
+    rlpx_bond bond;                 /*!< endpoint proofs */
+    const knode* from;              /*!< sender in hand */
+    rlpx_discovery_check checks[RLPX_DISCOVERY_CHECKS];    /*!< full buckets */
+    rlpx_discovery_lookup lookups[RLPX_DISCOVERY_LOOKUPS]; /*!< running */
 } rlpx_discovery_table;
 
 /**
  * @brief
  *
  * @param table
+ *
+ * @return 0 ok, -1 out of memory
+ */
+int rlpx_discovery_table_init(rlpx_discovery_table* table);
+void rlpx_discovery_table_deinit(rlpx_discovery_table* table);
+
+/**
+ * @brief Answer PING and FINDNODE and run lookups. Packets are signed with
+ * skey (its context is reused for every packet) and written in place into
+ * udp's send ring. Lookup deadlines and bond expiry run on udp's loop. Our
+ * record (table->enr) gets skey's public key, its sequence number starts at
+ * the epoch, and PING and PONG carry it (EIP-868). Buckets are by distance
+ * to our id, nodes added before are sorted again.
+ */
+void rlpx_discovery_table_bind(
+    rlpx_discovery_table* table,
+    uecc_ctx* skey,
+    async_udp* udp);
+
+/**
+ * @brief Our endpoint (set after bind), the source of our pings and the "ip"
+ * (unless zero), "udp" and "tcp" of our record. A change re-signs the record
+ * with a new seq.
+ */
+void rlpx_discovery_table_endpoint(
+    rlpx_discovery_table* table,
+    const rlpx_discovery_endpoint* ep);
+
+/**
+ * @brief Load the nodes of db (those that answered a ping first) and keep db
+ * up to date from then on: endpoints, answers and unanswered FINDNODEs.
+ *
+ * @return nodes loaded
+ */
+uint32_t rlpx_discovery_table_attach(
+    rlpx_discovery_table* table,
+    rlpx_nodedb* db);
+
+/**
+ * @brief Start an iterative lookup of target (64 bytes, need not be a real
+ * key) seeded with our closest nodes. FINDNODE goes to KLOOKUP_ALPHA nodes
+ * at a time and each has RLPX_DISCOVERY_FIND_MS to answer. Lookups share the
+ * bound socket, NEIGHBOURS are matched to the lookups that asked the sender.
+ * A node that hasn't seen our endpoint proof is pinged first, its FINDNODE
+ * goes out once it pings us back (or answers, if it doesn't). A node that
+ * leaves RLPX_DISCOVERY_FAILS of them unanswered in a row is removed.
+ * fn may run before this returns (every request failed to send).
+ *
+ * @return 0 started, -1 not bound, no nodes to ask or RLPX_DISCOVERY_LOOKUPS
+ * running
+ */
+int rlpx_discovery_table_lookup(
+    rlpx_discovery_table* table,
+    const uint8_t* target,
+    rlpx_discovery_lookup_fn fn,
+    void* ctx);
+
+/**
+ * @brief Node id of a public key (keccak256 of its 64 bytes)
  */
-void rlpx_discovery_table_init(rlpx_discovery_table* table);
+void rlpx_discovery_node_id(const uint8_t* pub, knode* id);
 
+/**
+ * @brief Look a live node up by id (one bucket scan, see ktable.h). Its
+ * endpoint is the kpeer of the same slot, both move as the table changes.
+ *
+ * @return 0 found (node set), -1 not in the table
+ */
 int rlpx_discovery_table_find_node(
     rlpx_discovery_table* table,
-    uecc_public_key* target,
-    rlpx_discovery_node* node);
+    const knode* id,
+    rlpx_discovery_node** node);
 
-void rlpx_discovery_table_update_recent(
+/**
+ * @brief Latest record of a node. PING and PONG announce the sequence number
+ * of a node's record, a newer one is asked for (ENRRequest) and kept once
+ * its signature checks out.
+ *
+ * @return record, NULL none
+ */
+const rlpx_enr* rlpx_discovery_table_enr(
     rlpx_discovery_table* table,
-    rlpx_discovery_node* node);
+    const knode* id);
+
+/**
+ * @brief Drop a node, the newest replacement of its bucket takes its place
+ *
+ * @return 0 removed, -1 not in the table
+ */
+int rlpx_discovery_table_remove_node(
+    rlpx_discovery_table* table,
+    const knode* id);
+
 /**
  * @brief
  *
@@ -94,17 +282,12 @@ int rlpx_discovery_table_add_node_rlp(
     const urlp* rlp);
 
 /**
- * @brief
+ * @brief Add a node or update its endpoint. meta, when not NULL, is the
+ * node's record (EIP-778 rlp), kept if it verifies and is newer. A node whose
+ * bucket is full waits as a replacement while the oldest of the bucket is
+ * pinged, it is removed if it doesn't answer within RLPX_BOND_PING_MS.
  *
- * @param table
- * @param ip
- * @param iplen
- * @param tcp
- * @param udp
- * @param id
- * @param meta
- *
- * @return
+ * @return 0 ok, -1 bad endpoint or key or ourselves
  */
 int rlpx_discovery_table_add_node(
     rlpx_discovery_table* table,
@@ -115,7 +298,35 @@ int rlpx_discovery_table_add_node(
     uecc_public_key* id,
     urlp* meta);
 
-int rlpx_discovery_recv(rlpx_discovery_table* t, const uint8_t* b, uint32_t l);
+/**
+ * @brief Handle one packet from a peer. A bound table (see
+ * rlpx_discovery_table_bind) answers PING with PONG, and pings back a node
+ * that hasn't proved its endpoint yet (see rlpx_bond.h). PONG only counts
+ * when it echoes our ping. FINDNODE is answered, with as many NEIGHBOURS
+ * packets as our closest nodes need, and ENRRequest with our record, for
+ * nodes that proved their endpoint.
+ * Packets of the wrong size or type, or over the budget of their source (see
+ * rlpx_ratelimit), are dropped before they are hashed or their signature
+ * recovered. A NULL from is local and never limited.
+ *
+ * @return 0 ok, -1 dropped, invalid, expired or the reply did not fit
+ */
+int rlpx_discovery_recv(
+    rlpx_discovery_table* t,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* from);
+
+/**
+ * @brief Handle datagrams read in one batch (see async_udp). Empty datagrams
+ * (truncated) are skipped.
+ *
+ * @return number of packets that parsed
+ */
+uint32_t rlpx_discovery_recv_batch(
+    rlpx_discovery_table* t,
+    const usys_dgram* d,
+    uint32_t n);
 int rlpx_discovery_parse(
     const uint8_t* b,
     uint32_t l,
@@ -125,12 +336,26 @@ int rlpx_discovery_parse(
 
 int rlpx_discovery_parse_endpoint(const urlp*, rlpx_discovery_endpoint* ep);
 
+/**
+ * @brief Sign a packet whose rlp (l bytes) was printed at
+ * b + RLPX_DISCOVERY_HEADER, then hash it.
+ *
+ * @return 0 ok (l is the packet length), -1 signing failed
+ */
+int rlpx_discovery_sign(uecc_ctx* skey, int type, uint8_t* b, uint32_t* l);
+
 int rlpx_discovery_parse_ping(
     const urlp**,
     uint8_t* version32,
     rlpx_discovery_endpoint* from,
     rlpx_discovery_endpoint* to,
     uint32_t* timestamp);
+/**
+ * @brief Print packet rlp into b (l is its size, then the bytes written).
+ * Nodes are public keys without the 0x04 prefix (64 bytes).
+ *
+ * @return 0 ok, -1 too small
+ */
 int rlpx_discovery_print_ping(
     uint32_t ver,
     const rlpx_discovery_endpoint* ep_src,
@@ -145,19 +370,51 @@ int rlpx_discovery_parse_pong(
     uint32_t* timestamp);
 int rlpx_discovery_print_pong(
     uint32_t timestamp,
-    h256* echo,
+    const h256* echo,
     const rlpx_discovery_endpoint* ep_to,
     uint8_t* d,
     uint32_t* l);
-int
-rlpx_discovery_parse_find(const urlp** rlp, uecc_public_key* q, uint32_t* ts);
+int rlpx_discovery_parse_find(const urlp** rlp, uint8_t* nodeid, uint32_t* ts);
 int rlpx_discovery_print_find(
-    uint8_t* nodeid,
+    const uint8_t* nodeid,
     uint32_t timestamp,
     uint8_t* b,
     uint32_t* l);
 int rlpx_discovery_parse_neighbours(rlpx_discovery_table* t, const urlp** rlp);
-//  rlpx_discovery_print_neighbours( ....TODO
+int rlpx_discovery_parse_enr_request(const urlp** rlp, uint32_t* timestamp);
+int rlpx_discovery_print_enr_request(
+    uint32_t timestamp,
+    uint8_t* b,
+    uint32_t* l);
+
+/**
+ * @brief ENRResponse: the hash of the request it answers and a record
+ * (verified, see rlpx_enr_parse).
+ *
+ * @return 0 ok, -1 malformed or the record didn't verify
+ */
+int rlpx_discovery_parse_enr_response(
+    const urlp** rlp,
+    uint8_t* echo32,
+    rlpx_enr* enr);
+int rlpx_discovery_print_enr_response(
+    const h256* echo,
+    const rlpx_enr* enr,
+    uint8_t* b,
+    uint32_t* l);
+
+/**
+ * @brief Print as many of n nodes as fit in l bytes (callers split the rest
+ * into more packets). n may be 0 (an empty answer).
+ *
+ * @return nodes printed, -1 not even one fits
+ */
+int rlpx_discovery_print_neighbours(
+    const kpeer* nodes,
+    uint32_t n,
+    uint32_t timestamp,
+    uint8_t* b,
+    uint32_t* l);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1477 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_discv5.h"
+#include "rlpx_metrics.h"
+#include "uhash.h"
+#include "ukeccak256.h"
+#include "urand.h"
+#include "usys_time.h"
+
+// A NODES being walked, records join the table at the distances asked
+typedef struct
+{
+    rlpx_discv5* ctx;
+    const rlpx_discv5_session* s;
+} rlpx_discv5_walk;
+
+// Private
+void rlpx_discv5_random(rlpx_discv5* ctx, uint8_t* b, uint32_t l);
+void rlpx_discv5_header(
+    uint8_t* h,
+    int flag,
+    const uint8_t* nonce,
+    uint32_t authlen);
+int rlpx_discv5_slot(rlpx_discv5* ctx, const knode* id);
+void rlpx_discv5_session_key(
+    const knode* id,
+    const usys_sockaddr* addr,
+    knode* key);
+rlpx_discv5_session* rlpx_discv5_session_find(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr);
+rlpx_discv5_session* rlpx_discv5_session_get(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now);
+rlpx_discv5_session* rlpx_discv5_session_nonce(
+    rlpx_discv5* ctx,
+    const uint8_t* nonce,
+    const usys_sockaddr* addr);
+rlpx_discv5_session* rlpx_discv5_session_to(
+    rlpx_discv5* ctx,
+    const knode* id);
+void rlpx_discv5_session_await(
+    rlpx_discv5_session* s,
+    uint32_t req,
+    const uint16_t* d,
+    uint32_t n);
+int rlpx_discv5_session_keys(
+    rlpx_discv5_session* s,
+    const uint8_t* wkey,
+    const uint8_t* rkey);
+void rlpx_discv5_session_unkey(rlpx_discv5_session* s);
+void rlpx_discv5_session_drop(rlpx_discv5* ctx, rlpx_discv5_session* s);
+rlpx_discv5_session* rlpx_discv5_session_victim(rlpx_discv5* ctx);
+rlpx_discv5_challenge* rlpx_discv5_challenge_find(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now);
+rlpx_discv5_challenge* rlpx_discv5_challenge_get(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now);
+uint32_t rlpx_discv5_print_findnode(
+    rlpx_discv5* ctx,
+    const uint16_t* d,
+    uint32_t n,
+    uint8_t* pt,
+    uint32_t* req);
+int rlpx_discv5_request(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const uint8_t* pt,
+    uint32_t l);
+int rlpx_discv5_request_session(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l);
+int rlpx_discv5_write(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int flag,
+    const uint8_t* iv,
+    const uint8_t* nonce,
+    const uint8_t* auth,
+    uint32_t authlen,
+    uaes_gcm_ctx* key,
+    const uint8_t* pt,
+    uint32_t l);
+int rlpx_discv5_encode_gcm(
+    const knode* dest,
+    const uint8_t* iv,
+    int flag,
+    const uint8_t* nonce,
+    const uint8_t* authdata,
+    uint32_t authlen,
+    uaes_gcm_ctx* key,
+    const uint8_t* pt,
+    uint32_t ptlen,
+    uint8_t* b,
+    uint32_t* l);
+int rlpx_discv5_open_gcm(
+    uaes_gcm_ctx* key,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* pt,
+    uint32_t* ptlen);
+int rlpx_discv5_send(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l);
+int rlpx_discv5_send_whoareyou(
+    rlpx_discv5* ctx,
+    rlpx_discv5_challenge* c,
+    const uint8_t* nonce);
+int rlpx_discv5_send_handshake(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* challenge);
+int rlpx_discv5_send_nodes(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* req,
+    uint32_t reqlen,
+    const urlp* d);
+void rlpx_discv5_session_sent(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* nonce);
+void rlpx_discv5_id_digest(
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    uint8_t* digest);
+int rlpx_discv5_on_message(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr);
+int rlpx_discv5_on_whoareyou(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    const usys_sockaddr* addr);
+int rlpx_discv5_on_handshake(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr);
+int rlpx_discv5_handle(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l);
+void rlpx_discv5_seq(rlpx_discv5* ctx, rlpx_discv5_session* s, uint64_t seq);
+void rlpx_discv5_walk_nodes(const urlp* rlp, int idx, void* ctx);
+uint32_t rlpx_discv5_put_req(
+    rlpx_discv5* ctx,
+    uint8_t* pt,
+    int type,
+    uint32_t* req);
+
+// Offsets in a decoded header (masking-iv first)
+#define RLPX_DISCV5_FLAG_AT 24
+#define RLPX_DISCV5_NONCE_AT 25
+#define RLPX_DISCV5_AUTH_AT RLPX_DISCV5_STATIC
+
+// Message of a packet without a session, it can't open
+#define RLPX_DISCV5_RANDOM 20
+
+// Largest message of a packet with a session (header and tag around it)
+#define RLPX_DISCV5_MESSAGE_MAX                                                \
+    (ASYNC_UDP_MTU - RLPX_DISCV5_STATIC - 32 - 16)
+
+int
+rlpx_discv5_init(
+    rlpx_discv5* ctx,
+    void* user,
+    rlpx_discv5_msg_fn on_msg,
+    rlpx_discv5_talk_fn on_talk)
+{
+    uint32_t nodes = RLPX_DISCV5_TABLE * sizeof(rlpx_enr),
+             sessions = RLPX_DISCV5_SESSIONS * sizeof(rlpx_discv5_session);
+    memset(ctx, 0, sizeof(rlpx_discv5));
+    ctx->ctx = user;
+    ctx->on_msg = on_msg;
+    ctx->on_talk = on_talk;
+    if (rlpx_ratelimit_init(&ctx->limit, RLPX_RATELIMIT_SOURCES)) return -1;
+    if (!(ctx->nodes = rlpx_malloc(nodes)) ||
+        !(ctx->sessions = rlpx_malloc(sessions))) {
+        rlpx_discv5_deinit(ctx);
+        return -1;
+    }
+
+    // Zeroed sessions hold no keys (deinit frees the keyed ones)
+    memset(ctx->nodes, 0, nodes);
+    memset(ctx->sessions, 0, sessions);
+    if (kindex_init(&ctx->index, RLPX_DISCV5_TABLE) ||
+        kindex_init(&ctx->sindex, RLPX_DISCV5_SESSIONS) ||
+        kindex_init(&ctx->nindex, RLPX_DISCV5_SESSIONS)) {
+        rlpx_discv5_deinit(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+void
+rlpx_discv5_deinit(rlpx_discv5* ctx)
+{
+    uint32_t i;
+
+    // Keys don't outlive the sessions
+    if (ctx->sessions) {
+        for (i = 0; i < RLPX_DISCV5_SESSIONS; i++) {
+            rlpx_discv5_session_unkey(&ctx->sessions[i]);
+        }
+        memset(
+            ctx->sessions,
+            0,
+            RLPX_DISCV5_SESSIONS * sizeof(rlpx_discv5_session));
+        rlpx_free(ctx->sessions);
+    }
+    if (ctx->nodes) rlpx_free(ctx->nodes);
+    kindex_deinit(&ctx->nindex);
+    kindex_deinit(&ctx->sindex);
+    kindex_deinit(&ctx->index);
+    rlpx_ratelimit_deinit(&ctx->limit);
+    memset(ctx, 0, sizeof(rlpx_discv5));
+}
+
+int
+rlpx_discv5_bind(
+    rlpx_discv5* ctx,
+    uecc_ctx* skey,
+    rlpx_enr_local* enr,
+    async_udp* udp)
+{
+    uint8_t pub[65];
+    if (uecc_qtob(&skey->Q, pub, sizeof(pub))) return -1;
+    ukeccak256(&pub[1], 64, ctx->self.b, sizeof(ctx->self.b));
+    ctx->skey = skey;
+    ctx->enr = enr;
+    ctx->udp = udp;
+
+    // One seed, nonces and ivs are hashed from it (no drbg per packet)
+    return urand(ctx->seed, sizeof(ctx->seed)) ? -1 : 0;
+}
+
+int
+rlpx_discv5_add_node(rlpx_discv5* ctx, const rlpx_enr* enr)
+{
+    int slot;
+    uint32_t i;
+    if (!enr->seq || !memcmp(&enr->id, &ctx->self, sizeof(knode))) return -1;
+
+    // Known nodes keep their slot, the newer record wins
+    if ((slot = rlpx_discv5_slot(ctx, &enr->id)) >= 0) {
+        if (enr->seq < ctx->nodes[slot].seq) return -1;
+        ctx->nodes[slot] = *enr;
+        return 0;
+    }
+    for (i = 0; i < RLPX_DISCV5_TABLE; i++) {
+        if (!ctx->nodes[i].seq) break;
+    }
+    if (i == RLPX_DISCV5_TABLE || kindex_put(&ctx->index, &enr->id, i)) {
+        return -1;
+    }
+    ctx->nodes[i] = *enr;
+    ctx->ids[i] = enr->id;
+    return 0;
+}
+
+const rlpx_enr*
+rlpx_discv5_find_node(rlpx_discv5* ctx, const knode* id)
+{
+    int slot = rlpx_discv5_slot(ctx, id);
+    return slot < 0 ? NULL : &ctx->nodes[slot];
+}
+
+int
+rlpx_discv5_slot(rlpx_discv5* ctx, const knode* id)
+{
+    // The index is keyed by 64 bits of the id, the slot confirms the rest
+    int slot = kindex_get(&ctx->index, id);
+    if (slot < 0 || !ctx->nodes[slot].seq ||
+        memcmp(&ctx->ids[slot], id, sizeof(knode))) {
+        return -1;
+    }
+    return slot;
+}
+
+int
+rlpx_discv5_ping(rlpx_discv5* ctx, const knode* id, uint32_t* req)
+{
+    // rlp.list(request-id, enr-seq)
+    uint8_t pt[1 + 3 + 5 + 9];
+    uint32_t n = rlpx_discv5_put_req(ctx, pt, RLPX_DISCV5_PING, req);
+    n += urlp_put_u64(&pt[4 + n], rlpx_enr_local_seq(ctx->enr));
+    n = 1 + urlp_put_list(&pt[1], n);
+    return rlpx_discv5_request(ctx, id, pt, n);
+}
+
+int
+rlpx_discv5_findnode(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const uint16_t* d,
+    uint32_t n,
+    uint32_t* req)
+{
+    uint8_t pt[RLPX_DISCV5_PENDING];
+    uint32_t l = rlpx_discv5_print_findnode(ctx, d, n, pt, req);
+    rlpx_discv5_session* s;
+    if (!(l && (s = rlpx_discv5_session_to(ctx, id)) &&
+          !rlpx_discv5_request_session(ctx, s, pt, l))) {
+        return -1;
+    }
+    rlpx_discv5_session_await(s, *req, d, n);
+    return 0;
+}
+
+int
+rlpx_discv5_talkreq(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const char* proto,
+    const uint8_t* b,
+    uint32_t l,
+    uint32_t* req)
+{
+    // rlp.list(request-id, protocol, request)
+    uint8_t pt[RLPX_DISCV5_PENDING];
+    uint32_t n, plen = strlen(proto);
+    if (1 + 3 + 5 + 3 + plen + 3 + l > sizeof(pt)) return -1;
+    n = rlpx_discv5_put_req(ctx, pt, RLPX_DISCV5_TALKREQ, req);
+    n += urlp_put_mem(&pt[4 + n], (const uint8_t*)proto, plen);
+    n += urlp_put_mem(&pt[4 + n], b, l);
+    n = 1 + urlp_put_list(&pt[1], n);
+    return rlpx_discv5_request(ctx, id, pt, n);
+}
+
+int
+rlpx_discv5_recv(
+    rlpx_discv5* ctx,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* from)
+{
+    uint8_t h[RLPX_DISCV5_HEADER_MAX];
+    uint32_t hlen;
+    int flag, err = -1;
+
+    // Cheap checks first, unmasking and opening is what floods cost us
+    if (!ctx->udp || l < RLPX_DISCV5_PACKET_MIN || l > ASYNC_UDP_MTU) {
+        rlpx_metrics_add(RLPX_METRIC_DISCV5_INVALID, 1);
+        return -1;
+    }
+    if (rlpx_ratelimit_take(&ctx->limit, from->ip, usys_now_cached())) {
+        rlpx_metrics_add(RLPX_METRIC_DISCV5_LIMITED, 1);
+        return -1;
+    }
+    if ((flag = rlpx_discv5_decode(&ctx->self, b, l, h, &hlen)) < 0) {
+        rlpx_metrics_add(RLPX_METRIC_DISCV5_INVALID, 1);
+        return -1;
+    }
+    rlpx_metrics_add(RLPX_METRIC_DISCV5_MESSAGE + flag, 1);
+    if (flag == RLPX_DISCV5_FLAG_MESSAGE) {
+        err = rlpx_discv5_on_message(ctx, h, hlen, b, l, from);
+    } else if (flag == RLPX_DISCV5_FLAG_WHOAREYOU) {
+        err = rlpx_discv5_on_whoareyou(ctx, h, from);
+    } else {
+        err = rlpx_discv5_on_handshake(ctx, h, hlen, b, l, from);
+    }
+    if (err) rlpx_metrics_add(RLPX_METRIC_DISCV5_INVALID, 1);
+    return err;
+}
+
+int
+rlpx_discv5_is_packet(rlpx_discv5* ctx, const uint8_t* b, uint32_t l)
+{
+    // Only "discv5" and the version, a discv4 packet has its hash there
+    uint8_t mkey[16], ctr[16], id[8];
+    if (l < RLPX_DISCV5_PACKET_MIN || l > ASYNC_UDP_MTU) return 0;
+    memcpy(mkey, ctx->self.b, 16);
+    memcpy(ctr, b, 16);
+    if (uaes_crypt_ctr(128, mkey, ctr, &b[16], 8, id)) return 0;
+    return memcmp(id, "discv5\x00\x01", 8) ? 0 : 1;
+}
+
+uint32_t
+rlpx_discv5_recv_batch(rlpx_discv5* ctx, const usys_dgram* d, uint32_t n)
+{
+    uint32_t i, ok = 0;
+    for (i = 0; i < n; i++) {
+        if (!d[i].len) continue;
+        if (!rlpx_discv5_recv(ctx, d[i].b, d[i].len, &d[i].addr)) ok++;
+    }
+    return ok;
+}
+
+int
+rlpx_discv5_on_message(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr)
+{
+    uint8_t pt[ASYNC_UDP_MTU];
+    uint32_t ptlen;
+    rlpx_discv5_session* s;
+    rlpx_discv5_challenge* c;
+    const knode* src = (const knode*)&h[RLPX_DISCV5_AUTH_AT];
+    int64_t now = usys_now_cached();
+
+    // Opens with the session's keys, else (none, or they forgot theirs) we
+    // challenge. Stale keys stay until a handshake replaces them, the
+    // source has no session until then.
+    s = rlpx_discv5_session_find(ctx, src, addr);
+    if (s && s->keyed &&
+        !rlpx_discv5_open_gcm(&s->rkey, h, hlen, b, l, pt, &ptlen)) {
+        s->at = now;
+        return rlpx_discv5_handle(ctx, s, pt, ptlen);
+    }
+    c = rlpx_discv5_challenge_get(ctx, src, addr, now);
+    return rlpx_discv5_send_whoareyou(ctx, c, &h[RLPX_DISCV5_NONCE_AT]);
+}
+
+int
+rlpx_discv5_on_whoareyou(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    const usys_sockaddr* addr)
+{
+    rlpx_discv5_session* s;
+    int64_t now = usys_now_cached();
+
+    // Only for our last request to that endpoint, and only once (the
+    // handshake takes a new nonce)
+    s = rlpx_discv5_session_nonce(ctx, &h[RLPX_DISCV5_NONCE_AT], addr);
+    if (!(s && s->len && s->pub[0] &&
+          now - s->sent < RLPX_DISCV5_HANDSHAKE_MS)) {
+        return -1;
+    }
+    return rlpx_discv5_send_handshake(ctx, s, h);
+}
+
+int
+rlpx_discv5_on_handshake(
+    rlpx_discv5* ctx,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* addr)
+{
+    // src-id | sig-size | eph-key-size | id-signature | eph-pubkey | record
+    const uint8_t* auth = &h[RLPX_DISCV5_AUTH_AT];
+    const uint8_t *sig = &auth[34], *eph = &auth[34 + 64], *pub = NULL;
+    uint32_t at = RLPX_DISCV5_AUTH_AT + 34 + 64 + 33, ptlen;
+    uint8_t keys[32], pt[ASYNC_UDP_MTU];
+    rlpx_discv5_challenge* c;
+    rlpx_discv5_session* s;
+    int64_t now = usys_now_cached();
+    rlpx_enr enr;
+    int slot;
+
+    // Answers our challenge, in time (a request of ours may have a session)
+    c = rlpx_discv5_challenge_find(ctx, (const knode*)auth, addr, now);
+    if (!c) return -1;
+    s = rlpx_discv5_session_find(ctx, &c->id, addr);
+
+    // Signed by the record it carries (ours was stale), else the one we hold
+    if (at < hlen) {
+        if (rlpx_enr_parse(&enr, &h[at], hlen - at) ||
+            memcmp(&enr.id, &c->id, sizeof(knode))) {
+            return -1;
+        }
+        pub = enr.pub;
+    } else if ((slot = rlpx_discv5_slot(ctx, &c->id)) >= 0) {
+        pub = ctx->nodes[slot].pub;
+    } else if (s && s->pub[0]) {
+        pub = s->pub;
+    }
+    if (!pub || rlpx_discv5_id_verify(
+                    pub, c->b, sizeof(c->b), eph, &ctx->self, sig)) {
+        return -1;
+    }
+
+    // They initiated, we read with initiator-key and write with the other.
+    // Proven, the source gets its session now and the challenge is spent.
+    if (rlpx_discv5_derive_keys(
+            ctx->skey,
+            eph,
+            c->b,
+            sizeof(c->b),
+            &c->id,
+            &ctx->self,
+            keys) ||
+        rlpx_discv5_open(&keys[0], h, hlen, b, l, pt, &ptlen) ||
+        !(s = rlpx_discv5_session_get(ctx, &c->id, addr, now)) ||
+        rlpx_discv5_session_keys(s, &keys[16], &keys[0])) {
+        memset(keys, 0, sizeof(keys));
+        return -1;
+    }
+    c->at = 0;
+    memset(keys, 0, sizeof(keys));
+    memcpy(s->pub, pub, 33);
+    s->at = now;
+    if (at < hlen) rlpx_discv5_add_node(ctx, &enr);
+    return rlpx_discv5_handle(ctx, s, pt, ptlen);
+}
+
+int
+rlpx_discv5_handle(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l)
+{
+    uint8_t req[8], b[RLPX_DISCV5_MESSAGE_MAX], ip[4];
+    uint8_t resp[RLPX_DISCV5_MESSAGE_MAX - 1 - 3 - 9 - 3];
+    uint32_t reqlen = sizeof(req), n, rl, protolen, talklen, id;
+    const uint8_t *proto, *talk;
+    rlpx_discv5_walk walk = { ctx, s };
+    uint64_t seq = 0, total;
+    const urlp* c;
+    urlp* rlp;
+    int type, err = -1;
+
+    // type | rlp.list(request-id, ...)
+    if (l < 2 || !(rlp = urlp_parse(&pt[1], l - 1))) return -1;
+    type = pt[0];
+    if (urlp_idx_to_mem(rlp, 0, req, &reqlen)) goto EXIT;
+    n = urlp_put_mem(&b[4], req, reqlen);
+    b[0] = type + 1;
+    if (type == RLPX_DISCV5_PING) {
+
+        // PONG echoes the request, our seq and where it came from
+        if (urlp_idx_to_u64(rlp, 1, &seq)) goto EXIT;
+        memcpy(ip, &s->addr.ip, 4);
+        n += urlp_put_u64(&b[4 + n], rlpx_enr_local_seq(ctx->enr));
+        n += urlp_put_mem(&b[4 + n], ip, 4);
+        n += urlp_put_u64(&b[4 + n], usys_sockaddr_port(&s->addr));
+        err = rlpx_discv5_send(ctx, s, b, 1 + urlp_put_list(&b[1], n));
+        rlpx_discv5_seq(ctx, s, seq);
+    } else if (type == RLPX_DISCV5_PONG) {
+        if (urlp_idx_to_u64(rlp, 1, &seq)) goto EXIT;
+        if (ctx->on_msg) ctx->on_msg(ctx->ctx, &s->id, type, rlp);
+        rlpx_discv5_seq(ctx, s, seq);
+        err = 0;
+    } else if (type == RLPX_DISCV5_FINDNODE) {
+        if (!(c = urlp_at(rlp, 1))) goto EXIT;
+        err = rlpx_discv5_send_nodes(ctx, s, req, reqlen, c);
+    } else if (type == RLPX_DISCV5_NODES) {
+
+        // Only the answers to our FINDNODE (total of them at most), records
+        // that verify join the table before the answer is handed on
+        if (!(s->find && reqlen == 4 && !urlp_idx_to_u32(rlp, 0, &id) &&
+              id == s->find) ||
+            urlp_idx_to_u64(rlp, 1, &total) || !(c = urlp_at(rlp, 2))) {
+            goto EXIT;
+        }
+        if (++s->found >= total || s->found >= RLPX_DISCV5_NODES_MAX) {
+            s->find = 0;
+        }
+        urlp_foreach(c, &walk, rlpx_discv5_walk_nodes);
+        if (ctx->on_msg) ctx->on_msg(ctx->ctx, &s->id, type, rlp);
+        err = 0;
+    } else if (type == RLPX_DISCV5_TALKREQ) {
+
+        // An unknown protocol gets an empty answer
+        if (!((c = urlp_at(rlp, 1)) && (proto = urlp_ref(c, &protolen)) &&
+              (c = urlp_at(rlp, 2)))) {
+            goto EXIT;
+        }
+        talk = urlp_ref(c, &talklen);
+        rl = sizeof(resp);
+        if (!(ctx->on_talk && !ctx->on_talk(
+                                  ctx->ctx,
+                                  &s->id,
+                                  proto,
+                                  protolen,
+                                  talk,
+                                  talklen,
+                                  resp,
+                                  &rl))) {
+            rl = 0;
+        }
+        n += urlp_put_mem(&b[4 + n], resp, rl);
+        err = rlpx_discv5_send(ctx, s, b, 1 + urlp_put_list(&b[1], n));
+    } else if (type == RLPX_DISCV5_TALKRESP) {
+        if (ctx->on_msg) ctx->on_msg(ctx->ctx, &s->id, type, rlp);
+        err = 0;
+    }
+EXIT:
+    urlp_free(&rlp);
+    return err;
+}
+
+int
+rlpx_discv5_send_nodes(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* req,
+    uint32_t reqlen,
+    const urlp* d)
+{
+    const rlpx_enr* recs[RLPX_DISCV5_NODES_MAX];
+    uint8_t b[RLPX_DISCV5_MESSAGE_MAX];
+    uint32_t budget = sizeof(b) - (1 + 3 + 9 + 2 + 3), dist, total, at, sz;
+    uint32_t i, j, n = 0, nd = urlp_children(d);
+
+    // Records at the distances asked for, 0 is ours
+    knode_distances(ctx->ids, RLPX_DISCV5_TABLE, &ctx->self, ctx->dist);
+    for (i = 0; i < nd && n < RLPX_DISCV5_NODES_MAX; i++) {
+        if (urlp_idx_to_u32(d, i, &dist) || dist > 256) continue;
+        if (!dist) {
+            if ((recs[n] = rlpx_enr_local_sign(ctx->enr, ctx->skey))) n++;
+            continue;
+        }
+        for (j = 0; j < RLPX_DISCV5_TABLE && n < RLPX_DISCV5_NODES_MAX; j++) {
+            if (ctx->nodes[j].seq && ctx->dist[j] == dist) {
+                recs[n++] = &ctx->nodes[j];
+            }
+        }
+    }
+
+    // As many messages as the records need (one, empty, when we have none),
+    // each names the total so the asker knows when it has them all
+    for (total = 1, sz = i = 0; i < n; sz += recs[i++]->len) {
+        if (sz + recs[i]->len > budget) total++, sz = 0;
+    }
+    i = 0;
+    do {
+        // rlp.list(request-id, total, rlp.list(record, ...))
+        b[0] = RLPX_DISCV5_NODES;
+        at = urlp_put_mem(&b[4], req, reqlen);
+        at += urlp_put_u64(&b[4 + at], total);
+        for (sz = 0; i < n && sz + recs[i]->len <= budget; i++) {
+            memcpy(&b[4 + at + 3 + sz], recs[i]->b, recs[i]->len);
+            sz += recs[i]->len;
+        }
+        at += urlp_put_list(&b[4 + at], sz);
+        if (rlpx_discv5_send(ctx, s, b, 1 + urlp_put_list(&b[1], at))) {
+            return -1;
+        }
+    } while (i < n);
+    return 0;
+}
+
+void
+rlpx_discv5_seq(rlpx_discv5* ctx, rlpx_discv5_session* s, uint64_t seq)
+{
+    uint8_t pt[1 + 3 + 5 + 3 + 1];
+    uint16_t d = 0;
+    uint32_t req, l;
+    int slot = rlpx_discv5_slot(ctx, &s->id);
+
+    // A newer record is asked for (FINDNODE 0), not while a request is out
+    if (seq <= (slot < 0 ? 0 : ctx->nodes[slot].seq) ||
+        usys_now_cached() - s->sent < RLPX_DISCV5_HANDSHAKE_MS) {
+        return;
+    }
+    if ((l = rlpx_discv5_print_findnode(ctx, &d, 1, pt, &req)) &&
+        !rlpx_discv5_request_session(ctx, s, pt, l)) {
+        rlpx_discv5_session_await(s, req, &d, 1);
+    }
+}
+
+void
+rlpx_discv5_walk_nodes(const urlp* rlp, int idx, void* ctx)
+{
+    // A record that doesn't verify, or at a distance we didn't ask for, is
+    // skipped, not the rest
+    rlpx_discv5_walk* walk = ctx;
+    uint8_t b[RLPX_ENR_MAX];
+    uint32_t l = sizeof(b), d;
+    rlpx_enr enr;
+    ((void)idx);
+    if (urlp_print(rlp, b, &l) || rlpx_enr_parse(&enr, b, l)) return;
+    d = knode_distance(&walk->s->id, &enr.id);
+    if (walk->s->want[d / 32] & (1u << d % 32)) {
+        rlpx_discv5_add_node(walk->ctx, &enr);
+    }
+}
+
+uint32_t
+rlpx_discv5_print_findnode(
+    rlpx_discv5* ctx,
+    const uint16_t* d,
+    uint32_t n,
+    uint8_t* pt,
+    uint32_t* req)
+{
+    // rlp.list(request-id, rlp.list(distance, ...)), pt has room for 16
+    // distances
+    uint32_t i, l = 0;
+    if (1 + 3 + 5 + 3 + n * 3 > RLPX_DISCV5_PENDING) return 0;
+    for (i = 0; i < n; i++) {
+        if (d[i] > 256) return 0;
+        l += urlp_put_u64(&pt[12 + l], d[i]);
+    }
+    l = urlp_put_list(&pt[9], l);
+    l += rlpx_discv5_put_req(ctx, pt, RLPX_DISCV5_FINDNODE, req);
+    return 1 + urlp_put_list(&pt[1], l);
+}
+
+int
+rlpx_discv5_request(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const uint8_t* pt,
+    uint32_t l)
+{
+    rlpx_discv5_session* s = rlpx_discv5_session_to(ctx, id);
+    return s ? rlpx_discv5_request_session(ctx, s, pt, l) : -1;
+}
+
+int
+rlpx_discv5_request_session(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l)
+{
+    uint8_t r[16 + 12 + RLPX_DISCV5_RANDOM];
+    int err;
+
+    // Kept for the handshake a WHOAREYOU asks for. Without keys the message
+    // is random, it can't open and brings the WHOAREYOU.
+    if (l > sizeof(s->pt)) return -1;
+    memcpy(s->pt, pt, l);
+    s->len = l;
+    rlpx_discv5_random(ctx, r, s->keyed ? 28 : sizeof(r));
+    err = rlpx_discv5_write(
+        ctx,
+        &s->id,
+        &s->addr,
+        RLPX_DISCV5_FLAG_MESSAGE,
+        &r[0],
+        &r[16],
+        ctx->self.b,
+        32,
+        s->keyed ? &s->wkey : NULL,
+        s->keyed ? s->pt : &r[28],
+        s->keyed ? s->len : RLPX_DISCV5_RANDOM);
+    if (!err) rlpx_discv5_session_sent(ctx, s, &r[16]);
+    return err;
+}
+
+int
+rlpx_discv5_send(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* pt,
+    uint32_t l)
+{
+    // Answers go out with the session's keys, they are not kept
+    uint8_t r[16 + 12];
+    rlpx_discv5_random(ctx, r, sizeof(r));
+    return rlpx_discv5_write(
+        ctx,
+        &s->id,
+        &s->addr,
+        RLPX_DISCV5_FLAG_MESSAGE,
+        &r[0],
+        &r[16],
+        ctx->self.b,
+        32,
+        &s->wkey,
+        pt,
+        l);
+}
+
+int
+rlpx_discv5_send_whoareyou(
+    rlpx_discv5* ctx,
+    rlpx_discv5_challenge* c,
+    const uint8_t* nonce)
+{
+    // id-nonce | enr-seq of the record we hold (0 asks for it)
+    uint8_t r[16 + 16], auth[24];
+    int slot = rlpx_discv5_slot(ctx, &c->id), i;
+    uint64_t seq = slot < 0 ? 0 : ctx->nodes[slot].seq;
+    rlpx_discv5_random(ctx, r, sizeof(r));
+    memcpy(auth, &r[16], 16);
+    for (i = 0; i < 8; i++) auth[16 + i] = seq >> (56 - 8 * i);
+
+    // The challenge is the packet as sent (before masking), the handshake
+    // proves and derives over it
+    memcpy(c->b, r, 16);
+    rlpx_discv5_header(&c->b[16], RLPX_DISCV5_FLAG_WHOAREYOU, nonce, 24);
+    memcpy(&c->b[RLPX_DISCV5_AUTH_AT], auth, sizeof(auth));
+    c->at = 0;
+    if (rlpx_discv5_write(
+            ctx,
+            &c->id,
+            &c->addr,
+            RLPX_DISCV5_FLAG_WHOAREYOU,
+            r,
+            nonce,
+            auth,
+            sizeof(auth),
+            NULL,
+            NULL,
+            0)) {
+        return -1;
+    }
+    c->at = usys_now_cached();
+    return 0;
+}
+
+int
+rlpx_discv5_send_handshake(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* challenge)
+{
+    // src-id | 64 | 33 | id-signature | eph-pubkey | record
+    uint8_t r[16 + 12 + 32], keys[32], auth[34 + 64 + 33 + RLPX_ENR_MAX];
+    const uint8_t* seqb = &challenge[RLPX_DISCV5_AUTH_AT + 16];
+    uint32_t l = 34 + 64 + 33, i;
+    const rlpx_enr* enr;
+    uint64_t seq = 0;
+    uecc_ctx eph;
+    int err;
+
+    // A fresh ephemeral key per handshake, proof and keys over the challenge
+    rlpx_discv5_random(ctx, r, sizeof(r));
+    if (uecc_key_init_binary(&eph, (const uecc_private_key*)&r[28])) {
+        memset(r, 0, sizeof(r));
+        return -1;
+    }
+    memcpy(auth, ctx->self.b, 32);
+    auth[32] = 64;
+    auth[33] = 33;
+    err = uecc_qtob(&eph.Q, &auth[34 + 64], 33) ||
+          rlpx_discv5_derive_keys(
+              &eph,
+              s->pub,
+              challenge,
+              RLPX_DISCV5_CHALLENGE,
+              &ctx->self,
+              &s->id,
+              keys) ||
+          rlpx_discv5_id_sign(
+              ctx->skey,
+              challenge,
+              RLPX_DISCV5_CHALLENGE,
+              &auth[34 + 64],
+              &s->id,
+              &auth[34]);
+    uecc_key_deinit(&eph);
+    memset(&r[28], 0, 32);
+    if (err) return -1;
+
+    // Our record goes along when their copy is older
+    for (i = 0; i < 8; i++) seq = seq << 8 | seqb[i];
+    if (seq < rlpx_enr_local_seq(ctx->enr) &&
+        (enr = rlpx_enr_local_sign(ctx->enr, ctx->skey))) {
+        memcpy(&auth[l], enr->b, enr->len);
+        l += enr->len;
+    }
+
+    // We initiated, we write with initiator-key
+    err = rlpx_discv5_session_keys(s, &keys[0], &keys[16]);
+    memset(keys, 0, sizeof(keys));
+    if (err) return -1;
+    if (rlpx_discv5_write(
+            ctx,
+            &s->id,
+            &s->addr,
+            RLPX_DISCV5_FLAG_HANDSHAKE,
+            &r[0],
+            &r[16],
+            auth,
+            l,
+            &s->wkey,
+            s->pt,
+            s->len)) {
+        return -1;
+    }
+    rlpx_discv5_session_sent(ctx, s, &r[16]);
+    return 0;
+}
+
+int
+rlpx_discv5_write(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int flag,
+    const uint8_t* iv,
+    const uint8_t* nonce,
+    const uint8_t* auth,
+    uint32_t authlen,
+    uaes_gcm_ctx* key,
+    const uint8_t* pt,
+    uint32_t l)
+{
+    // Encoded in place into the send ring
+    uint32_t cap;
+    uint8_t* b;
+    if (!(b = async_udp_tx_reserve(ctx->udp, &cap))) return -1;
+    if (rlpx_discv5_encode_gcm(
+            id, iv, flag, nonce, auth, authlen, key, pt, l, b, &cap)) {
+        async_udp_tx_commit(ctx->udp, 0, addr);
+        return -1;
+    }
+    async_udp_tx_commit(ctx->udp, cap, addr);
+    rlpx_metrics_add(RLPX_METRIC_DISCV5_SENT, 1);
+    return 0;
+}
+
+int
+rlpx_discv5_encode(
+    const knode* dest,
+    const uint8_t* iv,
+    int flag,
+    const uint8_t* nonce,
+    const uint8_t* authdata,
+    uint32_t authlen,
+    const uint8_t* key,
+    const uint8_t* pt,
+    uint32_t ptlen,
+    uint8_t* b,
+    uint32_t* l)
+{
+    uaes_gcm_ctx gcm;
+    int err;
+    if (key && uaes_gcm_init(&gcm, 128, key)) return -1;
+    err = rlpx_discv5_encode_gcm(
+        dest,
+        iv,
+        flag,
+        nonce,
+        authdata,
+        authlen,
+        key ? &gcm : NULL,
+        pt,
+        ptlen,
+        b,
+        l);
+    if (key) uaes_gcm_deinit(&gcm);
+    return err;
+}
+
+int
+rlpx_discv5_encode_gcm(
+    const knode* dest,
+    const uint8_t* iv,
+    int flag,
+    const uint8_t* nonce,
+    const uint8_t* authdata,
+    uint32_t authlen,
+    uaes_gcm_ctx* key,
+    const uint8_t* pt,
+    uint32_t ptlen,
+    uint8_t* b,
+    uint32_t* l)
+{
+    uint32_t hlen = RLPX_DISCV5_STATIC + authlen;
+    uint32_t n = hlen + ptlen + (key ? 16 : 0);
+    uint8_t mkey[16], ctr[16];
+
+    if (n > *l || authlen > 0xffff) return -1;
+    memcpy(b, iv, 16);
+    rlpx_discv5_header(&b[16], flag, nonce, authlen);
+    memcpy(&b[RLPX_DISCV5_STATIC], authdata, authlen);
+    if (key) {
+        if (uaes_gcm_enc(key, nonce, b, hlen, pt, ptlen, &b[hlen])) {
+            return -1;
+        }
+    } else if (ptlen) {
+        memcpy(&b[hlen], pt, ptlen);
+    }
+
+    // Masked last, the message was sealed over the header in the clear
+    memcpy(mkey, dest->b, 16);
+    memcpy(ctr, iv, 16);
+    if (uaes_crypt_ctr(128, mkey, ctr, &b[16], hlen - 16, &b[16])) return -1;
+    *l = n;
+    return 0;
+}
+
+int
+rlpx_discv5_decode(
+    const knode* self,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* h,
+    uint32_t* hlen)
+{
+    uint8_t mkey[16], ctr[16];
+    uint32_t authlen, n;
+    int flag;
+
+    if (l < RLPX_DISCV5_PACKET_MIN || l > ASYNC_UDP_MTU) return -1;
+    memcpy(mkey, self->b, 16);
+    memcpy(ctr, b, 16);
+    memcpy(h, b, 16);
+    if (uaes_crypt_ctr(128, mkey, ctr, &b[16], 23, &h[16])) return -1;
+    if (memcmp(&h[16], "discv5\x00\x01", 8)) return -1;
+    flag = h[RLPX_DISCV5_FLAG_AT];
+    authlen = h[RLPX_DISCV5_STATIC - 2] << 8 | h[RLPX_DISCV5_STATIC - 1];
+
+    // Authdata as the flag has it, a message and its tag after it (but for
+    // WHOAREYOU)
+    if (!((flag == RLPX_DISCV5_FLAG_MESSAGE && authlen == 32) ||
+          (flag == RLPX_DISCV5_FLAG_WHOAREYOU && authlen == 24 &&
+           l == RLPX_DISCV5_CHALLENGE) ||
+          (flag == RLPX_DISCV5_FLAG_HANDSHAKE && authlen >= 34 + 64 + 33 &&
+           authlen <= RLPX_DISCV5_HEADER_MAX - RLPX_DISCV5_STATIC))) {
+        return -1;
+    }
+    n = RLPX_DISCV5_STATIC + authlen;
+    if (flag != RLPX_DISCV5_FLAG_WHOAREYOU && n + 16 > l) return -1;
+
+    // The counter moved on, the header is unmasked again from the iv
+    memcpy(ctr, b, 16);
+    if (uaes_crypt_ctr(128, mkey, ctr, &b[16], n - 16, &h[16])) return -1;
+    if (flag == RLPX_DISCV5_FLAG_HANDSHAKE &&
+        !(h[RLPX_DISCV5_AUTH_AT + 32] == 64 &&
+          h[RLPX_DISCV5_AUTH_AT + 33] == 33)) {
+        return -1;
+    }
+    *hlen = n;
+    return flag;
+}
+
+int
+rlpx_discv5_open(
+    const uint8_t* key,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* pt,
+    uint32_t* ptlen)
+{
+    uaes_gcm_ctx gcm;
+    int err;
+    if (uaes_gcm_init(&gcm, 128, key)) return -1;
+    err = rlpx_discv5_open_gcm(&gcm, h, hlen, b, l, pt, ptlen);
+    uaes_gcm_deinit(&gcm);
+    return err;
+}
+
+int
+rlpx_discv5_open_gcm(
+    uaes_gcm_ctx* key,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* pt,
+    uint32_t* ptlen)
+{
+    // ad is masking-iv and the header, the nonce is the header's
+    if (l < hlen + 16) return -1;
+    if (uaes_gcm_dec(
+            key,
+            &h[RLPX_DISCV5_NONCE_AT],
+            h,
+            hlen,
+            &b[hlen],
+            l - hlen,
+            pt)) {
+        return -1;
+    }
+    *ptlen = l - hlen - 16;
+    return 0;
+}
+
+int
+rlpx_discv5_derive_keys(
+    uecc_ctx* key,
+    const uint8_t* pub,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const knode* a,
+    const knode* b,
+    uint8_t* keys)
+{
+    // hkdf(salt challenge, ecdh (compressed), info "..." | id-a | id-b)
+    static const char kdf[] = "discovery v5 key agreement";
+    uint8_t info[sizeof(kdf) - 1 + 64];
+    if (uecc_agree_bin(key, pub, 33)) return -1;
+    memcpy(info, kdf, sizeof(kdf) - 1);
+    memcpy(&info[sizeof(kdf) - 1], a->b, 32);
+    memcpy(&info[sizeof(kdf) - 1 + 32], b->b, 32);
+    uhash_hkdf(
+        challenge,
+        clen,
+        key->z.b,
+        sizeof(key->z.b),
+        info,
+        sizeof(info),
+        keys,
+        32);
+    memset(key->z.b, 0, sizeof(key->z.b));
+    return 0;
+}
+
+int
+rlpx_discv5_id_sign(
+    uecc_ctx* skey,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    uint8_t* sig)
+{
+    uint8_t digest[32], rsv[65];
+    rlpx_discv5_id_digest(challenge, clen, eph, dest, digest);
+    if (uecc_sign_bin(skey, digest, rsv)) return -1;
+    memcpy(sig, rsv, 64);
+    return 0;
+}
+
+int
+rlpx_discv5_id_verify(
+    const uint8_t* pub,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    const uint8_t* sig)
+{
+    uecc_public_key q;
+    uint8_t digest[32];
+    if (uecc_btoq(pub, 33, &q)) return -1;
+    rlpx_discv5_id_digest(challenge, clen, eph, dest, digest);
+    return uecc_verify_bin(&q, digest, sig);
+}
+
+void
+rlpx_discv5_id_digest(
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    uint8_t* digest)
+{
+    // sha256("..." | challenge-data | eph-pubkey | node-id-B)
+    static const char proof[] = "discovery v5 identity proof";
+    usha256_ctx sha;
+    usha256_init(&sha);
+    usha256_update(&sha, (const uint8_t*)proof, sizeof(proof) - 1);
+    usha256_update(&sha, challenge, clen);
+    usha256_update(&sha, eph, 33);
+    usha256_update(&sha, dest->b, 32);
+    usha256_finish(&sha, digest);
+    usha256_free(&sha);
+}
+
+void
+rlpx_discv5_session_key(
+    const knode* id,
+    const usys_sockaddr* addr,
+    knode* key)
+{
+    // The id's first 64 bits (the index key) mixed with the endpoint
+    uint64_t k = kindex_key(id) ^ ((uint64_t)addr->ip << 32 | addr->port);
+    *key = *id;
+    memcpy(key->b, &k, sizeof(k));
+}
+
+rlpx_discv5_session*
+rlpx_discv5_session_find(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr)
+{
+    rlpx_discv5_session* s;
+    knode key;
+    int i;
+    rlpx_discv5_session_key(id, addr, &key);
+    if ((i = kindex_get(&ctx->sindex, &key)) < 0) return NULL;
+    s = &ctx->sessions[i];
+    if (!s->at || memcmp(&s->id, id, sizeof(knode)) ||
+        !(s->addr.ip == addr->ip && s->addr.port == addr->port)) {
+        return NULL;
+    }
+    return s;
+}
+
+rlpx_discv5_session*
+rlpx_discv5_session_get(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now)
+{
+    rlpx_discv5_session* s = rlpx_discv5_session_find(ctx, id, addr);
+    knode key;
+    if (s) return s;
+
+    // A free entry, else the least recently used of a sample
+    if (ctx->n < RLPX_DISCV5_SESSIONS) {
+        while (ctx->sessions[ctx->hand].at) {
+            ctx->hand = (ctx->hand + 1) % RLPX_DISCV5_SESSIONS;
+        }
+        s = &ctx->sessions[ctx->hand];
+    } else {
+        rlpx_discv5_session_drop(ctx, s = rlpx_discv5_session_victim(ctx));
+    }
+    rlpx_discv5_session_key(id, addr, &key);
+    if (kindex_put(&ctx->sindex, &key, s - ctx->sessions)) return NULL;
+    s->id = *id;
+    s->addr = *addr;
+    s->at = now;
+    ctx->n++;
+    return s;
+}
+
+rlpx_discv5_session*
+rlpx_discv5_session_nonce(
+    rlpx_discv5* ctx,
+    const uint8_t* nonce,
+    const usys_sockaddr* addr)
+{
+    rlpx_discv5_session* s;
+    knode key;
+    int i;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.b, nonce, 12);
+    if ((i = kindex_get(&ctx->nindex, &key)) < 0) return NULL;
+    s = &ctx->sessions[i];
+    if (!s->at || memcmp(s->nonce, nonce, 12) ||
+        !(s->addr.ip == addr->ip && s->addr.port == addr->port)) {
+        return NULL;
+    }
+    return s;
+}
+
+void
+rlpx_discv5_session_sent(
+    rlpx_discv5* ctx,
+    rlpx_discv5_session* s,
+    const uint8_t* nonce)
+{
+    // The WHOAREYOU for our request echoes its nonce, one per session
+    int slot = s - ctx->sessions;
+    knode key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.b, s->nonce, 12);
+    if (kindex_get(&ctx->nindex, &key) == slot) {
+        kindex_del(&ctx->nindex, &key);
+    }
+    memcpy(s->nonce, nonce, 12);
+    memcpy(key.b, nonce, 12);
+    kindex_put(&ctx->nindex, &key, slot);
+    s->sent = s->at = usys_now_cached();
+}
+
+rlpx_discv5_session*
+rlpx_discv5_session_to(rlpx_discv5* ctx, const knode* id)
+{
+    static const uint8_t any[4] = { 0 };
+    rlpx_discv5_session* s;
+    const rlpx_enr* enr;
+    usys_sockaddr addr;
+    int slot;
+
+    // Our socket is ipv4, the record says where
+    if (!ctx->udp || (slot = rlpx_discv5_slot(ctx, id)) < 0) return NULL;
+    enr = &ctx->nodes[slot];
+    if (!(enr->udp && memcmp(enr->ip, any, 4))) return NULL;
+    usys_sockaddr_init(&addr, enr->ip, enr->udp);
+    if (!(s = rlpx_discv5_session_get(ctx, id, &addr, usys_now_cached()))) {
+        return NULL;
+    }
+    memcpy(s->pub, enr->pub, 33);
+    return s;
+}
+
+void
+rlpx_discv5_session_await(
+    rlpx_discv5_session* s,
+    uint32_t req,
+    const uint16_t* d,
+    uint32_t n)
+{
+    // One FINDNODE out per session, a new one replaces it
+    uint32_t i;
+    memset(s->want, 0, sizeof(s->want));
+    for (i = 0; i < n; i++) s->want[d[i] / 32] |= 1u << d[i] % 32;
+    s->find = req;
+    s->found = 0;
+}
+
+int
+rlpx_discv5_session_keys(
+    rlpx_discv5_session* s,
+    const uint8_t* wkey,
+    const uint8_t* rkey)
+{
+    // Key schedules are set once here, not per packet
+    rlpx_discv5_session_unkey(s);
+    if (uaes_gcm_init(&s->wkey, 128, wkey)) return -1;
+    if (uaes_gcm_init(&s->rkey, 128, rkey)) {
+        uaes_gcm_deinit(&s->wkey);
+        return -1;
+    }
+    s->keyed = 1;
+    return 0;
+}
+
+void
+rlpx_discv5_session_unkey(rlpx_discv5_session* s)
+{
+    if (!s->keyed) return;
+    uaes_gcm_deinit(&s->wkey);
+    uaes_gcm_deinit(&s->rkey);
+    s->keyed = 0;
+}
+
+void
+rlpx_discv5_session_drop(rlpx_discv5* ctx, rlpx_discv5_session* s)
+{
+    knode key;
+    rlpx_discv5_session_key(&s->id, &s->addr, &key);
+    kindex_del(&ctx->sindex, &key);
+    memset(&key, 0, sizeof(key));
+    memcpy(key.b, s->nonce, 12);
+    if (kindex_get(&ctx->nindex, &key) == s - ctx->sessions) {
+        kindex_del(&ctx->nindex, &key);
+    }
+    rlpx_discv5_session_unkey(s);
+    memset(s, 0, sizeof(rlpx_discv5_session));
+    ctx->n--;
+}
+
+rlpx_discv5_session*
+rlpx_discv5_session_victim(rlpx_discv5* ctx)
+{
+    rlpx_discv5_session *s, *oldest = NULL;
+    uint32_t i;
+    for (i = 0; i < RLPX_DISCV5_SAMPLE; i++) {
+        s = &ctx->sessions[(ctx->hand + i) % RLPX_DISCV5_SESSIONS];
+        if (!oldest || s->at < oldest->at) oldest = s;
+    }
+    ctx->hand = (ctx->hand + RLPX_DISCV5_SAMPLE) % RLPX_DISCV5_SESSIONS;
+    return oldest;
+}
+
+rlpx_discv5_challenge*
+rlpx_discv5_challenge_find(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now)
+{
+    // Few and short lived, a scan is enough
+    rlpx_discv5_challenge* c;
+    uint32_t i;
+    for (i = 0; i < RLPX_DISCV5_CHALLENGES; i++) {
+        c = &ctx->challenges[i];
+        if (c->at && now - c->at < RLPX_DISCV5_HANDSHAKE_MS &&
+            c->addr.ip == addr->ip && c->addr.port == addr->port &&
+            !memcmp(&c->id, id, sizeof(knode))) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+rlpx_discv5_challenge*
+rlpx_discv5_challenge_get(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const usys_sockaddr* addr,
+    int64_t now)
+{
+    rlpx_discv5_challenge *c, *oldest = &ctx->challenges[0];
+    uint32_t i;
+    if ((c = rlpx_discv5_challenge_find(ctx, id, addr, now))) return c;
+
+    // Free ones are at 0, else the oldest (likely expired)
+    for (i = 1; i < RLPX_DISCV5_CHALLENGES; i++) {
+        if (ctx->challenges[i].at < oldest->at) oldest = &ctx->challenges[i];
+    }
+    oldest->id = *id;
+    oldest->addr = *addr;
+    oldest->at = 0;
+    return oldest;
+}
+
+void
+rlpx_discv5_random(rlpx_discv5* ctx, uint8_t* b, uint32_t l)
+{
+    // keccak(seed | counter), unpredictable without the seed and never
+    // repeats, so nonces stay unique per key
+    uint8_t in[32 + 8], out[32];
+    uint32_t n;
+    memcpy(in, ctx->seed, 32);
+    while (l) {
+        memcpy(&in[32], &ctx->counter, 8);
+        ctx->counter++;
+        ukeccak256(in, sizeof(in), out, sizeof(out));
+        n = l < sizeof(out) ? l : sizeof(out);
+        memcpy(b, out, n);
+        b += n;
+        l -= n;
+    }
+}
+
+void
+rlpx_discv5_header(
+    uint8_t* h,
+    int flag,
+    const uint8_t* nonce,
+    uint32_t authlen)
+{
+    // "discv5" | version | flag | nonce | authdata-size
+    memcpy(h, "discv5\x00\x01", 8);
+    h[8] = flag;
+    memcpy(&h[9], nonce, 12);
+    h[21] = authlen >> 8;
+    h[22] = authlen;
+}
+
+uint32_t
+rlpx_discv5_put_req(
+    rlpx_discv5* ctx,
+    uint8_t* pt,
+    int type,
+    uint32_t* req)
+{
+    // Message type, then our request id (4 bytes) where the list starts
+    *req = ++ctx->req;
+    pt[0] = type;
+    pt[4] = 0x84;
+    pt[5] = *req >> 24;
+    pt[6] = *req >> 16;
+    pt[7] = *req >> 8;
+    pt[8] = *req;
+    return 5;
+}
+
+//
+//
+//
@@ -0,0 +1,394 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+
+/**
+ * @file rlpx_discv5.h
+ *
+ * @brief Node Discovery v5 wire protocol (discv5.1). A packet is
+ * masking-iv || masked header || message, the header (static header and
+ * authdata) masked with aes-ctr keyed by the first 16 bytes of the
+ * recipient's id, the message sealed with aes-gcm under the session key of
+ * its direction (ad is masking-iv and the unmasked header).
+ *
+ * Sessions are kept per (node id, address). A node without one sends a
+ * random message, the recipient answers WHOAREYOU (id-nonce and the seq of
+ * the record it holds) and the handshake packet carries an ephemeral key,
+ * an identity proof signed over the challenge and, if the challenger's
+ * copy is stale, our record. Both ends derive the keys with HKDF from the
+ * ecdh of the ephemeral and the static key, so a handshake costs one
+ * signature, one verify and one ecdh, after that each message is one
+ * aes-gcm. The last request sent to a node is kept and resent in the
+ * handshake its WHOAREYOU asks for. Our WHOAREYOUs wait in a small table of
+ * their own, a source gets a session once its handshake verifies, so
+ * packets from anyone can't push sessions out.
+ *
+ * Nodes are the records we learn (NODES, handshakes and add_node), FINDNODE
+ * is answered from them by log distance.
+ */
+#ifndef RLPX_DISCV5_H_
+#define RLPX_DISCV5_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_udp.h"
+#include "kademlia/kindex.h"
+#include "rlpx_config.h"
+#include "rlpx_enr.h"
+#include "rlpx_ratelimit.h"
+#include "uaes.h"
+#include "uecc.h"
+#include "urlp.h"
+#include "usys_io.h"
+
+// Records the table holds
+#ifndef RLPX_DISCV5_TABLE
+#define RLPX_DISCV5_TABLE 256
+#endif
+
+// Sessions kept, the least recently used of a sample is evicted
+#ifndef RLPX_DISCV5_SESSIONS
+#define RLPX_DISCV5_SESSIONS 512
+#endif
+#ifndef RLPX_DISCV5_SAMPLE
+#define RLPX_DISCV5_SAMPLE 8
+#endif
+
+// WHOAREYOUs waiting for a handshake, the oldest is replaced
+#ifndef RLPX_DISCV5_CHALLENGES
+#define RLPX_DISCV5_CHALLENGES 64
+#endif
+
+// Largest request we send (message type and rlp), kept for a handshake
+#ifndef RLPX_DISCV5_PENDING
+#define RLPX_DISCV5_PENDING 512
+#endif
+
+// Time a WHOAREYOU has to be answered, and a request to be challenged (ms)
+#ifndef RLPX_DISCV5_HANDSHAKE_MS
+#define RLPX_DISCV5_HANDSHAKE_MS 1000
+#endif
+
+// Most records a FINDNODE is answered with
+#ifndef RLPX_DISCV5_NODES_MAX
+#define RLPX_DISCV5_NODES_MAX 16
+#endif
+
+// masking-iv(16) | "discv5" | version(2) | flag | nonce(12) | authsize(2)
+#define RLPX_DISCV5_STATIC (16 + 23)
+
+// WHOAREYOU as sent, the handshake signs and derives keys over it
+#define RLPX_DISCV5_CHALLENGE (RLPX_DISCV5_STATIC + 24)
+
+// Largest header, a handshake with a record
+#define RLPX_DISCV5_HEADER_MAX                                                 \
+    (RLPX_DISCV5_STATIC + 34 + 64 + 33 + RLPX_ENR_MAX)
+
+// Smallest packet (WHOAREYOU)
+#define RLPX_DISCV5_PACKET_MIN RLPX_DISCV5_CHALLENGE
+
+typedef enum {
+    RLPX_DISCV5_FLAG_MESSAGE = 0,
+    RLPX_DISCV5_FLAG_WHOAREYOU = 1,
+    RLPX_DISCV5_FLAG_HANDSHAKE = 2
+} RLPX_DISCV5_FLAG;
+
+typedef enum {
+    RLPX_DISCV5_PING = 1,
+    RLPX_DISCV5_PONG = 2,
+    RLPX_DISCV5_FINDNODE = 3,
+    RLPX_DISCV5_NODES = 4,
+    RLPX_DISCV5_TALKREQ = 5,
+    RLPX_DISCV5_TALKRESP = 6
+} RLPX_DISCV5;
+
+typedef struct
+{
+    knode id;                   /*!< node */
+    usys_sockaddr addr;         /*!< its endpoint, part of the key */
+    uaes_gcm_ctx wkey;          /*!< we seal with (set once per key) */
+    uaes_gcm_ctx rkey;          /*!< they seal with */
+    uint8_t pub[33];            /*!< their static key, zero unknown */
+    uint8_t nonce[12];          /*!< of our last request */
+    uint32_t keyed;             /*!< keys set */
+    uint32_t len;               /*!< bytes of pt, 0 none */
+    uint32_t find;              /*!< FINDNODE request id out, 0 none */
+    uint32_t found;             /*!< NODES of it received */
+    uint32_t want[9];           /*!< its distances (0..256), a bit each */
+    int64_t sent;               /*!< pt sent (ms) */
+    int64_t at;                 /*!< last used (ms), 0 free */
+    uint8_t pt[RLPX_DISCV5_PENDING]; /*!< our last request */
+} rlpx_discv5_session;
+
+typedef struct
+{
+    knode id;                         /*!< node we challenged */
+    usys_sockaddr addr;               /*!< its endpoint */
+    int64_t at;                       /*!< sent (ms), 0 free */
+    uint8_t b[RLPX_DISCV5_CHALLENGE]; /*!< our WHOAREYOU as sent */
+} rlpx_discv5_challenge;
+
+/**
+ * @brief A PONG, NODES or TALKRESP (rlp is the message list, the request
+ * id first). NODES records were added to the table before the call, only
+ * those at the distances asked for.
+ */
+typedef void (*rlpx_discv5_msg_fn)(
+    void* ctx,
+    const knode* from,
+    int type,
+    const urlp* rlp);
+
+/**
+ * @brief A TALKREQ for proto, write the answer to resp (capacity *l in,
+ * bytes out)
+ *
+ * @return 0 answered, -1 unknown protocol (an empty TALKRESP goes back)
+ */
+typedef int (*rlpx_discv5_talk_fn)(
+    void* ctx,
+    const knode* from,
+    const uint8_t* proto,
+    uint32_t protolen,
+    const uint8_t* req,
+    uint32_t reqlen,
+    uint8_t* resp,
+    uint32_t* l);
+
+typedef struct
+{
+    rlpx_enr* nodes;                  /*!< records by slot, seq 0 free */
+    knode ids[RLPX_DISCV5_TABLE];     /*!< node ids (distance kernels) */
+    uint16_t dist[RLPX_DISCV5_TABLE]; /*!< FINDNODE scratch */
+    kindex index;                     /*!< id -> nodes[] */
+    rlpx_discv5_session* sessions;    /*!< RLPX_DISCV5_SESSIONS */
+    kindex sindex;                    /*!< (id, addr) -> sessions[] */
+    kindex nindex;                    /*!< request nonce -> sessions[] */
+    uint32_t n;                       /*!< sessions in use */
+    uint32_t hand;                    /*!< eviction cursor */
+    rlpx_discv5_challenge challenges[RLPX_DISCV5_CHALLENGES]; /*!< ours */
+    knode self;                       /*!< our id (bound) */
+    uecc_ctx* skey;                   /*!< our static key */
+    rlpx_enr_local* enr;              /*!< our record */
+    async_udp* udp;                   /*!< packets out (NULL none) */
+    rlpx_ratelimit limit;             /*!< admission budgets */
+    uint8_t seed[32];                 /*!< nonces, ivs and ephemeral keys */
+    uint64_t counter;                 /*!< next of seed */
+    uint32_t req;                     /*!< next request id */
+    void* ctx;                        /*!< passed to the callbacks */
+    rlpx_discv5_msg_fn on_msg;        /*!< answers (NULL none) */
+    rlpx_discv5_talk_fn on_talk;      /*!< TALKREQ (NULL none) */
+} rlpx_discv5;
+
+/**
+ * @brief Allocate the table and sessions, user is handed to the callbacks
+ *
+ * @return 0 ok, -1 out of memory
+ */
+int rlpx_discv5_init(
+    rlpx_discv5* ctx,
+    void* user,
+    rlpx_discv5_msg_fn on_msg,
+    rlpx_discv5_talk_fn on_talk);
+void rlpx_discv5_deinit(rlpx_discv5* ctx);
+
+/**
+ * @brief Answer and send through udp as skey. enr is our record (shared
+ * with rlpx_discovery_table.enr is fine), it is signed with skey when it
+ * changed and handed to nodes whose copy is older.
+ *
+ * @return 0 ok, -1 no randomness
+ */
+int rlpx_discv5_bind(
+    rlpx_discv5* ctx,
+    uecc_ctx* skey,
+    rlpx_enr_local* enr,
+    async_udp* udp);
+
+/**
+ * @brief Add a node's record (verified, see rlpx_enr_parse), or replace an
+ * older one
+ *
+ * @return 0 ok, -1 ourselves, older than the one held or the table is full
+ */
+int rlpx_discv5_add_node(rlpx_discv5* ctx, const rlpx_enr* enr);
+
+/**
+ * @brief Record of a node
+ *
+ * @return record, NULL not in the table
+ */
+const rlpx_enr* rlpx_discv5_find_node(rlpx_discv5* ctx, const knode* id);
+
+/**
+ * @brief Send a request to a node of the table (its record has "ip" and
+ * "udp"). Without a session the request waits for the handshake. req is set
+ * to its id, answers carry it (see rlpx_discv5_msg_fn). FINDNODE asks for
+ * the records at n log distances (0 is the node's own record), NODES are
+ * only taken for the last one sent to a node.
+ *
+ * @return 0 sent, -1 unknown node, no endpoint, too large or no room
+ */
+int rlpx_discv5_ping(rlpx_discv5* ctx, const knode* id, uint32_t* req);
+int rlpx_discv5_findnode(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const uint16_t* d,
+    uint32_t n,
+    uint32_t* req);
+int rlpx_discv5_talkreq(
+    rlpx_discv5* ctx,
+    const knode* id,
+    const char* proto,
+    const uint8_t* b,
+    uint32_t l,
+    uint32_t* req);
+
+/**
+ * @brief Handle one packet. Packets of the wrong size, or over the budget
+ * of their source (see rlpx_ratelimit), are dropped before they are
+ * unmasked. A message that doesn't open (no session, or stale keys) is
+ * answered with WHOAREYOU, a WHOAREYOU only counts when it echoes the nonce
+ * of our last request to that endpoint, a handshake only when it answers
+ * our WHOAREYOU in time and its identity proof verifies. PING, FINDNODE and
+ * TALKREQ are answered, a PING or PONG announcing a newer record than ours
+ * asks for it (FINDNODE distance 0). from is required, sessions are per
+ * endpoint.
+ *
+ * @return 0 ok, -1 dropped or invalid
+ */
+int rlpx_discv5_recv(
+    rlpx_discv5* ctx,
+    const uint8_t* b,
+    uint32_t l,
+    const usys_sockaddr* from);
+
+/**
+ * @brief Cheap test for a port shared with discv4: a packet to us unmasks
+ * to the discv5 protocol id under our id
+ *
+ * @return 1 discv5, 0 not
+ */
+int rlpx_discv5_is_packet(rlpx_discv5* ctx, const uint8_t* b, uint32_t l);
+
+/**
+ * @brief Handle datagrams read in one batch (see async_udp). Empty
+ * datagrams (truncated) are skipped.
+ *
+ * @return number of packets handled
+ */
+uint32_t rlpx_discv5_recv_batch(
+    rlpx_discv5* ctx,
+    const usys_dgram* d,
+    uint32_t n);
+
+/**
+ * @brief Write a packet for dest into b (capacity *l in, bytes out). The
+ * message pt is sealed with key, or copied as is when key is NULL (random
+ * messages, WHOAREYOU has none).
+ *
+ * @return 0 ok, -1 too small
+ */
+int rlpx_discv5_encode(
+    const knode* dest,
+    const uint8_t* iv,
+    int flag,
+    const uint8_t* nonce,
+    const uint8_t* authdata,
+    uint32_t authlen,
+    const uint8_t* key,
+    const uint8_t* pt,
+    uint32_t ptlen,
+    uint8_t* b,
+    uint32_t* l);
+
+/**
+ * @brief Unmask the header of a packet to self into h (masking-iv and
+ * header, at least RLPX_DISCV5_HEADER_MAX bytes), *hlen its length
+ *
+ * @return flag, -1 not a discv5 packet or a header that doesn't add up
+ */
+int rlpx_discv5_decode(
+    const knode* self,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* h,
+    uint32_t* hlen);
+
+/**
+ * @brief Open the message of a decoded packet (hlen from
+ * rlpx_discv5_decode) into pt, *ptlen bytes
+ *
+ * @return 0 ok, -1 the tag doesn't authenticate
+ */
+int rlpx_discv5_open(
+    const uint8_t* key,
+    const uint8_t* h,
+    uint32_t hlen,
+    const uint8_t* b,
+    uint32_t l,
+    uint8_t* pt,
+    uint32_t* ptlen);
+
+/**
+ * @brief Session keys of a handshake, initiator-key then recipient-key (32
+ * bytes). The ecdh is of key and pub (33 bytes), the initiator's ephemeral
+ * key and the recipient's static key or the other way around. a is the
+ * initiator, b the recipient.
+ *
+ * @return 0 ok, -1 bad key
+ */
+int rlpx_discv5_derive_keys(
+    uecc_ctx* key,
+    const uint8_t* pub,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const knode* a,
+    const knode* b,
+    uint8_t* keys);
+
+/**
+ * @brief Identity proof of a handshake, over the challenge, the ephemeral
+ * public key (33 bytes) and the recipient's id (64 bytes r | s)
+ *
+ * @return 0 ok, -1 signing failed or (verify) the proof doesn't check out
+ */
+int rlpx_discv5_id_sign(
+    uecc_ctx* skey,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    uint8_t* sig);
+int rlpx_discv5_id_verify(
+    const uint8_t* pub,
+    const uint8_t* challenge,
+    uint32_t clen,
+    const uint8_t* eph,
+    const knode* dest,
+    const uint8_t* sig);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
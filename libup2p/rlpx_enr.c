@@ -0,0 +1,302 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_enr.h"
+#include "ukeccak256.h"
+#include "urlp.h"
+
+// Private
+int rlpx_enr_decode(
+    rlpx_enr* enr,
+    const uint8_t* b,
+    uint32_t l,
+    uint32_t* body,
+    uecc_public_key* q);
+int rlpx_enr_item(const uint8_t* b, uint32_t l, uint32_t* hdr, uint32_t* len);
+int rlpx_enr_key(const uint8_t* b, uint32_t l, const char* key);
+uint64_t rlpx_enr_uint(const uint8_t* b, uint32_t l);
+
+int
+rlpx_enr_parse(rlpx_enr* enr, const uint8_t* b, uint32_t l)
+{
+    uint8_t c[3 + RLPX_ENR_MAX];
+    uecc_public_key q;
+    uint32_t body, n;
+    h256 hash;
+
+    if (rlpx_enr_decode(enr, b, l, &body, &q)) return -1;
+
+    // The signature (before seq) covers rlp([seq, k, v, ...])
+    memcpy(&c[3], &b[body], l - body);
+    n = urlp_put_list(c, l - body);
+    ukeccak256(c, n, hash.b, sizeof(hash.b));
+    if (uecc_verify_bin(&q, hash.b, &b[body - 64])) {
+        memset(enr, 0, sizeof(rlpx_enr));
+        return -1;
+    }
+    return 0;
+}
+
+int
+rlpx_enr_get(
+    const rlpx_enr* enr,
+    const char* key,
+    const uint8_t** val,
+    uint32_t* l)
+{
+    uint32_t h, n, at, i;
+    int match;
+
+    // Past the signature and seq, the layout was checked when decoded
+    if (!enr->len) return -1;
+    rlpx_enr_item(enr->b, enr->len, &h, &n);
+    for (at = h, i = 0; i < 2; i++) {
+        rlpx_enr_item(&enr->b[at], enr->len - at, &h, &n);
+        at += h + n;
+    }
+    while (at < enr->len) {
+        rlpx_enr_item(&enr->b[at], enr->len - at, &h, &n);
+        match = rlpx_enr_key(&enr->b[at + h], n, key);
+        at += h + n;
+        rlpx_enr_item(&enr->b[at], enr->len - at, &h, &n);
+        if (match) {
+            *val = &enr->b[at];
+            *l = h + n;
+            return 0;
+        }
+        at += h + n;
+    }
+    return -1;
+}
+
+int
+rlpx_enr_local_init(
+    rlpx_enr_local* ctx,
+    const uecc_public_key* q,
+    uint64_t seq)
+{
+    uint8_t pub[33];
+    memset(ctx, 0, sizeof(rlpx_enr_local));
+    ctx->enr.seq = seq;
+    if (uecc_qtob(q, pub, sizeof(pub)) ||
+        rlpx_enr_local_set_mem(ctx, "id", (const uint8_t*)"v4", 2) ||
+        rlpx_enr_local_set_mem(ctx, "secp256k1", pub, sizeof(pub))) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+rlpx_enr_local_set(
+    rlpx_enr_local* ctx,
+    const char* key,
+    const uint8_t* val,
+    uint32_t l)
+{
+    rlpx_enr_pair* p;
+    uint32_t i = 0;
+    int c = 1;
+
+    if (!(strlen(key) < sizeof(p->key)) || l > RLPX_ENR_VALUE) return -1;
+
+    // Kept in key order, a known key is updated in place
+    while (i < ctx->n && (c = strcmp(ctx->pairs[i].key, key)) < 0) i++;
+    p = &ctx->pairs[i];
+    if (i < ctx->n && !c) {
+        if (p->len == l && !memcmp(p->val, val, l)) return 0;
+    } else {
+        if (ctx->n == RLPX_ENR_PAIRS) return -1;
+        memmove(&p[1], p, (ctx->n - i) * sizeof(rlpx_enr_pair));
+        memcpy(p->key, key, strlen(key) + 1);
+        ctx->n++;
+    }
+    memcpy(p->val, val, l);
+    p->len = l;
+
+    // A record that may have gone out is superseded
+    if (ctx->enr.len) {
+        ctx->enr.seq++;
+        ctx->enr.len = 0;
+    }
+    return 0;
+}
+
+int
+rlpx_enr_local_set_mem(
+    rlpx_enr_local* ctx,
+    const char* key,
+    const uint8_t* mem,
+    uint32_t l)
+{
+    uint8_t val[RLPX_ENR_VALUE];
+    if (l + 2 > sizeof(val)) return -1;
+    return rlpx_enr_local_set(ctx, key, val, urlp_put_mem(val, mem, l));
+}
+
+int
+rlpx_enr_local_set_u32(rlpx_enr_local* ctx, const char* key, uint32_t v)
+{
+    uint8_t val[5];
+    return rlpx_enr_local_set(ctx, key, val, urlp_put_u64(val, v));
+}
+
+const rlpx_enr*
+rlpx_enr_local_sign(rlpx_enr_local* ctx, uecc_ctx* skey)
+{
+    uint8_t c[3 + RLPX_ENR_MAX], b[3 + RLPX_ENR_MAX], sig[65];
+    uint32_t i, k, n, body;
+    rlpx_enr enr;
+    h256 hash;
+
+    if (ctx->enr.len) return &ctx->enr;
+
+    // Sign rlp([seq, k, v, ...])
+    n = urlp_put_u64(&c[3], ctx->enr.seq);
+    for (i = 0; i < ctx->n; i++) {
+        k = strlen(ctx->pairs[i].key);
+        if (3 + n + 1 + k + ctx->pairs[i].len > sizeof(c)) return NULL;
+        n += urlp_put_mem(&c[3 + n], (const uint8_t*)ctx->pairs[i].key, k);
+        memcpy(&c[3 + n], ctx->pairs[i].val, ctx->pairs[i].len);
+        n += ctx->pairs[i].len;
+    }
+    body = n;
+    n = urlp_put_list(c, body);
+    ukeccak256(c, n, hash.b, sizeof(hash.b));
+    if (uecc_sign_bin(skey, hash.b, sig)) return NULL;
+
+    // Then rlp([signature, seq, k, v, ...]), decoded for its common keys
+    if (66 + body > RLPX_ENR_MAX) return NULL;
+    urlp_put_mem(&b[3], sig, 64);
+    memcpy(&b[3 + 66], &c[n - body], body);
+    n = urlp_put_list(b, 66 + body);
+    if (n > RLPX_ENR_MAX || rlpx_enr_decode(&enr, b, n, &body, NULL)) {
+        return NULL;
+    }
+    ctx->enr = enr;
+    return &ctx->enr;
+}
+
+int
+rlpx_enr_decode(
+    rlpx_enr* enr,
+    const uint8_t* b,
+    uint32_t l,
+    uint32_t* body,
+    uecc_public_key* q)
+{
+    const uint8_t *k, *key = NULL;
+    uint32_t h, n, at, kn, keylen = 0;
+    uint8_t raw[65];
+    uecc_public_key pub;
+    int c, v4 = 0, list;
+
+    // rlp([signature, seq, k, v, ...]) and nothing after it
+    if (l > RLPX_ENR_MAX || !(rlpx_enr_item(b, l, &h, &n) == 1) ||
+        !(h + n == l)) {
+        return -1;
+    }
+    at = h;
+    if (!(rlpx_enr_item(&b[at], l - at, &h, &n) == 0 && n == 64)) return -1;
+    *body = at += h + n;
+    if (rlpx_enr_item(&b[at], l - at, &h, &n) || n > 8) return -1;
+    memset(enr, 0, sizeof(rlpx_enr));
+    enr->seq = rlpx_enr_uint(&b[at + h], n);
+    at += h + n;
+
+    // Keys sorted and unique, the ones we use decoded
+    while (at < l) {
+        if (rlpx_enr_item(&b[at], l - at, &h, &kn)) return -1;
+        k = &b[at + h];
+        at += h + kn;
+        if (key) {
+            c = memcmp(key, k, keylen < kn ? keylen : kn);
+            if (c > 0 || (!c && keylen >= kn)) return -1;
+        }
+        key = k;
+        keylen = kn;
+        if ((list = rlpx_enr_item(&b[at], l - at, &h, &n)) < 0) return -1;
+        if (!list && rlpx_enr_key(k, kn, "id")) {
+            v4 = n == 2 && !memcmp(&b[at + h], "v4", 2);
+        } else if (!list && n == 33 && rlpx_enr_key(k, kn, "secp256k1")) {
+            memcpy(enr->pub, &b[at + h], 33);
+        } else if (!list && n == 4 && rlpx_enr_key(k, kn, "ip")) {
+            memcpy(enr->ip, &b[at + h], 4);
+        } else if (!list && n <= 4 && rlpx_enr_key(k, kn, "tcp")) {
+            enr->tcp = rlpx_enr_uint(&b[at + h], n);
+        } else if (!list && n <= 4 && rlpx_enr_key(k, kn, "udp")) {
+            enr->udp = rlpx_enr_uint(&b[at + h], n);
+        }
+        at += h + n;
+    }
+
+    // Identity "v4", the node id is the hash of the uncompressed key
+    if (!q) q = &pub;
+    if (!v4 || uecc_btoq(enr->pub, 33, q) || uecc_qtob(q, raw, sizeof(raw))) {
+        return -1;
+    }
+    ukeccak256(&raw[1], 64, enr->id.b, sizeof(enr->id.b));
+    memcpy(enr->b, b, l);
+    enr->len = l;
+    return 0;
+}
+
+// 1 list, 0 string, -1 malformed or past l (header and payload bytes out)
+int
+rlpx_enr_item(const uint8_t* b, uint32_t l, uint32_t* hdr, uint32_t* len)
+{
+    uint32_t n, i;
+    int list;
+    if (!l) return -1;
+    list = b[0] >= 0xc0 ? 1 : 0;
+    if (b[0] < 0x80) {
+        *hdr = 0;
+        *len = 1;
+    } else if (b[0] < 0xb8 || (list && b[0] < 0xf8)) {
+        *hdr = 1;
+        *len = b[0] - (list ? 0xc0 : 0x80);
+    } else {
+        // Long forms, two length bytes are plenty for a datagram
+        n = b[0] - (list ? 0xf7 : 0xb7);
+        if (n > 2 || l < 1 + n) return -1;
+        for (*len = 0, i = 0; i < n; i++) *len = *len << 8 | b[1 + i];
+        *hdr = 1 + n;
+    }
+    return *hdr + *len <= l ? list : -1;
+}
+
+int
+rlpx_enr_key(const uint8_t* b, uint32_t l, const char* key)
+{
+    return l == strlen(key) && !memcmp(b, key, l);
+}
+
+uint64_t
+rlpx_enr_uint(const uint8_t* b, uint32_t l)
+{
+    uint64_t v = 0;
+    uint32_t i;
+    for (i = 0; i < l; i++) v = v << 8 | b[i];
+    return v;
+}
+
+//
+//
+//
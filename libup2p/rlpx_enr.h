@@ -0,0 +1,147 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_enr.h
+ *
+ * @brief Ethereum Node Records (EIP-778), "v4" identity scheme. A record is
+ * rlp([signature, seq, k, v, ...]) with sorted unique keys and at most
+ * RLPX_ENR_MAX bytes, signed by the node's key over
+ * keccak256(rlp([seq, k, v, ...])).
+ *
+ * Records of other nodes are verified once, when parsed, and kept in their
+ * signed encoding with the common keys decoded alongside. Ours
+ * (rlpx_enr_local) is a set of pairs signed into an encoding on first use
+ * and served from that cache until a pair changes, which also bumps its
+ * sequence number.
+ */
+#ifndef RLPX_ENR_H_
+#define RLPX_ENR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kademlia/knode.h"
+#include "uecc.h"
+
+// Largest record (EIP-778)
+#define RLPX_ENR_MAX 300
+
+// Pairs of our own record
+#ifndef RLPX_ENR_PAIRS
+#define RLPX_ENR_PAIRS 12
+#endif
+
+// Largest value of our own pairs (rlp item)
+#ifndef RLPX_ENR_VALUE
+#define RLPX_ENR_VALUE 48
+#endif
+
+typedef struct
+{
+    uint64_t seq;            /*!< sequence number, 0 none */
+    knode id;                /*!< keccak(pub) */
+    uint8_t pub[33];         /*!< "secp256k1", compressed */
+    uint8_t ip[4];           /*!< "ip" (big endian), zero absent */
+    uint32_t tcp;            /*!< "tcp", 0 absent */
+    uint32_t udp;            /*!< "udp", 0 absent */
+    uint32_t len;            /*!< bytes of b, 0 none */
+    uint8_t b[RLPX_ENR_MAX]; /*!< signed encoding */
+} rlpx_enr;
+
+typedef struct
+{
+    char key[12];                /*!< NUL terminated */
+    uint8_t val[RLPX_ENR_VALUE]; /*!< rlp item */
+    uint32_t len;                /*!< bytes of val */
+} rlpx_enr_pair;
+
+typedef struct
+{
+    rlpx_enr enr;                        /*!< signed cache, len 0 stale */
+    rlpx_enr_pair pairs[RLPX_ENR_PAIRS]; /*!< sorted by key */
+    uint32_t n;                          /*!< pairs */
+} rlpx_enr_local;
+
+/**
+ * @brief Decode and verify the record in b (exactly l bytes)
+ *
+ * @return 0 ok, -1 malformed, unknown identity scheme or bad signature
+ */
+int rlpx_enr_parse(rlpx_enr* enr, const uint8_t* b, uint32_t l);
+
+/**
+ * @brief Value of key (an rlp item, list or string) in a record
+ *
+ * @return 0 found, -1 absent
+ */
+int rlpx_enr_get(
+    const rlpx_enr* enr,
+    const char* key,
+    const uint8_t** val,
+    uint32_t* l);
+
+/**
+ * @brief Our record with key q ("id" and "secp256k1" set). Start seq past
+ * any record we signed before, the epoch in seconds does unless a pair
+ * changes more than once a second.
+ */
+int rlpx_enr_local_init(
+    rlpx_enr_local* ctx,
+    const uecc_public_key* q,
+    uint64_t seq);
+
+/**
+ * @brief Set a pair, val an rlp item. Changing a signed record drops its
+ * encoding and bumps seq, setting the same value does neither.
+ *
+ * @return 0 ok, -1 key or value too long, or no room
+ */
+int rlpx_enr_local_set(
+    rlpx_enr_local* ctx,
+    const char* key,
+    const uint8_t* val,
+    uint32_t l);
+int rlpx_enr_local_set_mem(
+    rlpx_enr_local* ctx,
+    const char* key,
+    const uint8_t* mem,
+    uint32_t l);
+int rlpx_enr_local_set_u32(rlpx_enr_local* ctx, const char* key, uint32_t v);
+
+/**
+ * @brief Our signed record, signed with skey (the key of init) if stale
+ *
+ * @return record, NULL too large or signing failed
+ */
+const rlpx_enr* rlpx_enr_local_sign(rlpx_enr_local* ctx, uecc_ctx* skey);
+
+static inline uint64_t
+rlpx_enr_local_seq(const rlpx_enr_local* ctx)
+{
+    return ctx->enr.seq;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
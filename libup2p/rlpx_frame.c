@@ -21,6 +21,7 @@
 
 #include "rlpx_frame.h"
 #include "rlpx_helper_macros.h"
+#include "usys_trace.h"
 
 // @brief Private methods
 
@@ -118,8 +119,10 @@ rlpx_frame_write(
     // TODO - fix rlpx.list(protocol-type[,context-id])
     head[3] = '\xc2', head[4] = '\x80' + type, head[5] = '\x80' + id;
 
+    usys_trace_begin(t);
     frame_egress(x, head, 0, out, &out[16]);
     frame_egress(x, body, len, &out[32], &out[32 + len]);
+    usys_trace_end(t, "frame_egress");
     return 0;
 }
 
@@ -174,7 +177,7 @@ frame_parse_header(
     int err = -1;
     uint8_t tmp[32];
 
-    err = frame_ingress(x, hdr, 0, &hdr[16], tmp);
+    usys_trace("frame_ingress", err = frame_ingress(x, hdr, 0, &hdr[16], tmp));
     if (err) return err;
 
     // Read in big endian length prefix, give to caller
@@ -182,7 +185,7 @@ frame_parse_header(
     READ_BE(3, body_len, tmp);
 
     // Parse header rlp, give to caller
-    *header_urlp = urlp_parse(tmp + 3, 13);
+    usys_trace("urlp_parse", *header_urlp = urlp_parse(tmp + 3, 13));
     return *header_urlp ? 0 : -1;
 }
 
@@ -191,9 +194,11 @@ frame_parse_body(rlpx_coder* x, const uint8_t* frame, uint32_t l, urlp** rlp)
 {
     int err;
     uint8_t body[(l = l % 16 ? AES_LEN(l) : l)];
-    err = frame_ingress(x, frame, l, frame + l, body);
+    usys_trace(
+        "frame_ingress", err = frame_ingress(x, frame, l, frame + l, body));
     if (err) return err;
 
+    usys_trace_begin(p);
     if (body[0] < 0xc0) {
         // Some technical debt? Early packets did not nest their body frames
         // So we nest them here and pass up stack and we'll see how that goes
@@ -206,6 +211,7 @@ frame_parse_body(rlpx_coder* x, const uint8_t* frame, uint32_t l, urlp** rlp)
         // This packet appears to be proper
         *rlp = urlp_parse(body, l);
     }
+    usys_trace_end(p, "urlp_parse");
     return *rlp ? 0 : -1;
 }
 
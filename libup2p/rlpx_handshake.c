@@ -36,11 +36,19 @@
 #include "uecies_decrypt.h"
 #include "uecies_encrypt.h"
 #include "urand.h"
+#include "usys_trace.h"
 
 // rlp <--> cipher text
 int rlpx_encrypt(urlp* rlp, const uecc_public_key* q, uint8_t*, size_t* l);
 uint32_t rlpx_decrypt(uecc_ctx* ctx, const uint8_t*, size_t l, urlp** rlp);
 
+// Handshake contexts only live until secrets are extracted so recycle them
+rlpx_thread_local rlpx_slab g_rlpx_handshake_slab = RLPX_SLAB_INIT(
+    "handshake",
+    sizeof(rlpx_handshake),
+    RLPX_CONFIG_SLAB_HANDSHAKE_N,
+    RLPX_CONFIG_SLAB_HANDSHAKE_LIMIT);
+
 int rlpx_handshake_auth_recv_legacy(
     rlpx_handshake* hs,
     const uint8_t* b,
@@ -80,7 +88,9 @@ rlpx_encrypt(urlp* rlp, const uecc_public_key* q, uint8_t* p, size_t* l)
     *l = sz;
     if (urlp_print(rlp, plain, &rlpsz)) return -1;
     urand(&plain[rlpsz], padsz);
-    err = uecies_encrypt(q, p, 2, plain, padsz + rlpsz, &p[2]);
+    usys_trace(
+        "uecies_encrypt",
+        err = uecies_encrypt(q, p, 2, plain, padsz + rlpsz, &p[2]));
     return err;
 }
 
@@ -98,8 +108,13 @@ rlpx_decrypt(uecc_ctx* ecc, const uint8_t* c, size_t l, urlp** rlp_p)
     if (l < sz) return 0;
 
     // Decrypt and parse rlp returns 0 on err, cipher_len on OK
-    int err = uecies_decrypt(ecc, c, 2, &c[2], sz - 2, buffer);
-    return ((err > 0) && (*rlp_p = urlp_parse(buffer, err))) ? sz : 0;
+    int err;
+    usys_trace(
+        "uecies_decrypt",
+        err = uecies_decrypt(ecc, c, 2, &c[2], sz - 2, buffer));
+    if (!(err > 0)) return 0;
+    usys_trace("urlp_parse", *rlp_p = urlp_parse(buffer, err));
+    return *rlp_p ? sz : 0;
 }
 
 rlpx_handshake*
@@ -110,7 +125,7 @@ rlpx_handshake_alloc(
     h256* nonce,
     const uecc_public_key* to)
 {
-    rlpx_handshake* hs = rlpx_malloc(sizeof(rlpx_handshake));
+    rlpx_handshake* hs = rlpx_slab_alloc(&g_rlpx_handshake_slab);
     if (hs) {
         memset(hs, 0, sizeof(rlpx_handshake));
         hs->cipher_len = sizeof(hs->cipher);
@@ -119,9 +134,13 @@ rlpx_handshake_alloc(
         hs->skey = skey;
         hs->nonce = nonce;
         if (orig) {
-            rlpx_handshake_auth_init(hs, to);
+            usys_trace(
+                "rlpx_handshake_auth_init", rlpx_handshake_auth_init(hs, to));
+        } else if (to) {
+            usys_trace(
+                "rlpx_handshake_ack_init", rlpx_handshake_ack_init(hs, to));
         } else {
-            rlpx_handshake_ack_init(hs, to);
+            hs->cipher_len = 0; // Inbound, ack is written once auth names peer
         }
     }
     return hs;
@@ -133,7 +152,19 @@ rlpx_handshake_free(rlpx_handshake** hs_p)
     rlpx_handshake* hs = *hs_p;
     *hs_p = NULL;
     memset(hs, 0, sizeof(rlpx_handshake));
-    rlpx_free(hs);
+    rlpx_slab_free(&g_rlpx_handshake_slab, hs);
+}
+
+const rlpx_slab_stats*
+rlpx_handshake_slab_stats()
+{
+    return rlpx_slab_stats_get(&g_rlpx_handshake_slab);
+}
+
+void
+rlpx_handshake_slab_deinit()
+{
+    rlpx_slab_deinit(&g_rlpx_handshake_slab);
 }
 
 int
@@ -150,7 +181,8 @@ rlpx_handshake_secrets(
     uint8_t *sent = hs->cipher, *recv = hs->cipher_remote;
     uint32_t slen = hs->cipher_len, rlen = hs->cipher_remote_len;
     uint8_t buf[32 + ((slen > rlen) ? slen : rlen)], *out = &buf[32];
-    if ((err = uecc_agree(hs->ekey, &hs->ekey_remote))) return err;
+    usys_trace("uecc_agree", err = uecc_agree(hs->ekey, &hs->ekey_remote));
+    if (err) return err;
     memcpy(buf, orig ? hs->nonce_remote.b : hs->nonce->b, 32);
     memcpy(out, orig ? hs->nonce->b : hs->nonce_remote.b, 32);
 
@@ -188,11 +220,13 @@ rlpx_handshake_auth_init(rlpx_handshake* hs, const uecc_public_key* to)
     uecc_shared_secret x;
     uecc_signature sig;
     urlp* rlp;
-    if (uecc_agree(hs->skey, to)) return -1;
+    usys_trace("uecc_agree", err = uecc_agree(hs->skey, to));
+    if (err) return -1;
     for (int i = 0; i < 32; i++) {
         x.b[i] = hs->skey->z.b[i + 1] ^ hs->nonce->b[i];
     }
-    if (uecc_sign(hs->ekey, x.b, 32, &sig)) return -1;
+    usys_trace("uecc_sign", err = uecc_sign(hs->ekey, x.b, 32, &sig));
+    if (err) return -1;
     uecc_sig_to_bin(&sig, rawsig);
     uecc_qtob(&hs->skey->Q, rawpub, 65);
     if ((rlp = urlp_list())) {
@@ -250,14 +284,17 @@ rlpx_handshake_auth_install(rlpx_handshake* hs, urlp** rlp_p)
         buffer[0] = 0x04;
         memcpy(&buffer[1], urlp_ref(seek, NULL), urlp_size(seek));
         uecc_btoq(buffer, 65, &hs->skey_remote);
-        uecc_agree(hs->skey, &hs->skey_remote);
+        usys_trace("uecc_agree", uecc_agree(hs->skey, &hs->skey_remote));
     }
     if ((seek = urlp_at(rlp, 0)) &&
         // Get remote ephemeral public key from signature
         urlp_size(seek) == sizeof(uecc_signature)) {
         uecc_shared_secret x;
         XOR32_SET(x.b, (&hs->skey->z.b[1]), hs->nonce_remote.b);
-        err = uecc_recover_bin(urlp_ref(seek, NULL), x.b, &hs->ekey_remote);
+        usys_trace(
+            "uecc_recover_bin",
+            err = uecc_recover_bin(
+                urlp_ref(seek, NULL), x.b, &hs->ekey_remote));
     }
     // urlp_free(&rlp);
     return err;
@@ -289,7 +326,10 @@ rlpx_handshake_auth_recv_legacy(
     int err = -1;
     uint8_t b[194];
     if (!(l == 307)) return err;
-    if (!(uecies_decrypt(hs->skey, NULL, 0, auth, l, b) == 194)) return err;
+    usys_trace(
+        "uecies_decrypt",
+        err = uecies_decrypt(hs->skey, NULL, 0, auth, l, b));
+    if (!(err == 194)) return -1;
     if (!(*rlp_p = urlp_list())) return err;
     urlp_push(*rlp_p, urlp_item_u8_arr(b, 65));                // signature
     urlp_push(*rlp_p, urlp_item_u8_arr(&b[65 + 32], 64));      // pubkey
@@ -344,8 +384,11 @@ rlpx_handshake_ack_recv_legacy(
 {
     int err = -1;
     uint8_t b[194];
-    if (!(uecies_decrypt(hs->skey, NULL, 0, ack, l, b) > 0)) return err;
-    if (!(*rlp_p = urlp_list())) return err;
+    usys_trace(
+        "uecies_decrypt",
+        err = uecies_decrypt(hs->skey, NULL, 0, ack, l, b));
+    if (!(err > 0)) return -1;
+    if (!(*rlp_p = urlp_list())) return -1;
     urlp_push(*rlp_p, urlp_item_u8_arr(b, 64));      // pubkey
     urlp_push(*rlp_p, urlp_item_u8_arr(&b[64], 32)); // nonce
     urlp_push(*rlp_p, urlp_item_u64(4));             // ver
@@ -33,6 +33,7 @@ extern "C" {
 #endif
 
 #include "rlpx_config.h"
+#include "rlpx_slab.h"
 #include "uaes.h"
 #include "uecc.h"
 #include "ukeccak256.h"
@@ -65,6 +66,10 @@ rlpx_handshake* rlpx_handshake_alloc(
     const uecc_public_key* to);
 void rlpx_handshake_free(rlpx_handshake** hs_p);
 
+// Handshake pool usage (calling thread)
+const rlpx_slab_stats* rlpx_handshake_slab_stats();
+void rlpx_handshake_slab_deinit();
+
 /**
  * @brief - extract secrets from the handshake cipher texts and nonces
  *
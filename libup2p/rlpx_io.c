@@ -23,6 +23,7 @@
 #include "unonce.h"
 #include "usys_log.h"
 #include "usys_time.h"
+#include "usys_trace.h"
 
 // Private io callbacks
 int rlpx_io_on_accept(void* ctx);
@@ -34,12 +35,31 @@ int rlpx_io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
 int rlpx_io_on_recv_auth(void* ctx, int err, uint8_t* b, uint32_t l);
 int rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l);
 
+// Private send queue
+int rlpx_io_commit(rlpx_io* ch, uint32_t len);
+int rlpx_io_queue(rlpx_io* ch, uint32_t len);
+int rlpx_io_send_cipher(rlpx_io* ch, const uint8_t* b, uint32_t l);
+
+// Private timer
+void rlpx_io_on_timer(void* ctx);
+void rlpx_io_arm(rlpx_io* ch, uint32_t ms);
+void rlpx_io_redial(rlpx_io* ch);
+void rlpx_io_drop(rlpx_io* ch);
+void rlpx_io_link(rlpx_io* ch, int up);
+
 // Private protocol callbacks
 int rlpx_io_on_hello(void* ctx, const urlp* rlp);
 int rlpx_io_on_disconnect(void* ctx, const urlp* rlp);
 int rlpx_io_on_ping(void* ctx, const urlp* rlp);
 int rlpx_io_on_pong(void* ctx, const urlp* rlp);
 
+// Session pool
+rlpx_thread_local rlpx_slab g_rlpx_io_slab = RLPX_SLAB_INIT(
+    "io",
+    sizeof(rlpx_io),
+    RLPX_CONFIG_SLAB_IO_N,
+    RLPX_CONFIG_SLAB_IO_LIMIT);
+
 // IO callback handlers
 async_io_settings g_rlpx_io_io_settings = { //
     .on_accept = rlpx_io_on_accept,
@@ -60,7 +80,7 @@ rlpx_devp2p_protocol_settings g_devp2p_settings = { //
 rlpx_io*
 rlpx_io_alloc(uecc_ctx* skey, const uint32_t* listen)
 {
-    rlpx_io* ch = rlpx_malloc(sizeof(rlpx_io));
+    rlpx_io* ch = rlpx_slab_alloc(&g_rlpx_io_slab);
     if (ch) {
         rlpx_io_init(ch, skey, listen);
     }
@@ -73,7 +93,19 @@ rlpx_io_free(rlpx_io** ch_p)
     rlpx_io* ch = *ch_p;
     *ch_p = NULL;
     rlpx_io_deinit(ch);
-    rlpx_free(ch);
+    rlpx_slab_free(&g_rlpx_io_slab, ch);
+}
+
+const rlpx_slab_stats*
+rlpx_io_slab_stats()
+{
+    return rlpx_slab_stats_get(&g_rlpx_io_slab);
+}
+
+void
+rlpx_io_slab_deinit()
+{
+    rlpx_slab_deinit(&g_rlpx_io_slab);
 }
 
 int
@@ -86,10 +118,11 @@ rlpx_io_init(rlpx_io* ch, uecc_ctx* s, const uint32_t* listen)
     ch->skey = s;
 
     // Create random epheremeral key
-    uecc_key_init_new(&ch->ekey);
+    usys_trace("uecc_key_init_new", uecc_key_init_new(&ch->ekey));
 
     // Install network io handler
     async_io_init(&ch->io, ch, &g_rlpx_io_io_settings);
+    async_timer_init(&ch->timer, rlpx_io_on_timer, ch);
 
     // update info
     ch->listen_port = listen;
@@ -105,6 +138,8 @@ rlpx_io_init(rlpx_io* ch, uecc_ctx* s, const uint32_t* listen)
 void
 rlpx_io_deinit(rlpx_io* ch)
 {
+    async_timer_stop(&ch->timer);
+    async_io_deinit(&ch->io);
     uecc_key_deinit(&ch->ekey);
     rlpx_devp2p_protocol_deinit(&ch->devp2p);
     if (ch->hs) rlpx_handshake_free(&ch->hs);
@@ -122,6 +157,12 @@ rlpx_io_poll(rlpx_io** ch, uint32_t count, uint32_t ms)
     return async_io_poll_n((async_io**)ch, count, ms);
 }
 
+int
+rlpx_io_attach(rlpx_io* ch, async_loop* loop)
+{
+    return async_loop_add(loop, &ch->io);
+}
+
 int
 rlpx_io_connect(
     rlpx_io* ch,
@@ -151,26 +192,48 @@ rlpx_io_connect_enode(rlpx_io* ch, const char* enode)
 int
 rlpx_io_connect_node(rlpx_io* ch, const rlpx_node* n)
 {
+    int err;
     ch->node = *n;
-    return async_io_connect(&ch->io, n->ip_v4, n->port_tcp) < 0 ? -1 : 0;
+    ch->ready = ch->shutdown = ch->leaving = 0;
+    ch->started = usys_now_cached_ns(); // callers need not be on the loop
+    async_io_set_cb_send(&ch->io, rlpx_io_on_send); // a new stream
+    rlpx_io_arm(ch, RLPX_CONFIG_HANDSHAKE_MS);
+    err = async_io_connect(&ch->io, n->ip_v4, n->port_tcp) < 0 ? -1 : 0;
+    rlpx_io_link(ch, rlpx_io_is_connected(ch));
+    return err;
 }
 
 int
-rlpx_io_accept(rlpx_io* ch, const uecc_public_key* from)
+rlpx_io_accept(rlpx_io* ch, usys_socket_fd sock, const uecc_public_key* from)
 {
-    // TODO - this is a stub.
+    // Inbound socket, the initiator speaks first (auth)
     if (ch->hs) rlpx_handshake_free(&ch->hs);
+    ch->ready = ch->shutdown = ch->refuse = ch->leaving = 0;
+    ch->started = usys_now_cached_ns();
+    async_io_set_cb_send(&ch->io, rlpx_io_on_send);
+    async_io_open(&ch->io, sock);
+    rlpx_io_link(ch, 1);
+    rlpx_io_arm(ch, RLPX_CONFIG_HANDSHAKE_MS);
+    async_io_set_cb_recv(&ch->io, rlpx_io_on_recv_auth);
+    if (!from) return 0;
+
+    // Remote already known, our ack can go out now
     ch->node.id = *from;
     ch->hs = rlpx_handshake_alloc(0, ch->skey, &ch->ekey, &ch->nonce, from);
     if (ch->hs) {
-        ch->io.sock = 3;
-        async_io_memcpy(&ch->io, 0, ch->hs->cipher, ch->hs->cipher_len);
-        return async_io_send(&ch->io);
+        return rlpx_io_send_cipher(ch, ch->hs->cipher, ch->hs->cipher_len);
     } else {
         return -1;
     }
 }
 
+void
+rlpx_io_refuse(rlpx_io* ch, RLPX_DEVP2P_DISCONNECT_REASON reason)
+{
+    ch->refuse = 1;
+    ch->reason = reason;
+}
+
 int
 rlpx_io_send_auth(rlpx_io* ch)
 {
@@ -181,8 +244,7 @@ rlpx_io_send_auth(rlpx_io* ch)
     if (ch->hs) {
         usys_log("[OUT] (auth) size: %d", ch->hs->cipher_len);
         async_io_set_cb_recv(&ch->io, rlpx_io_on_recv_ack);
-        async_io_memcpy(&ch->io, 0, ch->hs->cipher, ch->hs->cipher_len);
-        return async_io_send(&ch->io);
+        return rlpx_io_send_cipher(ch, ch->hs->cipher, ch->hs->cipher_len);
     } else {
         return -1;
     }
@@ -192,14 +254,17 @@ int
 rlpx_io_send_hello(rlpx_io* ch)
 {
     int err;
+    uint32_t l;
+    uint8_t* b = async_io_tx_reserve(&ch->io, &l);
+    if (!b) return -1;
     async_io_set_cb_recv(&ch->io, rlpx_io_on_recv);
-    ch->io.len = sizeof(ch->io.b);
     err = rlpx_devp2p_protocol_write_hello(
-        &ch->x, *ch->listen_port, &ch->node_id[1], ch->io.b, &ch->io.len);
+        &ch->x, *ch->listen_port, &ch->node_id[1], b, &l);
     if (!err) {
-        usys_log("[OUT] (hello) size: %d", ch->io.len);
-        return async_io_send(&ch->io);
+        usys_log("[OUT] (hello) size: %d", l);
+        return rlpx_io_commit(ch, l);
     } else {
+        rlpx_io_commit(ch, 0);
         return err;
     }
 }
@@ -208,14 +273,17 @@ int
 rlpx_io_send_disconnect(rlpx_io* ch, RLPX_DEVP2P_DISCONNECT_REASON reason)
 {
     int err;
-    ch->io.len = sizeof(ch->io.b);
-    err = rlpx_devp2p_protocol_write_disconnect(
-        &ch->x, reason, ch->io.b, &ch->io.len);
+    uint32_t l;
+    uint8_t* b = async_io_tx_reserve(&ch->io, &l);
+    if (!b) return -1;
+    err = rlpx_devp2p_protocol_write_disconnect(&ch->x, reason, b, &l);
     if (!err) {
-        usys_log("[OUT] (disconnect) size: %d", ch->io.len);
+        usys_log("[OUT] (disconnect) size: %d", l);
+        ch->leaving = 1;
         async_io_set_cb_send(&ch->io, rlpx_io_on_send_shutdown);
-        return async_io_send(&ch->io);
+        return rlpx_io_commit(ch, l);
     } else {
+        rlpx_io_commit(ch, 0);
         return err;
     }
 }
@@ -224,13 +292,16 @@ int
 rlpx_io_send_ping(rlpx_io* ch)
 {
     int err;
-    ch->io.len = sizeof(ch->io.b);
-    err = rlpx_devp2p_protocol_write_ping(&ch->x, ch->io.b, &ch->io.len);
+    uint32_t l;
+    uint8_t* b = async_io_tx_reserve(&ch->io, &l);
+    if (!b) return -1;
+    err = rlpx_devp2p_protocol_write_ping(&ch->x, b, &l);
     if (!err) {
-        ch->devp2p.ping = usys_now();
-        usys_log("[OUT] (ping) size: %d", ch->io.len);
-        return async_io_send(&ch->io);
+        ch->devp2p.ping = usys_now_cached_ns(); // pong reads it too
+        usys_log("[OUT] (ping) size: %d", l);
+        return rlpx_io_commit(ch, l);
     } else {
+        rlpx_io_commit(ch, 0);
         return err;
     }
 }
@@ -239,16 +310,130 @@ int
 rlpx_io_send_pong(rlpx_io* ch)
 {
     int err;
-    ch->io.len = sizeof(ch->io.b);
-    err = rlpx_devp2p_protocol_write_pong(&ch->x, ch->io.b, &ch->io.len);
+    uint32_t l;
+    uint8_t* b = async_io_tx_reserve(&ch->io, &l);
+    if (!b) return -1;
+    err = rlpx_devp2p_protocol_write_pong(&ch->x, b, &l);
     if (!err) {
-        usys_log("[OUT] (pong) size: %d", ch->io.len);
-        return async_io_send(&ch->io);
+        usys_log("[OUT] (pong) size: %d", l);
+        return rlpx_io_commit(ch, l);
     } else {
+        rlpx_io_commit(ch, 0);
         return err;
     }
 }
 
+int
+rlpx_io_commit(rlpx_io* ch, uint32_t len)
+{
+    if (len) rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_FRAMES_OUT, 1);
+    return rlpx_io_queue(ch, len);
+}
+
+int
+rlpx_io_queue(rlpx_io* ch, uint32_t len)
+{
+    // Peer isn't reading, drop it rather than buffer without bound
+    if (async_io_tx_commit(&ch->io, len) < 0) {
+        usys_log_err("[ERR] socket %d (send queue)", ch->io.sock);
+        rlpx_metrics_add(RLPX_METRIC_TX_OVERFLOWS, 1);
+        rlpx_io_drop(ch);
+        return -1;
+    }
+    rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_BYTES_OUT, len);
+    return 0;
+}
+
+int
+rlpx_io_send_cipher(rlpx_io* ch, const uint8_t* b, uint32_t l)
+{
+    uint32_t cap;
+    uint8_t* mem = async_io_tx_reserve(&ch->io, &cap);
+    if (!mem) return -1;
+    if (l > cap) {
+        async_io_tx_commit(&ch->io, 0);
+        return -1;
+    }
+    memcpy(mem, b, l);
+    return rlpx_io_queue(ch, l);
+}
+
+void
+rlpx_io_arm(rlpx_io* ch, uint32_t ms)
+{
+    // Only peers driven by a loop keep time
+    if (ch->io.loop) async_loop_timer(ch->io.loop, &ch->timer, ms);
+}
+
+void
+rlpx_io_redial(rlpx_io* ch)
+{
+    ch->ready = 0;
+
+    // Inbound peers have no port to dial, and we don't call back a peer we
+    // hung up on
+    if (!ch->node.port_tcp || ch->shutdown || ch->leaving) {
+        async_timer_stop(&ch->timer);
+        rlpx_io_link(ch, 0);
+        return;
+    }
+
+    // A transient peer that failed its redial is done, the owner frees it
+    if (ch->transient && ch->backoff) {
+        ch->shutdown = 1;
+        async_timer_stop(&ch->timer);
+        rlpx_io_link(ch, 0);
+        return;
+    }
+    ch->backoff = ch->backoff ? ch->backoff * 2 : RLPX_CONFIG_REDIAL_MIN_MS;
+    if (ch->backoff > RLPX_CONFIG_REDIAL_MAX_MS) {
+        ch->backoff = RLPX_CONFIG_REDIAL_MAX_MS;
+    }
+    rlpx_io_arm(ch, ch->backoff);
+    rlpx_io_link(ch, 0);
+}
+
+void
+rlpx_io_drop(rlpx_io* ch)
+{
+    ch->shutdown = 1;
+    async_timer_stop(&ch->timer);
+    async_io_close(&ch->io);
+    rlpx_io_link(ch, 0);
+}
+
+void
+rlpx_io_link(rlpx_io* ch, int up)
+{
+    if (ch->on_link) ch->on_link(ch->link_ctx, ch->slot, up);
+}
+
+void
+rlpx_io_on_timer(void* ctx)
+{
+    rlpx_io* ch = ctx;
+    if (!rlpx_io_is_connected(ch)) {
+        // Backoff elapsed
+        rlpx_io_nonce(ch);
+        rlpx_io_connect_node(ch, &ch->node);
+    } else if (!ch->ready) {
+        usys_log_err("[ERR] socket %d (handshake timeout)", ch->io.sock);
+        rlpx_metrics_add(RLPX_METRIC_FAIL_TIMEOUT, 1);
+        async_io_close(&ch->io);
+        rlpx_io_redial(ch);
+    } else if (ch->pinged) {
+        usys_log_err("[ERR] socket %d (ping timeout)", ch->io.sock);
+        rlpx_metrics_add(RLPX_METRIC_PING_TIMEOUTS, 1);
+        async_io_close(&ch->io);
+        rlpx_io_redial(ch);
+    } else {
+        // Re-arm first, a refused ping drops the peer and stops the timer
+        ch->pinged = 1;
+        rlpx_io_arm(ch, RLPX_CONFIG_PING_MS);
+        if (rlpx_io_is_writable(ch)) rlpx_io_send_ping(ch);
+    }
+}
+
 int
 rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l)
 {
@@ -257,9 +442,11 @@ rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l)
     urlp* rlp = NULL;
     rlpx_protocol* p;
     while ((l) && (!err)) {
-        sz = rlpx_frame_parse(&ch->x, d, l, &rlp);
+        usys_trace(
+            "rlpx_frame_parse", sz = rlpx_frame_parse(&ch->x, d, l, &rlp));
         if (sz > 0) {
             if (sz <= l) {
+                rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_FRAMES_IN, 1);
                 type = rlpx_frame_header_type(rlp);
                 p = (type >= 0 && type < 2) ? ch->protocols[type] : NULL;
                 err = p ? p->recv(p, rlpx_frame_body(rlp)) : -1;
@@ -270,6 +457,7 @@ rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l)
             }
             urlp_free(&rlp);
         } else {
+            rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_MAC_FAILS, 1);
             err = -1;
         }
     }
@@ -283,18 +471,34 @@ rlpx_io_recv_auth(rlpx_io* ch, const uint8_t* b, size_t l)
     urlp* rlp = NULL;
 
     // Decrypt authentication packet (allocates rlp context)
-    if ((err = rlpx_handshake_auth_recv(ch->hs, b, l, &rlp))) return err;
+    usys_trace(
+        "rlpx_handshake_auth_recv",
+        err = rlpx_handshake_auth_recv(ch->hs, b, l, &rlp));
+    if (err) return err;
 
     // Process the Decrypted RLP data
-    if (!(err = rlpx_handshake_auth_install(ch->hs, &rlp))) {
-        err = rlpx_handshake_secrets(
-            ch->hs,
-            0,
-            &ch->x.emac,
-            &ch->x.imac,
-            &ch->x.aes_enc,
-            &ch->x.aes_dec,
-            &ch->x.aes_mac);
+    usys_trace(
+        "rlpx_handshake_auth_install",
+        err = rlpx_handshake_auth_install(ch->hs, &rlp));
+    if (!err && !ch->hs->cipher_len) {
+        // Inbound peer named itself, ack is part of the secrets
+        ch->node.id = ch->hs->skey_remote;
+        ch->hs->cipher_len = sizeof(ch->hs->cipher);
+        usys_trace(
+            "rlpx_handshake_ack_init",
+            err = rlpx_handshake_ack_init(ch->hs, &ch->hs->skey_remote));
+    }
+    if (!err) {
+        usys_trace(
+            "rlpx_handshake_secrets",
+            err = rlpx_handshake_secrets(
+                ch->hs,
+                0,
+                &ch->x.emac,
+                &ch->x.imac,
+                &ch->x.aes_enc,
+                &ch->x.aes_dec,
+                &ch->x.aes_mac));
     }
 
     // Free rlp and return
@@ -309,18 +513,26 @@ rlpx_io_recv_ack(rlpx_io* ch, const uint8_t* ack, size_t l)
     urlp* rlp = NULL;
 
     // Decrypt authentication packet
-    if ((err = rlpx_handshake_ack_recv(ch->hs, ack, l, &rlp))) return err;
+    usys_trace(
+        "rlpx_handshake_ack_recv",
+        err = rlpx_handshake_ack_recv(ch->hs, ack, l, &rlp));
+    if (err) return err;
 
     // Process the Decrypted RLP data
-    if (!(err = rlpx_handshake_ack_install(ch->hs, &rlp))) {
-        err = rlpx_handshake_secrets(
-            ch->hs,
-            1,
-            &ch->x.emac,
-            &ch->x.imac,
-            &ch->x.aes_enc,
-            &ch->x.aes_dec,
-            &ch->x.aes_mac);
+    usys_trace(
+        "rlpx_handshake_ack_install",
+        err = rlpx_handshake_ack_install(ch->hs, &rlp));
+    if (!err) {
+        usys_trace(
+            "rlpx_handshake_secrets",
+            err = rlpx_handshake_secrets(
+                ch->hs,
+                1,
+                &ch->x.emac,
+                &ch->x.imac,
+                &ch->x.aes_enc,
+                &ch->x.aes_dec,
+                &ch->x.aes_mac));
     }
 
     // Free rlp and return
@@ -348,6 +560,7 @@ rlpx_io_on_erro(void* ctx)
 {
     rlpx_io* ch = (rlpx_io*)ctx;
     usys_log_err("[ERR] %d", ch->io.sock);
+    rlpx_io_redial(ch);
     return 0;
 }
 
@@ -371,8 +584,7 @@ rlpx_io_on_send_shutdown(void* ctx, int err, const uint8_t* b, uint32_t l)
     rlpx_io* ch = (rlpx_io*)ctx;
     ((void)b);
     ((void)l);
-    ch->shutdown = 1;
-    async_io_close(&ch->io);
+    rlpx_io_drop(ch);
     return err;
 }
 
@@ -381,6 +593,7 @@ rlpx_io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
 {
     rlpx_io* ch = (rlpx_io*)ctx;
     if (!err) {
+        rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_BYTES_IN, l);
         return rlpx_io_recv(ch, b, l);
     } else {
         usys_log_err("[ERR] socket: %d", ch->io.sock);
@@ -392,9 +605,40 @@ int
 rlpx_io_on_recv_auth(void* ctx, int err, uint8_t* b, uint32_t l)
 {
     rlpx_io* ch = (rlpx_io*)ctx;
+    uint32_t idx = 0, sz;
     if (!err) {
         usys_log("[ IN] (auth) size: %d", l);
-        return rlpx_io_recv_auth(ch, b, l);
+        rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_BYTES_IN, l);
+        if (!ch->hs) {
+            ch->hs =
+                rlpx_handshake_alloc(0, ch->skey, &ch->ekey, &ch->nonce, NULL);
+            if (!ch->hs) return -1;
+        }
+        if (!(ch->hs->cipher_len)) idx = 1; // ack not sent yet
+        if ((err = rlpx_io_recv_auth(ch, b, l))) {
+            usys_log_err("[ERR] socket %d (auth)", ch->io.sock);
+            rlpx_metrics_add(RLPX_METRIC_FAIL_AUTH, 1);
+            return err;
+        }
+
+        // Secrets installed, ack (if not sent) and hello or disconnect are
+        // queued back to back and the handshake returns to pool
+        sz = ch->hs->cipher_remote_len ? ch->hs->cipher_remote_len : l;
+        if (idx) {
+            err = rlpx_io_send_cipher(ch, ch->hs->cipher, ch->hs->cipher_len);
+        }
+        rlpx_handshake_free(&ch->hs);
+        if (err) return err;
+        if (ch->refuse) return rlpx_io_send_disconnect(ch, ch->reason);
+        if ((err = rlpx_io_send_hello(ch))) return err;
+
+        // Frames the remote sent right behind its auth came in this read
+        // (a legacy auth is only accepted as the whole read)
+        if (l > sz && rlpx_io_recv(ch, &b[sz], l - sz)) {
+            usys_log_err("[ERR] socket %d (auth)", ch->io.sock);
+            return -1;
+        }
+        return 0;
     } else {
         return err;
     }
@@ -405,12 +649,15 @@ rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l)
 {
     rlpx_io* ch = (rlpx_io*)ctx;
     if (!err) {
+        rlpx_metrics_io_add(&ch->metrics, RLPX_METRIC_BYTES_IN, l);
         if (!rlpx_io_recv_ack(ch, b, l)) {
-            // TODO Free handshake?
-            l -= ch->hs->cipher_remote_len;
-            usys_log("[ IN] (ack) size: %d", ch->hs->cipher_remote_len);
+            // Secrets installed, return handshake to pool
+            uint32_t sz = ch->hs->cipher_remote_len;
+            rlpx_handshake_free(&ch->hs);
+            l -= sz;
+            usys_log("[ IN] (ack) size: %d", sz);
             if (l) {
-                if (rlpx_io_recv(ch, &b[ch->hs->cipher_remote_len], l)) {
+                if (rlpx_io_recv(ch, &b[sz], l)) {
                     usys_log_err("[ERR] %d", ch->io.sock);
                 }
             }
@@ -418,6 +665,7 @@ rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l)
             return rlpx_io_send_hello(ch);
         } else {
             usys_log_err("[ERR] socket %d (ack)", ch->io.sock);
+            rlpx_metrics_add(RLPX_METRIC_FAIL_ACK, 1);
             return -1;
         }
     } else {
@@ -454,12 +702,20 @@ rlpx_io_on_hello(void* ctx, const urlp* rlp)
         (l == 64) &&                                  //
         (!uecc_qtob(&ch->node.id, pub_expect, 65)) && //
         (!(memcmp(pub, &pub_expect[1], 64)))) {
+        // Handshake done, the timer keeps the session alive from here
         ch->ready = 1;
+        ch->backoff = 0;
+        ch->pinged = 0;
+        rlpx_io_arm(ch, RLPX_CONFIG_PING_MS);
+        rlpx_metrics_add(RLPX_METRIC_HANDSHAKES, 1);
+        rlpx_metrics_observe(
+            RLPX_METRIC_HIST_HANDSHAKE,
+            (uint32_t)((usys_now_cached_ns() - ch->started) / 1000));
     } else {
         // Bad public key...
         usys_log_err("[ERR] Invalid \"hello\" - bad public key");
-        ch->shutdown = 1;
-        async_io_close(&ch->io);
+        rlpx_metrics_add(RLPX_METRIC_FAIL_HELLO, 1);
+        rlpx_io_drop(ch);
     }
 
     return 0;
@@ -490,8 +746,12 @@ rlpx_io_on_pong(void* ctx, const urlp* rlp)
 {
     ((void)rlp);
     rlpx_io* ch = ctx;
+    uint64_t now = usys_now_cached_ns();
     usys_log("[ IN] (pong)");
-    ch->devp2p.latency = usys_now() - ch->devp2p.ping;
+    ch->devp2p.latency =
+        now > ch->devp2p.ping ? (now - ch->devp2p.ping) / 1000 : 0;
+    ch->pinged = 0;
+    rlpx_metrics_observe(RLPX_METRIC_HIST_LATENCY, ch->devp2p.latency);
     return 0;
 }
 
@@ -32,10 +32,16 @@ extern "C" {
 #endif
 
 #include "async_io.h"
+#include "async_loop.h"
 #include "rlpx_config.h"
 #include "rlpx_devp2p.h"
 #include "rlpx_handshake.h"
+#include "rlpx_metrics.h"
 #include "rlpx_node.h"
+#include "rlpx_slab.h"
+
+// Socket opened (up) or closed with the redial decided, by slot
+typedef void (*rlpx_io_link_fn)(void* ctx, uint32_t slot, int up);
 
 typedef struct
 {
@@ -50,8 +56,20 @@ typedef struct
     rlpx_handshake* hs;          /*!< temp context during handshake process */
     int ready;                   /*!< handshake complete */
     int shutdown;                /*!< shutting down */
+    int refuse;                  /*!< disconnect after handshake (inbound) */
+    RLPX_DEVP2P_DISCONNECT_REASON reason; /*!< why we refuse */
     uint8_t node_id[65];         /*!< node id */
     const uint32_t* listen_port; /*!< our listen port */
+    uint32_t slot;               /*!< index in peer table */
+    rlpx_io_link_fn on_link;     /*!< socket opened or closed (optional) */
+    void* link_ctx;              /*!< on_link context (peer table) */
+    async_timer timer;           /*!< handshake, keepalive or redial */
+    uint32_t backoff;            /*!< last redial delay (ms) */
+    int pinged;                  /*!< keepalive ping not answered yet */
+    int leaving;                 /*!< we sent disconnect, don't redial */
+    int transient;               /*!< redial once, then give up */
+    uint64_t started;            /*!< connect or accept (ns) */
+    rlpx_io_metrics metrics;     /*!< bytes, frames (rlpx_metrics.h) */
 } rlpx_io;
 
 // constructors
@@ -62,9 +80,15 @@ int rlpx_io_init(rlpx_io*, uecc_ctx*, const uint32_t*);
 int rlpx_io_mock_init(rlpx_io*, async_io_settings*, uecc_ctx*, const uint32_t*);
 void rlpx_io_deinit(rlpx_io* session);
 
+// session pool (one per thread)
+extern rlpx_thread_local rlpx_slab g_rlpx_io_slab;
+const rlpx_slab_stats* rlpx_io_slab_stats();
+void rlpx_io_slab_deinit();
+
 // methods
 void rlpx_io_nonce(rlpx_io* ch);
 int rlpx_io_poll(rlpx_io** ch, uint32_t count, uint32_t ms);
+int rlpx_io_attach(rlpx_io* ch, async_loop* loop);
 int rlpx_io_connect(
     rlpx_io* ch,
     const uecc_public_key* to,
@@ -72,7 +96,11 @@ int rlpx_io_connect(
     uint32_t tcp);
 int rlpx_io_connect_enode(rlpx_io* ch, const char* enode);
 int rlpx_io_connect_node(rlpx_io* ch, const rlpx_node* node);
-int rlpx_io_accept(rlpx_io* ch, const uecc_public_key* from);
+int rlpx_io_accept(
+    rlpx_io* ch,
+    usys_socket_fd sock,
+    const uecc_public_key* from);
+void rlpx_io_refuse(rlpx_io* ch, RLPX_DEVP2P_DISCONNECT_REASON reason);
 int rlpx_io_send_auth(rlpx_io* ch);
 int rlpx_io_send_hello(rlpx_io* ch);
 int rlpx_io_send_disconnect(rlpx_io* ch, RLPX_DEVP2P_DISCONNECT_REASON);
@@ -100,6 +128,14 @@ rlpx_io_is_shutdown(rlpx_io* ch)
     return ch->shutdown;
 }
 
+// False while the peer has more than ASYNC_IO_TX_HWM bytes of ours to read.
+// Frames past ASYNC_IO_TX_MAX are refused and the peer is dropped.
+static inline int
+rlpx_io_is_writable(rlpx_io* ch)
+{
+    return !async_io_tx_full(&ch->io);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,7 +24,7 @@
 rlpx_io*
 rlpx_io_mock_alloc(async_io_settings* s, uecc_ctx* skey, const uint32_t* listen)
 {
-    rlpx_io* ch = rlpx_malloc(sizeof(rlpx_io));
+    rlpx_io* ch = rlpx_slab_alloc(&g_rlpx_io_slab);
     if (ch) rlpx_io_mock_init(ch, s, skey, listen);
     return ch;
 }
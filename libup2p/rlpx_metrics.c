@@ -0,0 +1,139 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_metrics.h"
+
+// Export names, consecutive entries of one family share its HELP and TYPE
+typedef struct
+{
+    const char* name;
+    const char* labels;
+    const char* help;
+} rlpx_metrics_name;
+
+// clang-format off
+rlpx_metrics_name g_rlpx_metrics_names[RLPX_METRIC_COUNT] = {
+    { "rlpx_bytes_in_total", NULL, "Bytes read from peers" },
+    { "rlpx_bytes_out_total", NULL, "Bytes queued to peers" },
+    { "rlpx_frames_in_total", NULL, "Frames read from peers" },
+    { "rlpx_frames_out_total", NULL, "Frames queued to peers" },
+    { "rlpx_mac_failures_total", NULL, "Frames failing mac or decode" },
+    { "rlpx_tx_overflows_total", NULL, "Peers dropped for a full send queue" },
+    { "rlpx_handshakes_total", NULL, "Handshakes completed" },
+    { "rlpx_handshake_failures_total", "phase=\"auth\"",
+      "Handshakes failed by phase" },
+    { "rlpx_handshake_failures_total", "phase=\"ack\"", NULL },
+    { "rlpx_handshake_failures_total", "phase=\"hello\"", NULL },
+    { "rlpx_handshake_failures_total", "phase=\"timeout\"", NULL },
+    { "rlpx_ping_timeouts_total", NULL, "Keepalive pings not answered" },
+    { "rlpx_discovery_packets_total", "type=\"ping\"",
+      "Discovery packets read by type" },
+    { "rlpx_discovery_packets_total", "type=\"pong\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"find\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"neighbours\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"enr_request\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"enr_response\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"invalid\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"expired\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"limited\"", NULL },
+    { "rlpx_discovery_packets_total", "type=\"unbonded\"", NULL },
+    { "rlpx_discovery_sent_total", NULL, "Discovery packets sent" },
+    { "rlpx_discv5_packets_total", "flag=\"message\"",
+      "Discovery v5 packets read by flag" },
+    { "rlpx_discv5_packets_total", "flag=\"whoareyou\"", NULL },
+    { "rlpx_discv5_packets_total", "flag=\"handshake\"", NULL },
+    { "rlpx_discv5_packets_total", "flag=\"invalid\"", NULL },
+    { "rlpx_discv5_packets_total", "flag=\"limited\"", NULL },
+    { "rlpx_discv5_sent_total", NULL, "Discovery v5 packets sent" },
+};
+rlpx_metrics_name g_rlpx_metrics_hist_names[RLPX_METRIC_HIST_COUNT] = {
+    { "rlpx_ping_latency_us", NULL, "Ping to pong" },
+    { "rlpx_handshake_us", NULL, "Connect or accept to hello" },
+};
+// clang-format on
+
+rlpx_thread_local rlpx_metrics* g_rlpx_metrics = NULL;
+rlpx_metrics* g_rlpx_metrics_all = NULL;
+
+rlpx_metrics*
+rlpx_metrics_local()
+{
+    rlpx_metrics* m = usys_malloc(sizeof(rlpx_metrics));
+    if (!m) return NULL;
+    memset(m, 0, sizeof(rlpx_metrics));
+
+    // Blocks are only ever pushed, readers walk the list without a lock
+    m->next = __atomic_load_n(&g_rlpx_metrics_all, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+        &g_rlpx_metrics_all,
+        &m->next,
+        m,
+        1,
+        __ATOMIC_RELEASE,
+        __ATOMIC_RELAXED)) {
+    }
+    return g_rlpx_metrics = m;
+}
+
+void
+rlpx_metrics_snapshot(rlpx_metrics* m)
+{
+    rlpx_metrics* b = __atomic_load_n(&g_rlpx_metrics_all, __ATOMIC_ACQUIRE);
+    uint32_t i;
+    memset(m, 0, sizeof(rlpx_metrics));
+    for (; b; b = b->next) {
+        for (i = 0; i < RLPX_METRIC_COUNT; i++) {
+            m->c[i] += usys_metrics_get(&b->c[i]);
+        }
+        for (i = 0; i < RLPX_METRIC_HIST_COUNT; i++) {
+            usys_metrics_hist_sum(&m->h[i], &b->h[i]);
+        }
+    }
+}
+
+void
+rlpx_metrics_io_snapshot(const rlpx_io_metrics* io, rlpx_io_metrics* m)
+{
+    for (uint32_t i = 0; i < RLPX_METRIC_IO; i++) {
+        m->c[i] = usys_metrics_get(&io->c[i]);
+    }
+}
+
+void
+rlpx_metrics_text(usys_metrics_text* t, const rlpx_metrics* m)
+{
+    const rlpx_metrics_name* n = g_rlpx_metrics_names;
+    uint32_t i;
+    for (i = 0; i < RLPX_METRIC_COUNT; i++) {
+        if (n[i].help) {
+            usys_metrics_text_family(t, n[i].name, "counter", n[i].help);
+        }
+        usys_metrics_text_sample(t, n[i].name, n[i].labels, m->c[i]);
+    }
+    for (i = 0; i < RLPX_METRIC_HIST_COUNT; i++) {
+        n = &g_rlpx_metrics_hist_names[i];
+        usys_metrics_text_hist(t, n->name, n->help, &m->h[i]);
+    }
+}
+
+//
+//
+//
@@ -0,0 +1,150 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_metrics.h
+ *
+ * @brief Process wide rlpx counters and histograms. Each thread bumps its
+ * own block (allocated on its first update, kept for the life of the
+ * process so totals survive the thread), rlpx_metrics_snapshot sums them.
+ * The first RLPX_METRIC_IO counters are also kept per peer (rlpx_io.metrics).
+ */
+#ifndef RLPX_METRICS_H_
+#define RLPX_METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rlpx_config.h"
+#include "usys_metrics.h"
+
+typedef enum {
+    // Per peer too
+    RLPX_METRIC_BYTES_IN = 0, /*!< read from peers */
+    RLPX_METRIC_BYTES_OUT,    /*!< queued to peers */
+    RLPX_METRIC_FRAMES_IN,    /*!< frames authenticated and parsed */
+    RLPX_METRIC_FRAMES_OUT,   /*!< frames queued */
+    RLPX_METRIC_MAC_FAILS,    /*!< frames failing mac or decode */
+
+    // Sessions
+    RLPX_METRIC_TX_OVERFLOWS,  /*!< peers dropped for a full send queue */
+    RLPX_METRIC_HANDSHAKES,    /*!< handshakes completed (hello) */
+    RLPX_METRIC_FAIL_AUTH,     /*!< auth did not decrypt or verify */
+    RLPX_METRIC_FAIL_ACK,      /*!< ack did not decrypt or verify */
+    RLPX_METRIC_FAIL_HELLO,    /*!< hello from the wrong key */
+    RLPX_METRIC_FAIL_TIMEOUT,  /*!< not done in RLPX_CONFIG_HANDSHAKE_MS */
+    RLPX_METRIC_PING_TIMEOUTS, /*!< keepalive not answered */
+
+    // Discovery packets read, by type
+    RLPX_METRIC_DISC_PING,
+    RLPX_METRIC_DISC_PONG,
+    RLPX_METRIC_DISC_FIND,
+    RLPX_METRIC_DISC_NEIGHBOURS,
+    RLPX_METRIC_DISC_ENR_REQUEST,
+    RLPX_METRIC_DISC_ENR_RESPONSE,
+    RLPX_METRIC_DISC_INVALID,  /*!< bad hash, signature, rlp or type */
+    RLPX_METRIC_DISC_EXPIRED,  /*!< past their expiration */
+    RLPX_METRIC_DISC_LIMITED,  /*!< dropped over budget, before any crypto */
+    RLPX_METRIC_DISC_UNBONDED, /*!< not asked for, or sender unproven */
+    RLPX_METRIC_DISC_SENT,     /*!< packets sent */
+
+    // Discovery v5 packets read, by flag
+    RLPX_METRIC_DISCV5_MESSAGE,
+    RLPX_METRIC_DISCV5_WHOAREYOU,
+    RLPX_METRIC_DISCV5_HANDSHAKE,
+    RLPX_METRIC_DISCV5_INVALID, /*!< bad header, tag, signature or rlp */
+    RLPX_METRIC_DISCV5_LIMITED, /*!< dropped over budget, before any crypto */
+    RLPX_METRIC_DISCV5_SENT,    /*!< packets sent */
+    RLPX_METRIC_COUNT
+} RLPX_METRIC;
+
+// Counters also kept per peer
+#define RLPX_METRIC_IO (RLPX_METRIC_MAC_FAILS + 1)
+
+typedef enum {
+    RLPX_METRIC_HIST_LATENCY = 0, /*!< ping to pong (us) */
+    RLPX_METRIC_HIST_HANDSHAKE,   /*!< connect or accept to hello (us) */
+    RLPX_METRIC_HIST_COUNT
+} RLPX_METRIC_HIST;
+
+typedef struct
+{
+    uint64_t c[RLPX_METRIC_IO];
+} rlpx_io_metrics;
+
+typedef struct rlpx_metrics
+{
+    uint8_t pad0[64];                            /*!< own cache lines */
+    uint64_t c[RLPX_METRIC_COUNT];               /*!< RLPX_METRIC */
+    usys_metrics_hist h[RLPX_METRIC_HIST_COUNT]; /*!< RLPX_METRIC_HIST */
+    struct rlpx_metrics* next;                   /*!< every thread's block */
+    uint8_t pad1[64];
+} rlpx_metrics;
+
+extern rlpx_thread_local rlpx_metrics* g_rlpx_metrics;
+
+/**
+ * @brief The calling thread's block (allocated and registered on first use)
+ */
+rlpx_metrics* rlpx_metrics_local();
+
+/**
+ * @brief Totals over every thread (any thread). Only c and h are set.
+ */
+void rlpx_metrics_snapshot(rlpx_metrics* m);
+
+/**
+ * @brief Copy a peer's counters (any thread, while the peer exists).
+ */
+void rlpx_metrics_io_snapshot(const rlpx_io_metrics* io, rlpx_io_metrics* m);
+
+/**
+ * @brief Append the totals in Prometheus text format.
+ */
+void rlpx_metrics_text(usys_metrics_text* t, const rlpx_metrics* m);
+
+static inline void
+rlpx_metrics_add(RLPX_METRIC m, uint64_t n)
+{
+    rlpx_metrics* b = g_rlpx_metrics ? g_rlpx_metrics : rlpx_metrics_local();
+    if (b) usys_metrics_add(&b->c[m], n);
+}
+
+static inline void
+rlpx_metrics_observe(RLPX_METRIC_HIST m, uint32_t v)
+{
+    rlpx_metrics* b = g_rlpx_metrics ? g_rlpx_metrics : rlpx_metrics_local();
+    if (b) usys_metrics_observe(&b->h[m], v);
+}
+
+// Peer and process wide
+static inline void
+rlpx_metrics_io_add(rlpx_io_metrics* io, RLPX_METRIC m, uint64_t n)
+{
+    usys_metrics_add(&io->c[m], n);
+    rlpx_metrics_add(m, n);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -62,6 +62,28 @@ rlpx_node_init_enode(rlpx_node* self, const char* enode)
     return rlpx_node_init(self, &key, host, atoi(++tcp), udp ? atoi(++udp) : 0);
 }
 
+int
+rlpx_node_init_enr(rlpx_node* self, const rlpx_enr* enr)
+{
+    static const uint8_t any[4] = { 0 };
+    char host[16];
+    uecc_public_key key;
+
+    if (!enr->seq || !memcmp(enr->ip, any, 4) ||
+        uecc_btoq(enr->pub, sizeof(enr->pub), &key)) {
+        return -1;
+    }
+    snprintf(
+        host,
+        sizeof(host),
+        "%d.%d.%d.%d",
+        enr->ip[0],
+        enr->ip[1],
+        enr->ip[2],
+        enr->ip[3]);
+    return rlpx_node_init(self, &key, host, enr->tcp, enr->udp);
+}
+
 void
 rlpx_node_deinit(rlpx_node* self)
 {
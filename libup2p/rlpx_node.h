@@ -33,6 +33,7 @@ extern "C" {
 #endif
 
 #include "rlpx_config.h"
+#include "rlpx_enr.h"
 #include "uecc.h"
 
 typedef struct
@@ -63,6 +64,13 @@ int rlpx_node_init(
  */
 int rlpx_node_init_enode(rlpx_node* self, const char* enode);
 
+/**
+ * @brief Create a node from its record (see rlpx_discovery_table_enr)
+ *
+ * @return 0 ok, -1 no record, key or ipv4 address
+ */
+int rlpx_node_init_enr(rlpx_node* self, const rlpx_enr* enr);
+
 void rlpx_node_deinit(rlpx_node* self);
 
 int rlpx_node_hex_to_bin(const char*, uint32_t, uint8_t*, uint32_t*);
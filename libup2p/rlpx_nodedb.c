@@ -0,0 +1,196 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_nodedb.h"
+#include "usys_time.h"
+
+// Private
+void rlpx_nodedb_reset(rlpx_nodedb* db, uint32_t size);
+void rlpx_nodedb_drop(rlpx_nodedb* db, uint32_t i);
+uint32_t rlpx_nodedb_victim(rlpx_nodedb* db);
+
+int
+rlpx_nodedb_open(rlpx_nodedb* db, const char* path, uint32_t size)
+{
+    rlpx_nodedb_record* r;
+    int64_t old = usys_epoch() - RLPX_NODEDB_AGE;
+    uint32_t i;
+
+    memset(db, 0, sizeof(rlpx_nodedb));
+    if (kindex_init(&db->index, size)) return -1;
+    if (usys_map_open(
+            &db->map,
+            path,
+            sizeof(rlpx_nodedb_header) + size * sizeof(rlpx_nodedb_record))) {
+        kindex_deinit(&db->index);
+        return -1;
+    }
+    db->head = (rlpx_nodedb_header*)db->map.b;
+    db->records = (rlpx_nodedb_record*)&db->head[1];
+    if (memcmp(db->head->magic, RLPX_NODEDB_MAGIC, 8) ||
+        !(db->head->version == RLPX_NODEDB_VERSION) ||
+        !(db->head->size == size)) {
+        rlpx_nodedb_reset(db, size);
+    }
+
+    // Index what is still fresh, drop the rest
+    for (i = 0; i < size; i++) {
+        r = &db->records[i];
+        if (!r->seen) continue;
+        if (r->seen < old || r->iplen > 16 ||
+            kindex_put(&db->index, &r->id, i)) {
+            memset(r, 0, sizeof(rlpx_nodedb_record));
+            continue;
+        }
+        db->n++;
+    }
+    return 0;
+}
+
+void
+rlpx_nodedb_close(rlpx_nodedb* db)
+{
+    if (!db->head) return;
+    usys_map_close(&db->map);
+    kindex_deinit(&db->index);
+    memset(db, 0, sizeof(rlpx_nodedb));
+}
+
+int
+rlpx_nodedb_sync(rlpx_nodedb* db)
+{
+    return usys_map_sync(&db->map, 0);
+}
+
+rlpx_nodedb_record*
+rlpx_nodedb_find(rlpx_nodedb* db, const knode* id)
+{
+    int i = kindex_get(&db->index, id);
+    if (i < 0 || memcmp(&db->records[i].id, id, sizeof(knode))) return NULL;
+    return &db->records[i];
+}
+
+int
+rlpx_nodedb_update(
+    rlpx_nodedb* db,
+    const knode* id,
+    const uint8_t* pub,
+    const uint8_t* ip,
+    uint32_t iplen,
+    uint32_t tcp,
+    uint32_t udp)
+{
+    rlpx_nodedb_record* r;
+    uint32_t i;
+
+    if (iplen > 16) return -1;
+    if (!(r = rlpx_nodedb_find(db, id))) {
+        // A free record, else the worst of a sample
+        if (db->n < db->head->size) {
+            i = 0;
+            while (db->records[i].seen) i++;
+        } else {
+            i = rlpx_nodedb_victim(db);
+            rlpx_nodedb_drop(db, i);
+        }
+        r = &db->records[i];
+        if (kindex_put(&db->index, id, i)) return -1;
+        r->id = *id;
+        memcpy(r->pub, pub, 64);
+        r->pong = 0;
+        r->fails = 0;
+        db->n++;
+    }
+    memset(r->ip, 0, 16);
+    memcpy(r->ip, ip, iplen);
+    r->iplen = iplen;
+    r->tcp = tcp;
+    r->udp = udp;
+    r->seen = usys_epoch();
+    return 0;
+}
+
+void
+rlpx_nodedb_seen(rlpx_nodedb* db, const knode* id, int pong)
+{
+    rlpx_nodedb_record* r = rlpx_nodedb_find(db, id);
+    if (!r) return;
+    r->seen = usys_epoch();
+    r->fails = 0;
+    if (pong) r->pong = r->seen;
+}
+
+void
+rlpx_nodedb_fail(rlpx_nodedb* db, const knode* id)
+{
+    rlpx_nodedb_record* r = rlpx_nodedb_find(db, id);
+    if (r && ++r->fails >= RLPX_NODEDB_FAILS) {
+        rlpx_nodedb_drop(db, r - db->records);
+    }
+}
+
+int
+rlpx_nodedb_remove(rlpx_nodedb* db, const knode* id)
+{
+    rlpx_nodedb_record* r = rlpx_nodedb_find(db, id);
+    if (!r) return -1;
+    rlpx_nodedb_drop(db, r - db->records);
+    return 0;
+}
+
+void
+rlpx_nodedb_reset(rlpx_nodedb* db, uint32_t size)
+{
+    memset(db->map.b, 0, db->map.len);
+    memcpy(db->head->magic, RLPX_NODEDB_MAGIC, 8);
+    db->head->version = RLPX_NODEDB_VERSION;
+    db->head->size = size;
+}
+
+void
+rlpx_nodedb_drop(rlpx_nodedb* db, uint32_t i)
+{
+    kindex_del(&db->index, &db->records[i].id);
+    memset(&db->records[i], 0, sizeof(rlpx_nodedb_record));
+    db->n--;
+}
+
+uint32_t
+rlpx_nodedb_victim(rlpx_nodedb* db)
+{
+    rlpx_nodedb_record *r, *worst = NULL;
+    uint32_t i, hand = db->head->hand;
+
+    // Most failures, then least recently seen
+    for (i = 0; i < RLPX_NODEDB_SAMPLE; i++) {
+        r = &db->records[(hand + i) % db->head->size];
+        if (!worst || r->fails > worst->fails ||
+            (r->fails == worst->fails && r->seen < worst->seen)) {
+            worst = r;
+        }
+    }
+    db->head->hand = (hand + RLPX_NODEDB_SAMPLE) % db->head->size;
+    return worst - db->records;
+}
+
+//
+//
+//
@@ -0,0 +1,161 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_nodedb.h
+ *
+ * @brief Discovery nodes kept across restarts. A file of fixed size records
+ * (native byte order) mapped into memory, so loading is a walk over the
+ * mapping and updates are plain stores that the kernel writes back on its
+ * own time (rlpx_nodedb_sync only schedules it). An index keyed by node id
+ * finds records in constant time.
+ *
+ * When full, a new node takes the place of the worst of RLPX_NODEDB_SAMPLE
+ * records from a rotating hand (most failures, then least recently seen), an
+ * approximate LRU that never scans the whole file. Records not heard of in
+ * RLPX_NODEDB_AGE seconds are dropped when the database is opened.
+ */
+#ifndef RLPX_NODEDB_H_
+#define RLPX_NODEDB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kademlia/kindex.h"
+#include "usys_io.h"
+
+// Records per database
+#ifndef RLPX_NODEDB_RECORDS
+#define RLPX_NODEDB_RECORDS 1024
+#endif
+
+// Seconds a record lives without news of its node
+#ifndef RLPX_NODEDB_AGE
+#define RLPX_NODEDB_AGE (24 * 60 * 60)
+#endif
+
+// Unanswered requests in a row before a node is dropped
+#ifndef RLPX_NODEDB_FAILS
+#define RLPX_NODEDB_FAILS 5
+#endif
+
+// Records weighed per eviction
+#ifndef RLPX_NODEDB_SAMPLE
+#define RLPX_NODEDB_SAMPLE 8
+#endif
+
+#define RLPX_NODEDB_MAGIC "rlpxndb"
+#define RLPX_NODEDB_VERSION 1
+
+typedef struct
+{
+    char magic[8];    /*!< RLPX_NODEDB_MAGIC */
+    uint32_t version; /*!< RLPX_NODEDB_VERSION */
+    uint32_t size;    /*!< records in file */
+    uint32_t hand;    /*!< eviction cursor */
+    uint8_t pad[44];  /*!< records start 64 bytes in */
+} rlpx_nodedb_header;
+
+typedef struct
+{
+    knode id;        /*!< keccak(pub) */
+    uint8_t pub[64]; /*!< public key (less 0x04 prefix) */
+    uint8_t ip[16];  /*!< big endian, ipv4 in the first 4 */
+    uint32_t iplen;  /*!< 4 or 16 */
+    uint16_t udp;    /*!< discovery port */
+    uint16_t tcp;    /*!< devp2p port */
+    int64_t pong;    /*!< last pong (epoch s), 0 never */
+    int64_t seen;    /*!< last heard of or from (epoch s), 0 free */
+    uint32_t fails;  /*!< requests unanswered since the last answer */
+    uint32_t pad;    /*!< 8 byte aligned */
+} rlpx_nodedb_record;
+
+typedef struct
+{
+    usys_map map;                /*!< the file */
+    rlpx_nodedb_header* head;    /*!< in the mapping */
+    rlpx_nodedb_record* records; /*!< in the mapping, head->size */
+    kindex index;                /*!< id -> record */
+    uint32_t n;                  /*!< records in use */
+} rlpx_nodedb;
+
+/**
+ * @brief Map the database at path (created empty, or reset when it was
+ * written with another layout or size) and index its records.
+ *
+ * @return 0 ok, -1 file or memory error
+ */
+int rlpx_nodedb_open(rlpx_nodedb* db, const char* path, uint32_t size);
+
+/**
+ * @brief Wait for the write back and unmap
+ */
+void rlpx_nodedb_close(rlpx_nodedb* db);
+
+/**
+ * @brief Schedule the write back of what changed (doesn't block)
+ */
+int rlpx_nodedb_sync(rlpx_nodedb* db);
+
+/**
+ * @brief Record of a node
+ *
+ * @return record, NULL not in the database
+ */
+rlpx_nodedb_record* rlpx_nodedb_find(rlpx_nodedb* db, const knode* id);
+
+/**
+ * @brief Add a node or refresh its endpoint, evicts when full
+ *
+ * @return 0 ok, -1 bad endpoint
+ */
+int rlpx_nodedb_update(
+    rlpx_nodedb* db,
+    const knode* id,
+    const uint8_t* pub,
+    const uint8_t* ip,
+    uint32_t iplen,
+    uint32_t tcp,
+    uint32_t udp);
+
+/**
+ * @brief Node answered (pong when it was a PONG)
+ */
+void rlpx_nodedb_seen(rlpx_nodedb* db, const knode* id, int pong);
+
+/**
+ * @brief Node left a request unanswered. Dropped after RLPX_NODEDB_FAILS
+ * in a row.
+ */
+void rlpx_nodedb_fail(rlpx_nodedb* db, const knode* id);
+
+/**
+ * @brief Drop a node
+ *
+ * @return 0 removed, -1 not in the database
+ */
+int rlpx_nodedb_remove(rlpx_nodedb* db, const knode* id);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,234 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_peers.h"
+
+// Private
+int rlpx_peers_grow(rlpx_peers* peers);
+void rlpx_peers_swap(rlpx_peers* peers, uint32_t a, uint32_t b);
+void rlpx_peers_set_done(rlpx_peers* peers, rlpx_io* ch);
+void rlpx_peers_on_link(void* ctx, uint32_t slot, int up);
+
+int
+rlpx_peers_init(
+    rlpx_peers* peers,
+    uecc_ctx* skey,
+    const uint32_t* listen,
+    async_loop* loop,
+    uint32_t limit)
+{
+    memset(peers, 0, sizeof(rlpx_peers));
+    peers->skey = skey;
+    peers->listen = listen;
+    peers->loop = loop;
+    peers->limit = limit;
+    return 0;
+}
+
+void
+rlpx_peers_deinit(rlpx_peers* peers)
+{
+    rlpx_io* ch;
+    for (uint32_t i = 0; i < peers->size; i++) {
+        if ((ch = peers->slots[i])) rlpx_io_free(&ch);
+    }
+    if (peers->slots) rlpx_free(peers->slots);
+    if (peers->free) rlpx_free(peers->free);
+    if (peers->set) rlpx_free(peers->set);
+    if (peers->pos) rlpx_free(peers->pos);
+    memset(peers, 0, sizeof(rlpx_peers));
+}
+
+rlpx_io*
+rlpx_peers_add(rlpx_peers* peers)
+{
+    rlpx_io* ch;
+    uint32_t slot;
+
+    // Take a recycled slot, else grow
+    if (peers->limit && peers->count >= peers->limit) return NULL;
+    if (!peers->nfree && rlpx_peers_grow(peers)) return NULL;
+    if (!(ch = rlpx_io_alloc(peers->skey, peers->listen))) return NULL;
+    if (peers->loop && rlpx_io_attach(ch, peers->loop)) {
+        rlpx_io_free(&ch);
+        return NULL;
+    }
+    slot = peers->free[--peers->nfree];
+    ch->slot = slot;
+    ch->on_link = rlpx_peers_on_link;
+    ch->link_ctx = peers;
+    peers->slots[slot] = ch;
+
+    // New peers start idle, ahead of the done set
+    peers->set[peers->count] = slot;
+    peers->pos[slot] = peers->count++;
+    if (peers->ndone) {
+        rlpx_peers_swap(
+            peers, peers->count - 1, peers->count - 1 - peers->ndone);
+    }
+    return ch;
+}
+
+void
+rlpx_peers_remove(rlpx_peers* peers, rlpx_io* ch)
+{
+    uint32_t slot = ch->slot;
+    if (!(slot < peers->size && peers->slots[slot] == ch)) return;
+
+    // Move to the end of the set and drop it
+    rlpx_peers_set_done(peers, ch);
+    rlpx_peers_swap(peers, peers->pos[slot], peers->count - 1);
+    peers->ndone--;
+    peers->count--;
+    peers->slots[slot] = NULL;
+    peers->free[peers->nfree++] = slot;
+    rlpx_io_free(&ch);
+}
+
+void
+rlpx_peers_set_active(rlpx_peers* peers, rlpx_io* ch)
+{
+    if (peers->pos[ch->slot] < peers->nactive) return;
+    rlpx_peers_set_idle(peers, ch);
+    rlpx_peers_swap(peers, peers->pos[ch->slot], peers->nactive++);
+}
+
+void
+rlpx_peers_set_idle(rlpx_peers* peers, rlpx_io* ch)
+{
+    uint32_t idx = peers->pos[ch->slot], done = peers->count - peers->ndone;
+    if (idx < peers->nactive) {
+        rlpx_peers_swap(peers, idx, --peers->nactive);
+    } else if (idx >= done) {
+        rlpx_peers_swap(peers, idx, done);
+        peers->ndone--;
+    }
+}
+
+void
+rlpx_peers_set_done(rlpx_peers* peers, rlpx_io* ch)
+{
+    rlpx_peers_set_idle(peers, ch);
+    peers->ndone++;
+    rlpx_peers_swap(peers, peers->pos[ch->slot], peers->count - peers->ndone);
+}
+
+uint32_t
+rlpx_peers_update(rlpx_peers* peers)
+{
+    uint32_t i = 0, n = 0;
+    rlpx_io* ch;
+
+    // Peers that lost their connection move to the idle set
+    while (i < peers->nactive) {
+        ch = rlpx_peers_active(peers, i);
+        if (rlpx_io_is_connected(ch)) {
+            i++;
+        } else {
+            rlpx_peers_set_idle(peers, ch);
+            n++;
+        }
+    }
+    return n;
+}
+
+uint32_t
+rlpx_peers_reap(rlpx_peers* peers)
+{
+    uint32_t n = 0;
+    while (peers->ndone) {
+        rlpx_peers_remove(peers, peers->slots[peers->set[peers->count - 1]]);
+        n++;
+    }
+    return n;
+}
+
+int
+rlpx_peers_grow(rlpx_peers* peers)
+{
+    uint32_t size = peers->size ? peers->size * 2 : RLPX_CONFIG_PEERS_INIT;
+    rlpx_io** slots;
+    uint32_t *stack, *set, *pos;
+
+    if (peers->limit && size > peers->limit) size = peers->limit;
+    if (!(size > peers->size)) return -1;
+    slots = rlpx_malloc(size * sizeof(rlpx_io*));
+    stack = rlpx_malloc(size * sizeof(uint32_t));
+    set = rlpx_malloc(size * sizeof(uint32_t));
+    pos = rlpx_malloc(size * sizeof(uint32_t));
+    if (!(slots && stack && set && pos)) {
+        if (slots) rlpx_free(slots);
+        if (stack) rlpx_free(stack);
+        if (set) rlpx_free(set);
+        if (pos) rlpx_free(pos);
+        return -1;
+    }
+    memset(slots, 0, size * sizeof(rlpx_io*));
+    if (peers->size) {
+        memcpy(slots, peers->slots, peers->size * sizeof(rlpx_io*));
+        memcpy(set, peers->set, peers->count * sizeof(uint32_t));
+        memcpy(pos, peers->pos, peers->size * sizeof(uint32_t));
+        rlpx_free(peers->slots);
+        rlpx_free(peers->free);
+        rlpx_free(peers->set);
+        rlpx_free(peers->pos);
+    }
+
+    // Only called when the free stack is empty. Lowest slot on top.
+    for (uint32_t i = size; i > peers->size; i--) stack[peers->nfree++] = i - 1;
+    peers->slots = slots;
+    peers->free = stack;
+    peers->set = set;
+    peers->pos = pos;
+    peers->size = size;
+    return 0;
+}
+
+void
+rlpx_peers_swap(rlpx_peers* peers, uint32_t a, uint32_t b)
+{
+    uint32_t sa = peers->set[a], sb = peers->set[b];
+    peers->set[a] = sb;
+    peers->set[b] = sa;
+    peers->pos[sb] = a;
+    peers->pos[sa] = b;
+}
+
+void
+rlpx_peers_on_link(void* ctx, uint32_t slot, int up)
+{
+    rlpx_peers* peers = ctx;
+    rlpx_io* ch = peers->slots[slot];
+
+    // Inbound peers have no port to dial, a transient peer stops after its
+    // redial. Neither comes back.
+    if (up) {
+        rlpx_peers_set_active(peers, ch);
+    } else if (!ch->node.port_tcp || (ch->transient && ch->shutdown)) {
+        rlpx_peers_set_done(peers, ch);
+    } else {
+        rlpx_peers_set_idle(peers, ch);
+    }
+}
+
+//
+//
+//
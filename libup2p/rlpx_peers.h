@@ -0,0 +1,124 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_peers.h
+ *
+ * @brief Growable table of rlpx_io peers. Peers are allocated from the io
+ * slab on demand and addressed by a slot index that is recycled from a free
+ * list. Slots are kept in one dense array partitioned into an active set
+ * (connected), an idle set and the peers that are done, so callers only walk
+ * the peers they care about and moving a peer between sets is a swap.
+ *
+ * Peers move between sets from their own io callbacks (rlpx_io on_link) as
+ * their socket opens or closes. A walk that sends may move the peer it is on,
+ * so it goes from the end of the set. Inbound peers and transient peers that
+ * gave up are done, rlpx_peers_reap frees them.
+ *
+ * Peers should be added and removed outside of io callbacks (the reactor may
+ * still hold the peer while dispatching a batch).
+ */
+#ifndef RLPX_PEERS_H_
+#define RLPX_PEERS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rlpx_io.h"
+
+typedef struct
+{
+    rlpx_io** slots;        /*!< slot -> peer (NULL when free) */
+    uint32_t* free;         /*!< stack of free slots */
+    uint32_t* set;          /*!< active slots, idle slots, done slots */
+    uint32_t* pos;          /*!< slot -> index into set */
+    uint32_t size;          /*!< allocated slots */
+    uint32_t nfree;         /*!< free slots on stack */
+    uint32_t count;         /*!< peers in table */
+    uint32_t nactive;       /*!< peers in active set */
+    uint32_t ndone;         /*!< peers waiting on rlpx_peers_reap */
+    uint32_t limit;         /*!< max peers (0 no limit) */
+    uecc_ctx* skey;         /*!< our static key for new peers */
+    const uint32_t* listen; /*!< our listen port for new peers */
+    async_loop* loop;       /*!< reactor new peers attach to (optional) */
+} rlpx_peers;
+
+int rlpx_peers_init(
+    rlpx_peers* peers,
+    uecc_ctx* skey,
+    const uint32_t* listen,
+    async_loop* loop,
+    uint32_t limit);
+void rlpx_peers_deinit(rlpx_peers* peers);
+rlpx_io* rlpx_peers_add(rlpx_peers* peers);
+void rlpx_peers_remove(rlpx_peers* peers, rlpx_io* ch);
+void rlpx_peers_set_active(rlpx_peers* peers, rlpx_io* ch);
+void rlpx_peers_set_idle(rlpx_peers* peers, rlpx_io* ch);
+uint32_t rlpx_peers_update(rlpx_peers* peers);
+uint32_t rlpx_peers_reap(rlpx_peers* peers);
+
+static inline uint32_t
+rlpx_peers_count(rlpx_peers* peers)
+{
+    return peers->count;
+}
+
+static inline uint32_t
+rlpx_peers_active_count(rlpx_peers* peers)
+{
+    return peers->nactive;
+}
+
+static inline uint32_t
+rlpx_peers_idle_count(rlpx_peers* peers)
+{
+    return peers->count - peers->nactive - peers->ndone;
+}
+
+static inline uint32_t
+rlpx_peers_done_count(rlpx_peers* peers)
+{
+    return peers->ndone;
+}
+
+static inline rlpx_io*
+rlpx_peers_active(rlpx_peers* peers, uint32_t i)
+{
+    return peers->slots[peers->set[i]];
+}
+
+static inline rlpx_io*
+rlpx_peers_idle(rlpx_peers* peers, uint32_t i)
+{
+    return peers->slots[peers->set[peers->nactive + i]];
+}
+
+static inline rlpx_io*
+rlpx_peers_get(rlpx_peers* peers, uint32_t slot)
+{
+    return slot < peers->size ? peers->slots[slot] : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
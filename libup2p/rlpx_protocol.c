@@ -23,10 +23,16 @@
 
 int rlpx_protocol_default_recv(rlpx_protocol*, const urlp* rlp);
 
+rlpx_thread_local rlpx_slab g_rlpx_protocol_slab = RLPX_SLAB_INIT(
+    "protocol",
+    sizeof(rlpx_protocol),
+    RLPX_CONFIG_SLAB_PROTOCOL_N,
+    RLPX_CONFIG_SLAB_PROTOCOL_LIMIT);
+
 rlpx_protocol*
 rlpx_protocol_alloc(uint32_t type, const char* cap, void* ctx)
 {
-    rlpx_protocol* proto = rlpx_malloc(sizeof(rlpx_protocol));
+    rlpx_protocol* proto = rlpx_slab_alloc(&g_rlpx_protocol_slab);
     if (proto) rlpx_protocol_init(proto, type, cap, ctx);
     return proto;
 }
@@ -36,7 +42,19 @@ rlpx_protocol_free(rlpx_protocol** self_p)
 {
     rlpx_protocol* self = *self_p;
     *self_p = NULL;
-    rlpx_free(self);
+    rlpx_slab_free(&g_rlpx_protocol_slab, self);
+}
+
+const rlpx_slab_stats*
+rlpx_protocol_slab_stats()
+{
+    return rlpx_slab_stats_get(&g_rlpx_protocol_slab);
+}
+
+void
+rlpx_protocol_slab_deinit()
+{
+    rlpx_slab_deinit(&g_rlpx_protocol_slab);
 }
 
 void
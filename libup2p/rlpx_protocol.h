@@ -28,6 +28,7 @@ extern "C" {
 
 #include "rlpx_config.h"
 #include "rlpx_frame.h"
+#include "rlpx_slab.h"
 #include "urlp.h"
 
 // Base protocol type
@@ -51,6 +52,10 @@ void rlpx_protocol_init(
     void* ctx);
 void rlpx_protocol_deinit(rlpx_protocol*);
 
+// Protocol pool usage (calling thread)
+const rlpx_slab_stats* rlpx_protocol_slab_stats();
+void rlpx_protocol_slab_deinit();
+
 // parseing helpers
 static inline int
 rlpx_rlp_to_str(const urlp* rlp, int idx, const char** str_p)
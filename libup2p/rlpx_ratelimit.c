@@ -0,0 +1,111 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_ratelimit.h"
+
+// Sources of one set share a cache line (4 ways of 16 bytes)
+#define rlpx_ratelimit_set(ctx, ip)                                            \
+    (&(ctx)->sources[(((ip)*0x9e3779b1u) >> 16 & (ctx)->mask) *               \
+                     RLPX_RATELIMIT_WAYS])
+
+// Private
+uint32_t rlpx_ratelimit_refill(
+    uint32_t tokens,
+    int64_t elapsed,
+    uint32_t rate,
+    uint32_t burst);
+
+int
+rlpx_ratelimit_init(rlpx_ratelimit* ctx, uint32_t n)
+{
+    uint32_t sets = 1;
+    memset(ctx, 0, sizeof(rlpx_ratelimit));
+    while (sets * RLPX_RATELIMIT_WAYS < n) sets <<= 1;
+    ctx->sources = rlpx_malloc(
+        sets * RLPX_RATELIMIT_WAYS * sizeof(rlpx_ratelimit_source));
+    if (!ctx->sources) return -1;
+    memset(
+        ctx->sources,
+        0,
+        sets * RLPX_RATELIMIT_WAYS * sizeof(rlpx_ratelimit_source));
+    ctx->mask = sets - 1;
+    ctx->rate = RLPX_RATELIMIT_RATE;
+    ctx->burst = RLPX_RATELIMIT_BURST;
+    ctx->global = RLPX_RATELIMIT_GLOBAL;
+    ctx->tokens = ctx->global * 1000;
+    return 0;
+}
+
+void
+rlpx_ratelimit_deinit(rlpx_ratelimit* ctx)
+{
+    if (ctx->sources) rlpx_free(ctx->sources);
+    memset(ctx, 0, sizeof(rlpx_ratelimit));
+}
+
+int
+rlpx_ratelimit_take(rlpx_ratelimit* ctx, uint32_t ip, int64_t now)
+{
+    rlpx_ratelimit_source *set = rlpx_ratelimit_set(ctx, ip), *s = NULL;
+    uint32_t i;
+
+    // Known source, else the entry of its set refilled longest ago
+    for (i = 0; i < RLPX_RATELIMIT_WAYS; i++) {
+        if (set[i].ip == ip) {
+            s = &set[i];
+            s->tokens = rlpx_ratelimit_refill(
+                s->tokens, now - s->at, ctx->rate, ctx->burst);
+            break;
+        }
+        if (!s || set[i].at < s->at) s = &set[i];
+    }
+    if (!(i < RLPX_RATELIMIT_WAYS)) {
+        s->ip = ip;
+        s->tokens = ctx->burst * 1000;
+    }
+    s->at = now;
+
+    // The source pays first, everyone's budget only for what it lets by
+    if (s->tokens < 1000) return -1;
+    s->tokens -= 1000;
+    ctx->tokens = rlpx_ratelimit_refill(
+        ctx->tokens, now - ctx->at, ctx->global, ctx->global);
+    ctx->at = now;
+    if (ctx->tokens < 1000) return -1;
+    ctx->tokens -= 1000;
+    return 0;
+}
+
+uint32_t
+rlpx_ratelimit_refill(
+    uint32_t tokens,
+    int64_t elapsed,
+    uint32_t rate,
+    uint32_t burst)
+{
+    uint64_t t = tokens;
+    if (elapsed > 0) t += (uint64_t)elapsed * rate;
+    return t < burst * 1000ull ? (uint32_t)t : burst * 1000;
+}
+
+//
+//
+//
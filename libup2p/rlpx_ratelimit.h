@@ -0,0 +1,99 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_ratelimit.h
+ *
+ * @brief Token buckets per source address plus one for everyone, checked
+ * before a packet costs us any hashing or signature work. Sources live in a
+ * fixed table of RLPX_RATELIMIT_WAYS entry sets, a new source takes the
+ * least recently refilled entry of its set. Spoofed sources that churn the
+ * table get fresh buckets, the global bucket is what bounds them.
+ *
+ * Budgets count in thousandths of a packet, so a rate of r packets a second
+ * refills r per millisecond.
+ */
+#ifndef RLPX_RATELIMIT_H_
+#define RLPX_RATELIMIT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rlpx_config.h"
+
+// Sources tracked (rounded up to a power of two sets)
+#ifndef RLPX_RATELIMIT_SOURCES
+#define RLPX_RATELIMIT_SOURCES 4096
+#endif
+
+// Entries a source may take
+#ifndef RLPX_RATELIMIT_WAYS
+#define RLPX_RATELIMIT_WAYS 4
+#endif
+
+// Packets a second, and at once, from one source
+#ifndef RLPX_RATELIMIT_RATE
+#define RLPX_RATELIMIT_RATE 20
+#endif
+#ifndef RLPX_RATELIMIT_BURST
+#define RLPX_RATELIMIT_BURST 40
+#endif
+
+// Packets a second from everyone (a second's worth at once)
+#ifndef RLPX_RATELIMIT_GLOBAL
+#define RLPX_RATELIMIT_GLOBAL 20000
+#endif
+
+typedef struct
+{
+    uint32_t ip;     /*!< source, 0 free */
+    uint32_t tokens; /*!< budget left */
+    int64_t at;      /*!< last refill (ms) */
+} rlpx_ratelimit_source;
+
+typedef struct
+{
+    rlpx_ratelimit_source* sources; /*!< sets of RLPX_RATELIMIT_WAYS */
+    uint32_t mask;                  /*!< sets - 1 */
+    uint32_t rate;                  /*!< per source packets a second */
+    uint32_t burst;                 /*!< per source packets at once */
+    uint32_t global;                /*!< everyone, packets a second */
+    uint32_t tokens;                /*!< everyone, budget left */
+    int64_t at;                     /*!< everyone, last refill (ms) */
+} rlpx_ratelimit;
+
+// Init/Deinit routines (room for about n sources)
+int rlpx_ratelimit_init(rlpx_ratelimit* ctx, uint32_t n);
+void rlpx_ratelimit_deinit(rlpx_ratelimit* ctx);
+
+/**
+ * @brief Take one packet from the budget of ip (any 32 bit key) and from
+ * the global one
+ *
+ * @return 0 admitted, -1 over budget
+ */
+int rlpx_ratelimit_take(rlpx_ratelimit* ctx, uint32_t ip, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
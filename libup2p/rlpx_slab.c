@@ -0,0 +1,114 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "rlpx_slab.h"
+
+// Chunk header, objects follow (aligned)
+typedef struct rlpx_slab_chunk
+{
+    struct rlpx_slab_chunk* next;
+} rlpx_slab_chunk;
+
+#define RLPX_SLAB_CHUNK_HDR RLPX_SLAB_ALIGN(sizeof(rlpx_slab_chunk))
+
+// Private
+int rlpx_slab_grow(rlpx_slab* slab);
+
+void
+rlpx_slab_init(
+    rlpx_slab* slab,
+    const char* name,
+    uint32_t size,
+    uint32_t n,
+    uint32_t limit)
+{
+    memset(slab, 0, sizeof(rlpx_slab));
+    slab->name = slab->stats.name = name;
+    slab->size = slab->stats.size = RLPX_SLAB_ALIGN(size);
+    slab->n = n ? n : 1;
+    slab->limit = limit;
+}
+
+void
+rlpx_slab_deinit(rlpx_slab* slab)
+{
+    rlpx_slab_chunk *chunk = slab->chunks, *next;
+    while (chunk) {
+        next = chunk->next;
+        rlpx_free(chunk);
+        chunk = next;
+    }
+    slab->chunks = slab->free = NULL;
+    slab->stats.total = slab->stats.used = slab->stats.chunks = 0;
+}
+
+void*
+rlpx_slab_alloc(rlpx_slab* slab)
+{
+    void* obj;
+    if (!slab->free && rlpx_slab_grow(slab)) {
+        slab->stats.fails++;
+        return NULL;
+    }
+    obj = slab->free;
+    slab->free = *(void**)obj;
+    if (++slab->stats.used > slab->stats.peak) {
+        slab->stats.peak = slab->stats.used;
+    }
+    return obj;
+}
+
+void
+rlpx_slab_free(rlpx_slab* slab, void* obj)
+{
+    if (!obj) return;
+    *(void**)obj = slab->free;
+    slab->free = obj;
+    slab->stats.used--;
+}
+
+int
+rlpx_slab_grow(rlpx_slab* slab)
+{
+    uint8_t* mem;
+    rlpx_slab_chunk* chunk;
+    if (slab->limit && slab->stats.chunks >= slab->limit) return -1;
+    chunk = rlpx_malloc(RLPX_SLAB_CHUNK_HDR + slab->size * slab->n);
+    if (!chunk) return -1;
+
+    // Track chunk so we can return it to heap on deinit
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->stats.chunks++;
+    slab->stats.total += slab->n;
+
+    // Thread new objects onto free list
+    mem = (uint8_t*)chunk + RLPX_SLAB_CHUNK_HDR;
+    for (uint32_t i = 0; i < slab->n; i++) {
+        *(void**)&mem[i * slab->size] = slab->free;
+        slab->free = &mem[i * slab->size];
+    }
+    return 0;
+}
+
+//
+//
+//
@@ -0,0 +1,93 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file rlpx_slab.h
+ *
+ * @brief Fixed size object pool. Objects are carved from chunks of heap
+ * memory that are requested once and then recycled through a free list, so
+ * alloc/free for session objects never touches the system allocator after
+ * warm up.
+ */
+#ifndef RLPX_SLAB_H_
+#define RLPX_SLAB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rlpx_config.h"
+
+#define RLPX_SLAB_ALIGN(sz) (((sz) + 15) & ~((size_t)15))
+
+// clang-format off
+#define RLPX_SLAB_INIT(nm, sz, per, max) {                                     \
+    .name = nm,                                                                \
+    .size = RLPX_SLAB_ALIGN(sz),                                               \
+    .n = per,                                                                  \
+    .limit = max,                                                              \
+    .free = NULL,                                                              \
+    .chunks = NULL,                                                            \
+    .stats = { .name = nm, .size = RLPX_SLAB_ALIGN(sz) } }
+// clang-format on
+
+typedef struct
+{
+    const char* name; /*!< pool name */
+    uint32_t size;    /*!< object size (aligned) */
+    uint32_t total;   /*!< objects carved from chunks */
+    uint32_t used;    /*!< objects currently handed out */
+    uint32_t peak;    /*!< high water mark of used */
+    uint32_t chunks;  /*!< chunks requested from heap */
+    uint32_t fails;   /*!< requests refused (limit reached) */
+} rlpx_slab_stats;
+
+typedef struct
+{
+    const char* name;      /*!< pool name */
+    uint32_t size;         /*!< object size (aligned) */
+    uint32_t n;            /*!< objects per chunk */
+    uint32_t limit;        /*!< max chunks (0 - no limit) */
+    void* free;            /*!< free list of objects */
+    void* chunks;          /*!< list of chunks to return to heap */
+    rlpx_slab_stats stats; /*!< usage */
+} rlpx_slab;
+
+void rlpx_slab_init(
+    rlpx_slab* slab,
+    const char* name,
+    uint32_t size,
+    uint32_t n,
+    uint32_t limit);
+void rlpx_slab_deinit(rlpx_slab* slab);
+void* rlpx_slab_alloc(rlpx_slab* slab);
+void rlpx_slab_free(rlpx_slab* slab, void* obj);
+
+static inline const rlpx_slab_stats*
+rlpx_slab_stats_get(const rlpx_slab* slab)
+{
+    return &slab->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
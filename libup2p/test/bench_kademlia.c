@@ -0,0 +1,92 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file bench_kademlia.c
+ *
+ * @brief Closest k of n random ids: a byte by byte scan keeping the best k,
+ * then knode_distances plus knode_select. Reports both times.
+ *
+ * up2p_bench_kademlia [n] [k]
+ */
+
+#include "kademlia/knode.h"
+#include "urand.h"
+#include "usys_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_K_MAX 64
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t n = argc > 1 ? atoi(argv[1]) : 100000;
+    uint32_t k = argc > 2 ? atoi(argv[2]) : 16, i, j, found;
+    uint32_t slow[BENCH_K_MAX], fast[BENCH_K_MAX];
+    uint64_t t0, t1, t2;
+    knode target, *ids;
+    uint16_t* d;
+
+    if (!(n && k && k <= BENCH_K_MAX && k <= n)) return -1;
+    ids = malloc(n * sizeof(knode));
+    d = malloc(n * sizeof(uint16_t));
+    if (!(ids && d)) return -1;
+    urand((uint8_t*)ids, n * sizeof(knode));
+    urand(target.b, sizeof(target.b));
+
+    // Some share a prefix with the target, like the near buckets do
+    for (i = 0; i < n; i++) memcpy(ids[i].b, target.b, i % 4);
+
+    // Scalar: compare every id byte by byte against the best k
+    t0 = usys_now_ns();
+    for (found = 0, i = 0; i < n; i++) {
+        for (j = found;
+             j > 0 && knode_cmp(&ids[i], &ids[slow[j - 1]], &target) < 0;
+             j--) {
+            if (j < k) slow[j] = slow[j - 1];
+        }
+        if (j < k) {
+            slow[j] = i;
+            if (found < k) found++;
+        }
+    }
+    t1 = usys_now_ns();
+
+    // Vector distances, then only ids near the best k are compared in full
+    knode_distances(ids, n, &target, d);
+    knode_select(ids, d, n, &target, fast, k);
+    t2 = usys_now_ns();
+    printf(
+        "closest %u of %u: scalar %lluus vector %lluus (%s)\n",
+        k,
+        n,
+        (unsigned long long)(t1 - t0) / 1000,
+        (unsigned long long)(t2 - t1) / 1000,
+        memcmp(slow, fast, k * sizeof(uint32_t)) ? "differ" : "same");
+    free(ids);
+    free(d);
+    return 0;
+}
+
+//
+//
+//
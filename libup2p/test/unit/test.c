@@ -96,8 +96,13 @@ main(int argc, char* argv[])
     IF_ERR_EXIT(test_frame());
     IF_ERR_EXIT(test_protocol());
     IF_ERR_EXIT(test_enode());
+    IF_ERR_EXIT(test_enr());
     IF_ERR_EXIT(test_kademlia());
     IF_ERR_EXIT(test_discovery());
+    IF_ERR_EXIT(test_discv5());
+    IF_ERR_EXIT(test_nodedb());
+    IF_ERR_EXIT(test_slab());
+    IF_ERR_EXIT(test_peers());
 
 EXIT:
     if (!err) {
@@ -158,6 +163,17 @@ test_session_deinit(test_session* s)
     uecc_key_deinit(&s->skey_b);
 }
 
+void
+test_session_flush(test_session* s)
+{
+    // Queued frames land in io.b, as the remote would read them
+    rlpx_io* io[2] = { s->alice, s->bob };
+    for (int i = 0; i < 2; i++) {
+        io[i]->io.len =
+            async_io_tx_read(&io[i]->io, io[i]->io.b, sizeof(io[i]->io.b));
+    }
+}
+
 int
 cmp_q(const uecc_public_key* a, const uecc_public_key* b)
 {
@@ -22,10 +22,16 @@
 #ifndef TEST_H_
 #define TEST_H_
 
+#include "kademlia/kindex.h"
+#include "kademlia/klookup.h"
 #include "kademlia/ktable.h"
 #include "rlpx_devp2p.h"
 #include "rlpx_discovery.h"
+#include "rlpx_discv5.h"
 #include "rlpx_io.h"
+#include "rlpx_nodedb.h"
+#include "rlpx_peers.h"
+#include "rlpx_slab.h"
 #include "rlpx_test_helpers.h"
 #include "test_vectors.h"
 #include "unonce.h"
@@ -43,6 +49,9 @@
         if ((val = (f)) < 0) goto EXIT;                                        \
     } while (0)
 
+// Any socket, mock io does not touch it
+#define TEST_MOCK_SOCK 3
+
 typedef struct
 {
     const char* auth;    /*!< auth cipher text */
@@ -72,12 +81,18 @@ int cmp_q(const uecc_public_key* a, const uecc_public_key* b);
 int check_q(const uecc_public_key* key, const char* str);
 int test_session_init(test_session*, int);
 void test_session_deinit(test_session*);
+void test_session_flush(test_session*);
 
 int test_handshake(void);
 int test_frame(void);
 int test_protocol(void);
 int test_enode(void);
+int test_enr(void);
 int test_kademlia(void);
 int test_discovery(void);
+int test_discv5(void);
+int test_nodedb(void);
+int test_slab(void);
+int test_peers(void);
 
 #endif
@@ -20,6 +20,7 @@
  */
 
 #include "test.h"
+#include "usys_time.h"
 
 uint32_t g_disc_ping_v4_len;
 uint32_t g_disc_ping_v555_len;
@@ -48,6 +49,24 @@ int test_disc_read();
 // Test some protocol ops
 int test_disc_protocol();
 
+// Budgets per source and for everyone, checked before any crypto
+int test_disc_limit();
+
+// Endpoint proofs, FINDNODE answered once the sender proved its endpoint
+int test_disc_bond();
+
+// Records announced by PING and PONG, fetched with ENRRequest
+int test_disc_enr();
+const usys_dgram* test_disc_sent(async_udp* udp, int type);
+
+// Lookup across tables on loopback
+int test_disc_lookup();
+void test_disc_on_dgrams(void* ctx, const usys_dgram* d, uint32_t n);
+void test_disc_on_lookup(void* ctx, klookup* l);
+
+// A full bucket pings its oldest node, which makes room unless it answers
+int test_disc_bucket();
+
 // check functions
 int check_ping_v4(rlpx_discovery_table* t, int type, const urlp* rlp);
 int check_ping_v555(rlpx_discovery_table* t, int type, const urlp* rlp);
@@ -88,6 +107,11 @@ test_discovery()
     err |= test_disc_read();
     err |= test_disc_write();
     err |= test_disc_protocol();
+    err |= test_disc_limit();
+    err |= test_disc_bond();
+    err |= test_disc_enr();
+    err |= test_disc_lookup();
+    err |= test_disc_bucket();
 
     // Free test vectors
     rlpx_free(g_disc_ping_v4_bin);
@@ -112,7 +136,7 @@ test_disc_read()
     uecc_public_key nodeid;
     int type, err;
     // usys_sockaddr sock_addr;
-    rlpx_discovery_table_init(&table);
+    if (rlpx_discovery_table_init(&table)) return -1;
 
     // Construct test vector arrays for loop
     const uint8_t* reads[5] = { g_disc_ping_v4_bin,
@@ -140,13 +164,491 @@ test_disc_read()
         }
     }
 
+    rlpx_discovery_table_deinit(&table);
     return 0;
 }
 
 int
 test_disc_protocol()
 {
-    return 0;
+    int err = -1, type, c;
+    uecc_ctx key, peer;
+    uecc_public_key q;
+    rlpx_discovery_table table, learn;
+    kpeer nodes[RLPX_DISCOVERY_NEIGHBOURS_MAX];
+    uint32_t slots[RLPX_DISCOVERY_NEIGHBOURS_MAX];
+    rlpx_discovery_endpoint to, ep = {.ip = { 127, 0, 0, 1 },
+                                      .iplen = 4,
+                                      .udp = 30303,
+                                      .tcp = 30304 };
+    h256 echo;
+    uint8_t b[ASYNC_UDP_MTU], a[65], z[65], out[32];
+    uint32_t l, ts = 0x5a000000, ts2, i, n;
+    urlp* rlp = NULL;
+    const urlp* crlp;
+
+    if (uecc_key_init_new(&key)) return -1;
+    err = rlpx_discovery_table_init(&table);
+    err |= rlpx_discovery_table_init(&learn);
+    if (err) goto EXIT;
+
+    // Pong signed with our key, parsed back
+    memset(echo.b, 0xab, sizeof(echo.b));
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_pong(
+        ts, &echo, &ep, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&key, RLPX_DISCOVERY_PONG, b, &l));
+    IF_ERR_EXIT(rlpx_discovery_parse(b, l, &q, &type, &rlp));
+    IF_ERR_EXIT(uecc_qtob(&q, a, sizeof(a)));
+    IF_ERR_EXIT(uecc_qtob(&key.Q, z, sizeof(z)));
+    err = -1;
+    if (!(type == RLPX_DISCOVERY_PONG && !memcmp(a, z, 65))) goto EXIT;
+    crlp = rlp;
+    IF_ERR_EXIT(rlpx_discovery_parse_pong(&crlp, &to, out, &ts2));
+    err = -1;
+    if (!(ts2 == ts && !memcmp(out, echo.b, 32))) goto EXIT;
+    if (!(to.iplen == 4 && to.udp == ep.udp && to.tcp == ep.tcp)) goto EXIT;
+    urlp_free(&rlp);
+
+    // A full bucket of ipv6 neighbours doesn't fit one packet
+    memset(ep.ip, 0xfe, sizeof(ep.ip));
+    for (i = 0; i < RLPX_DISCOVERY_NEIGHBOURS_MAX; i++) {
+        if (uecc_key_init_new(&peer)) goto EXIT;
+        c = rlpx_discovery_table_add_node(
+            &table, ep.ip, 16, ep.tcp, ep.udp, &peer.Q, NULL);
+        uecc_key_deinit(&peer);
+        if (c) goto EXIT;
+    }
+    n = ktable_closest(&table.nodes, &table.self, slots, KTABLE_K);
+    if (!(n == RLPX_DISCOVERY_NEIGHBOURS_MAX)) goto EXIT;
+    for (i = 0; i < n; i++) nodes[i] = *ktable_peer(&table.nodes, slots[i]);
+    for (i = 0; i < RLPX_DISCOVERY_NEIGHBOURS_MAX; i += c) {
+        l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+        c = rlpx_discovery_print_neighbours(
+            &nodes[i],
+            RLPX_DISCOVERY_NEIGHBOURS_MAX - i,
+            ts,
+            &b[RLPX_DISCOVERY_HEADER],
+            &l);
+        if (!(c > 0 && (i || c < RLPX_DISCOVERY_NEIGHBOURS_MAX))) goto EXIT;
+        if (!(rlp = urlp_parse(&b[RLPX_DISCOVERY_HEADER], l))) goto EXIT;
+        crlp = rlp;
+        if (rlpx_discovery_parse_neighbours(&learn, &crlp)) goto EXIT;
+        urlp_free(&rlp);
+        if (!(ktable_size(&learn.nodes) == i + c)) goto EXIT;
+    }
+    err = 0;
+
+EXIT:
+    if (rlp) urlp_free(&rlp);
+    rlpx_discovery_table_deinit(&table);
+    rlpx_discovery_table_deinit(&learn);
+    uecc_key_deinit(&key);
+    return err;
+}
+
+int
+test_disc_limit()
+{
+    int err = -1;
+    rlpx_ratelimit rl;
+    rlpx_discovery_table table;
+    usys_sockaddr from = {.ip = 0x0100007f, .port = 0x5f76 };
+    rlpx_metrics m0, m1;
+    uint8_t b[ASYNC_UDP_MTU + 1];
+    uint32_t i, ip;
+    int64_t now = 1000;
+
+    if (rlpx_ratelimit_init(&rl, 64)) return -1;
+    if (rlpx_discovery_table_init(&table)) goto EXIT;
+
+    // A source gets its burst, then its rate
+    for (i = 0; i < RLPX_RATELIMIT_BURST; i++) {
+        IF_ERR_EXIT(rlpx_ratelimit_take(&rl, 1, now));
+    }
+    err = -1;
+    if (!rlpx_ratelimit_take(&rl, 1, now)) goto EXIT;
+    if (rlpx_ratelimit_take(&rl, 2, now)) goto EXIT;
+    now += 1000 / RLPX_RATELIMIT_RATE;
+    if (rlpx_ratelimit_take(&rl, 1, now)) goto EXIT;
+    if (!rlpx_ratelimit_take(&rl, 1, now)) goto EXIT;
+
+    // Many new sources churn the table (1 is forgotten, starts full again)
+    for (ip = 3; ip < 3 + 64 * RLPX_RATELIMIT_WAYS; ip++) {
+        if (rlpx_ratelimit_take(&rl, ip, now + 1)) goto EXIT;
+    }
+    if (rlpx_ratelimit_take(&rl, 1, now + 1)) goto EXIT;
+
+    // Everyone shares the global budget
+    rl.global = 10;
+    rl.tokens = rl.global * 1000;
+    for (i = 0; i < 10; i++) {
+        if (rlpx_ratelimit_take(&rl, 0x1000 + i, now + 1)) goto EXIT;
+    }
+    if (!rlpx_ratelimit_take(&rl, 0x2000, now + 1)) goto EXIT;
+    if (rlpx_ratelimit_take(&rl, 0x2000, now + 101)) goto EXIT;
+
+    // Discovery drops runts, giants and unknown types before parsing
+    rlpx_metrics_snapshot(&m0);
+    memset(b, 0, sizeof(b));
+    b[RLPX_DISCOVERY_HEADER - 1] = RLPX_DISCOVERY_PING;
+    if (!rlpx_discovery_recv(&table, b, RLPX_DISCOVERY_HEADER, &from)) {
+        goto EXIT;
+    }
+    if (!rlpx_discovery_recv(&table, b, sizeof(b), &from)) goto EXIT;
+    b[RLPX_DISCOVERY_HEADER - 1] = 9;
+    if (!rlpx_discovery_recv(&table, b, 200, &from)) goto EXIT;
+
+    // And a source over budget before the hash is checked
+    b[RLPX_DISCOVERY_HEADER - 1] = RLPX_DISCOVERY_PING;
+    for (i = 0; i < RLPX_RATELIMIT_BURST + 4; i++) {
+        rlpx_discovery_recv(&table, b, 200, &from);
+    }
+    rlpx_metrics_snapshot(&m1);
+    i = RLPX_METRIC_DISC_INVALID;
+    if (!(m1.c[i] - m0.c[i] == 3 + RLPX_RATELIMIT_BURST)) goto EXIT;
+    i = RLPX_METRIC_DISC_LIMITED;
+    if (!(m1.c[i] - m0.c[i] == 4)) goto EXIT;
+    err = 0;
+
+EXIT:
+    rlpx_discovery_table_deinit(&table);
+    rlpx_ratelimit_deinit(&rl);
+    return err;
+}
+
+int
+test_disc_bond()
+{
+    int err = -1;
+    rlpx_bond bond;
+    rlpx_bond_node* n;
+    rlpx_discovery_table table;
+    rlpx_discovery_endpoint ep = {.ip = { 127, 0, 0, 1 },
+                                  .iplen = 4,
+                                  .udp = 30303,
+                                  .tcp = 30303 };
+    usys_sockaddr from = {.ip = 0x0100007f, .port = 0x5f76 };
+    uecc_ctx key, peer;
+    async_udp udp;
+    knode id;
+    h256 echo;
+    uint8_t b[ASYNC_UDP_MTU], x[32], y[32], target[64];
+    uint32_t i, l;
+
+    memset(&id, 1, sizeof(id));
+    memset(x, 'x', sizeof(x));
+    memset(y, 'y', sizeof(y));
+    if (rlpx_bond_init(&bond, 8)) return -1;
+    if (uecc_key_init_new(&key)) goto EXIT;
+    if (uecc_key_init_new(&peer)) goto EXIT;
+    if (async_udp_init(&udp, NULL, NULL)) goto EXIT;
+    if (rlpx_discovery_table_init(&table)) goto EXIT;
+    rlpx_discovery_table_bind(&table, &key, &udp);
+
+    // Only the pong of our ping in flight proves an endpoint, and only once
+    if (!(n = rlpx_bond_get(&bond, &id, 1, 1000))) goto EXIT;
+    if (!rlpx_bond_pong(n, x, 1000)) goto EXIT;
+    rlpx_bond_ping(n, x, 1000);
+    if (!rlpx_bond_pong(n, y, 1100)) goto EXIT;
+    if (rlpx_bond_pong(n, x, 1100)) goto EXIT;
+    if (!rlpx_bond_pong(n, x, 1200)) goto EXIT;
+    if (!(rlpx_bond_proven(n, 1, 1200) && !rlpx_bond_proven(n, 2, 1200))) {
+        goto EXIT;
+    }
+    if (rlpx_bond_proven(n, 1, 1100 + RLPX_BOND_MS)) goto EXIT;
+    rlpx_bond_ping(n, x, 2000);
+    if (!rlpx_bond_pong(n, x, 2000 + RLPX_BOND_PING_MS)) goto EXIT;
+
+    // Another ip proves itself again, a full table evicts
+    if (!(rlpx_bond_get(&bond, &id, 2, 3000) == n)) goto EXIT;
+    if (rlpx_bond_proven(n, 2, 3000) || rlpx_bond_known(n, 3000)) goto EXIT;
+    for (i = 0; i < 8; i++) {
+        id.b[0] = 2 + i;
+        if (!rlpx_bond_get(&bond, &id, 1, 4000 + i)) goto EXIT;
+    }
+    if (!(bond.n == 8 && rlpx_bond_find(&bond, &id))) goto EXIT;
+
+    // A stranger's ping is answered and pinged back, its FINDNODE isn't
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_ping(
+        4, &ep, &ep, usys_epoch() + 20, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&peer, RLPX_DISCOVERY_PING, b, &l));
+    IF_ERR_EXIT(rlpx_discovery_recv(&table, b, l, &from));
+    err = -1;
+    if (!(udp.tx_n == 2 && udp.tx[1].b[RLPX_DISCOVERY_HEADER - 1] ==
+                               RLPX_DISCOVERY_PING)) {
+        goto EXIT;
+    }
+    memcpy(echo.b, udp.tx[1].b, 32);
+    udp.tx_n = 0;
+    memset(target, 7, sizeof(target));
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_find(
+        target, usys_epoch() + 20, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&peer, RLPX_DISCOVERY_FIND, b, &l));
+    err = -1;
+    if (!rlpx_discovery_recv(&table, b, l, &from) || udp.tx_n) goto EXIT;
+
+    // Its pong proves it, then FINDNODE is answered and pings aren't repeated
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_pong(
+        usys_epoch() + 20, &echo, &ep, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&peer, RLPX_DISCOVERY_PONG, b, &l));
+    IF_ERR_EXIT(rlpx_discovery_recv(&table, b, l, &from));
+    err = -1;
+    if (!rlpx_discovery_recv(&table, b, l, &from)) goto EXIT;
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_find(
+        target, usys_epoch() + 20, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&peer, RLPX_DISCOVERY_FIND, b, &l));
+    IF_ERR_EXIT(rlpx_discovery_recv(&table, b, l, &from));
+    err = -1;
+    if (!(udp.tx_n == 1)) goto EXIT;
+    l = sizeof(b) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_ping(
+        4, &ep, &ep, usys_epoch() + 20, &b[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&peer, RLPX_DISCOVERY_PING, b, &l));
+    IF_ERR_EXIT(rlpx_discovery_recv(&table, b, l, &from));
+    err = (udp.tx_n == 2) ? 0 : -1;
+
+EXIT:
+    rlpx_discovery_table_deinit(&table);
+    async_udp_deinit(&udp);
+    uecc_key_deinit(&key);
+    uecc_key_deinit(&peer);
+    rlpx_bond_deinit(&bond);
+    return err;
+}
+
+int
+test_disc_enr()
+{
+    int err = -1;
+    rlpx_discovery_table a, b;
+    rlpx_discovery_endpoint ep = {.ip = { 127, 0, 0, 1 },
+                                  .iplen = 4,
+                                  .udp = 30303,
+                                  .tcp = 30303 };
+    usys_sockaddr from_a = {.ip = 0x0100007f, .port = 0x5f76 },
+                  from_b = {.ip = 0x0100007f, .port = 0x6076 };
+    const usys_dgram *ping, *pong, *req, *res;
+    const rlpx_enr* enr;
+    uecc_ctx key_a, key_b;
+    async_udp udp_a, udp_b;
+    uint8_t buf[ASYNC_UDP_MTU], pub[65];
+    uint32_t l;
+    knode id_a;
+
+    if (uecc_key_init_new(&key_a)) return -1;
+    if (uecc_key_init_new(&key_b)) goto EXIT;
+    if (async_udp_init(&udp_a, NULL, NULL)) goto EXIT;
+    if (async_udp_init(&udp_b, NULL, NULL)) goto EXIT;
+    if (rlpx_discovery_table_init(&a)) goto EXIT;
+    if (rlpx_discovery_table_init(&b)) goto EXIT;
+    rlpx_discovery_table_bind(&a, &key_a, &udp_a);
+    rlpx_discovery_table_bind(&b, &key_b, &udp_b);
+    rlpx_discovery_table_endpoint(&a, &ep);
+    if (uecc_qtob(&key_a.Q, pub, sizeof(pub))) goto EXIT;
+    rlpx_discovery_node_id(&pub[1], &id_a);
+    IF_ERR_EXIT(rlpx_discovery_table_add_node(
+        &b, ep.ip, ep.iplen, ep.tcp, ep.udp, &key_a.Q, NULL));
+    err = -1;
+    if (rlpx_discovery_table_enr(&b, &id_a)) goto EXIT;
+
+    // b pings a, a answers and pings back announcing its record
+    l = sizeof(buf) - RLPX_DISCOVERY_HEADER;
+    IF_ERR_EXIT(rlpx_discovery_print_ping(
+        4, &ep, &ep, usys_epoch() + 20, &buf[RLPX_DISCOVERY_HEADER], &l));
+    IF_ERR_EXIT(rlpx_discovery_sign(&key_b, RLPX_DISCOVERY_PING, buf, &l));
+    IF_ERR_EXIT(rlpx_discovery_recv(&a, buf, l, &from_b));
+    err = -1;
+    if (!(ping = test_disc_sent(&udp_a, RLPX_DISCOVERY_PING))) goto EXIT;
+
+    // b answers, knows a (it ponged) and asks for the newer record
+    IF_ERR_EXIT(rlpx_discovery_recv(&b, ping->b, ping->len, &from_a));
+    err = -1;
+    if (!(pong = test_disc_sent(&udp_b, RLPX_DISCOVERY_PONG))) goto EXIT;
+    if (!(req = test_disc_sent(&udp_b, RLPX_DISCOVERY_ENR_REQUEST))) goto EXIT;
+
+    // a answers once b proved its endpoint
+    udp_a.tx_n = 0;
+    if (!rlpx_discovery_recv(&a, req->b, req->len, &from_b)) goto EXIT;
+    IF_ERR_EXIT(rlpx_discovery_recv(&a, pong->b, pong->len, &from_b));
+    IF_ERR_EXIT(rlpx_discovery_recv(&a, req->b, req->len, &from_b));
+    err = -1;
+    if (!(res = test_disc_sent(&udp_a, RLPX_DISCOVERY_ENR_RESPONSE))) goto EXIT;
+
+    // b keeps it, once
+    IF_ERR_EXIT(rlpx_discovery_recv(&b, res->b, res->len, &from_a));
+    err = -1;
+    if (!rlpx_discovery_recv(&b, res->b, res->len, &from_a)) goto EXIT;
+    if (!(enr = rlpx_discovery_table_enr(&b, &id_a))) goto EXIT;
+    if (!(enr->seq == rlpx_enr_local_seq(&a.enr) && enr->udp == ep.udp &&
+          !memcmp(&enr->id, &id_a, sizeof(knode)))) {
+        goto EXIT;
+    }
+    err = 0;
+
+EXIT:
+    rlpx_discovery_table_deinit(&a);
+    rlpx_discovery_table_deinit(&b);
+    async_udp_deinit(&udp_a);
+    async_udp_deinit(&udp_b);
+    uecc_key_deinit(&key_a);
+    uecc_key_deinit(&key_b);
+    return err;
+}
+
+const usys_dgram*
+test_disc_sent(async_udp* udp, int type)
+{
+    uint32_t i;
+    for (i = 0; i < udp->tx_n; i++) {
+        if (udp->tx[i].b[RLPX_DISCOVERY_HEADER - 1] == type) return &udp->tx[i];
+    }
+    return NULL;
+}
+
+int
+test_disc_lookup()
+{
+    // a knows b and d (never answers), b knows c. a looks c up.
+    int err = -1;
+    uint8_t ip[4] = { 127, 0, 0, 1 }, pub[65];
+    uint32_t i, idx[KLOOKUP_K], n = 0, port = 40401;
+    uecc_ctx keys[4];
+    rlpx_discovery_table tables[3];
+    rlpx_discovery_node* node;
+    async_udp udp[3];
+    async_loop loop;
+    knode c, d;
+    int64_t end;
+    klookup* found = NULL;
+
+    if (async_loop_init(&loop)) return -1;
+    for (i = 0; i < 4; i++) uecc_key_init_new(&keys[i]);
+    for (i = 0; i < 3; i++) {
+        rlpx_discovery_table_init(&tables[i]);
+        async_udp_init(&udp[i], &tables[i], test_disc_on_dgrams);
+    }
+    for (i = 0; i < 3; i++) {
+        if (async_udp_listen(&udp[i], &loop, port + i)) goto EXIT;
+        rlpx_discovery_table_bind(&tables[i], &keys[i], &udp[i]);
+    }
+    rlpx_discovery_table_add_node(
+        &tables[0], ip, 4, port + 1, port + 1, &keys[1].Q, NULL);
+    rlpx_discovery_table_add_node(
+        &tables[0], ip, 4, port + 3, port + 3, &keys[3].Q, NULL);
+    rlpx_discovery_table_add_node(
+        &tables[1], ip, 4, port + 2, port + 2, &keys[2].Q, NULL);
+
+    // Converges once d timed out
+    uecc_qtob(&keys[2].Q, pub, sizeof(pub));
+    rlpx_discovery_node_id(&pub[1], &c);
+    IF_ERR_EXIT(rlpx_discovery_table_lookup(
+        &tables[0], &pub[1], test_disc_on_lookup, &found));
+    end = usys_now() + RLPX_DISCOVERY_FIND_MS * 4;
+    while (!found && usys_now() < end) {
+        async_loop_poll(&loop, 10);
+        for (i = 0; i < 3; i++) {
+            if (async_udp_busy(&udp[i])) async_udp_poll(&udp[i]);
+            if (async_udp_tx_pending(&udp[i])) async_udp_flush(&udp[i]);
+        }
+    }
+    err = -1;
+    if (!found) goto EXIT;
+    n = klookup_results(found, idx, KLOOKUP_K);
+    if (!(n == 2 && !memcmp(&found->nodes[idx[0]].id, &c, sizeof(c)))) {
+        goto EXIT;
+    }
+
+    // d failed once, it stays until RLPX_DISCOVERY_FAILS in a row
+    uecc_qtob(&keys[3].Q, pub, sizeof(pub));
+    rlpx_discovery_node_id(&pub[1], &d);
+    if (rlpx_discovery_table_find_node(&tables[0], &d, &node)) goto EXIT;
+    if (!(node->fails == 1)) goto EXIT;
+    err = 0;
+
+EXIT:
+    for (i = 0; i < 3; i++) {
+        rlpx_discovery_table_deinit(&tables[i]);
+        async_udp_deinit(&udp[i]);
+    }
+    for (i = 0; i < 4; i++) uecc_key_deinit(&keys[i]);
+    async_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_disc_bucket()
+{
+    int err = -1, c;
+    uint8_t ip[4] = { 127, 0, 0, 1 }, pub[65];
+    uint32_t n = 0, port = 40411;
+    rlpx_discovery_table table;
+    rlpx_discovery_node* node;
+    uecc_ctx key, peer;
+    async_udp udp;
+    async_loop loop;
+    knode id, first;
+    int64_t end;
+
+    if (async_loop_init(&loop)) return -1;
+    uecc_key_init_new(&key);
+    rlpx_discovery_table_init(&table);
+    async_udp_init(&udp, &table, test_disc_on_dgrams);
+    if (async_udp_listen(&udp, &loop, port)) goto EXIT;
+    rlpx_discovery_table_bind(&table, &key, &udp);
+
+    // Furthest bucket fills with nodes nobody answers for, one more waits
+    while (n <= KTABLE_K) {
+        if (uecc_key_init_new(&peer)) goto EXIT;
+        uecc_qtob(&peer.Q, pub, sizeof(pub));
+        rlpx_discovery_node_id(&pub[1], &id);
+        c = 0;
+        if (knode_distance(&table.self, &id) == KTABLE_BUCKETS) {
+            if (!n++) first = id;
+            c = rlpx_discovery_table_add_node(
+                &table, ip, 4, port + 1, port + 1, &peer.Q, NULL);
+        }
+        uecc_key_deinit(&peer);
+        if (c) goto EXIT;
+    }
+    if (!(ktable_size(&table.nodes) == KTABLE_K)) goto EXIT;
+    if (!rlpx_discovery_table_find_node(&table, &id, &node)) goto EXIT;
+    if (!test_disc_sent(&udp, RLPX_DISCOVERY_PING)) goto EXIT;
+
+    // The oldest never answers its ping, the replacement takes its place
+    end = usys_now() + RLPX_BOND_PING_MS * 2;
+    while (!rlpx_discovery_table_find_node(&table, &first, &node) &&
+           usys_now() < end) {
+        async_loop_poll(&loop, 10);
+        if (async_udp_busy(&udp)) async_udp_poll(&udp);
+        if (async_udp_tx_pending(&udp)) async_udp_flush(&udp);
+    }
+    if (!rlpx_discovery_table_find_node(&table, &first, &node)) goto EXIT;
+    if (rlpx_discovery_table_find_node(&table, &id, &node)) goto EXIT;
+    err = 0;
+
+EXIT:
+    rlpx_discovery_table_deinit(&table);
+    async_udp_deinit(&udp);
+    uecc_key_deinit(&key);
+    async_loop_deinit(&loop);
+    return err;
+}
+
+void
+test_disc_on_dgrams(void* ctx, const usys_dgram* d, uint32_t n)
+{
+    rlpx_discovery_recv_batch(ctx, d, n);
+}
+
+void
+test_disc_on_lookup(void* ctx, klookup* l)
+{
+    *(klookup**)ctx = l;
 }
 
 int
@@ -199,8 +701,8 @@ check_find_node(rlpx_discovery_table* t, int type, const urlp* rlp)
     int err = -1;
     if (type != 3) return err;
     uint32_t ts;
-    uecc_public_key q;
-    err = rlpx_discovery_parse_find(&rlp, &q, &ts);
+    uint8_t target[64];
+    err = rlpx_discovery_parse_find(&rlp, target, &ts);
     return err;
 }
 
@@ -208,7 +710,22 @@ int
 check_neighbours(rlpx_discovery_table* t, int type, const urlp* rlp)
 {
     int err = -1;
+    rlpx_discovery_node* n;
+    uint32_t slots[KTABLE_K], c;
+    knode id;
     if (type != 4) return err;
     err = rlpx_discovery_parse_neighbours(t, &rlp);
+    if (err) return err;
+
+    // Every neighbour is found by id, and gone once removed
+    if (!(c = ktable_closest(&t->nodes, &t->self, slots, KTABLE_K))) return -1;
+    for (uint32_t i = 0; i < c; i++) {
+        rlpx_discovery_node_id(ktable_peer(&t->nodes, slots[i])->pub, &id);
+        if (rlpx_discovery_table_find_node(t, &id, &n)) return -1;
+        if (!(n == ktable_value(&t->nodes, slots[i]))) return -1;
+    }
+    id = *ktable_id(&t->nodes, slots[0]);
+    if (rlpx_discovery_table_remove_node(t, &id)) return -1;
+    if (!rlpx_discovery_table_find_node(t, &id, &n)) return -1;
     return err;
 }
@@ -0,0 +1,351 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "test.h"
+
+// Test vectors of the discv5 wire spec, node A sends to node B
+#define DISCV5_SKEY_A                                                          \
+    "eef77acb6c6a6eebc5b363a475ac583ec7eccdb42b6481424c60f59aa326547f"
+#define DISCV5_SKEY_B                                                          \
+    "66fb62bfbd66b9177a138c1e5cddbe4f7c30c343e94e68df8769459cb1cde628"
+#define DISCV5_ID_A                                                            \
+    "aaaa8419e9f49d0083561b48287df592939a8d19947d8c0ef88f2a4856a69fbb"
+#define DISCV5_ID_B                                                            \
+    "bbbb9d047f0488c0b5a93c1c3f2d8bafc7c8ff337024a55434a0d0555de64db9"
+#define DISCV5_PING                                                            \
+    "00000000000000000000000000000000088b3d4342774649325f313964a39e55ea96c0" \
+    "05ad52be8c7560413a7008f16c9e6d2f43bbea8814a546b7409ce783d34c4f53245d08" \
+    "dab84102ed931f66d1492acb308fa1c6715b9d139b81acbdcc"
+#define DISCV5_WHOAREYOU                                                       \
+    "00000000000000000000000000000000088b3d434277464933a1ccc59f5967ad1d6035" \
+    "f15e528627dde75cd68292f9e6c27d6b66c8100a873fcbaed4e16b8d"
+#define DISCV5_CHALLENGE                                                       \
+    "000000000000000000000000000000006469736376350001010102030405060708090a" \
+    "0b0c00180102030405060708090a0b0c0d0e0f100000000000000000"
+#define DISCV5_EPH_SKEY                                                        \
+    "fb757dc581730490a1d7a00deea65e9b1936924caaea8f44d476014856b68736"
+#define DISCV5_EPH_PUB                                                         \
+    "039961e4c2356d61bedb83052c115d311acb3a96f5777296dcf297351130266231"
+#define DISCV5_DEST_PUB                                                        \
+    "0317931e6e0840220642f230037d285d122bc59063221ef3226b1f403ddc69ca91"
+#define DISCV5_KEYS                                                            \
+    "dccc82d81bd610f4f76d3ebe97a40571ac74bb8773749920b0d3a8881c173ec5"
+#define DISCV5_ID_SIGNATURE                                                    \
+    "94852a1e2318c4e5e9d422c98eaf19d1d90d876b29cd06ca7cb7546d0fff7b484fe86c" \
+    "09a064fe72bdbef73ba8e9c34df0cd2b53e9d65528c2c7f336d5dfc6e6"
+
+typedef struct
+{
+    int type;         /*!< last answer */
+    uint8_t resp[16]; /*!< last TALKRESP */
+    uint32_t len;     /*!< bytes of resp */
+} test_discv5_answers;
+
+int test_discv5_vectors();
+int test_discv5_sessions();
+void test_discv5_on_msg(void*, const knode*, int, const urlp*);
+int test_discv5_on_talk(
+    void*,
+    const knode*,
+    const uint8_t*,
+    uint32_t,
+    const uint8_t*,
+    uint32_t,
+    uint8_t*,
+    uint32_t*);
+
+int
+test_discv5()
+{
+    int err = 0;
+    err |= test_discv5_vectors();
+    err |= test_discv5_sessions();
+    return err;
+}
+
+int
+test_discv5_vectors()
+{
+    int err = -1;
+    uint8_t b[ASYNC_UDP_MTU], h[RLPX_DISCV5_HEADER_MAX], pt[ASYNC_UDP_MTU];
+    uint8_t iv[16], nonce[12], key[16], auth[24], keys[32], sig[64];
+    uint8_t challenge[RLPX_DISCV5_CHALLENGE], eph_pub[33];
+    uint32_t l = sizeof(b), hlen, ptlen;
+    uecc_private_key skey;
+    uecc_ctx eph;
+    knode a, b_id;
+    size_t len;
+
+    memcpy(a.b, makebin(DISCV5_ID_A, NULL), 32);
+    memcpy(b_id.b, makebin(DISCV5_ID_B, NULL), 32);
+    memcpy(skey.b, makebin(DISCV5_EPH_SKEY, NULL), 32);
+    if (uecc_key_init_binary(&eph, &skey)) return -1;
+
+    // Ping message packet (flag 0), read-key zero
+    memset(iv, 0, sizeof(iv));
+    memset(nonce, 0xff, sizeof(nonce));
+    memset(key, 0, sizeof(key));
+    makebin("01c6840000000102", &len);
+    memcpy(pt, makebin("01c6840000000102", NULL), len);
+    IF_ERR_EXIT(rlpx_discv5_encode(
+        &b_id, iv, 0, nonce, a.b, 32, key, pt, len, b, &l));
+    makebin(DISCV5_PING, &len);
+    err = -1;
+    if (!(l == len && !memcmp(b, makebin(DISCV5_PING, NULL), len))) goto EXIT;
+    if (rlpx_discv5_decode(&b_id, b, l, h, &hlen)) goto EXIT;
+    IF_ERR_EXIT(rlpx_discv5_open(key, h, hlen, b, l, pt, &ptlen));
+    err = -1;
+    if (!(ptlen == 8 && !memcmp(&h[RLPX_DISCV5_STATIC], a.b, 32))) goto EXIT;
+    if (!rlpx_discv5_decode(&a, b, l, h, &hlen)) goto EXIT;
+
+    // WHOAREYOU (flag 1)
+    memcpy(nonce, makebin("0102030405060708090a0b0c", NULL), 12);
+    memcpy(auth, makebin("0102030405060708090a0b0c0d0e0f10", NULL), 16);
+    memset(&auth[16], 0, 8);
+    l = sizeof(b);
+    IF_ERR_EXIT(rlpx_discv5_encode(
+        &b_id, iv, 1, nonce, auth, 24, NULL, NULL, 0, b, &l));
+    makebin(DISCV5_WHOAREYOU, &len);
+    err = -1;
+    if (!(l == len && !memcmp(b, makebin(DISCV5_WHOAREYOU, NULL), len))) {
+        goto EXIT;
+    }
+    if (!(rlpx_discv5_decode(&b_id, b, l, h, &hlen) == 1)) goto EXIT;
+
+    // Handshake keys and identity proof over the challenge
+    memcpy(challenge, makebin(DISCV5_CHALLENGE, NULL), sizeof(challenge));
+    memcpy(eph_pub, makebin(DISCV5_DEST_PUB, NULL), 33);
+    IF_ERR_EXIT(rlpx_discv5_derive_keys(
+        &eph, eph_pub, challenge, sizeof(challenge), &a, &b_id, keys));
+    IF_ERR_EXIT(memcmp(keys, makebin(DISCV5_KEYS, NULL), 32) ? -1 : 0);
+    memcpy(eph_pub, makebin(DISCV5_EPH_PUB, NULL), 33);
+    IF_ERR_EXIT(rlpx_discv5_id_sign(
+        &eph, challenge, sizeof(challenge), eph_pub, &b_id, sig));
+    IF_ERR_EXIT(memcmp(sig, makebin(DISCV5_ID_SIGNATURE, NULL), 64) ? -1 : 0);
+    IF_ERR_EXIT(uecc_qtob(&eph.Q, pt, 33));
+    IF_ERR_EXIT(rlpx_discv5_id_verify(
+        pt, challenge, sizeof(challenge), eph_pub, &b_id, sig));
+    sig[0] ^= 1;
+    err = rlpx_discv5_id_verify(
+              pt, challenge, sizeof(challenge), eph_pub, &b_id, sig)
+              ? 0
+              : -1;
+
+EXIT:
+    uecc_key_deinit(&eph);
+    return err;
+}
+
+int
+test_discv5_sessions()
+{
+    int err = -1;
+    usys_sockaddr from_a = {.ip = 0x0100007f, .port = 0x5f76 },
+                  from_b = {.ip = 0x0100007f, .port = 0x6076 },
+                  from = {.port = 0x5f76 };
+    uint8_t ip[4] = { 127, 0, 0, 1 }, b[ASYNC_UDP_MTU];
+    rlpx_discv5 a, b5;
+    rlpx_enr_local enr_a, enr_b, enr_c;
+    test_discv5_answers answers;
+    uecc_private_key skey;
+    uecc_ctx key_a, key_b, key_c;
+    async_udp udp_a, udp_b;
+    const rlpx_enr* signed_enr;
+    rlpx_enr enr;
+    uint16_t d = 0;
+    uint32_t req, l;
+
+    memset(&answers, 0, sizeof(answers));
+    memset(&a, 0, sizeof(a));
+    memset(&b5, 0, sizeof(b5));
+    memcpy(skey.b, makebin(DISCV5_SKEY_A, NULL), 32);
+    if (uecc_key_init_binary(&key_a, &skey)) return -1;
+    memcpy(skey.b, makebin(DISCV5_SKEY_B, NULL), 32);
+    if (uecc_key_init_binary(&key_b, &skey)) {
+        uecc_key_deinit(&key_a);
+        return -1;
+    }
+    memcpy(skey.b, makebin(DISCV5_EPH_SKEY, NULL), 32);
+    if (uecc_key_init_binary(&key_c, &skey)) {
+        uecc_key_deinit(&key_a);
+        uecc_key_deinit(&key_b);
+        return -1;
+    }
+    if (async_udp_init(&udp_a, NULL, NULL)) goto EXIT;
+    if (async_udp_init(&udp_b, NULL, NULL)) goto EXIT;
+    IF_ERR_EXIT(rlpx_enr_local_init(&enr_a, &key_a.Q, 1));
+    IF_ERR_EXIT(rlpx_enr_local_set_mem(&enr_a, "ip", ip, 4));
+    IF_ERR_EXIT(rlpx_enr_local_set_u32(&enr_a, "udp", 30303));
+    IF_ERR_EXIT(rlpx_enr_local_init(&enr_b, &key_b.Q, 1));
+    IF_ERR_EXIT(rlpx_enr_local_set_mem(&enr_b, "ip", ip, 4));
+    IF_ERR_EXIT(rlpx_enr_local_set_u32(&enr_b, "udp", 30304));
+    IF_ERR_EXIT(rlpx_discv5_init(&a, &answers, test_discv5_on_msg, NULL));
+    IF_ERR_EXIT(rlpx_discv5_init(
+        &b5, &answers, test_discv5_on_msg, test_discv5_on_talk));
+    IF_ERR_EXIT(rlpx_discv5_bind(&a, &key_a, &enr_a, &udp_a));
+    IF_ERR_EXIT(rlpx_discv5_bind(&b5, &key_b, &enr_b, &udp_b));
+    IF_ERR_EXIT(memcmp(a.self.b, makebin(DISCV5_ID_A, NULL), 32) ? -1 : 0);
+    IF_ERR_EXIT(memcmp(b5.self.b, makebin(DISCV5_ID_B, NULL), 32) ? -1 : 0);
+
+    // a knows b's record, b knows nothing of a
+    err = -1;
+    if (!(signed_enr = rlpx_enr_local_sign(&enr_b, &key_b))) goto EXIT;
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, signed_enr->b, signed_enr->len));
+    IF_ERR_EXIT(rlpx_discv5_add_node(&a, &enr));
+
+    // a's ping can't open, b challenges, a answers with the ping again
+    IF_ERR_EXIT(rlpx_discv5_ping(&a, &b5.self, &req));
+    IF_ERR_EXIT((udp_a.tx_n == 1) ? 0 : -1);
+    IF_ERR_EXIT(
+        rlpx_discv5_is_packet(&b5, udp_a.tx[0].b, udp_a.tx[0].len) ? 0 : -1);
+    IF_ERR_EXIT(
+        rlpx_discv5_is_packet(&a, udp_a.tx[0].b, udp_a.tx[0].len) ? -1 : 0);
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_b.tx_n == 1 && udp_b.tx[0].len == 63) ? 0 : -1);
+    udp_a.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT((udp_a.tx_n == 1) ? 0 : -1);
+
+    // b verifies, keeps a's record (it held none) and pongs
+    udp_b.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_b.tx_n == 1) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_discv5_find_node(&b5, &a.self) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT((answers.type == RLPX_DISCV5_PONG) ? 0 : -1);
+
+    // A handshake counts once, another endpoint has no session (challenged)
+    IF_ERR_EXIT(
+        rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a) ? 0
+                                                                        : -1);
+    udp_a.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_a.tx_n == 1 && udp_a.tx[0].len == 63) ? 0 : -1);
+
+    // Sources that haven't proven themselves are challenged without taking
+    // a session, however many there are
+    udp_a.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_ping(&a, &b5.self, &req));
+    for (l = 0; l < RLPX_DISCV5_CHALLENGES + 8; l++) {
+        udp_b.tx_n = 0;
+        from.ip = 0x0200000a + (l << 24);
+        IF_ERR_EXIT(
+            rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from));
+        IF_ERR_EXIT((udp_b.tx_n == 1 && udp_b.tx[0].len == 63) ? 0 : -1);
+    }
+    IF_ERR_EXIT((b5.n == 1) ? 0 : -1);
+
+    // Both hold keys now, a request is one packet each way
+    udp_a.tx_n = udp_b.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_talkreq(
+        &a, &b5.self, "test", (const uint8_t*)"ping", 4, &req));
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_b.tx_n == 1) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT((answers.type == RLPX_DISCV5_TALKRESP) ? 0 : -1);
+    IF_ERR_EXIT(memcmp(answers.resp, "pong", 4) ? -1 : 0);
+
+    // FINDNODE 0 is b's own record
+    udp_a.tx_n = udp_b.tx_n = 0;
+    answers.type = 0;
+    IF_ERR_EXIT(rlpx_discv5_findnode(&a, &b5.self, &d, 1, &req));
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_b.tx_n == 1) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT((answers.type == RLPX_DISCV5_NODES) ? 0 : -1);
+
+    // NODES only answer our FINDNODE, with records at the distances asked
+    // for. b holds c's record, a takes it only once it asks for it.
+    IF_ERR_EXIT(rlpx_enr_local_init(&enr_c, &key_c.Q, 1));
+    if (!(signed_enr = rlpx_enr_local_sign(&enr_c, &key_c))) goto EXIT;
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, signed_enr->b, signed_enr->len));
+    IF_ERR_EXIT(rlpx_discv5_add_node(&b5, &enr));
+    d = knode_distance(&b5.self, &enr.id);
+    udp_a.tx_n = udp_b.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_findnode(&a, &b5.self, &d, 1, &req));
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT((udp_b.tx_n == 1) ? 0 : -1);
+    l = 0;
+    while (l < RLPX_DISCV5_SESSIONS && a.sessions[l].find != req) l++;
+    if (!(l < RLPX_DISCV5_SESSIONS)) goto EXIT;
+    a.sessions[l].want[d / 32] ^= 1u << d % 32;
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT(rlpx_discv5_find_node(&a, &enr.id) ? -1 : 0);
+    IF_ERR_EXIT(
+        rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b) ? 0
+                                                                        : -1);
+    udp_a.tx_n = udp_b.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_findnode(&a, &b5.self, &d, 1, &req));
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, udp_a.tx[0].b, udp_a.tx[0].len, &from_a));
+    IF_ERR_EXIT(rlpx_discv5_recv(&a, udp_b.tx[0].b, udp_b.tx[0].len, &from_b));
+    IF_ERR_EXIT(rlpx_discv5_find_node(&a, &enr.id) ? 0 : -1);
+
+    // A message that doesn't open is challenged again
+    udp_a.tx_n = udp_b.tx_n = 0;
+    IF_ERR_EXIT(rlpx_discv5_ping(&a, &b5.self, &req));
+    l = udp_a.tx[0].len;
+    memcpy(b, udp_a.tx[0].b, l);
+    b[l - 1] ^= 1;
+    IF_ERR_EXIT(rlpx_discv5_recv(&b5, b, l, &from_a));
+    err = (udp_b.tx_n == 1 && udp_b.tx[0].len == 63) ? 0 : -1;
+
+EXIT:
+    rlpx_discv5_deinit(&a);
+    rlpx_discv5_deinit(&b5);
+    async_udp_deinit(&udp_a);
+    async_udp_deinit(&udp_b);
+    uecc_key_deinit(&key_a);
+    uecc_key_deinit(&key_b);
+    uecc_key_deinit(&key_c);
+    return err;
+}
+
+void
+test_discv5_on_msg(void* ctx, const knode* from, int type, const urlp* rlp)
+{
+    test_discv5_answers* answers = ctx;
+    answers->type = type;
+    if (type == RLPX_DISCV5_TALKRESP) {
+        answers->len = sizeof(answers->resp);
+        urlp_idx_to_mem(rlp, 1, answers->resp, &answers->len);
+    }
+}
+
+int
+test_discv5_on_talk(
+    void* ctx,
+    const knode* from,
+    const uint8_t* proto,
+    uint32_t protolen,
+    const uint8_t* req,
+    uint32_t reqlen,
+    uint8_t* resp,
+    uint32_t* l)
+{
+    if (!(protolen == 4 && !memcmp(proto, "test", 4))) return -1;
+    memcpy(resp, "pong", 4);
+    *l = 4;
+    return 0;
+}
+
+//
+//
+//
@@ -0,0 +1,121 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "test.h"
+
+// Example record of EIP-778, the key that signed it and its node id
+#define ENR_RECORD                                                             \
+    "f884b8407098ad865b00a582051940cb9cf36836572411a47278783077011599ed5cd16b" \
+    "76f2635f4e234738f30813a89eb9137e3e3df5266e3a1f11df72ecf1145ccb9c01826964" \
+    "827634826970847f00000189736563703235366b31a103ca634cae0d49acb401d8a4c6b6" \
+    "fe8c55b70d115bf400769cc1400f3258cd31388375647082765f"
+#define ENR_SKEY                                                               \
+    "b71c71a67e1177ad4e901695e1b4b9ee17ae16c6668d313eac2f96dbcda3f291"
+#define ENR_ID                                                                 \
+    "a448f24c6d18e575453db13171562b71999873db5b286df957af199ec94617f7"
+
+int test_enr_parse();
+int test_enr_local();
+
+int
+test_enr()
+{
+    int err = 0;
+    err |= test_enr_parse();
+    err |= test_enr_local();
+    return err;
+}
+
+int
+test_enr_parse()
+{
+    int err = 0;
+    rlpx_enr enr;
+    rlpx_node node;
+    uint8_t b[RLPX_ENR_MAX];
+    const uint8_t *val, *rec;
+    uint32_t l;
+    size_t len;
+
+    rec = makebin(ENR_RECORD, &len);
+    memcpy(b, rec, len);
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, b, len));
+    IF_ERR_EXIT((enr.seq == 1) ? 0 : -1);
+    IF_ERR_EXIT((enr.udp == 30303 && !enr.tcp) ? 0 : -1);
+    IF_ERR_EXIT(memcmp(enr.ip, "\x7f\x00\x00\x01", 4) ? -1 : 0);
+    IF_ERR_EXIT(memcmp(enr.id.b, makebin(ENR_ID, NULL), 32) ? -1 : 0);
+    IF_ERR_EXIT(rlpx_enr_get(&enr, "secp256k1", &val, &l));
+    IF_ERR_EXIT((l == 34 && val[0] == 0xa1) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_enr_get(&enr, "tcp", &val, &l) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_node_init_enr(&node, &enr));
+    IF_ERR_EXIT(strcmp(node.ip_v4, "127.0.0.1") ? -1 : 0);
+    IF_ERR_EXIT((node.port_udp == 30303) ? 0 : -1);
+
+    // Any change breaks the signature, trailing bytes the encoding
+    b[len - 1] ^= 1;
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, b, len) ? 0 : -1);
+    b[len - 1] ^= 1;
+    b[len] = 0x80;
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, b, len + 1) ? 0 : -1);
+EXIT:
+    return err;
+}
+
+int
+test_enr_local()
+{
+    int err = 0;
+    uecc_private_key key;
+    uecc_ctx skey;
+    rlpx_enr_local local;
+    rlpx_enr enr;
+    const rlpx_enr* signed_enr;
+    uint8_t ip[4] = { 127, 0, 0, 1 };
+    size_t len;
+
+    memcpy(key.b, makebin(ENR_SKEY, NULL), 32);
+    uecc_key_init_binary(&skey, &key);
+    IF_ERR_EXIT(rlpx_enr_local_init(&local, &skey.Q, 1));
+    IF_ERR_EXIT(rlpx_enr_local_set_mem(&local, "ip", ip, 4));
+    IF_ERR_EXIT(rlpx_enr_local_set_u32(&local, "udp", 30303));
+
+    // Signatures are deterministic, the same record as the example
+    IF_ERR_EXIT((signed_enr = rlpx_enr_local_sign(&local, &skey)) ? 0 : -1);
+    makebin(ENR_RECORD, &len);
+    IF_ERR_EXIT((signed_enr->len == len) ? 0 : -1);
+    IF_ERR_EXIT(memcmp(signed_enr->b, makebin(ENR_RECORD, NULL), len) ? -1 : 0);
+
+    // Cached until a pair changes, which bumps seq
+    IF_ERR_EXIT(rlpx_enr_local_set_u32(&local, "udp", 30303));
+    IF_ERR_EXIT((local.enr.len && rlpx_enr_local_seq(&local) == 1) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_enr_local_set_u32(&local, "udp", 30304));
+    IF_ERR_EXIT((!local.enr.len && rlpx_enr_local_seq(&local) == 2) ? 0 : -1);
+    IF_ERR_EXIT((signed_enr = rlpx_enr_local_sign(&local, &skey)) ? 0 : -1);
+    IF_ERR_EXIT(rlpx_enr_parse(&enr, signed_enr->b, signed_enr->len));
+    IF_ERR_EXIT((enr.seq == 2 && enr.udp == 30304) ? 0 : -1);
+EXIT:
+    uecc_key_deinit(&skey);
+    return err;
+}
+
+//
+//
+//
@@ -60,7 +60,7 @@ test_frame_read()
 
     // Update our secrets
     rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-    rlpx_io_accept(s.bob, &s.alice->skey->Q);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
     IF_ERR_EXIT(rlpx_io_recv_auth(s.bob, s.auth, s.authlen));
     IF_ERR_EXIT(
         rlpx_test_expect_secrets(
@@ -100,9 +100,10 @@ test_frame_write()
     rlpx_io_nonce(s.alice);
     rlpx_io_nonce(s.bob);
     rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-    rlpx_io_accept(s.bob, &s.alice->skey->Q);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
 
     // Recv keys
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv_ack(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv_auth(s.bob, s.alice->io.b, s.alice->io.len));
 
@@ -113,6 +114,7 @@ test_frame_write()
     // Write some packets
     IF_ERR_EXIT(rlpx_io_send_hello(s.alice));
     IF_ERR_EXIT(rlpx_io_send_hello(s.bob));
+    test_session_flush(&s);
     if (!rlpx_frame_parse(&s.alice->x, s.bob->io.b, s.bob->io.len, &rlpb)) {
         goto EXIT;
     }
@@ -31,6 +31,7 @@ extern const char* g_foo;
 int test_read();
 int test_write();
 int test_secrets();
+int test_inbound();
 
 int
 test_handshake()
@@ -39,6 +40,7 @@ test_handshake()
     IF_ERR_EXIT(test_read());
     IF_ERR_EXIT(test_write());
     IF_ERR_EXIT(test_secrets());
+    IF_ERR_EXIT(test_inbound());
 
 EXIT:
     return err;
@@ -57,7 +59,7 @@ test_read()
         rlpx_io_nonce(s.alice);
         rlpx_io_nonce(s.bob);
         rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-        rlpx_io_accept(s.bob, &s.alice->skey->Q);
+        rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
         if (rlpx_io_recv_auth(s.bob, s.auth, s.authlen)) break;
         if (rlpx_io_recv_ack(s.alice, s.ack, s.acklen)) break;
         if (!(s.bob->hs->version_remote == tv->authver)) break;
@@ -83,7 +85,8 @@ test_write()
     rlpx_io_nonce(s.alice);
     rlpx_io_nonce(s.bob);
     rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-    rlpx_io_accept(s.bob, &s.alice->skey->Q);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv_auth(s.bob, s.alice->io.b, s.alice->io.len));
     IF_ERR_EXIT(rlpx_io_recv_ack(s.alice, s.bob->io.b, s.bob->io.len));
 
@@ -94,6 +97,53 @@ EXIT:
     return err;
 }
 
+int
+test_inbound()
+{
+    int err;
+    uint32_t l;
+    uint8_t b[2048];
+    test_session s, t;
+    test_session_init(&s, 1);
+    test_session_init(&t, 1);
+
+    // Bob does not know alice until her auth arrives
+    rlpx_io_nonce(s.alice);
+    rlpx_io_nonce(s.bob);
+    rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
+    IF_ERR_EXIT(rlpx_io_accept(s.bob, TEST_MOCK_SOCK, NULL));
+    IF_ERR_EXIT(s.bob->hs ? -1 : 0);
+    s.bob->hs = rlpx_handshake_alloc(
+        0, s.bob->skey, &s.bob->ekey, &s.bob->nonce, NULL);
+    IF_ERR_EXIT(s.bob->hs ? 0 : -1);
+    test_session_flush(&s);
+    IF_ERR_EXIT(rlpx_io_recv_auth(s.bob, s.alice->io.b, s.alice->io.len));
+    IF_ERR_EXIT(cmp_q(&s.bob->node.id, &s.alice->skey->Q));
+    IF_ERR_EXIT(
+        rlpx_io_recv_ack(s.alice, s.bob->hs->cipher, s.bob->hs->cipher_len));
+    IF_ERR_EXIT(check_q(&s.alice->hs->ekey_remote, g_bob_epub));
+
+    // Auth with a frame right behind it in one read, the frame is not lost
+    rlpx_io_nonce(t.alice);
+    rlpx_io_nonce(t.bob);
+    rlpx_io_connect(t.alice, &t.bob->skey->Q, "1.1.1.1", 33);
+    IF_ERR_EXIT(rlpx_io_accept(t.bob, TEST_MOCK_SOCK, &t.alice->skey->Q));
+    test_session_flush(&t);
+    IF_ERR_EXIT(rlpx_io_recv_ack(t.alice, t.bob->io.b, t.bob->io.len));
+    memcpy(b, t.alice->io.b, l = t.alice->io.len);
+    IF_ERR_EXIT(rlpx_io_send_ping(t.alice));
+    test_session_flush(&t);
+    IF_ERR_EXIT(l + t.alice->io.len <= sizeof(b) ? 0 : -1);
+    memcpy(&b[l], t.alice->io.b, t.alice->io.len);
+    l += t.alice->io.len;
+    IF_ERR_EXIT(t.bob->io.settings.on_recv(t.bob, 0, b, l));
+    IF_ERR_EXIT(t.bob->metrics.c[RLPX_METRIC_FRAMES_IN] == 1 ? 0 : -1);
+EXIT:
+    test_session_deinit(&s);
+    test_session_deinit(&t);
+    return err;
+}
+
 int
 test_secrets()
 {
@@ -111,7 +161,7 @@ test_secrets()
     rlpx_test_nonce_set(s.alice, &s.alice_n);
 
     rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-    rlpx_io_accept(s.bob, &s.alice->skey->Q);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
     rlpx_io_recv_auth(s.bob, s.auth, s.authlen);
     rlpx_io_recv_ack(s.alice, s.ack, s.acklen);
     IF_ERR_EXIT(
@@ -23,40 +23,346 @@
 #include "urand.h"
 
 int test_ktable();
+int test_ktable_closest();
+int test_knode_distances();
+int test_knode_select();
+int test_kindex();
+int test_klookup();
+int test_knode_closer(const knode* a, const knode* b, const knode* target);
 
 int
 test_kademlia()
 {
     int err = 0;
     IF_ERR_EXIT(test_ktable());
+    IF_ERR_EXIT(test_ktable_closest());
+    IF_ERR_EXIT(test_knode_distances());
+    IF_ERR_EXIT(test_knode_select());
+    IF_ERR_EXIT(test_kindex());
+    IF_ERR_EXIT(test_klookup());
 EXIT:
-    err = 0; // TODO
     return err;
 }
 
 int
 test_ktable()
 {
-    /*!< stack */
-    int err = 0;
-    ktable table;   /*!< routing table */
-    knode id, node; /*!< our node, add node */
+    int err = -1, slot, r;
+    ktable table;
+    knode id, nodes[KTABLE_K + 2];
+    kpeer peer;
+
+    memset(&peer, 0, sizeof(peer));
+    urand(id.b, sizeof(id.b));
+    if (ktable_init(&table, &id, sizeof(uint32_t))) return -1;
+
+    // Log distance
+    nodes[0] = id;
+    nodes[0].b[31] ^= 0x01;
+    if (!(knode_distance(&id, &id) == 0)) goto EXIT;
+    if (!(knode_distance(&id, &nodes[0]) == 1)) goto EXIT;
+    nodes[0].b[0] ^= 0x80;
+    if (!(knode_distance(&id, &nodes[0]) == 256)) goto EXIT;
+    if (!(ktable_add_node(&table, &id, &peer) == -1)) goto EXIT;
+
+    // Furthest bucket fills, the rest wait as replacements
+    for (int i = 0; i < KTABLE_K + 2; i++) {
+        urand(nodes[i].b, sizeof(nodes[i].b));
+        nodes[i].b[0] = (id.b[0] ^ 0x80);
+        peer.udp = i;
+        r = ktable_add_node(&table, &nodes[i], &peer);
+        if (!(r == (i < KTABLE_K ? 0 : 1))) goto EXIT;
+        if (!r && (slot = ktable_find(&table, &nodes[i])) >= 0) {
+            *(uint32_t*)ktable_value(&table, slot) = i + 1;
+        }
+    }
+    if (!(ktable_size(&table) == KTABLE_K)) goto EXIT;
+    if (!(ktable_buckets_len(&table) == 1)) goto EXIT;
+    if (!(ktable_find(&table, &nodes[KTABLE_K]) == -1)) goto EXIT;
+
+    // Seen nodes move to the back
+    peer.udp = 100;
+    if (ktable_add_node(&table, &nodes[0], &peer)) goto EXIT;
+    if ((slot = ktable_oldest(&table, &nodes[0])) < 0) goto EXIT;
+    if (!(ktable_peer(&table, slot)->udp == 1)) goto EXIT;
+    if ((slot = ktable_find(&table, &nodes[0])) < 0) goto EXIT;
+    if (!(ktable_peer(&table, slot)->udp == 100)) goto EXIT;
+    if (!(*(uint32_t*)ktable_value(&table, slot) == 1)) goto EXIT;
+
+    // Removed nodes are replaced by the newest replacement
+    if (ktable_remove_node(&table, &nodes[1])) goto EXIT;
+    if (!(ktable_size(&table) == KTABLE_K)) goto EXIT;
+    if ((slot = ktable_find(&table, &nodes[KTABLE_K + 1])) < 0) goto EXIT;
+    if (!(ktable_peer(&table, slot)->udp == KTABLE_K + 1)) goto EXIT;
+    if (!(*(uint32_t*)ktable_value(&table, slot) == 0)) goto EXIT;
+    if (ktable_remove_node(&table, &nodes[KTABLE_K])) goto EXIT;
+    if (ktable_remove_node(&table, &nodes[2])) goto EXIT;
+    if (!(ktable_size(&table) == KTABLE_K - 1)) goto EXIT;
+    if (!(ktable_remove_node(&table, &nodes[1]) == -1)) goto EXIT;
+    err = 0;
+
+EXIT:
+    ktable_deinit(&table);
+    return err;
+}
+
+int
+test_ktable_closest()
+{
+    int err = -1;
+    ktable table;
+    knode id, node, target;
+    kpeer peer;
+    uint32_t slots[KTABLE_K], n, i, d, last = 0;
+
+    memset(&peer, 0, sizeof(peer));
+    urand(id.b, sizeof(id.b));
+    if (ktable_init(&table, &id, 0)) return -1;
+    for (i = 0; i < 1000; i++) {
+        urand(node.b, sizeof(node.b));
+        if (i == 500) target = node;
+        if (ktable_add_node(&table, &node, &peer) < 0) goto EXIT;
+    }
+
+    // Bucket i holds at most K nodes at distance i + 1
+    if (!(ktable_size(&table) < 1000 && ktable_buckets_len(&table) > 4)) {
+        goto EXIT;
+    }
+
+    // Closest first, a live target is its own closest
+    n = ktable_closest(&table, &target, slots, KTABLE_K);
+    if (!(n == KTABLE_K)) goto EXIT;
+    for (i = 0; i < n; i++) {
+        d = knode_distance(ktable_id(&table, slots[i]), &target);
+        if (d < last) goto EXIT;
+        last = d;
+    }
+    if (ktable_find(&table, &target) >= 0 &&
+        !(knode_distance(ktable_id(&table, slots[0]), &target) == 0)) {
+        goto EXIT;
+    }
+    if (!(ktable_closest(&table, &target, slots, 2) == 2)) goto EXIT;
+    err = 0;
+
+EXIT:
+    ktable_deinit(&table);
+    return err;
+}
+
+int
+test_knode_distances()
+{
+    int err = -1;
+    uint32_t n = 1000, i, f;
+    knode target, ids[1000];
+    uint16_t want[1000], d[1000];
+    void (*fn[])(const knode*, uint32_t, const knode*, uint16_t*) = {
+        knode_distances,
+        knode_distances_words,
+#if KNODE_X86
+        knode_distances_sse2,
+        __builtin_cpu_supports("avx2") ? knode_distances_avx2 : NULL,
+#endif
+    };
+
+    // Every prefix length, the same id and the furthest one
+    urand((uint8_t*)ids, sizeof(ids));
+    urand(target.b, sizeof(target.b));
+    for (i = 0; i < n; i++) memcpy(ids[i].b, target.b, i % 33);
+    ids[0] = target;
+    ids[1] = target;
+    ids[1].b[0] ^= 0x80;
+    for (i = 0; i < n; i++) want[i] = knode_distance(&ids[i], &target);
+
+    // Each kernel against the scalar reference
+    for (f = 0; f < sizeof(fn) / sizeof(fn[0]); f++) {
+        if (!fn[f]) continue;
+        memset(d, 0xff, sizeof(d));
+        fn[f](ids, n, &target, d);
+        if (memcmp(d, want, sizeof(d))) goto EXIT;
+    }
+    if (!(want[0] == 0 && want[1] == 256)) goto EXIT;
+    err = 0;
+
+EXIT:
+    return err;
+}
+
+int
+test_knode_select()
+{
+    int err = -1;
+    uint32_t n = 100000, i, j, k = 16, found, slow[16], fast[16];
+    knode target, *ids = rlpx_malloc(n * sizeof(knode));
+    uint16_t* d = rlpx_malloc(n * sizeof(uint16_t));
+    if (!(ids && d)) goto EXIT;
+    urand((uint8_t*)ids, n * sizeof(knode));
+    urand(target.b, sizeof(target.b));
 
-    /*!< init routines */
-    urand(id.b, sizeof(id.b)); /*!< initiaze our id */
-    ktable_init(&table, &id);  /*!< initialize table */
+    // Some share a prefix with the target, like the near buckets do
+    for (i = 0; i < n; i++) memcpy(ids[i].b, target.b, i % 4);
+    ids[7] = target;
+    ids[9] = target;
+    ids[9].b[31] ^= 1;
 
-    /*!< stimulate table */
-    for (uint32_t i = 0; i < 1000; i++) {
-        urand(node.b, sizeof(node.b));                     /*!< add me */
-        ktable_add_node(&table, &node);                    /*!< node added */
-        if (ktable_buckets_len(&table) <= i + 2) err = -1; /*!< check */
+    // Scalar reference: compare every id byte by byte against the best k
+    for (found = 0, i = 0; i < n; i++) {
+        for (j = found;
+             j > 0 && test_knode_closer(&ids[i], &ids[slow[j - 1]], &target);
+             j--) {
+            if (j < k) slow[j] = slow[j - 1];
+        }
+        if (j < k) {
+            slow[j] = i;
+            if (found < k) found++;
+        }
     }
-    if (ktable_buckets_len(&table) <= 512) err = -1;
 
-    /*!< Check results */
+    // Vector distances, then only ids near the best k are compared in full
+    memset(d, 0, n * sizeof(uint16_t));
+    knode_distances(ids, n, &target, d);
+    if (!(knode_select(ids, d, n, &target, fast, k) == k)) goto EXIT;
 
-    /*!< Free resources */
-    ktable_deinit(&table); /*!< free resources */
+    // Same order, exact ones first
+    if (!(fast[0] == 7 && fast[1] == 9)) goto EXIT;
+    for (i = 0; i < k; i++) {
+        if (!(fast[i] == slow[i])) goto EXIT;
+    }
+    for (i = 0; i < n; i += 97) {
+        if (!(d[i] == knode_distance(&ids[i], &target))) goto EXIT;
+    }
+    d[5] = KNODE_DISTANCE_NONE;
+    if (!(knode_select(ids, d, 5, &target, fast, k) == 5)) goto EXIT;
+    if (!(knode_select(ids, d, 6, &target, fast, k) == 5)) goto EXIT;
+    err = 0;
+
+EXIT:
+    if (ids) rlpx_free(ids);
+    if (d) rlpx_free(d);
+    return err;
+}
+
+int
+test_kindex()
+{
+    int err = -1, want;
+    uint32_t n = 10000, i;
+    kindex index;
+    knode* ids = rlpx_malloc(n * sizeof(knode));
+    if (!ids) return -1;
+    if (kindex_init(&index, n)) goto EXIT;
+
+    // Half share a 16 bit prefix (ids near ours do)
+    urand((uint8_t*)ids, n * sizeof(knode));
+    for (i = 0; i < n / 2; i++) memcpy(ids[i].b, ids[n - 1].b, 2);
+    for (i = 0; i < n; i++) {
+        if (kindex_put(&index, &ids[i], i)) goto EXIT;
+    }
+    if (!(index.size == n)) goto EXIT;
+    for (i = 0; i < n; i++) {
+        if (!(kindex_get(&index, &ids[i]) == (int)i)) goto EXIT;
+    }
+
+    // Updates keep the entry, deletes leave no hole in the runs left
+    if (kindex_put(&index, &ids[3], 42)) goto EXIT;
+    if (!(kindex_get(&index, &ids[3]) == 42 && index.size == n)) goto EXIT;
+    for (i = 0; i < n; i += 2) {
+        if (kindex_del(&index, &ids[i])) goto EXIT;
+    }
+    if (!(kindex_del(&index, &ids[0]) == -1)) goto EXIT;
+    for (i = 0; i < n; i++) {
+        want = i % 2 ? (i == 3 ? 42 : (int)i) : -1;
+        if (!(kindex_get(&index, &ids[i]) == want)) goto EXIT;
+    }
+
+    // Full at half load
+    while (index.size < index.max) {
+        urand(ids[0].b, sizeof(ids[0].b));
+        if (kindex_put(&index, &ids[0], 0)) goto EXIT;
+    }
+    urand(ids[0].b, sizeof(ids[0].b));
+    if (!(kindex_put(&index, &ids[0], 0) == -1)) goto EXIT;
+    err = 0;
+
+EXIT:
+    kindex_deinit(&index);
+    rlpx_free(ids);
     return err;
 }
+
+int
+test_klookup()
+{
+    int err = -1, i, j, asked = 0, q[KLOOKUP_ALPHA], nq;
+    uint32_t n = 256, known = 48, m, r, idx[KLOOKUP_K];
+    klookup l;
+    kpeer peer;
+    knode target, id, *ids = rlpx_malloc(n * sizeof(knode));
+    if (!ids) return -1;
+
+    // Duplicates and ordering
+    memset(&peer, 0, sizeof(peer));
+    urand((uint8_t*)ids, n * sizeof(knode));
+    urand(target.b, sizeof(target.b));
+    klookup_init(&l, &target);
+    for (i = 0; i < 3; i++) {
+        if (klookup_add(&l, &ids[i], &peer)) goto EXIT;
+    }
+    if (!(klookup_add(&l, &ids[1], &peer) == 1 && l.n == 3)) goto EXIT;
+    for (i = 1; i < 3; i++) {
+        if (!(knode_cmp(&l.nodes[i - 1].id, &l.nodes[i].id, &target) < 0)) {
+            goto EXIT;
+        }
+    }
+
+    // Simulated network, node j knows known others and answers with all of
+    // them. Every 5th node times out.
+    klookup_init(&l, &target);
+    for (i = 0; i < KLOOKUP_ALPHA; i++) klookup_add(&l, &ids[i], &peer);
+    while (!klookup_done(&l)) {
+        nq = 0;
+        while ((i = klookup_next(&l)) >= 0) q[nq++] = i;
+        if (!(nq && l.inflight <= KLOOKUP_ALPHA)) goto EXIT;
+        for (i = 0; i < nq; i++) {
+            id = l.nodes[q[i]].id;
+            for (j = 0; j < (int)n; j++) {
+                if (!memcmp(&ids[j], &id, sizeof(knode))) break;
+            }
+            q[i] = j;
+            asked++;
+            if (klookup_reply(&l, &id, j % 5 != 4)) goto EXIT;
+        }
+        for (i = 0; i < nq; i++) {
+            if (q[i] % 5 == 4) continue;
+            for (m = 0; m < known; m++) {
+                r = (q[i] * 7 + m * 13 + 1) % n;
+                klookup_add(&l, &ids[r], &peer);
+            }
+        }
+    }
+    if (!(klookup_reply(&l, &ids[0], 1) == -1)) goto EXIT;
+    if (!(asked < (int)n && l.inflight == 0)) goto EXIT;
+
+    // Results answered, closest first
+    if (!(klookup_results(&l, idx, KLOOKUP_K) == KLOOKUP_K)) goto EXIT;
+    for (i = 0; i < KLOOKUP_K; i++) {
+        if (!(l.nodes[idx[i]].state == KLOOKUP_REPLIED)) goto EXIT;
+        if (i && !(idx[i] > idx[i - 1])) goto EXIT;
+    }
+    err = 0;
+
+EXIT:
+    rlpx_free(ids);
+    return err;
+}
+
+int
+test_knode_closer(const knode* a, const knode* b, const knode* target)
+{
+    for (int i = 0; i < 32; i++) {
+        if ((a->b[i] ^ target->b[i]) != (b->b[i] ^ target->b[i])) {
+            return (a->b[i] ^ target->b[i]) < (b->b[i] ^ target->b[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "test.h"
+#include "urand.h"
+#include "usys_time.h"
+#include <unistd.h>
+
+int test_nodedb_records();
+int test_nodedb_attach();
+
+int
+test_nodedb()
+{
+    int err = 0;
+    IF_ERR_EXIT(test_nodedb_records());
+    IF_ERR_EXIT(test_nodedb_attach());
+EXIT:
+    return err;
+}
+
+int
+test_nodedb_records()
+{
+    int err = -1, fd;
+    char path[] = "/tmp/rlpx_test_nodedb.XXXXXX";
+    uint8_t ip[4] = { 127, 0, 0, 1 }, pub[64];
+    uint32_t i;
+    rlpx_nodedb db;
+    rlpx_nodedb_record* r;
+    knode ids[20];
+
+    if ((fd = mkstemp(path)) < 0) return -1;
+    close(fd);
+    urand((uint8_t*)ids, sizeof(ids));
+    urand(pub, sizeof(pub));
+
+    // Full at 8, new nodes evict (failures first)
+    if (rlpx_nodedb_open(&db, path, 8)) goto EXIT;
+    for (i = 0; i < 8; i++) {
+        if (rlpx_nodedb_update(&db, &ids[i], pub, ip, 4, 30303, i)) goto EXIT;
+    }
+    rlpx_nodedb_fail(&db, &ids[5]);
+    rlpx_nodedb_seen(&db, &ids[1], 1);
+    if (rlpx_nodedb_update(&db, &ids[8], pub, ip, 4, 30303, 8)) goto EXIT;
+    if (!(db.n == 8 && !rlpx_nodedb_find(&db, &ids[5]))) goto EXIT;
+    if (!((r = rlpx_nodedb_find(&db, &ids[1])) && r->pong && !r->fails)) {
+        goto EXIT;
+    }
+
+    // Nodes that keep failing leave
+    for (i = 0; i < RLPX_NODEDB_FAILS; i++) rlpx_nodedb_fail(&db, &ids[2]);
+    if (!(db.n == 7 && !rlpx_nodedb_find(&db, &ids[2]))) goto EXIT;
+    if (!(rlpx_nodedb_remove(&db, &ids[2]) == -1)) goto EXIT;
+    rlpx_nodedb_close(&db);
+
+    // Reopened as they were, another size starts over
+    if (rlpx_nodedb_open(&db, path, 8)) goto EXIT;
+    if (!(db.n == 7 && (r = rlpx_nodedb_find(&db, &ids[8])) && r->udp == 8)) {
+        goto EXIT;
+    }
+    rlpx_nodedb_close(&db);
+    if (rlpx_nodedb_open(&db, path, 16)) goto EXIT;
+    if (!(db.n == 0 && !rlpx_nodedb_find(&db, &ids[8]))) goto EXIT;
+    err = 0;
+
+EXIT:
+    rlpx_nodedb_close(&db);
+    unlink(path);
+    return err;
+}
+
+int
+test_nodedb_attach()
+{
+    int err = -1, fd, slot;
+    char path[] = "/tmp/rlpx_test_nodedb.XXXXXX";
+    uint8_t ip[4] = { 10, 0, 0, 1 }, pub[65];
+    uint32_t i;
+    uecc_ctx key;
+    rlpx_nodedb db;
+    rlpx_discovery_table table;
+    kpeer* node;
+    knode id;
+
+    if ((fd = mkstemp(path)) < 0) return -1;
+    close(fd);
+    memset(&db, 0, sizeof(db));
+    err = rlpx_discovery_table_init(&table);
+    err |= rlpx_nodedb_open(&db, path, 64);
+    if (err) goto EXIT;
+
+    // Nodes the table learns are persisted
+    err = -1;
+    rlpx_discovery_table_attach(&table, &db);
+    for (i = 0; i < 4; i++) {
+        if (uecc_key_init_new(&key)) goto EXIT;
+        ip[3] = i;
+        uecc_qtob(&key.Q, pub, sizeof(pub));
+        rlpx_discovery_table_add_node(
+            &table, ip, 4, 30303, 30303, &key.Q, NULL);
+        uecc_key_deinit(&key);
+    }
+    if (!(db.n == 4)) goto EXIT;
+    rlpx_discovery_table_deinit(&table);
+    rlpx_nodedb_close(&db);
+
+    // And come back on the next start
+    rlpx_discovery_table_init(&table);
+    if (rlpx_nodedb_open(&db, path, 64)) goto EXIT;
+    if (!(rlpx_discovery_table_attach(&table, &db) == 4)) goto EXIT;
+    rlpx_discovery_node_id(&pub[1], &id);
+    if ((slot = ktable_find(&table.nodes, &id)) < 0) goto EXIT;
+    node = ktable_peer(&table.nodes, slot);
+    if (!(node->ip[3] == 3 && node->udp == 30303)) goto EXIT;
+    err = 0;
+
+EXIT:
+    rlpx_discovery_table_deinit(&table);
+    rlpx_nodedb_close(&db);
+    unlink(path);
+    return err;
+}
+
+//
+//
+//
@@ -0,0 +1,143 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "test.h"
+
+int test_peers_table();
+int test_peers_sets();
+
+int
+test_peers()
+{
+    int err = 0;
+    IF_ERR_EXIT(test_peers_table());
+    IF_ERR_EXIT(test_peers_sets());
+EXIT:
+    return err;
+}
+
+int
+test_peers_table()
+{
+    int err = -1;
+    uint32_t udp = UDP_TEST_PORT, used = rlpx_io_slab_stats()->used;
+    uecc_ctx skey;
+    rlpx_peers peers;
+    rlpx_io* ch[20];
+
+    uecc_key_init_new(&skey);
+    rlpx_peers_init(&peers, &skey, &udp, NULL, 20);
+
+    // Grows past the initial allocation up to the limit
+    for (int i = 0; i < 20; i++) {
+        if (!(ch[i] = rlpx_peers_add(&peers))) goto EXIT;
+        if (!(rlpx_peers_get(&peers, ch[i]->slot) == ch[i])) goto EXIT;
+    }
+    if (rlpx_peers_add(&peers)) goto EXIT;
+    if (!(rlpx_peers_count(&peers) == 20 && peers.size == 20)) goto EXIT;
+    if (!(rlpx_io_slab_stats()->used == used + 20)) goto EXIT;
+
+    // Removed slots are recycled
+    for (int i = 0; i < 20; i += 4) rlpx_peers_remove(&peers, ch[i]);
+    if (!(rlpx_peers_count(&peers) == 15)) goto EXIT;
+    for (int i = 0; i < 20; i += 4) {
+        if (!(ch[i] = rlpx_peers_add(&peers))) goto EXIT;
+        if (ch[i]->slot % 4) goto EXIT;
+    }
+    if (!(peers.size == 20)) goto EXIT;
+    err = 0;
+EXIT:
+    rlpx_peers_deinit(&peers);
+    uecc_key_deinit(&skey);
+    if (!(rlpx_io_slab_stats()->used == used)) err = -1;
+    return err;
+}
+
+int
+test_peers_sets()
+{
+    int err = -1;
+    uint32_t udp = UDP_TEST_PORT;
+    uecc_ctx skey;
+    rlpx_peers peers;
+    rlpx_io* ch[4];
+
+    uecc_key_init_new(&skey);
+    rlpx_peers_init(&peers, &skey, &udp, NULL, 0);
+    for (int i = 0; i < 4; i++) {
+        if (!(ch[i] = rlpx_peers_add(&peers))) goto EXIT;
+    }
+    if (!(rlpx_peers_idle_count(&peers) == 4)) goto EXIT;
+
+    // Move between sets
+    rlpx_peers_set_active(&peers, ch[1]);
+    rlpx_peers_set_active(&peers, ch[3]);
+    rlpx_peers_set_active(&peers, ch[3]);
+    if (!(rlpx_peers_active_count(&peers) == 2)) goto EXIT;
+    if (!(rlpx_peers_idle_count(&peers) == 2)) goto EXIT;
+    for (uint32_t i = 0; i < rlpx_peers_active_count(&peers); i++) {
+        rlpx_io* a = rlpx_peers_active(&peers, i);
+        if (!(a == ch[1] || a == ch[3])) goto EXIT;
+    }
+    for (uint32_t i = 0; i < rlpx_peers_idle_count(&peers); i++) {
+        rlpx_io* a = rlpx_peers_idle(&peers, i);
+        if (!(a == ch[0] || a == ch[2])) goto EXIT;
+    }
+
+    // Removing an active peer
+    rlpx_peers_remove(&peers, ch[1]);
+    if (!(rlpx_peers_active_count(&peers) == 1)) goto EXIT;
+    if (!(rlpx_peers_active(&peers, 0) == ch[3])) goto EXIT;
+
+    // Peers without a socket are not active
+    if (!(rlpx_peers_update(&peers) == 1)) goto EXIT;
+    if (!(rlpx_peers_idle_count(&peers) == 3)) goto EXIT;
+
+    // Peers move as their socket opens or closes. Without a port to dial a
+    // closed peer is done, new peers go ahead of it.
+    ch[0]->on_link(ch[0]->link_ctx, ch[0]->slot, 0);
+    if (!(rlpx_peers_done_count(&peers) == 1)) goto EXIT;
+    if (!(rlpx_peers_idle_count(&peers) == 2)) goto EXIT;
+    if (!(ch[1] = rlpx_peers_add(&peers))) goto EXIT;
+    if (!(rlpx_peers_idle_count(&peers) == 3)) goto EXIT;
+    ch[2]->on_link(ch[2]->link_ctx, ch[2]->slot, 1);
+    if (!(rlpx_peers_active(&peers, 0) == ch[2])) goto EXIT;
+    ch[2]->on_link(ch[2]->link_ctx, ch[2]->slot, 0);
+    if (!(rlpx_peers_active_count(&peers) == 0)) goto EXIT;
+    if (!(rlpx_peers_done_count(&peers) == 2)) goto EXIT;
+
+    // Reaped
+    if (!(rlpx_peers_reap(&peers) == 2)) goto EXIT;
+    if (!(rlpx_peers_count(&peers) == 2)) goto EXIT;
+    for (uint32_t i = 0; i < rlpx_peers_idle_count(&peers); i++) {
+        rlpx_io* a = rlpx_peers_idle(&peers, i);
+        if (!(a == ch[1] || a == ch[3])) goto EXIT;
+    }
+    err = 0;
+EXIT:
+    rlpx_peers_deinit(&peers);
+    uecc_key_deinit(&skey);
+    return err;
+}
+
+//
+//
+//
@@ -40,22 +40,26 @@ test_protocol()
 {
     int err = 0;
     test_session s;
+    rlpx_metrics m0, m1;
 
+    rlpx_metrics_snapshot(&m0);
     test_session_init(&s, TEST_VECTOR_LEGACY_GO);
     rlpx_test_mock_devp2p(&g_test_devp2p_settings);
 
     rlpx_io_nonce(s.alice);
     rlpx_io_nonce(s.bob);
     rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
-    rlpx_io_accept(s.bob, &s.alice->skey->Q);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
 
     // Recv keys
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv_ack(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv_auth(s.bob, s.alice->io.b, s.alice->io.len));
 
     // Read/Write HELLO
     IF_ERR_EXIT(rlpx_io_send_hello(s.alice));
     IF_ERR_EXIT(rlpx_io_send_hello(s.bob));
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv(s.bob, s.alice->io.b, s.alice->io.len));
 
@@ -63,24 +67,34 @@ test_protocol()
     IF_ERR_EXIT(
         rlpx_io_send_disconnect(s.alice, DEVP2P_DISCONNECT_BAD_VERSION));
     IF_ERR_EXIT(rlpx_io_send_disconnect(s.bob, DEVP2P_DISCONNECT_BAD_VERSION));
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv(s.bob, s.alice->io.b, s.alice->io.len));
 
     // Read/Write PING
     IF_ERR_EXIT(rlpx_io_send_ping(s.alice));
     IF_ERR_EXIT(rlpx_io_send_ping(s.bob));
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv(s.bob, s.alice->io.b, s.alice->io.len));
 
     // Read/Write PONG
     IF_ERR_EXIT(rlpx_io_send_pong(s.alice));
     IF_ERR_EXIT(rlpx_io_send_pong(s.bob));
+    test_session_flush(&s);
     IF_ERR_EXIT(rlpx_io_recv(s.alice, s.bob->io.b, s.bob->io.len));
     IF_ERR_EXIT(rlpx_io_recv(s.bob, s.alice->io.b, s.alice->io.len));
 
     // Confirm all callbacks readback
     IF_ERR_EXIT((g_test_mask == 0x0f) ? 0 : -1);
 
+    // Frames counted per peer and in the totals
+    rlpx_metrics_snapshot(&m1);
+    IF_ERR_EXIT(s.alice->metrics.c[RLPX_METRIC_FRAMES_OUT] == 4 ? 0 : -1);
+    IF_ERR_EXIT(s.bob->metrics.c[RLPX_METRIC_FRAMES_IN] == 4 ? 0 : -1);
+    m1.c[RLPX_METRIC_FRAMES_IN] -= m0.c[RLPX_METRIC_FRAMES_IN];
+    IF_ERR_EXIT(m1.c[RLPX_METRIC_FRAMES_IN] == 8 ? 0 : -1);
+
 EXIT:
     test_session_deinit(&s);
     return err;
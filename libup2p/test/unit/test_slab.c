@@ -0,0 +1,119 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "test.h"
+
+int test_slab_pool();
+int test_slab_limit();
+int test_slab_handshake();
+
+int
+test_slab()
+{
+    int err = 0;
+    IF_ERR_EXIT(test_slab_pool());
+    IF_ERR_EXIT(test_slab_limit());
+    IF_ERR_EXIT(test_slab_handshake());
+EXIT:
+    return err;
+}
+
+int
+test_slab_pool()
+{
+    int err = -1;
+    rlpx_slab slab;
+    void* objs[10];
+    const rlpx_slab_stats* stats = rlpx_slab_stats_get(&slab);
+
+    rlpx_slab_init(&slab, "test", 100, 4, 0);
+    for (int i = 0; i < 10; i++) {
+        if (!(objs[i] = rlpx_slab_alloc(&slab))) goto EXIT;
+        memset(objs[i], i, 100);
+    }
+    if (!(stats->used == 10 && stats->chunks == 3 && stats->total == 12)) {
+        goto EXIT;
+    }
+
+    // Objects should not overlap
+    for (int i = 0; i < 10; i++) {
+        if (((uint8_t*)objs[i])[99] != i) goto EXIT;
+    }
+
+    // Freed objects are recycled before more chunks are requested
+    for (int i = 0; i < 10; i++) rlpx_slab_free(&slab, objs[i]);
+    for (int i = 0; i < 12; i++) objs[i % 10] = rlpx_slab_alloc(&slab);
+    if (!(stats->chunks == 3 && stats->peak == 12)) goto EXIT;
+    err = 0;
+EXIT:
+    rlpx_slab_deinit(&slab);
+    return err;
+}
+
+int
+test_slab_limit()
+{
+    int err = -1;
+    rlpx_slab slab = RLPX_SLAB_INIT("test", 32, 2, 1);
+    void *a, *b;
+    if (!(a = rlpx_slab_alloc(&slab))) goto EXIT;
+    if (!(b = rlpx_slab_alloc(&slab))) goto EXIT;
+    if (rlpx_slab_alloc(&slab)) goto EXIT;
+    if (!(slab.stats.fails == 1)) goto EXIT;
+    rlpx_slab_free(&slab, a);
+    if (!(rlpx_slab_alloc(&slab) == a)) goto EXIT;
+    err = 0;
+EXIT:
+    rlpx_slab_deinit(&slab);
+    return err;
+}
+
+int
+test_slab_handshake()
+{
+    int err = -1;
+    test_session s;
+    const rlpx_slab_stats* stats = rlpx_handshake_slab_stats();
+    uint32_t used = stats->used;
+
+    // Session holds a handshake until the remote cipher is consumed
+    test_session_init(&s, 1);
+    rlpx_io_nonce(s.alice);
+    rlpx_io_nonce(s.bob);
+    rlpx_io_connect(s.alice, &s.bob->skey->Q, "1.1.1.1", 33);
+    rlpx_io_accept(s.bob, TEST_MOCK_SOCK, &s.alice->skey->Q);
+    if (!(stats->used == used + 2)) goto EXIT;
+
+    // Async path returns handshake to pool once secrets are installed
+    test_session_flush(&s);
+    if (rlpx_io_recv_auth(s.bob, s.alice->io.b, s.alice->io.len)) goto EXIT;
+    if (!(stats->used == used + 2)) goto EXIT;
+    if (s.alice->io.settings.on_recv(s.alice, 0, s.bob->io.b, s.bob->io.len)) {
+        goto EXIT;
+    }
+    if (!(stats->used == used + 1)) goto EXIT;
+    if (s.alice->hs) goto EXIT;
+    err = 0;
+EXIT:
+    test_session_deinit(&s);
+    if (!(stats->used == used)) err = -1;
+    return err;
+}
@@ -93,6 +93,7 @@ int test_u8();
 int test_u16();
 int test_u32();
 int test_u64();
+int test_put();
 int test_item(uint8_t*, uint32_t, urlp**);
 void test_walk_fn(const urlp* rlp, int idx, void* ctx);
 
@@ -106,6 +107,7 @@ main(int argc, char* argv[])
     err |= test_u16();
     err |= test_u32();
     err |= test_u64();
+    err |= test_put();
     return err;
 }
 
@@ -357,6 +359,46 @@ test_u64()
     return err;
 }
 
+int
+test_put()
+{
+    int err = -1;
+    uint8_t b[600], big[300];
+    uint32_t n;
+
+    // Items, against the same bytes urlp_print gives
+    if (!(urlp_put_mem(b, (uint8_t*)"cat", 3) == sizeof(rlp_cat) &&
+          !memcmp(b, rlp_cat, sizeof(rlp_cat)))) {
+        goto EXIT;
+    }
+    if (!(urlp_put_mem(b, &rlp_lorem[2], 56) == sizeof(rlp_lorem) &&
+          !memcmp(b, rlp_lorem, sizeof(rlp_lorem)))) {
+        goto EXIT;
+    }
+    if (!(urlp_put_u64(b, 15) == 1 && !memcmp(b, rlp_15, 1))) goto EXIT;
+    if (!(urlp_put_u64(b, 1024) == 3 && !memcmp(b, rlp_1024, 3))) goto EXIT;
+    if (!(urlp_put_u64(b, 0) == 1 && b[0] == 0x80)) goto EXIT;
+
+    // Lists move their payload from b + 3
+    n = urlp_put_mem(&b[3], (uint8_t*)"cat", 3);
+    n += urlp_put_mem(&b[3 + n], (uint8_t*)"dog", 3);
+    if (!(urlp_put_list(b, n) == sizeof(rlp_catdog) &&
+          !memcmp(b, rlp_catdog, sizeof(rlp_catdog)))) {
+        goto EXIT;
+    }
+
+    // Long string and long list (2 byte length)
+    memset(big, 'x', sizeof(big));
+    n = urlp_put_mem(&b[3], big, sizeof(big));
+    if (!(n == 3 + sizeof(big) && b[3] == 0xb9 && b[4] == 0x01)) goto EXIT;
+    if (!(urlp_put_list(b, n) == 3 + n && b[0] == 0xf9 && b[1] == 0x01)) {
+        goto EXIT;
+    }
+    err = 0;
+EXIT:
+    return err;
+}
+
 int
 test_item(uint8_t* rlp, uint32_t rlplen, urlp** item_p)
 {
@@ -713,6 +713,58 @@ urlp_foreach(const urlp* rlp, void* ctx, urlp_walk_fn fn)
     }
 }
 
+uint32_t
+urlp_put_mem(uint8_t* b, const uint8_t* m, uint32_t l)
+{
+    // One byte below 0x80 is itself
+    uint32_t h = 1;
+    if (l == 1 && m[0] < 0x80) {
+        b[0] = m[0];
+        return 1;
+    } else if (l < 56) {
+        b[0] = 0x80 + l;
+    } else if (l < 256) {
+        b[0] = 0xb8;
+        b[h++] = l;
+    } else {
+        b[0] = 0xb9;
+        b[h++] = l >> 8;
+        b[h++] = l;
+    }
+    memcpy(&b[h], m, l);
+    return h + l;
+}
+
+uint32_t
+urlp_put_u64(uint8_t* b, uint64_t v)
+{
+    uint8_t be[8];
+    uint32_t i;
+    for (i = 0; i < 8; i++) be[i] = v >> (56 - 8 * i);
+    i = 0;
+    while (i < 8 && !be[i]) i++;
+    return urlp_put_mem(b, &be[i], 8 - i);
+}
+
+uint32_t
+urlp_put_list(uint8_t* b, uint32_t l)
+{
+    // The payload was written at b + 3, its header goes right before it
+    uint32_t h = l < 56 ? 1 : l < 256 ? 2 : 3;
+    if (h == 1) {
+        b[0] = 0xc0 + l;
+    } else if (h == 2) {
+        b[0] = 0xf8;
+        b[1] = l;
+    } else {
+        b[0] = 0xf9;
+        b[1] = l >> 8;
+        b[2] = l;
+    }
+    if (h < 3) memmove(&b[h], &b[3], l);
+    return h + l;
+}
+
 //
 //
 //
@@ -87,6 +87,12 @@ int urlp_print(const urlp* rlp, uint8_t* b, uint32_t* sz);
 urlp* urlp_parse(const uint8_t* b, uint32_t);
 void urlp_foreach(const urlp* rlp, void* ctx, urlp_walk_fn fn);
 
+// Flat writers, no allocation. Strings and lists up to 64K. A list payload
+// is written at b + 3 first, urlp_put_list moves it behind its header.
+uint32_t urlp_put_mem(uint8_t* b, const uint8_t* m, uint32_t l);
+uint32_t urlp_put_u64(uint8_t* b, uint64_t v);
+uint32_t urlp_put_list(uint8_t* b, uint32_t l);
+
 #ifdef __cplusplus
 }
 #endif
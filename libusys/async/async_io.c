@@ -20,6 +20,9 @@
  */
 
 #include "async_io.h"
+#include "async_loop.h"
+#include "usys_time.h"
+#include "usys_trace.h"
 
 // Override system IO with MOCK implementation OR other IO implementation.
 // Useful for test or portability.
@@ -38,6 +41,13 @@ async_io_settings g_async_io_settings_default = {
 
 // Private prototypes.
 void async_error(async_io* self, int);
+int async_io_tx_write(async_io* self);
+async_io_chunk* async_io_chunk_get();
+void async_io_chunk_put(async_io_chunk* q);
+
+// Free frames, reused by whichever io on this thread needs one next
+usys_thread_local async_io_chunk* g_async_io_tx_cache = NULL;
+usys_thread_local uint32_t g_async_io_tx_cache_n = 0;
 
 // Public
 void
@@ -74,7 +84,9 @@ async_io_init(async_io* self, void* ctx, const async_io_settings* opts)
 void
 async_io_deinit(async_io* self)
 {
+    if (self->loop) async_loop_remove(self->loop, self);
     if (ASYNC_IO_SOCK(self)) self->settings.close(&self->sock);
+    async_io_tx_clear(self);
     memset(self, 0, sizeof(async_io));
 }
 
@@ -82,6 +94,7 @@ int
 async_io_connect(async_io* self, const char* ip, uint32_t p)
 {
     if (ASYNC_IO_SOCK(self)) self->settings.close(&self->sock);
+    async_io_tx_clear(self); // new stream
     int ret = self->settings.connect(&self->sock, ip, p);
     if (ret < 0) {
         ASYNC_IO_SET_ERRO(self);
@@ -91,13 +104,42 @@ async_io_connect(async_io* self, const char* ip, uint32_t p)
         self->state |= ASYNC_IO_STATE_RECV | ASYNC_IO_STATE_READY;
         self->settings.on_connect(self->ctx);
     }
+    async_io_arm(self);
     return ret;
 }
 
+int
+async_io_listen(async_io* self, uint32_t port)
+{
+    if (ASYNC_IO_SOCK(self)) self->settings.close(&self->sock);
+    if (usys_listen_tcp(&self->sock, port)) return -1;
+    self->state = ASYNC_IO_STATE_READY | ASYNC_IO_STATE_LISTEN;
+    async_io_arm(self);
+    return 0;
+}
+
+int
+async_io_accept(async_io* self, usys_socket_fd* fds, uint32_t n)
+{
+    return ASYNC_IO_SOCK(self) ? usys_accept_fd(self->sock, fds, n) : 0;
+}
+
+void
+async_io_open(async_io* self, usys_socket_fd sock)
+{
+    if (ASYNC_IO_SOCK(self)) self->settings.close(&self->sock);
+    async_io_tx_clear(self);
+    self->sock = sock;
+    self->state = ASYNC_IO_STATE_READY;
+    ASYNC_IO_SET_RECV(self);
+    async_io_arm(self);
+}
+
 void
 async_io_close(async_io* self)
 {
     ASYNC_IO_CLOSE(self);
+    async_io_arm(self);
 }
 
 void*
@@ -141,18 +183,123 @@ int
 async_io_send(async_io* self)
 {
     if (ASYNC_IO_SOCK(self)) {
+        // The buffer is both ways, reading waits until it is out
         ASYNC_IO_SET_SEND(self);
+        self->state &= ~ASYNC_IO_STATE_RECV;
+        self->c = 0;
+        async_io_arm(self);
         return 0;
     } else {
         return -1;
     }
 }
 
+uint8_t*
+async_io_tx_reserve(async_io* self, uint32_t* len)
+{
+    if (!(self->tx_res || (self->tx_res = async_io_chunk_get()))) return NULL;
+    *len = sizeof(self->tx_res->b);
+    return self->tx_res->b;
+}
+
+int
+async_io_tx_commit(async_io* self, uint32_t len)
+{
+    async_io_chunk* q = self->tx_res;
+    self->tx_res = NULL;
+    if (!q) return -1;
+
+    // Nothing written, or a peer that stopped reading
+    if (!(len && len <= sizeof(q->b) && ASYNC_IO_SOCK(self) &&
+          self->tx_bytes + len <= ASYNC_IO_TX_MAX)) {
+        async_io_chunk_put(q);
+        return len ? -1 : 0;
+    }
+    q->len = len;
+    q->next = NULL;
+    if (self->tx_tail) {
+        self->tx_tail->next = q;
+    } else {
+        self->tx_head = q;
+    }
+    self->tx_tail = q;
+    self->tx_bytes += len;
+
+    // Already sending (or connecting), the frame goes out behind the others
+    if (ASYNC_IO_READY(self->state) && !ASYNC_IO_SEND(self->state)) {
+        ASYNC_IO_SET_SEND(self);
+        async_io_arm(self);
+    }
+    return async_io_tx_full(self) ? 1 : 0;
+}
+
+int
+async_io_tx(async_io* self, const void* b, uint32_t len)
+{
+    uint32_t cap;
+    uint8_t* mem = async_io_tx_reserve(self, &cap);
+    if (!mem) return -1;
+    if (len > cap) {
+        async_io_tx_commit(self, 0);
+        return -1;
+    }
+    memcpy(mem, b, len);
+    return async_io_tx_commit(self, len);
+}
+
+uint32_t
+async_io_tx_read(async_io* self, uint8_t* b, uint32_t len)
+{
+    async_io_chunk* q;
+    uint32_t n = 0, l, off = self->tx_off;
+    while ((q = self->tx_head) && (l = q->len - off) <= len - n) {
+        memcpy(&b[n], &q->b[off], l);
+        n += l;
+        off = 0;
+        self->tx_bytes -= l;
+        self->tx_head = q->next;
+        async_io_chunk_put(q);
+    }
+    if (!self->tx_head) {
+        self->tx_tail = NULL;
+        if (ASYNC_IO_READY(self->state) && ASYNC_IO_SEND(self->state)) {
+            ASYNC_IO_SET_RECV(self);
+        }
+    }
+    self->tx_off = off;
+    return n;
+}
+
+void
+async_io_tx_clear(async_io* self)
+{
+    async_io_chunk* q;
+    while ((q = self->tx_head)) {
+        self->tx_head = q->next;
+        async_io_chunk_put(q);
+    }
+    if (self->tx_res) async_io_chunk_put(self->tx_res);
+    self->tx_res = self->tx_tail = NULL;
+    self->tx_bytes = self->tx_off = 0;
+}
+
+void
+async_io_tx_cache_deinit()
+{
+    async_io_chunk* q;
+    while ((q = g_async_io_tx_cache)) {
+        g_async_io_tx_cache = q->next;
+        usys_free(q);
+    }
+    g_async_io_tx_cache_n = 0;
+}
+
 int
 async_io_recv(async_io* self)
 {
     if (ASYNC_IO_SOCK(self)) {
         ASYNC_IO_SET_RECV(self);
+        async_io_arm(self);
         return 0;
     } else {
         return -1;
@@ -162,17 +309,17 @@ async_io_recv(async_io* self)
 int
 async_io_poll_n(async_io** io, uint32_t n, uint32_t ms)
 {
-    uint32_t mask = 0;
+    uint32_t mask[(n + 31) / 32 + 1];
     int reads[n], writes[n], err;
+    memset(mask, 0, sizeof(mask));
     for (uint32_t c = 0; c < n; c++) {
         reads[c] = async_io_state_recv(io[c]) ? io[c]->sock : -1;
         writes[c] = async_io_state_send(io[c]) ? io[c]->sock : -1;
     }
-    err = usys_select(&mask, &mask, ms, reads, n, writes, n);
-    if (mask) {
-        for (uint32_t i = 0; i < n; i++) {
-            if (mask & (0x01 << i)) async_io_poll(io[i]);
-        }
+    err = usys_select(mask, mask, ms, reads, n, writes, n);
+    usys_tick();
+    for (uint32_t i = 0; i < n; i++) {
+        if (mask[i / 32] & (0x01 << (i % 32))) async_io_poll(io[i]);
     }
     return err;
 }
@@ -181,7 +328,11 @@ int
 async_io_poll(async_io* self)
 {
     int c, ret = -1, end = self->len, start = self->c;
+    int sending = ASYNC_IO_SEND(self->state);
+    int hup = self->state & ASYNC_IO_STATE_HUP;
+    usys_trace_begin(t);
     ((void)start);
+    self->state &= ~ASYNC_IO_STATE_HUP;
     if (!(ASYNC_IO_READY(self->state))) {
         if (ASYNC_IO_SOCK(self)) {
             ret = self->settings.ready(&self->sock);
@@ -191,11 +342,20 @@ async_io_poll(async_io* self)
                 ASYNC_IO_SET_READY(self);
                 ASYNC_IO_SET_RECV(self);
                 self->settings.on_connect(self->ctx);
+                if (self->tx_head && !ASYNC_IO_SEND(self->state)) {
+                    ASYNC_IO_SET_SEND(self); // queued while connecting
+                }
             }
         } else {
         }
+    } else if (ASYNC_IO_LISTEN(self->state)) {
+        // Owner drains pending sockets (async_io_accept)
+        ret = self->settings.on_accept(self->ctx);
+    } else if (ASYNC_IO_SEND(self->state) && self->tx_head) {
+        ret = async_io_tx_write(self);
     } else if (ASYNC_IO_SEND(self->state)) {
-        for (c = 0; c < 2; c++) {
+        // Write until complete or would block. (Reactor is edge triggered)
+        for (;;) {
             ret = self->settings.tx(
                 &self->sock,
                 &self->b[self->c],
@@ -216,29 +376,44 @@ async_io_poll(async_io* self)
             } else {
                 self->settings.on_send(self->ctx, -1, 0, 0); // IO error
                 ASYNC_IO_SET_ERRO(self);
+                break;
             }
         }
-    } else if (ASYNC_IO_RECV(self->state)) {
-        for (c = 0; c < 2; c++) {
+    }
+
+    // Reads go on while queued frames go out. A socket polled for both may
+    // only have been writable, so nothing to read is only eof when reading
+    // alone or the reactor saw a hang up.
+    if (ASYNC_IO_RECV(self->state)) {
+        // Read until would block. (Reactor is edge triggered)
+        for (c = 0;; c++) {
             ret = self->settings.rx(
                 &self->sock,
                 &self->b[self->c],
                 self->len - self->c,
                 self->addr_ptr);
             if (ret >= 0) {
-                if (ret + (int)self->c == end) {
+                if (ret + self->c == self->len) {
                     self->settings.on_recv(self->ctx, -1, 0, 0);
                     ASYNC_IO_SET_ERRO(self);
                     break;
                 } else if (ret == 0) {
-                    if (c == 0) {
+                    if (c == 0 && (hup || !sending)) {
                         // When a readable socket returns 0 bytes on first then
                         // that means remote has disconnected.
                         ASYNC_IO_SET_ERRO(self);
-                    } else {
-                        self->settings.on_recv(self->ctx, 0, self->b, self->c);
-                        ret = 0; // OK no more data
+                    } else if (c) {
+                        // Next read starts the buffer over
+                        c = self->c;
+                        self->c = 0;
+                        self->settings.on_recv(self->ctx, 0, self->b, c);
+
+                        // Edge triggered, no later edge reports the eof
+                        if (hup && ASYNC_IO_RECV(self->state)) {
+                            ASYNC_IO_SET_ERRO(self);
+                        }
                     }
+                    ret = 0; // OK no more data
                     break;
                 } else {
                     self->c += ret;
@@ -247,12 +422,21 @@ async_io_poll(async_io* self)
             } else {
                 self->settings.on_recv(self->ctx, -1, 0, 0); // IO error
                 ASYNC_IO_SET_ERRO(self);
+                break;
             }
         }
     }
+    async_io_arm(self);
+    usys_trace_end(t, "async_io_poll");
     return ret;
 }
 
+void
+async_io_arm(async_io* self)
+{
+    if (self->loop) async_loop_arm(self->loop, self);
+}
+
 void
 async_io_set_cb_recv(async_io* self, async_io_on_recv_fn fn)
 {
@@ -280,7 +464,8 @@ async_io_has_sock(async_io* self)
 int
 async_io_state_recv(async_io* self)
 {
-    return ASYNC_IO_READY(self->state) && ASYNC_IO_RECV(self->state);
+    return ASYNC_IO_READY(self->state) &&
+           (ASYNC_IO_RECV(self->state) || ASYNC_IO_LISTEN(self->state));
 }
 
 int
@@ -288,3 +473,65 @@ async_io_state_send(async_io* self)
 {
     return ASYNC_IO_READY(self->state) ? ASYNC_IO_SEND(self->state) : 1;
 }
+
+int
+async_io_tx_write(async_io* self)
+{
+    int ret;
+    async_io_chunk* q;
+
+    // Write until drained or would block. A partial write leaves tx_off
+    // inside the head frame and the next write picks up from there.
+    while ((q = self->tx_head)) {
+        ret = self->settings.tx(
+            &self->sock,
+            &q->b[self->tx_off],
+            q->len - self->tx_off,
+            self->addr_ptr);
+        if (ret < 0) {
+            self->settings.on_send(self->ctx, -1, 0, 0); // IO error
+            ASYNC_IO_SET_ERRO(self);
+            return ret;
+        } else if (ret == 0) {
+            return 0; // Would block
+        }
+        self->tx_off += ret;
+        self->tx_bytes -= ret;
+        if (self->tx_off < q->len) continue;
+        self->tx_off = 0;
+        if ((self->tx_head = q->next)) {
+            async_io_chunk_put(q);
+            continue;
+        }
+
+        // Drained, listen again before the owner hears about it (the owner
+        // may queue more or close)
+        self->tx_tail = NULL;
+        ASYNC_IO_SET_RECV(self);
+        self->settings.on_send(self->ctx, 0, q->b, q->len);
+        async_io_chunk_put(q);
+    }
+    return 0;
+}
+
+async_io_chunk*
+async_io_chunk_get()
+{
+    async_io_chunk* q = g_async_io_tx_cache;
+    if (!q) return usys_malloc(sizeof(async_io_chunk));
+    g_async_io_tx_cache = q->next;
+    g_async_io_tx_cache_n--;
+    return q;
+}
+
+void
+async_io_chunk_put(async_io_chunk* q)
+{
+    if (g_async_io_tx_cache_n < ASYNC_IO_TX_CACHE) {
+        q->next = g_async_io_tx_cache;
+        g_async_io_tx_cache = q;
+        g_async_io_tx_cache_n++;
+    } else {
+        usys_free(q);
+    }
+}
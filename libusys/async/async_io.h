@@ -29,22 +29,44 @@ extern "C" {
 #include "usys_config.h"
 #include "usys_io.h"
 
+// Capacity of one queued outgoing frame
+#ifndef ASYNC_IO_TX_CHUNK
+#define ASYNC_IO_TX_CHUNK 1200
+#endif
+
+// Queued bytes above which async_io_tx_commit reports backpressure
+#ifndef ASYNC_IO_TX_HWM
+#define ASYNC_IO_TX_HWM (16 * 1024)
+#endif
+
+// Queued bytes a peer may owe us before frames are refused
+#ifndef ASYNC_IO_TX_MAX
+#define ASYNC_IO_TX_MAX (64 * 1024)
+#endif
+
+// Free frames kept per thread for reuse
+#ifndef ASYNC_IO_TX_CACHE
+#define ASYNC_IO_TX_CACHE 256
+#endif
+
 #define ASYNC_IO_STATE_READY (0x01 << 0)
 #define ASYNC_IO_STATE_ERRO (0x01 << 1)
 #define ASYNC_IO_STATE_SEND (0x01 << 2)
 #define ASYNC_IO_STATE_RECV (0x01 << 3)
+#define ASYNC_IO_STATE_LISTEN (0x01 << 4)
+#define ASYNC_IO_STATE_HUP (0x01 << 5)
 
 #define ASYNC_IO_READY(x) ((x) & (ASYNC_IO_STATE_READY))
 #define ASYNC_IO_SEND(x) ((x) & (ASYNC_IO_STATE_SEND))
 #define ASYNC_IO_RECV(x) ((x) & (ASYNC_IO_STATE_RECV))
 #define ASYNC_IO_ERRO(x) ((x) & (ASYNC_IO_STATE_ERRO))
+#define ASYNC_IO_LISTEN(x) ((x) & (ASYNC_IO_STATE_LISTEN))
 #define ASYNC_IO_SOCK(x) ((x)->sock >= 0)
 
+// Receive interest stays armed while queued frames go out
 #define ASYNC_IO_SET_SEND(x)                                                   \
     do {                                                                       \
         (x)->state |= ASYNC_IO_STATE_SEND;                                     \
-        (x)->state &= (~(ASYNC_IO_STATE_RECV));                                \
-        (x)->c = 0;                                                            \
     } while (0)
 
 #define ASYNC_IO_SET_RECV(x)                                                   \
@@ -61,7 +83,8 @@ extern "C" {
         (x)->state = 0;                                                        \
         (x)->c = 0;                                                            \
         (x)->len = 0;                                                          \
-        if (ASYNC_IO_SOCK((x))) usys_close(&(x)->sock);                        \
+        async_io_tx_clear((x));                                                \
+        if (ASYNC_IO_SOCK((x))) (x)->settings.close(&(x)->sock);               \
     } while (0)
 
 #define ASYNC_IO_SET_READY(x)                                                  \
@@ -76,7 +99,8 @@ extern "C" {
         (x)->state = 0;                                                        \
         (x)->c = 0;                                                            \
         (x)->len = 0;                                                          \
-        if (ASYNC_IO_SOCK((x))) usys_close(&(x)->sock);                        \
+        async_io_tx_clear((x));                                                \
+        if (ASYNC_IO_SOCK((x))) (x)->settings.close(&(x)->sock);               \
     } while (0)
 
 typedef int (*async_io_on_connect_fn)(void*);
@@ -99,15 +123,31 @@ typedef struct async_io_settings
     usys_io_close_fn close;
 } async_io_settings;
 
+struct async_loop;
+
+typedef struct async_io_chunk
+{
+    struct async_io_chunk* next; /*!< next frame in queue (or cache) */
+    uint32_t len;                /*!< bytes used */
+    uint8_t b[ASYNC_IO_TX_CHUNK];
+} async_io_chunk;
+
 typedef struct
 {
     usys_socket_fd sock;
     uint32_t state;
+    struct async_loop* loop; /*!< reactor (NULL when polled directly) */
+    uint32_t events;         /*!< interest registered with reactor */
     async_io_settings settings;
     void* ctx;
     usys_sockaddr addr;
     usys_sockaddr* addr_ptr;
     uint32_t c, len;
+    async_io_chunk* tx_head; /*!< queued frames, oldest first */
+    async_io_chunk* tx_tail; /*!< newest queued frame */
+    async_io_chunk* tx_res;  /*!< reserved frame, not yet committed */
+    uint32_t tx_bytes;       /*!< bytes queued (not yet written) */
+    uint32_t tx_off;         /*!< bytes of the head frame written */
     uint8_t b[1200];
 } async_io;
 
@@ -116,6 +156,20 @@ void async_io_init_udp(async_io*, void*, const async_io_settings*);
 void async_io_init(async_io*, void*, const async_io_settings*);
 void async_io_deinit(async_io* self);
 int async_io_connect(async_io* async, const char* ip, uint32_t p);
+
+/**
+ * @brief Turn io into a tcp listener. Readable listeners call on_accept, which
+ * should collect pending sockets with async_io_accept. Call before adding the
+ * io to a loop.
+ */
+int async_io_listen(async_io* self, uint32_t port);
+int async_io_accept(async_io* self, usys_socket_fd* fds, uint32_t n);
+
+/**
+ * @brief Take ownership of a connected socket (ie: from async_io_accept) and
+ * wait for the remote to speak.
+ */
+void async_io_open(async_io* self, usys_socket_fd sock);
 void async_io_close(async_io* self);
 void* async_io_mem(async_io* self, uint32_t idx);
 void async_io_len_set(async_io* self, uint32_t len);
@@ -123,9 +177,34 @@ uint32_t async_io_len(async_io* self);
 const void* async_io_memcpy(async_io* self, uint32_t idx, void* mem, size_t l);
 int async_io_print(async_io* self, uint32_t, const char* fmt, ...);
 int async_io_send(async_io*);
+
+/**
+ * @brief Outgoing frame queue. A frame is written in place: reserve a chunk
+ * (*len is set to its capacity), write into it and commit the bytes used.
+ * Frames go out in order, partial writes resume where the socket stopped and
+ * on_send fires once the queue has drained. Reads go on while the queue
+ * drains. An io sends either from its buffer (async_io_send, which stops
+ * reading until sent) or from its queue, not both at once.
+ *
+ * @return commit returns 0 ok, 1 ok but more than ASYNC_IO_TX_HWM bytes are
+ * waiting (backpressure), -1 frame dropped (ASYNC_IO_TX_MAX or no memory)
+ */
+uint8_t* async_io_tx_reserve(async_io* self, uint32_t* len);
+int async_io_tx_commit(async_io* self, uint32_t len);
+int async_io_tx(async_io* self, const void* b, uint32_t len);
+
+// Take queued frames without a socket (ie: loopback, tests)
+uint32_t async_io_tx_read(async_io* self, uint8_t* b, uint32_t len);
+
+// Drop queued frames
+void async_io_tx_clear(async_io* self);
+
+// Release free frames cached by the calling thread (before it exits)
+void async_io_tx_cache_deinit();
 int async_io_recv(async_io*);
 int async_io_poll_n(async_io** io, uint32_t n, uint32_t ms);
 int async_io_poll(async_io*);
+void async_io_arm(async_io*);
 void async_io_set_cb_recv(async_io* self, async_io_on_recv_fn fn);
 void async_io_set_cb_send(async_io* self, async_io_on_send_fn fn);
 int async_io_sock(async_io* self);
@@ -133,6 +212,18 @@ int async_io_has_sock(async_io* self);
 int async_io_state_recv(async_io* self);
 int async_io_state_send(async_io* self);
 
+static inline uint32_t
+async_io_tx_pending(async_io* self)
+{
+    return self->tx_bytes;
+}
+
+static inline int
+async_io_tx_full(async_io* self)
+{
+    return self->tx_bytes > ASYNC_IO_TX_HWM;
+}
+
 static inline int
 async_io_default_on_connect(void* ctx)
 {
@@ -0,0 +1,304 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_loop.h"
+#include "usys_time.h"
+#include "usys_trace.h"
+
+// Private
+int async_loop_wait(async_loop* loop, uint32_t ms);
+
+#if ASYNC_LOOP_EPOLL
+#include "async_uring.h"
+#include <errno.h>
+#include <sys/epoll.h>
+
+// Set in async_io.events once the socket is known to the epoll instance
+// (io_uring stores its slot index there instead)
+#define ASYNC_LOOP_REGISTERED (0x01u << 31)
+
+int
+async_loop_init(async_loop* loop)
+{
+    struct epoll_event ev;
+    memset(loop, 0, sizeof(async_loop));
+    async_wheel_init(&loop->timers, usys_now());
+    loop->fd = -1;
+    if (usys_wake_open(loop->wake)) return -1;
+#if ASYNC_LOOP_URING
+    // Prefer io_uring, kernels without support fall back to epoll
+    if ((loop->uring = async_uring_alloc())) {
+        if (!async_uring_wake(loop->uring, loop->wake[0])) return 0;
+        async_uring_free(&loop->uring);
+    }
+#endif
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // wakeup
+    if ((loop->fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        epoll_ctl(loop->fd, EPOLL_CTL_ADD, loop->wake[0], &ev)) {
+        async_loop_deinit(loop);
+        return -1;
+    }
+    return 0;
+}
+
+void
+async_loop_deinit(async_loop* loop)
+{
+    async_wheel_deinit(&loop->timers);
+#if ASYNC_LOOP_URING
+    if (loop->uring) async_uring_free(&loop->uring);
+#endif
+    if (loop->fd >= 0) close(loop->fd);
+    usys_wake_close(loop->wake);
+    memset(loop, 0, sizeof(async_loop));
+    loop->fd = loop->wake[0] = loop->wake[1] = -1;
+}
+
+int
+async_loop_add(async_loop* loop, async_io* io)
+{
+    if (io->loop) return io->loop == loop ? 0 : -1;
+    io->loop = loop;
+    io->events = 0;
+#if ASYNC_LOOP_URING
+    if (loop->uring && async_uring_add(loop->uring, io)) {
+        io->loop = NULL;
+        return -1;
+    }
+#endif
+    loop->n++;
+    async_loop_arm(loop, io);
+    return 0;
+}
+
+void
+async_loop_remove(async_loop* loop, async_io* io)
+{
+    if (!(io->loop == loop)) return;
+#if ASYNC_LOOP_URING
+    if (loop->uring) async_uring_remove(loop->uring, io);
+#endif
+    if (ASYNC_IO_SOCK(io) && (io->events & ASYNC_LOOP_REGISTERED)) {
+        epoll_ctl(loop->fd, EPOLL_CTL_DEL, io->sock, NULL);
+    }
+    io->loop = NULL;
+    io->events = 0;
+    loop->n--;
+}
+
+void
+async_loop_arm(async_loop* loop, async_io* io)
+{
+    struct epoll_event ev;
+    uint32_t want = 0;
+
+#if ASYNC_LOOP_URING
+    if (loop->uring) {
+        async_uring_arm(loop->uring, io);
+        return;
+    }
+#endif
+
+    // Closing a socket drops it from the epoll set
+    if (!ASYNC_IO_SOCK(io)) {
+        io->events = 0;
+        return;
+    }
+
+    // Connecting sockets signal completion with writable, sending ones keep
+    // reading
+    if (async_io_state_send(io)) want = EPOLLOUT;
+    if (async_io_state_recv(io)) want |= EPOLLIN | EPOLLRDHUP;
+    want |= ASYNC_LOOP_REGISTERED;
+    if (want == io->events) return;
+
+    // (Re)arm. EPOLL_CTL_MOD reports the socket again if already ready.
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (want & ~ASYNC_LOOP_REGISTERED) | EPOLLET;
+    ev.data.ptr = io;
+    if (io->events & ASYNC_LOOP_REGISTERED) {
+        if (epoll_ctl(loop->fd, EPOLL_CTL_MOD, io->sock, &ev) &&
+            errno == ENOENT) {
+            epoll_ctl(loop->fd, EPOLL_CTL_ADD, io->sock, &ev);
+        }
+    } else {
+        if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, io->sock, &ev) &&
+            errno == EEXIST) {
+            epoll_ctl(loop->fd, EPOLL_CTL_MOD, io->sock, &ev);
+        }
+    }
+    io->events = want;
+}
+
+int
+async_loop_wait(async_loop* loop, uint32_t ms)
+{
+    struct epoll_event ev[ASYNC_LOOP_EVENTS];
+    async_io* io;
+    int n, ret = 0;
+#if ASYNC_LOOP_URING
+    if (loop->uring) return async_uring_poll(loop->uring, ms);
+#endif
+    n = epoll_wait(
+        loop->fd,
+        ev,
+        ASYNC_LOOP_EVENTS,
+        ms == ASYNC_LOOP_FOREVER ? -1 : (int)ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    usys_tick(); // callbacks read the time they woke (usys_now_cached)
+    for (int i = 0; i < n; i++) {
+        if ((io = ev[i].data.ptr)) {
+            // rx reads eof and would block both as 0, a hang up tells them
+            // apart
+            if ((ev[i].events & (EPOLLRDHUP | EPOLLHUP)) &&
+                ASYNC_IO_RECV(io->state)) {
+                io->state |= ASYNC_IO_STATE_HUP;
+            }
+            async_io_poll(io);
+            ret++;
+        } else {
+            usys_wake_drain(loop->wake[0]);
+        }
+    }
+    return ret;
+}
+
+#else
+
+int
+async_loop_init(async_loop* loop)
+{
+    memset(loop, 0, sizeof(async_loop));
+    async_wheel_init(&loop->timers, usys_now());
+    loop->fd = -1;
+    return usys_wake_open(loop->wake);
+}
+
+void
+async_loop_deinit(async_loop* loop)
+{
+    async_wheel_deinit(&loop->timers);
+    if (loop->ios) usys_free(loop->ios);
+    usys_wake_close(loop->wake);
+    memset(loop, 0, sizeof(async_loop));
+    loop->fd = loop->wake[0] = loop->wake[1] = -1;
+}
+
+int
+async_loop_add(async_loop* loop, async_io* io)
+{
+    async_io** ios;
+    if (io->loop) return io->loop == loop ? 0 : -1;
+    if (loop->n == loop->size) {
+        uint32_t size = loop->size ? loop->size * 2 : 16;
+        if (!(ios = usys_malloc(size * sizeof(async_io*)))) return -1;
+        if (loop->n) memcpy(ios, loop->ios, loop->n * sizeof(async_io*));
+        if (loop->ios) usys_free(loop->ios);
+        loop->ios = ios;
+        loop->size = size;
+    }
+    loop->ios[loop->n++] = io;
+    io->loop = loop;
+    return 0;
+}
+
+void
+async_loop_remove(async_loop* loop, async_io* io)
+{
+    for (uint32_t i = 0; i < loop->n; i++) {
+        if (loop->ios[i] == io) {
+            loop->ios[i] = loop->ios[--loop->n];
+            io->loop = NULL;
+            break;
+        }
+    }
+}
+
+void
+async_loop_arm(async_loop* loop, async_io* io)
+{
+    // Interest is read from async_io state each poll
+    ((void)loop);
+    ((void)io);
+}
+
+int
+async_loop_wait(async_loop* loop, uint32_t ms)
+{
+    // Registered io plus the wakeup (last)
+    uint32_t i, n = loop->n, mask[(n + 1 + 31) / 32 + 1];
+    int reads[n + 1], writes[n + 1], err;
+    async_io** io = loop->ios;
+    memset(mask, 0, sizeof(mask));
+    for (i = 0; i < n; i++) {
+        reads[i] = async_io_state_recv(io[i]) ? io[i]->sock : -1;
+        writes[i] = async_io_state_send(io[i]) ? io[i]->sock : -1;
+    }
+    reads[n] = loop->wake[0];
+    writes[n] = -1;
+    err = usys_select(mask, mask, (int)ms, reads, n + 1, writes, n + 1);
+    usys_tick(); // callbacks read the time they woke (usys_now_cached)
+    if (mask[n / 32] & (0x01 << (n % 32))) usys_wake_drain(loop->wake[0]);
+    for (i = 0; i < n; i++) {
+        if (mask[i / 32] & (0x01 << (i % 32))) async_io_poll(io[i]);
+    }
+    return err;
+}
+
+#endif
+
+int
+async_loop_poll(async_loop* loop, uint32_t ms)
+{
+    // Sleep no longer than the next timer, then fire whatever came due
+    int64_t now = (int64_t)(usys_tick() / 1000000);
+    int n = async_loop_wait(loop, async_wheel_wait(&loop->timers, ms, now));
+
+    // Rearm wakeups. Callers look for queued work after this (see wake).
+    if (__atomic_load_n(&loop->woken, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&loop->woken, 0, __ATOMIC_SEQ_CST);
+    }
+    usys_trace_begin(t);
+    async_wheel_run(&loop->timers, usys_now_cached());
+    usys_trace_end(t, "async_wheel_run");
+    return n;
+}
+
+void
+async_loop_timer(async_loop* loop, async_timer* t, uint32_t ms)
+{
+    async_wheel_start(&loop->timers, t, usys_now_cached() + ms);
+}
+
+void
+async_loop_wake(async_loop* loop)
+{
+    // Only the first caller since the last wait writes
+    if (!__atomic_exchange_n(&loop->woken, 1, __ATOMIC_SEQ_CST)) {
+        usys_wake_signal(loop->wake[1]);
+    }
+}
+
+//
+//
+//
@@ -0,0 +1,105 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_loop.h
+ *
+ * @brief Reactor for async_io contexts. On linux sockets are registered once
+ * with an edge triggered epoll instance. Interest follows the async_io
+ * SEND/RECV state (see async_io_arm), so each wakeup only dispatches the
+ * contexts that are ready. Other platforms fall back to usys_select over the
+ * registered set.
+ *
+ * When built with ASYNC_LOOP_URING (see async_uring.h) the loop prefers an
+ * io_uring instance and only uses epoll if the kernel refuses it.
+ *
+ * Each loop also owns a timer wheel (see async_timer.h). async_loop_poll
+ * never blocks past the next timer and fires due timers after dispatching io.
+ * Other threads interrupt the wait with async_loop_wake (an eventfd, or a pipe
+ * off linux), so an idle loop can block with ASYNC_LOOP_FOREVER.
+ */
+#ifndef ASYNC_ASYNC_LOOP_H_
+#define ASYNC_ASYNC_LOOP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_io.h"
+#include "async_timer.h"
+
+#if defined(__linux__) && !defined(ASYNC_LOOP_USE_SELECT)
+#define ASYNC_LOOP_EPOLL 1
+#else
+#undef ASYNC_LOOP_URING
+#endif
+
+// Max events dispatched per wait
+#ifndef ASYNC_LOOP_EVENTS
+#define ASYNC_LOOP_EVENTS 64
+#endif
+
+// async_loop_poll wait with no timeout
+#define ASYNC_LOOP_FOREVER ((uint32_t)-1)
+
+struct async_uring;
+
+typedef struct async_loop
+{
+    int fd;                    /*!< epoll instance */
+    uint32_t n;                /*!< number of registered io */
+    uint32_t size;             /*!< capacity of ios (select fallback) */
+    async_io** ios;            /*!< registered io (select fallback) */
+    struct async_uring* uring; /*!< io_uring backend (NULL when epoll) */
+    async_wheel timers;        /*!< timers fired by async_loop_poll */
+    usys_file_fd wake[2];      /*!< wakeup read/write ends */
+    uint32_t woken;            /*!< wakeup written and not yet waited on */
+} async_loop;
+
+int async_loop_init(async_loop* loop);
+void async_loop_deinit(async_loop* loop);
+int async_loop_add(async_loop* loop, async_io* io);
+void async_loop_remove(async_loop* loop, async_io* io);
+void async_loop_arm(async_loop* loop, async_io* io);
+int async_loop_poll(async_loop* loop, uint32_t ms);
+
+/**
+ * @brief Arm (or re-arm) a timer to fire ms from now on the loop thread.
+ */
+void async_loop_timer(async_loop* loop, async_timer* t, uint32_t ms);
+
+/**
+ * @brief Return a blocked (or the next) async_loop_poll early. Safe from any
+ * thread and from signal handlers. Wakeups coalesce until the loop waits
+ * again, so work queued before the call is seen once poll returns.
+ */
+void async_loop_wake(async_loop* loop);
+
+static inline uint32_t
+async_loop_count(async_loop* loop)
+{
+    return loop->n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
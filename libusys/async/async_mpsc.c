@@ -0,0 +1,107 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_mpsc.h"
+
+// Private
+uint32_t* async_mpsc_seq(async_mpsc* q, uint32_t pos);
+
+int
+async_mpsc_init(async_mpsc* q, uint32_t esz, uint32_t n)
+{
+    uint32_t i, cap = 1;
+    memset(q, 0, sizeof(async_mpsc));
+    while (cap < n) cap <<= 1;
+    q->csz = 8 + ((esz + 7) & ~7u);
+    q->mem = usys_malloc(cap * q->csz);
+    if (!q->mem) return -1;
+    q->mask = cap - 1;
+    q->esz = esz;
+
+    // A cell is free for the producer whose position matches its sequence
+    for (i = 0; i < cap; i++) *async_mpsc_seq(q, i) = i;
+    return 0;
+}
+
+void
+async_mpsc_deinit(async_mpsc* q)
+{
+    if (q->mem) usys_free(q->mem);
+    q->mem = NULL;
+}
+
+int
+async_mpsc_push(async_mpsc* q, const void* e)
+{
+    uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED), *seq;
+    int32_t dif;
+
+    // Claim the cell at tail, or learn the queue is full
+    for (;;) {
+        seq = async_mpsc_seq(q, pos);
+        dif = (int32_t)(__atomic_load_n(seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                    &q->tail,
+                    &pos,
+                    pos + 1,
+                    1,
+                    __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1; // consumer hasn't freed this cell yet
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Publish to the consumer
+    memcpy(&seq[2], e, q->esz);
+    __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+async_mpsc_pop(async_mpsc* q, void* e)
+{
+    uint32_t pos = q->head, *seq = async_mpsc_seq(q, pos);
+    if ((int32_t)(__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0) {
+        return -1;
+    }
+    memcpy(e, &seq[2], q->esz);
+
+    // Free for the producer one lap ahead
+    __atomic_store_n(seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->head, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+uint32_t*
+async_mpsc_seq(async_mpsc* q, uint32_t pos)
+{
+    return (uint32_t*)&q->mem[(pos & q->mask) * q->csz];
+}
+
+//
+//
+//
@@ -0,0 +1,95 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_mpsc.h
+ *
+ * @brief Bounded multi producer / single consumer queue of fixed size
+ * elements. Lock free: producers claim a cell by advancing tail with a
+ * compare and swap, copy the element in and publish it through the cell's
+ * sequence number, so nobody waits on a mutex and the consumer never writes
+ * anything a producer spins on except the sequence it hands back. Elements
+ * come out in the order their cells were claimed. Paired with
+ * async_loop_wake so any thread can hand work to a reactor.
+ */
+#ifndef ASYNC_ASYNC_MPSC_H_
+#define ASYNC_ASYNC_MPSC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#ifndef ASYNC_MPSC_CACHE_LINE
+#define ASYNC_MPSC_CACHE_LINE 64
+#endif
+
+typedef struct
+{
+    uint32_t tail; /*!< next cell to claim (producers) */
+    uint8_t pad0[ASYNC_MPSC_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t head; /*!< next cell to read (consumer) */
+    uint8_t pad1[ASYNC_MPSC_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t mask; /*!< capacity - 1 (capacity is power of 2) */
+    uint32_t esz;  /*!< element size */
+    uint32_t csz;  /*!< cell size (sequence + element, 8 byte aligned) */
+    uint8_t* mem;  /*!< capacity * csz */
+} async_mpsc;
+
+/**
+ * @brief Allocate room for n elements of esz bytes (n rounded up to a power
+ * of 2).
+ */
+int async_mpsc_init(async_mpsc* q, uint32_t esz, uint32_t n);
+void async_mpsc_deinit(async_mpsc* q);
+
+/**
+ * @brief Copy one element in (any thread).
+ *
+ * @return 0 ok, -1 queue full
+ */
+int async_mpsc_push(async_mpsc* q, const void* e);
+
+/**
+ * @brief Copy one element out (consumer thread only). A producer that has
+ * claimed the next cell but not finished copying reads as empty until it
+ * does, later elements wait behind it.
+ *
+ * @return 0 ok, -1 queue empty
+ */
+int async_mpsc_pop(async_mpsc* q, void* e);
+
+/**
+ * @brief Approximate number of queued elements (includes cells still being
+ * written).
+ */
+static inline uint32_t
+async_mpsc_count(async_mpsc* q)
+{
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
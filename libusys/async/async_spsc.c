@@ -0,0 +1,76 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_spsc.h"
+
+int
+async_spsc_init(async_spsc* q, uint32_t esz, uint32_t n)
+{
+    uint32_t cap = 1;
+    memset(q, 0, sizeof(async_spsc));
+    while (cap < n) cap <<= 1;
+    q->mem = usys_malloc(cap * esz);
+    if (!q->mem) return -1;
+    q->mask = cap - 1;
+    q->esz = esz;
+    return 0;
+}
+
+void
+async_spsc_deinit(async_spsc* q)
+{
+    if (q->mem) usys_free(q->mem);
+    q->mem = NULL;
+}
+
+int
+async_spsc_push(async_spsc* q, const void* e)
+{
+    uint32_t tail = q->tail;
+
+    // Only reload the consumer index when our cached copy says full
+    if (tail - q->chead > q->mask) {
+        q->chead = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail - q->chead > q->mask) return -1;
+    }
+    memcpy(&q->mem[(tail & q->mask) * q->esz], e, q->esz);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+async_spsc_pop(async_spsc* q, void* e)
+{
+    uint32_t head = q->head;
+
+    // Only reload the producer index when our cached copy says empty
+    if (head == q->ctail) {
+        q->ctail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head == q->ctail) return -1;
+    }
+    memcpy(e, &q->mem[(head & q->mask) * q->esz], q->esz);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//
+//
+//
@@ -0,0 +1,92 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_spsc.h
+ *
+ * @brief Bounded single producer / single consumer queue of fixed size
+ * elements. Lock free: the producer only writes tail and the consumer only
+ * writes head, each on its own cache line, and elements are published with
+ * release/acquire ordering. Used to pass commands to a reactor running on
+ * another thread.
+ */
+#ifndef ASYNC_ASYNC_SPSC_H_
+#define ASYNC_ASYNC_SPSC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#ifndef ASYNC_SPSC_CACHE_LINE
+#define ASYNC_SPSC_CACHE_LINE 64
+#endif
+
+typedef struct
+{
+    uint32_t head;   /*!< next read (consumer) */
+    uint32_t ctail;  /*!< consumer copy of tail */
+    uint8_t pad0[ASYNC_SPSC_CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint32_t tail;   /*!< next write (producer) */
+    uint32_t chead;  /*!< producer copy of head */
+    uint8_t pad1[ASYNC_SPSC_CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint32_t mask;   /*!< capacity - 1 (capacity is power of 2) */
+    uint32_t esz;    /*!< element size */
+    uint8_t* mem;    /*!< capacity * esz */
+} async_spsc;
+
+/**
+ * @brief Allocate room for n elements of esz bytes (n rounded up to a power
+ * of 2).
+ */
+int async_spsc_init(async_spsc* q, uint32_t esz, uint32_t n);
+void async_spsc_deinit(async_spsc* q);
+
+/**
+ * @brief Copy one element in (producer thread only).
+ *
+ * @return 0 ok, -1 queue full
+ */
+int async_spsc_push(async_spsc* q, const void* e);
+
+/**
+ * @brief Copy one element out (consumer thread only).
+ *
+ * @return 0 ok, -1 queue empty
+ */
+int async_spsc_pop(async_spsc* q, void* e);
+
+/**
+ * @brief Approximate number of queued elements (exact from either end when
+ * the other side is idle).
+ */
+static inline uint32_t
+async_spsc_count(async_spsc* q)
+{
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
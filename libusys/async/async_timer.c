@@ -0,0 +1,162 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_timer.h"
+
+#define ASYNC_TIMER_MASK (ASYNC_TIMER_SLOTS - 1)
+
+// Private
+void async_timer_link(async_timer** head, async_timer* t);
+int64_t async_wheel_next(async_wheel* w);
+
+void
+async_wheel_init(async_wheel* w, int64_t now)
+{
+    memset(w, 0, sizeof(async_wheel));
+    w->now = now;
+    w->next = -1;
+}
+
+void
+async_wheel_deinit(async_wheel* w)
+{
+    async_timer* t;
+    // Leave owners with stopped timers, they may still call stop on them
+    for (uint32_t i = 0; i < ASYNC_TIMER_SLOTS; i++) {
+        while ((t = w->slots[i])) async_timer_stop(t);
+    }
+    w->next = -1;
+}
+
+void
+async_wheel_start(async_wheel* w, async_timer* t, int64_t expires)
+{
+    // Overdue timers go in the first bucket the next run will visit
+    int64_t tick = expires > w->now ? expires : w->now + 1;
+    async_timer_stop(t);
+    t->wheel = w;
+    t->expires = expires;
+    async_timer_link(&w->slots[tick & ASYNC_TIMER_MASK], t);
+    if (!w->n++ || (w->next >= 0 && expires < w->next)) w->next = expires;
+}
+
+uint32_t
+async_wheel_wait(async_wheel* w, uint32_t ms, int64_t now)
+{
+    int64_t due;
+    if (!w->n) return ms;
+    if (w->next < 0) w->next = async_wheel_next(w);
+    due = w->next - now;
+    if (due <= 0) return 0;
+    return due < ms ? (uint32_t)due : ms;
+}
+
+uint32_t
+async_wheel_run(async_wheel* w, int64_t now)
+{
+    async_timer *t, **pp, *fire = NULL, **tail = &fire;
+    int64_t tick = w->now;
+    uint32_t n = 0;
+
+    if (now <= w->now) return 0;
+    if (!w->n) {
+        w->now = now;
+        return 0;
+    }
+
+    // Visit each elapsed tick once (a long stall sweeps the wheel once) and
+    // move what is due onto a private list
+    if (now - tick > ASYNC_TIMER_SLOTS) tick = now - ASYNC_TIMER_SLOTS;
+    while (tick++ < now) {
+        pp = &w->slots[tick & ASYNC_TIMER_MASK];
+        while ((t = *pp)) {
+            if (t->expires > now) {
+                pp = &t->next;
+                continue;
+            }
+            async_timer_stop(t);
+            async_timer_link(tail, t);
+            tail = &t->next;
+            w->n++;
+        }
+    }
+    w->now = now;
+    if (!(w->next > now)) w->next = -1;
+
+    // Fire in the order the ticks were visited, which is deadline order only
+    // to the tick and not after a stall longer than the wheel. Pending timers
+    // stay linked so a callback can still stop them.
+    while ((t = fire)) {
+        async_timer_stop(t);
+        n++;
+        t->fn(t->ctx);
+    }
+    return n;
+}
+
+void
+async_timer_init(async_timer* t, async_timer_fn fn, void* ctx)
+{
+    memset(t, 0, sizeof(async_timer));
+    t->fn = fn;
+    t->ctx = ctx;
+}
+
+void
+async_timer_stop(async_timer* t)
+{
+    if (!t->pprev) return;
+    if ((*t->pprev = t->next)) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    t->wheel->n--;
+    if (t->expires == t->wheel->next) t->wheel->next = -1;
+}
+
+void
+async_timer_link(async_timer** head, async_timer* t)
+{
+    if ((t->next = *head)) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+int64_t
+async_wheel_next(async_wheel* w)
+{
+    async_timer* t;
+    int64_t tick = w->now, best = -1;
+
+    // Walk buckets in tick order. A bucket only holds timers due on its tick
+    // or a later revolution, so the first exact hit ends the scan.
+    for (uint32_t i = 0; i < ASYNC_TIMER_SLOTS; i++) {
+        tick++;
+        for (t = w->slots[tick & ASYNC_TIMER_MASK]; t; t = t->next) {
+            if (best < 0 || t->expires < best) best = t->expires;
+        }
+        if (best >= 0 && best <= tick) break;
+    }
+    return best;
+}
+
+//
+//
+//
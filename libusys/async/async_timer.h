@@ -0,0 +1,105 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_timer.h
+ *
+ * @brief Hashed timer wheel with 1ms ticks. Timers hash into one of
+ * ASYNC_TIMER_SLOTS buckets by their expiry, so start and stop are O(1) and
+ * running the wheel only visits the buckets for the ticks that elapsed.
+ * Timers further out than one revolution stay in their bucket until their
+ * turn comes round.
+ *
+ * Every async_loop owns a wheel and bounds its wait by the next expiry (see
+ * async_loop_timer), so a process with nothing due sleeps in the kernel.
+ * Callbacks run on the loop thread and may stop or restart any timer,
+ * including their own.
+ */
+#ifndef ASYNC_ASYNC_TIMER_H_
+#define ASYNC_ASYNC_TIMER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+// Buckets in the wheel (power of 2), one per ms
+#ifndef ASYNC_TIMER_SLOTS
+#define ASYNC_TIMER_SLOTS 1024
+#endif
+
+struct async_wheel;
+
+typedef void (*async_timer_fn)(void* ctx);
+
+typedef struct async_timer
+{
+    struct async_timer* next;   /*!< next timer in bucket */
+    struct async_timer** pprev; /*!< link to us (NULL when stopped) */
+    struct async_wheel* wheel;  /*!< wheel we were last started on */
+    int64_t expires;            /*!< absolute deadline (ms) */
+    async_timer_fn fn;          /*!< called on expiry */
+    void* ctx;                  /*!< passed to fn */
+} async_timer;
+
+typedef struct async_wheel
+{
+    async_timer* slots[ASYNC_TIMER_SLOTS]; /*!< buckets */
+    int64_t now;                           /*!< last tick processed */
+    int64_t next;                          /*!< earliest expiry (-1 unknown) */
+    uint32_t n;                            /*!< timers armed */
+} async_wheel;
+
+void async_wheel_init(async_wheel* w, int64_t now);
+void async_wheel_deinit(async_wheel* w);
+
+/**
+ * @brief Arm (or re-arm) a timer to fire at an absolute time. Deadlines in
+ * the past fire on the next run.
+ */
+void async_wheel_start(async_wheel* w, async_timer* t, int64_t expires);
+
+/**
+ * @brief How long a loop may block: ms, or less if a timer is due sooner.
+ */
+uint32_t async_wheel_wait(async_wheel* w, uint32_t ms, int64_t now);
+
+/**
+ * @brief Fire every timer due by now.
+ *
+ * @return number of callbacks made
+ */
+uint32_t async_wheel_run(async_wheel* w, int64_t now);
+
+void async_timer_init(async_timer* t, async_timer_fn fn, void* ctx);
+void async_timer_stop(async_timer* t);
+
+static inline int
+async_timer_active(async_timer* t)
+{
+    return t->pprev ? 1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,217 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_udp.h"
+#include <errno.h>
+
+// Private
+int async_udp_on_ready(void* ctx);
+void async_udp_want_send(async_udp* u, int want);
+int async_udp_transient(int err);
+
+async_io_settings g_async_udp_settings = {
+    .on_accept = async_udp_on_ready, //
+};
+
+int
+async_udp_init(async_udp* u, void* ctx, async_udp_on_recv_fn on_recv)
+{
+    uint32_t i;
+    memset(u, 0, sizeof(async_udp));
+    async_io_init(&u->io, u, &g_async_udp_settings);
+    u->ctx = ctx;
+    u->on_recv = on_recv;
+
+    // One pool for both directions, buffers never move
+    u->mem = usys_malloc(ASYNC_UDP_MTU * (ASYNC_UDP_BATCH + ASYNC_UDP_TX_RING));
+    if (!u->mem) return -1;
+    for (i = 0; i < ASYNC_UDP_BATCH; i++) {
+        u->rx[i].b = &u->mem[i * ASYNC_UDP_MTU];
+    }
+    for (i = 0; i < ASYNC_UDP_TX_RING; i++) {
+        u->tx[i].b = &u->mem[(ASYNC_UDP_BATCH + i) * ASYNC_UDP_MTU];
+    }
+    return 0;
+}
+
+void
+async_udp_deinit(async_udp* u)
+{
+    async_io_deinit(&u->io);
+    if (u->mem) usys_free(u->mem);
+    memset(u, 0, sizeof(async_udp));
+    u->io.sock = -1;
+}
+
+int
+async_udp_listen(async_udp* u, async_loop* loop, uint32_t port)
+{
+    if (usys_listen_udp(&u->io.sock, port)) return -1;
+
+    // Readable (or writable while the ring waits) calls async_udp_on_ready
+    u->io.state = ASYNC_IO_STATE_READY | ASYNC_IO_STATE_LISTEN;
+    if (async_loop_add(loop, &u->io)) {
+        usys_close(&u->io.sock);
+        u->io.state = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int
+async_udp_poll(async_udp* u)
+{
+    uint32_t i, total = 0;
+    int n, err = 0;
+
+    // Replies first, a writable socket may be why we were woken
+    u->ready = 0;
+    async_udp_flush(u);
+    while (total < ASYNC_UDP_RX_MAX) {
+        for (i = 0; i < ASYNC_UDP_BATCH; i++) u->rx[i].len = ASYNC_UDP_MTU;
+        n = usys_recv_mmsg(u->io.sock, u->rx, ASYNC_UDP_BATCH);
+        if (n < 0 && async_udp_transient(errno)) {
+            total++; // ie: icmp unreachable for an earlier send
+            continue;
+        } else if (n < 0) {
+            u->nerr++;
+            err = -1;
+            break;
+        } else if (n == 0) {
+            break;
+        }
+        for (i = 0; i < (uint32_t)n; i++) {
+            if (!u->rx[i].len) u->ndrop++;
+        }
+        u->nrecv += n;
+        total += n;
+        u->on_recv(u->ctx, u->rx, n);
+        if (n < ASYNC_UDP_BATCH) break; // drained
+    }
+
+    // Budget spent with datagrams still waiting, come back next iteration
+    if (total >= ASYNC_UDP_RX_MAX) u->ready = 1;
+    async_udp_flush(u);
+    return err ? err : (int)total;
+}
+
+uint8_t*
+async_udp_tx_reserve(async_udp* u, uint32_t* len)
+{
+    if (u->tx_n == ASYNC_UDP_TX_RING &&
+        async_udp_flush(u) == ASYNC_UDP_TX_RING) {
+        return NULL;
+    }
+    u->tx_res = 1;
+    *len = ASYNC_UDP_MTU;
+    return u->tx[(u->tx_head + u->tx_n) & (ASYNC_UDP_TX_RING - 1)].b;
+}
+
+int
+async_udp_tx_commit(async_udp* u, uint32_t len, const usys_sockaddr* to)
+{
+    usys_dgram* d = &u->tx[(u->tx_head + u->tx_n) & (ASYNC_UDP_TX_RING - 1)];
+    if (!u->tx_res) return -1;
+    u->tx_res = 0;
+    if (!len) return 0;
+    d->len = len;
+    d->addr = *to;
+    u->tx_n++;
+    return 0;
+}
+
+int
+async_udp_tx(async_udp* u, const void* b, uint32_t l, const usys_sockaddr* to)
+{
+    uint32_t cap;
+    uint8_t* mem = async_udp_tx_reserve(u, &cap);
+    if (!mem) {
+        u->ndrop++;
+        return -1;
+    }
+    if (l > cap) {
+        async_udp_tx_commit(u, 0, to);
+        return -1;
+    }
+    memcpy(mem, b, l);
+    return async_udp_tx_commit(u, l, to);
+}
+
+uint32_t
+async_udp_flush(async_udp* u)
+{
+    uint32_t run;
+    int n;
+
+    // Contiguous runs of the ring, one sendmmsg each
+    while (u->tx_n && ASYNC_IO_SOCK(&u->io)) {
+        run = ASYNC_UDP_TX_RING - u->tx_head;
+        if (run > u->tx_n) run = u->tx_n;
+        if (run > ASYNC_UDP_BATCH) run = ASYNC_UDP_BATCH;
+        n = usys_send_mmsg(u->io.sock, &u->tx[u->tx_head], run);
+        if (n == 0) break; // socket full, wait for writable
+        if (n < 0) {
+            u->ndrop++; // unroutable, skip it
+            n = 1;
+        } else {
+            u->nsent += n;
+        }
+        u->tx_head = (u->tx_head + n) & (ASYNC_UDP_TX_RING - 1);
+        u->tx_n -= n;
+    }
+    async_udp_want_send(u, u->tx_n > 0);
+    return u->tx_n;
+}
+
+int
+async_udp_on_ready(void* ctx)
+{
+    // Datagrams are taken after the loop has dispatched this batch
+    ((async_udp*)ctx)->ready = 1;
+    return 0;
+}
+
+void
+async_udp_want_send(async_udp* u, int want)
+{
+    // While queued the loop watches for writable (async_io_state_send)
+    if (!ASYNC_IO_SOCK(&u->io) || !want == !ASYNC_IO_SEND(u->io.state)) {
+        return;
+    }
+    if (want) {
+        u->io.state |= ASYNC_IO_STATE_SEND;
+    } else {
+        u->io.state &= ~ASYNC_IO_STATE_SEND;
+    }
+    async_io_arm(&u->io);
+}
+
+int
+async_udp_transient(int err)
+{
+    // Errors an earlier send left on the socket (icmp), gone once read
+    return err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH ||
+           err == EHOSTDOWN;
+}
+
+//
+//
+//
@@ -0,0 +1,134 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_udp.h
+ *
+ * @brief Batched datagram engine (discovery). The socket is registered with
+ * the loop for readiness only. Once the loop has dispatched, async_udp_poll
+ * drains it with recvmmsg into a fixed pool of buffers and hands the owner a
+ * batch per sys call. Replies are written in place into a ring of outgoing
+ * datagrams and go out with sendmmsg at the end of the poll (or sooner when
+ * the ring fills). When the socket can't take more the ring waits for the
+ * loop to report it writable; datagrams are never blocked on.
+ */
+#ifndef ASYNC_ASYNC_UDP_H_
+#define ASYNC_ASYNC_UDP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_loop.h"
+
+// Datagrams per recvmmsg/sendmmsg
+#ifndef ASYNC_UDP_BATCH
+#define ASYNC_UDP_BATCH 32
+#endif
+
+// Largest datagram (discovery packets are at most 1280 bytes)
+#ifndef ASYNC_UDP_MTU
+#define ASYNC_UDP_MTU 1280
+#endif
+
+// Datagrams read per async_udp_poll before other io gets a turn
+#ifndef ASYNC_UDP_RX_MAX
+#define ASYNC_UDP_RX_MAX 256
+#endif
+
+// Outgoing datagrams queued (power of 2)
+#ifndef ASYNC_UDP_TX_RING
+#define ASYNC_UDP_TX_RING 256
+#endif
+
+typedef void (*async_udp_on_recv_fn)(void*, const usys_dgram* d, uint32_t n);
+
+typedef struct
+{
+    async_io io;                      /*!< readiness, registered with loop */
+    void* ctx;                        /*!< passed to on_recv */
+    async_udp_on_recv_fn on_recv;     /*!< one call per batch */
+    uint32_t ready;                   /*!< reported, not yet drained */
+    uint8_t* mem;                     /*!< rx then tx buffers */
+    usys_dgram rx[ASYNC_UDP_BATCH];   /*!< batch being read */
+    usys_dgram tx[ASYNC_UDP_TX_RING]; /*!< queued datagrams */
+    uint32_t tx_head;                 /*!< oldest queued datagram */
+    uint32_t tx_n;                    /*!< queued datagrams */
+    uint32_t tx_res;                  /*!< slot after tx_n reserved */
+    uint32_t nrecv;                   /*!< datagrams read */
+    uint32_t nsent;                   /*!< datagrams sent */
+    uint32_t ndrop;                   /*!< datagrams refused or truncated */
+    uint32_t nerr;                    /*!< reads failed (not icmp) */
+} async_udp;
+
+int async_udp_init(async_udp* u, void* ctx, async_udp_on_recv_fn on_recv);
+void async_udp_deinit(async_udp* u);
+
+/**
+ * @brief Bind port (SO_REUSEPORT) and register with the loop.
+ */
+int async_udp_listen(async_udp* u, async_loop* loop, uint32_t port);
+
+/**
+ * @brief Flush queued datagrams and read up to ASYNC_UDP_RX_MAX, calling
+ * on_recv once per batch. Call after async_loop_poll while async_udp_busy.
+ * Errors icmp left from earlier sends are skipped, any other read error
+ * stops the poll (the socket is not reported busy).
+ *
+ * @return datagrams read, -1 read error
+ */
+int async_udp_poll(async_udp* u);
+
+/**
+ * @brief Outgoing datagram, written in place like async_io_tx_reserve. Commit
+ * 0 bytes to give the slot back.
+ *
+ * @return reserve returns NULL when the ring is full and the socket blocked,
+ * commit returns 0 ok, -1 nothing reserved
+ */
+uint8_t* async_udp_tx_reserve(async_udp* u, uint32_t* len);
+int async_udp_tx_commit(async_udp* u, uint32_t len, const usys_sockaddr* to);
+int async_udp_tx(async_udp* u, const void* b, uint32_t l, const usys_sockaddr*);
+
+/**
+ * @brief Send what is queued, as far as the socket takes it.
+ *
+ * @return datagrams still queued
+ */
+uint32_t async_udp_flush(async_udp* u);
+
+// Socket reported ready and not yet drained (don't block the loop)
+static inline int
+async_udp_busy(async_udp* u)
+{
+    return u->ready;
+}
+
+static inline uint32_t
+async_udp_tx_pending(async_udp* u)
+{
+    return u->tx_n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,969 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_loop.h"
+#include "async_uring.h"
+#include "usys_time.h"
+
+#if ASYNC_LOOP_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// user_data layout [gen:32][slot:16][idx:13][op:3]
+#define URING_OP_RECV 1
+#define URING_OP_POLL 2
+#define URING_OP_WRITE 3
+#define URING_OP_CANCEL 4
+#define URING_OP_WAKE 5
+#define URING_UD(g, s, i, op)                                                  \
+    (((uint64_t)(g) << 32) | ((uint64_t)(s) << 16) |                           \
+     ((uint64_t)((i)&0x1fff) << 3) | (op))
+#define URING_UD_POLL(g, s, seq) URING_UD(g, s, seq, URING_OP_POLL)
+#define URING_UD_GEN(ud) ((uint32_t)((ud) >> 32))
+#define URING_UD_SLOT(ud) ((uint32_t)(((ud) >> 16) & 0xffff))
+#define URING_UD_IDX(ud) ((uint32_t)(((ud) >> 3) & 0x1fff))
+#define URING_UD_OP(ud) ((uint32_t)((ud)&0x07))
+#define URING_SLOTS_MAX 0xffff
+
+// Slot flags
+#define URING_NATIVE (0x01 << 0)  /*!< tx/rx/close served by the ring */
+#define URING_RECV (0x01 << 1)    /*!< recv armed */
+#define URING_STARVED (0x01 << 2) /*!< recv waiting on provided buffers */
+#define URING_EOF (0x01 << 3)     /*!< remote closed */
+#define URING_BLOCKED (0x01 << 4) /*!< tx waiting on frames */
+#define URING_QUEUED (0x01 << 5)  /*!< on ready list */
+#define URING_FLUSH (0x01 << 6)   /*!< on flush list */
+
+#define URING_SID(u, s) ((uint32_t)((s) - (u)->slots))
+#define URING_RX_MEM(u, bid) (&(u)->rx_mem[(bid)*ASYNC_URING_RX_SIZE])
+#define URING_TX_MEM(u, f) (&(u)->tx_mem[(f)*ASYNC_URING_TX_FRAME_SIZE])
+
+typedef struct
+{
+    uint16_t len, off;
+    int16_t next;
+} async_uring_buf;
+
+typedef struct
+{
+    async_io* io;         /*!< NULL when slot is free */
+    uint32_t gen;         /*!< bumped on close, stale completions dropped */
+    uint32_t flags;       /*!< URING_ flags */
+    uint32_t poll_mask;   /*!< events of armed oneshot poll (0 none) */
+    uint32_t poll_seq;    /*!< identifies current poll */
+    int err;              /*!< pending socket error */
+    int16_t rx_head;      /*!< received buffers not yet read by rx */
+    int16_t rx_tail;      /*!< last received buffer */
+    int16_t tx_head;      /*!< frames not yet written */
+    int16_t tx_tail;      /*!< last queued frame */
+    uint16_t tx_n;        /*!< frames queued */
+    uint16_t tx_inflight; /*!< frames submitted */
+    int32_t wait_prev;    /*!< blocked list, previous slot (-1 head) */
+    int32_t wait_next;    /*!< blocked list, next slot (-1 tail) */
+} async_uring_slot;
+
+struct async_uring
+{
+    int fd;
+    int multishot;
+    uint32_t sq_entries, sq_mask, sq_tail, sq_flushed, cq_mask;
+    uint32_t *ksq_head, *ksq_tail, *ksq_array, *kcq_head, *kcq_tail;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+    struct io_uring_buf_ring* br;
+    uint16_t br_tail;
+    uint8_t* rx_mem;
+    uint32_t rx_avail, starved;
+    async_uring_buf rx[ASYNC_URING_RX_BUFS];
+    uint8_t* tx_mem;
+    int16_t tx_free;
+    int32_t tx_wait, tx_wait_tail;
+    async_uring_buf tx[ASYNC_URING_TX_FRAMES];
+    async_uring_slot* slots;
+    uint32_t size, nready, nflush;
+    uint32_t *ready, *flush;
+    int wake_fd;
+    uint64_t wake_buf;
+};
+
+// Private
+int async_uring_map(async_uring* u);
+int async_uring_buffers(async_uring* u);
+int async_uring_register(async_uring* u, uint32_t op, void* arg, uint32_t n);
+int async_uring_grow(async_uring* u);
+int async_uring_enter(async_uring* u, uint32_t ms, int wait);
+int async_uring_reap(async_uring* u);
+int async_uring_dispatch(async_uring* u);
+void async_uring_flush(async_uring* u);
+void async_uring_rearm(async_uring* u);
+int async_uring_room(async_uring* u, uint32_t n);
+struct io_uring_sqe* async_uring_sqe(async_uring* u);
+void async_uring_complete(async_uring*, uint64_t, int, uint32_t);
+void async_uring_on_recv(async_uring*, async_uring_slot*, int, int, uint32_t);
+void async_uring_on_write(async_uring*, async_uring_slot*, int16_t, int);
+void async_uring_recv(async_uring* u, async_uring_slot* s);
+void async_uring_write(async_uring* u, async_uring_slot* s);
+void async_uring_poll_add(async_uring* u, async_uring_slot* s, uint32_t want);
+void async_uring_cancel(async_uring* u, uint64_t ud);
+void async_uring_reset(async_uring* u, async_uring_slot* s);
+void async_uring_ready(async_uring* u, async_uring_slot* s);
+void async_uring_flush_add(async_uring* u, async_uring_slot* s);
+void async_uring_rx_put(async_uring* u, int16_t bid);
+void async_uring_tx_put(async_uring* u, int16_t f);
+void async_uring_block(async_uring* u, async_uring_slot* s);
+void async_uring_unblock(async_uring* u, async_uring_slot* s);
+
+// Private vtable installed on stream sockets
+int async_uring_tx(usys_socket_fd*, const byte*, uint32_t, usys_sockaddr*);
+int async_uring_rx(usys_socket_fd*, byte*, uint32_t, usys_sockaddr*);
+void async_uring_close(usys_socket_fd*);
+
+static inline async_io*
+async_uring_io(usys_socket_fd* fd)
+{
+    return (async_io*)((uint8_t*)fd - offsetof(async_io, sock));
+}
+
+static inline async_uring_slot*
+async_uring_slot_get(usys_socket_fd* fd)
+{
+    async_io* io = async_uring_io(fd);
+    return &io->loop->uring->slots[io->events];
+}
+
+async_uring*
+async_uring_alloc()
+{
+    async_uring* u = usys_malloc(sizeof(async_uring));
+    if (!u) return NULL;
+    memset(u, 0, sizeof(async_uring));
+    u->fd = u->wake_fd = -1;
+    u->tx_wait = u->tx_wait_tail = -1;
+    if (async_uring_map(u) || async_uring_buffers(u)) async_uring_free(&u);
+    return u;
+}
+
+void
+async_uring_free(async_uring** u_p)
+{
+    async_uring* u = *u_p;
+    *u_p = NULL;
+    if (u->fd >= 0) close(u->fd);
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_sz);
+    if (u->sq_ptr) munmap(u->sq_ptr, u->sq_sz);
+    if (u->br) munmap(u->br, ASYNC_URING_RX_BUFS * sizeof(struct io_uring_buf));
+    if (u->rx_mem) munmap(u->rx_mem, ASYNC_URING_RX_BUFS * ASYNC_URING_RX_SIZE);
+    if (u->tx_mem) {
+        munmap(u->tx_mem, ASYNC_URING_TX_FRAMES * ASYNC_URING_TX_FRAME_SIZE);
+    }
+    if (u->slots) usys_free(u->slots);
+    if (u->ready) usys_free(u->ready);
+    if (u->flush) usys_free(u->flush);
+    usys_free(u);
+}
+
+int
+async_uring_add(async_uring* u, async_io* io)
+{
+    async_uring_slot* s;
+    uint32_t sid;
+
+    // Slot indexes are stable for the life of the io (completions refer to it)
+    for (sid = 0; sid < u->size; sid++) {
+        if (!u->slots[sid].io) break;
+    }
+    if (sid == u->size && async_uring_grow(u)) return -1;
+    s = &u->slots[sid];
+    s->io = io;
+    s->flags &= (URING_QUEUED | URING_FLUSH);
+    s->poll_mask = 0;
+    s->err = 0;
+    s->rx_head = s->rx_tail = s->tx_head = s->tx_tail = -1;
+    s->tx_n = s->tx_inflight = 0;
+    io->events = sid;
+
+    // Stream sockets using the default sys calls are served by the ring
+    // (listeners are polled).
+    if (io->settings.tx == usys_send_to && io->settings.rx == usys_recv_from &&
+        io->settings.close == usys_close && !io->addr_ptr &&
+        !ASYNC_IO_LISTEN(io->state)) {
+        s->flags |= URING_NATIVE;
+        io->settings.tx = async_uring_tx;
+        io->settings.rx = async_uring_rx;
+        io->settings.close = async_uring_close;
+    }
+    return 0;
+}
+
+void
+async_uring_remove(async_uring* u, async_io* io)
+{
+    async_uring_slot* s = &u->slots[io->events];
+    async_uring_reset(u, s);
+    if (s->flags & URING_NATIVE) {
+        io->settings.tx = usys_send_to;
+        io->settings.rx = usys_recv_from;
+        io->settings.close = usys_close;
+    }
+    s->flags &= (URING_QUEUED | URING_FLUSH);
+    s->io = NULL;
+}
+
+void
+async_uring_arm(async_uring* u, async_io* io)
+{
+    async_uring_slot* s = &u->slots[io->events];
+    uint32_t want = 0;
+
+    // Closed sockets drop their poll (native sockets were reset on close)
+    if (!ASYNC_IO_SOCK(io)) {
+        if (s->poll_mask) async_uring_poll_add(u, s, 0);
+        return;
+    }
+
+    // Oneshot poll for connect completion and non native readiness
+    if (!ASYNC_IO_READY(io->state)) {
+        want = POLLOUT;
+    } else if (!(s->flags & URING_NATIVE)) {
+        if (async_io_state_send(io)) want = POLLOUT;
+        if (async_io_state_recv(io)) want |= POLLIN;
+    }
+    if (want != s->poll_mask) async_uring_poll_add(u, s, want);
+    if (!(s->flags & URING_NATIVE) || !ASYNC_IO_READY(io->state)) return;
+
+    // Native sockets always have a recv in flight, and are dispatched when
+    // there is work that can complete without the kernel.
+    async_uring_recv(u, s);
+    if ((async_io_state_send(io) && !(s->flags & URING_BLOCKED)) ||
+        (async_io_state_recv(io) &&
+         (s->rx_head >= 0 || s->err || (s->flags & URING_EOF)))) {
+        async_uring_ready(u, s);
+    }
+}
+
+int
+async_uring_poll(async_uring* u, uint32_t ms)
+{
+    int n;
+
+    // Work queued outside of the loop (ie: async_io_send)
+    async_uring_dispatch(u);
+    async_uring_flush(u);
+
+    // Submit and wait (unless there is more work ready now)
+    if (async_uring_enter(u, ms, !u->nready)) return -1;
+    usys_tick(); // callbacks read the time they woke (usys_now_cached)
+    n = async_uring_reap(u);
+    if (u->starved && u->rx_avail) async_uring_rearm(u);
+    async_uring_dispatch(u);
+
+    // Push writes from callbacks now rather than next poll
+    async_uring_flush(u);
+    async_uring_enter(u, 0, 0);
+    return n;
+}
+
+int
+async_uring_wake(async_uring* u, int fd)
+{
+    struct io_uring_sqe* sqe = async_uring_sqe(u);
+    if (!sqe) return -1;
+    u->wake_fd = fd;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->wake_buf;
+    sqe->len = sizeof(u->wake_buf);
+    sqe->user_data = URING_UD(0, 0, 0, URING_OP_WAKE);
+    return 0;
+}
+
+int
+async_uring_map(async_uring* u)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_COOP_TASKRUN)
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+#endif
+    u->fd = syscall(__NR_io_uring_setup, ASYNC_URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        u->fd = syscall(__NR_io_uring_setup, ASYNC_URING_ENTRIES, &p);
+    }
+    if (u->fd < 0) return -1;
+
+    // Need timeouts passed to io_uring_enter (5.11)
+    if (!(p.features & IORING_FEAT_EXT_ARG)) return -1;
+
+    // Map rings
+    u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_sz > u->sq_sz) u->sq_sz = u->cq_sz;
+        u->cq_sz = u->sq_sz;
+    }
+    u->sq_ptr = mmap(
+        0,
+        u->sq_sz,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        u->fd,
+        IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(
+            0,
+            u->cq_sz,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            u->fd,
+            IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            u->cq_ptr = NULL;
+            return -1;
+        }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(
+        0,
+        u->sqes_sz,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        u->fd,
+        IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    u->sq_entries = p.sq_entries;
+    u->sq_mask = *(uint32_t*)((uint8_t*)u->sq_ptr + p.sq_off.ring_mask);
+    u->ksq_head = (uint32_t*)((uint8_t*)u->sq_ptr + p.sq_off.head);
+    u->ksq_tail = (uint32_t*)((uint8_t*)u->sq_ptr + p.sq_off.tail);
+    u->ksq_array = (uint32_t*)((uint8_t*)u->sq_ptr + p.sq_off.array);
+    u->sq_tail = u->sq_flushed = *u->ksq_tail;
+    u->cq_mask = *(uint32_t*)((uint8_t*)u->cq_ptr + p.cq_off.ring_mask);
+    u->kcq_head = (uint32_t*)((uint8_t*)u->cq_ptr + p.cq_off.head);
+    u->kcq_tail = (uint32_t*)((uint8_t*)u->cq_ptr + p.cq_off.tail);
+    u->cqes = (struct io_uring_cqe*)((uint8_t*)u->cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+int
+async_uring_buffers(async_uring* u)
+{
+    struct io_uring_buf_reg reg;
+    struct iovec iov;
+    size_t brsz = ASYNC_URING_RX_BUFS * sizeof(struct io_uring_buf);
+    int prot = PROT_READ | PROT_WRITE, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    // Page aligned memory for the provided buffer ring and send frames
+    u->br = mmap(0, brsz, prot, flags, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        return -1;
+    }
+    u->rx_mem = mmap(
+        0,
+        ASYNC_URING_RX_BUFS * ASYNC_URING_RX_SIZE,
+        prot,
+        flags,
+        -1,
+        0);
+    if (u->rx_mem == MAP_FAILED) {
+        u->rx_mem = NULL;
+        return -1;
+    }
+    u->tx_mem = mmap(
+        0,
+        ASYNC_URING_TX_FRAMES * ASYNC_URING_TX_FRAME_SIZE,
+        prot,
+        flags,
+        -1,
+        0);
+    if (u->tx_mem == MAP_FAILED) {
+        u->tx_mem = NULL;
+        return -1;
+    }
+
+    // Receive memory is handed to the kernel as provided buffer group 0 (5.19)
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = ASYNC_URING_RX_BUFS;
+    reg.bgid = 0;
+    if (async_uring_register(u, IORING_REGISTER_PBUF_RING, &reg, 1)) return -1;
+    for (int16_t i = 0; i < ASYNC_URING_RX_BUFS; i++) async_uring_rx_put(u, i);
+
+    // Send frames are registered once so writes skip the page pinning
+    iov.iov_base = u->tx_mem;
+    iov.iov_len = ASYNC_URING_TX_FRAMES * ASYNC_URING_TX_FRAME_SIZE;
+    if (async_uring_register(u, IORING_REGISTER_BUFFERS, &iov, 1)) return -1;
+    for (int16_t i = 0; i < ASYNC_URING_TX_FRAMES; i++) {
+        u->tx[i].next = (i + 1 < ASYNC_URING_TX_FRAMES) ? i + 1 : -1;
+    }
+    u->tx_free = 0;
+    u->multishot = 1;
+    return 0;
+}
+
+int
+async_uring_register(async_uring* u, uint32_t op, void* arg, uint32_t n)
+{
+    return syscall(__NR_io_uring_register, u->fd, op, arg, n) < 0 ? -1 : 0;
+}
+
+int
+async_uring_grow(async_uring* u)
+{
+    uint32_t size = u->size ? u->size * 2 : 16;
+    async_uring_slot* slots;
+    uint32_t *ready, *flush;
+    if (size > URING_SLOTS_MAX) return -1;
+    slots = usys_malloc(size * sizeof(async_uring_slot));
+    ready = usys_malloc(size * sizeof(uint32_t));
+    flush = usys_malloc(size * sizeof(uint32_t));
+    if (!(slots && ready && flush)) {
+        if (slots) usys_free(slots);
+        if (ready) usys_free(ready);
+        if (flush) usys_free(flush);
+        return -1;
+    }
+    memset(slots, 0, size * sizeof(async_uring_slot));
+    if (u->size) {
+        memcpy(slots, u->slots, u->size * sizeof(async_uring_slot));
+        memcpy(ready, u->ready, u->nready * sizeof(uint32_t));
+        memcpy(flush, u->flush, u->nflush * sizeof(uint32_t));
+        usys_free(u->slots);
+        usys_free(u->ready);
+        usys_free(u->flush);
+    }
+    u->slots = slots;
+    u->ready = ready;
+    u->flush = flush;
+    u->size = size;
+    return 0;
+}
+
+int
+async_uring_enter(async_uring* u, uint32_t ms, int wait)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    uint32_t n = u->sq_tail - u->sq_flushed, flags = 0;
+    long ret;
+
+    __atomic_store_n(u->ksq_tail, u->sq_tail, __ATOMIC_RELEASE);
+    if (!(n || wait)) return 0;
+    memset(&arg, 0, sizeof(arg));
+    if (wait) {
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000;
+        if (!(ms == ASYNC_LOOP_FOREVER)) arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+    ret = syscall(
+        __NR_io_uring_enter,
+        u->fd,
+        n,
+        wait ? 1 : 0,
+        flags,
+        wait ? &arg : NULL,
+        wait ? sizeof(arg) : 0);
+    if (ret >= 0) {
+        u->sq_flushed += ret;
+        return 0;
+    }
+
+    // Timeout, signal, or completion queue backed up (reap and retry)
+    return (errno == ETIME || errno == EINTR || errno == EBUSY ||
+            errno == EAGAIN)
+               ? 0
+               : -1;
+}
+
+int
+async_uring_reap(async_uring* u)
+{
+    uint32_t head = *u->kcq_head, n = 0;
+    uint32_t tail = __atomic_load_n(u->kcq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe* cqe;
+    while (head != tail) {
+        cqe = &u->cqes[head & u->cq_mask];
+        async_uring_complete(u, cqe->user_data, cqe->res, cqe->flags);
+        head++;
+        n++;
+    }
+    __atomic_store_n(u->kcq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+int
+async_uring_dispatch(async_uring* u)
+{
+    uint32_t n = u->nready, sid;
+    async_uring_slot* s;
+    async_io* io;
+
+    // Callbacks may queue more work, only take what is ready now
+    for (uint32_t i = 0; i < n; i++) {
+        sid = u->ready[i];
+        s = &u->slots[sid];
+        s->flags &= ~URING_QUEUED;
+        if (!((io = s->io) && ASYNC_IO_SOCK(io))) continue;
+        if ((s->flags & URING_NATIVE) && ASYNC_IO_READY(io->state) &&
+            !async_io_state_send(io) &&
+            !(async_io_state_recv(io) &&
+              (s->rx_head >= 0 || s->err || (s->flags & URING_EOF)))) {
+            continue; // nothing to write, nothing received (looks like eof)
+        }
+        async_io_poll(io);
+    }
+    if (!n) return 0;
+    u->nready -= n;
+    memmove(u->ready, &u->ready[n], u->nready * sizeof(uint32_t));
+    return n;
+}
+
+void
+async_uring_flush(async_uring* u)
+{
+    async_uring_slot* s;
+    for (uint32_t i = 0; i < u->nflush; i++) {
+        s = &u->slots[u->flush[i]];
+        s->flags &= ~URING_FLUSH;
+        if (s->io && ASYNC_IO_SOCK(s->io) && !s->tx_inflight && !s->err) {
+            async_uring_write(u, s);
+        }
+    }
+    u->nflush = 0;
+}
+
+void
+async_uring_rearm(async_uring* u)
+{
+    async_uring_slot* s;
+    for (uint32_t i = 0; i < u->size && u->rx_avail; i++) {
+        s = &u->slots[i];
+        if (s->io && (s->flags & URING_STARVED)) {
+            s->flags &= ~URING_STARVED;
+            u->starved--;
+            async_uring_recv(u, s);
+        }
+    }
+}
+
+int
+async_uring_room(async_uring* u, uint32_t n)
+{
+    uint32_t head = __atomic_load_n(u->ksq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_tail - head + n <= u->sq_entries) return 0;
+    async_uring_enter(u, 0, 0);
+    head = __atomic_load_n(u->ksq_head, __ATOMIC_ACQUIRE);
+    return (u->sq_tail - head + n <= u->sq_entries) ? 0 : -1;
+}
+
+struct io_uring_sqe*
+async_uring_sqe(async_uring* u)
+{
+    struct io_uring_sqe* sqe;
+    uint32_t idx = u->sq_tail & u->sq_mask;
+    if (async_uring_room(u, 1)) return NULL;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    u->ksq_array[idx] = idx;
+    u->sq_tail++;
+    return sqe;
+}
+
+void
+async_uring_complete(async_uring* u, uint64_t ud, int res, uint32_t flags)
+{
+    uint32_t op = URING_UD_OP(ud), sid = URING_UD_SLOT(ud);
+    async_uring_slot* s = sid < u->size ? &u->slots[sid] : NULL;
+    int bid = -1;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        u->rx_avail--;
+    }
+    if (op == URING_OP_CANCEL) return;
+    if (op == URING_OP_WAKE) {
+        async_uring_wake(u, u->wake_fd); // read drained it, read again
+        return;
+    }
+
+    // Completions of a closed or removed socket only return resources
+    if (!(s && s->io && s->gen == URING_UD_GEN(ud))) {
+        if (bid >= 0) async_uring_rx_put(u, bid);
+        if (op == URING_OP_WRITE) async_uring_tx_put(u, URING_UD_IDX(ud));
+        return;
+    }
+    switch (op) {
+        case URING_OP_RECV: async_uring_on_recv(u, s, bid, res, flags); break;
+        case URING_OP_WRITE:
+            async_uring_on_write(u, s, URING_UD_IDX(ud), res);
+            break;
+        case URING_OP_POLL:
+            if (URING_UD_IDX(ud) == (s->poll_seq & 0x1fff)) {
+                s->poll_mask = 0;
+                async_uring_ready(u, s);
+            }
+            break;
+    }
+}
+
+void
+async_uring_on_recv(
+    async_uring* u,
+    async_uring_slot* s,
+    int bid,
+    int res,
+    uint32_t flags)
+{
+    if (res > 0 && bid >= 0) {
+        u->rx[bid].len = res;
+        u->rx[bid].off = 0;
+        u->rx[bid].next = -1;
+        if (s->rx_tail >= 0) {
+            u->rx[s->rx_tail].next = bid;
+        } else {
+            s->rx_head = bid;
+        }
+        s->rx_tail = bid;
+    } else if (bid >= 0) {
+        async_uring_rx_put(u, bid);
+    }
+    if (res == 0) {
+        s->flags |= URING_EOF;
+    } else if (res == -ENOBUFS) {
+        if (!(s->flags & URING_STARVED)) u->starved++;
+        s->flags |= URING_STARVED;
+    } else if (res == -EINVAL && u->multishot) {
+        u->multishot = 0; // Pre 6.0 kernel, rearm as single shot
+    } else if (res < 0) {
+        s->err = res;
+    }
+
+    // Multishot ends on error, eof, or when buffers ran out
+    if (!(flags & IORING_CQE_F_MORE)) {
+        s->flags &= ~URING_RECV;
+        if (!(s->flags & URING_STARVED)) async_uring_recv(u, s);
+    }
+    if (res != -ENOBUFS) async_uring_ready(u, s);
+}
+
+void
+async_uring_on_write(async_uring* u, async_uring_slot* s, int16_t f, int res)
+{
+    async_uring_buf* frame = &u->tx[f];
+    s->tx_inflight--;
+    if (res > 0 && res == frame->len - frame->off) {
+        // Linked frames complete in order so this is the head
+        s->tx_head = frame->next;
+        if (s->tx_head < 0) s->tx_tail = -1;
+        s->tx_n--;
+        async_uring_tx_put(u, f);
+    } else if (res > 0) {
+        frame->off += res; // short write breaks the chain, resubmit rest
+    } else if (!(res == -ECANCELED || res == -EAGAIN || res == -EINTR)) {
+        s->err = res ? res : -EPIPE;
+        async_uring_ready(u, s);
+    }
+    if (!s->tx_inflight && s->tx_head >= 0 && !s->err) {
+        async_uring_flush_add(u, s);
+    }
+    if (s->flags & URING_BLOCKED) {
+        async_uring_unblock(u, s);
+        async_uring_ready(u, s);
+    }
+}
+
+void
+async_uring_recv(async_uring* u, async_uring_slot* s)
+{
+    struct io_uring_sqe* sqe;
+    if ((s->flags & (URING_RECV | URING_EOF | URING_STARVED)) || s->err) return;
+    if (!u->rx_avail) {
+        s->flags |= URING_STARVED;
+        u->starved++;
+        return;
+    }
+    if (!(sqe = async_uring_sqe(u))) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s->io->sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = u->multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = URING_UD(s->gen, URING_SID(u, s), 0, URING_OP_RECV);
+    s->flags |= URING_RECV;
+}
+
+void
+async_uring_write(async_uring* u, async_uring_slot* s)
+{
+    struct io_uring_sqe* sqe = NULL;
+    uint32_t sid = URING_SID(u, s);
+    int16_t f;
+
+    // Queued frames go out as one linked chain so they are written in order.
+    if (s->tx_head < 0 || async_uring_room(u, s->tx_n)) return;
+    for (f = s->tx_head; f >= 0; f = u->tx[f].next) {
+        if (sqe) sqe->flags |= IOSQE_IO_LINK;
+        sqe = async_uring_sqe(u);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = s->io->sock;
+        sqe->addr = (uint64_t)(uintptr_t)(URING_TX_MEM(u, f) + u->tx[f].off);
+        sqe->len = u->tx[f].len - u->tx[f].off;
+        sqe->buf_index = 0;
+        sqe->user_data = URING_UD(s->gen, sid, f, URING_OP_WRITE);
+        s->tx_inflight++;
+    }
+}
+
+void
+async_uring_poll_add(async_uring* u, async_uring_slot* s, uint32_t want)
+{
+    struct io_uring_sqe* sqe;
+    uint32_t sid = URING_SID(u, s);
+    if (s->poll_mask) {
+        async_uring_cancel(u, URING_UD_POLL(s->gen, sid, s->poll_seq));
+    }
+    s->poll_seq++;
+    s->poll_mask = 0;
+    if (!(want && (sqe = async_uring_sqe(u)))) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s->io->sock;
+    sqe->poll32_events = want;
+    sqe->user_data = URING_UD_POLL(s->gen, sid, s->poll_seq);
+    s->poll_mask = want;
+}
+
+void
+async_uring_cancel(async_uring* u, uint64_t ud)
+{
+    struct io_uring_sqe* sqe = async_uring_sqe(u);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = ud;
+    sqe->user_data = URING_UD(0, 0, 0, URING_OP_CANCEL);
+}
+
+void
+async_uring_reset(async_uring* u, async_uring_slot* s)
+{
+    uint32_t sid = URING_SID(u, s), n = 0;
+    int16_t f, next;
+
+    // Cancel what is armed. Later completions have a stale gen.
+    if (s->flags & URING_RECV) {
+        async_uring_cancel(u, URING_UD(s->gen, sid, 0, URING_OP_RECV));
+    }
+    if (s->poll_mask) {
+        async_uring_cancel(u, URING_UD_POLL(s->gen, sid, s->poll_seq));
+        s->poll_mask = 0;
+    }
+    s->gen++;
+    if (s->flags & URING_BLOCKED) async_uring_unblock(u, s);
+
+    // Return unread buffers and frames the kernel does not own
+    while ((f = s->rx_head) >= 0) {
+        s->rx_head = u->rx[f].next;
+        async_uring_rx_put(u, f);
+    }
+    for (f = s->tx_head; f >= 0; f = next) {
+        next = u->tx[f].next;
+        if (n++ >= s->tx_inflight) async_uring_tx_put(u, f);
+    }
+    if (s->flags & URING_STARVED) u->starved--;
+    s->flags &= (URING_NATIVE | URING_QUEUED | URING_FLUSH);
+    s->rx_head = s->rx_tail = s->tx_head = s->tx_tail = -1;
+    s->tx_n = s->tx_inflight = 0;
+    s->err = 0;
+}
+
+void
+async_uring_ready(async_uring* u, async_uring_slot* s)
+{
+    if (s->flags & URING_QUEUED) return;
+    s->flags |= URING_QUEUED;
+    u->ready[u->nready++] = URING_SID(u, s);
+}
+
+void
+async_uring_flush_add(async_uring* u, async_uring_slot* s)
+{
+    if (s->flags & URING_FLUSH) return;
+    s->flags |= URING_FLUSH;
+    u->flush[u->nflush++] = URING_SID(u, s);
+}
+
+void
+async_uring_rx_put(async_uring* u, int16_t bid)
+{
+    uint32_t idx = u->br_tail & (ASYNC_URING_RX_BUFS - 1);
+    struct io_uring_buf* buf = &u->br->bufs[idx];
+    buf->addr = (uint64_t)(uintptr_t)URING_RX_MEM(u, bid);
+    buf->len = ASYNC_URING_RX_SIZE;
+    buf->bid = bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+    u->rx_avail++;
+}
+
+void
+async_uring_tx_put(async_uring* u, int16_t f)
+{
+    u->tx[f].next = u->tx_free;
+    u->tx_free = f;
+
+    // Wake the longest blocked slot, past those only held by their own chain
+    // (their writes wake them)
+    while (u->tx_wait >= 0) {
+        async_uring_slot* s = &u->slots[u->tx_wait];
+        async_uring_unblock(u, s);
+        async_uring_ready(u, s);
+        if (s->tx_n < ASYNC_URING_TX_CHAIN) break;
+    }
+}
+
+void
+async_uring_block(async_uring* u, async_uring_slot* s)
+{
+    int32_t sid = URING_SID(u, s);
+    if (s->flags & URING_BLOCKED) return;
+    s->flags |= URING_BLOCKED;
+    s->wait_prev = u->tx_wait_tail;
+    s->wait_next = -1;
+    if (u->tx_wait_tail >= 0) {
+        u->slots[u->tx_wait_tail].wait_next = sid;
+    } else {
+        u->tx_wait = sid;
+    }
+    u->tx_wait_tail = sid;
+}
+
+void
+async_uring_unblock(async_uring* u, async_uring_slot* s)
+{
+    s->flags &= ~URING_BLOCKED;
+    if (s->wait_prev >= 0) {
+        u->slots[s->wait_prev].wait_next = s->wait_next;
+    } else {
+        u->tx_wait = s->wait_next;
+    }
+    if (s->wait_next >= 0) {
+        u->slots[s->wait_next].wait_prev = s->wait_prev;
+    } else {
+        u->tx_wait_tail = s->wait_prev;
+    }
+}
+
+int
+async_uring_tx(
+    usys_socket_fd* fd,
+    const byte* b,
+    uint32_t l,
+    usys_sockaddr* addr)
+{
+    async_io* io = async_uring_io(fd);
+    async_uring* u = io->loop->uring;
+    async_uring_slot* s = &u->slots[io->events];
+    int16_t f;
+    ((void)addr);
+
+    if (s->err) return -1;
+    if (!l) return 0;
+
+    // Out of frames is would block, dispatched again when a write completes
+    if (s->tx_n >= ASYNC_URING_TX_CHAIN || (f = u->tx_free) < 0) {
+        async_uring_block(u, s);
+        return 0;
+    }
+    u->tx_free = u->tx[f].next;
+    if (l > ASYNC_URING_TX_FRAME_SIZE) l = ASYNC_URING_TX_FRAME_SIZE;
+    memcpy(URING_TX_MEM(u, f), b, l);
+    u->tx[f].len = l;
+    u->tx[f].off = 0;
+    u->tx[f].next = -1;
+    if (s->tx_tail >= 0) {
+        u->tx[s->tx_tail].next = f;
+    } else {
+        s->tx_head = f;
+    }
+    s->tx_tail = f;
+    s->tx_n++;
+    if (!s->tx_inflight) async_uring_flush_add(u, s);
+    return l;
+}
+
+int
+async_uring_rx(usys_socket_fd* fd, byte* b, uint32_t l, usys_sockaddr* addr)
+{
+    async_uring* u = async_uring_io(fd)->loop->uring;
+    async_uring_slot* s = async_uring_slot_get(fd);
+    int16_t bid = s->rx_head;
+    uint32_t n;
+    ((void)addr);
+
+    // Data first, then error. Empty is would block (or eof)
+    if (bid < 0) return s->err ? -1 : 0;
+    n = u->rx[bid].len - u->rx[bid].off;
+    if (n > l) n = l;
+    memcpy(b, URING_RX_MEM(u, bid) + u->rx[bid].off, n);
+    u->rx[bid].off += n;
+    if (u->rx[bid].off == u->rx[bid].len) {
+        s->rx_head = u->rx[bid].next;
+        if (s->rx_head < 0) s->rx_tail = -1;
+        async_uring_rx_put(u, bid);
+    }
+    return n;
+}
+
+void
+async_uring_close(usys_socket_fd* fd)
+{
+    async_io* io = async_uring_io(fd);
+    if (io->loop && io->loop->uring) {
+        async_uring_reset(io->loop->uring, async_uring_slot_get(fd));
+    }
+    usys_close(fd);
+}
+
+#endif
+
+//
+//
+//
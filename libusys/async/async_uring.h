@@ -0,0 +1,87 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_uring.h
+ *
+ * @brief io_uring backend for async_loop (linux). Stream sockets using the
+ * default usys tx/rx/close get their vtable swapped for completion based
+ * versions while attached:
+ *
+ * - rx is fed by a multishot recv into a registered ring of provided buffers
+ * - tx copies into registered fixed frames and writes them as a linked chain
+ * - connect completion and all other async_io (udp, mocks) use oneshot polls
+ *
+ * async_loop_init picks this backend when the kernel supports it and falls
+ * back to epoll otherwise.
+ */
+#ifndef ASYNC_ASYNC_URING_H_
+#define ASYNC_ASYNC_URING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_io.h"
+
+// Submission queue entries
+#ifndef ASYNC_URING_ENTRIES
+#define ASYNC_URING_ENTRIES 256
+#endif
+
+// Provided receive buffers (power of 2) and their size
+#ifndef ASYNC_URING_RX_BUFS
+#define ASYNC_URING_RX_BUFS 256
+#endif
+#ifndef ASYNC_URING_RX_SIZE
+#define ASYNC_URING_RX_SIZE 2048
+#endif
+
+// Registered send frames shared by all sockets, and max frames per chain
+#ifndef ASYNC_URING_TX_FRAMES
+#define ASYNC_URING_TX_FRAMES 128
+#endif
+#ifndef ASYNC_URING_TX_FRAME_SIZE
+#define ASYNC_URING_TX_FRAME_SIZE 1200
+#endif
+#ifndef ASYNC_URING_TX_CHAIN
+#define ASYNC_URING_TX_CHAIN 8
+#endif
+
+typedef struct async_uring async_uring;
+
+async_uring* async_uring_alloc();
+void async_uring_free(async_uring** u_p);
+int async_uring_add(async_uring* u, async_io* io);
+void async_uring_remove(async_uring* u, async_io* io);
+void async_uring_arm(async_uring* u, async_io* io);
+int async_uring_poll(async_uring* u, uint32_t ms);
+
+/**
+ * @brief Keep a read of fd (the loop's eventfd) in flight. Its completion
+ * ends a wait.
+ */
+int async_uring_wake(async_uring* u, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,125 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file bench_stream.c
+ *
+ * @brief Loopback throughput of the reactor: unix socketpairs streaming
+ * 1100 byte frames (about an rlpx frame) from one end to the other, all on
+ * one async_loop. Reports the reactor in use and MB/s received.
+ *
+ * usys_bench_stream [pairs] [rounds]
+ *
+ * Built with UETH_USE_IO_URING=OFF (or a kernel without support) the loop
+ * is epoll.
+ */
+
+#include "async_io.h"
+#include "async_loop.h"
+#include "usys_time.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#define BENCH_PAIRS_MAX 1024
+#define BENCH_FRAME 1100
+
+int bench_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int bench_on_erro(void* ctx);
+
+static uint64_t g_bench_bytes = 0;
+static async_io g_bench_tx[BENCH_PAIRS_MAX], g_bench_rx[BENCH_PAIRS_MAX];
+
+int
+main(int argc, char* argv[])
+{
+    async_io_settings settings = {.on_recv = bench_on_recv,
+                                  .on_erro = bench_on_erro };
+    uint32_t pairs = argc > 1 ? atoi(argv[1]) : 64;
+    uint32_t rounds = argc > 2 ? atoi(argv[2]) : 5000, i, r;
+    async_loop loop;
+    uint64_t t;
+    int sv[2];
+
+    if (!(pairs && pairs <= BENCH_PAIRS_MAX)) return -1;
+    signal(SIGPIPE, SIG_IGN);
+    if (async_loop_init(&loop)) return -1;
+    for (i = 0; i < pairs; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) return -1;
+        async_io_init(&g_bench_tx[i], &g_bench_tx[i], &settings);
+        async_io_init(&g_bench_rx[i], &g_bench_rx[i], &settings);
+        g_bench_tx[i].sock = sv[0];
+        g_bench_rx[i].sock = sv[1];
+        ASYNC_IO_SET_READY(&g_bench_tx[i]);
+        ASYNC_IO_SET_READY(&g_bench_rx[i]);
+        async_io_recv(&g_bench_rx[i]);
+        async_loop_add(&loop, &g_bench_tx[i]);
+        async_loop_add(&loop, &g_bench_rx[i]);
+    }
+
+    // A frame per pair and round, when the previous one went out
+    t = usys_now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < pairs; i++) {
+            if (async_io_state_send(&g_bench_tx[i])) continue;
+            memset(async_io_mem(&g_bench_tx[i], 0), r, BENCH_FRAME);
+            async_io_len_set(&g_bench_tx[i], BENCH_FRAME);
+            async_io_send(&g_bench_tx[i]);
+        }
+        async_loop_poll(&loop, 10);
+    }
+    t = usys_now_ns() - t;
+    printf(
+        "%s: %u pairs, %llu bytes in %llu ms, %.1f MB/s\n",
+        loop.uring ? "io_uring" : "epoll",
+        pairs,
+        (unsigned long long)g_bench_bytes,
+        (unsigned long long)(t / 1000000),
+        t ? g_bench_bytes * 1000.0 / t : 0.0);
+
+    for (i = 0; i < pairs; i++) {
+        async_loop_remove(&loop, &g_bench_tx[i]);
+        async_loop_remove(&loop, &g_bench_rx[i]);
+        async_io_deinit(&g_bench_tx[i]);
+        async_io_deinit(&g_bench_rx[i]);
+    }
+    async_loop_deinit(&loop);
+    return 0;
+}
+
+int
+bench_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    if (!err) g_bench_bytes += l;
+    return async_io_recv(ctx);
+}
+
+int
+bench_on_erro(void* ctx)
+{
+    fprintf(stderr, "bench: io error\n");
+    return 0;
+}
+
+//
+//
+//
@@ -20,6 +20,20 @@
  */
 
 #include "async_io.h"
+#include "async_loop.h"
+#include "async_mpsc.h"
+#include "async_spsc.h"
+#include "async_timer.h"
+#include "async_udp.h"
+#include "usys_log.h"
+#include "usys_metrics.h"
+#include "usys_thread.h"
+#include "usys_time.h"
+#include "usys_trace.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 // 56 byte test vector
 char* g_lorem = "Lorem ipsum dolor sit amet, consectetur adipisicing elit";
@@ -42,6 +56,63 @@ int io_on_accept(void* ctx);
 int io_on_erro(void* ctx);
 int io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
 int io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_on_recv_loop(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_on_send_count(void* ctx, int err, const uint8_t* b, uint32_t l);
+
+// Reactor test
+int test_loop();
+
+// Remote close in the same edge as its last data
+int test_eof();
+int io_on_erro_loop(void* ctx);
+
+// Listener test
+int test_listen();
+int io_on_accept_loop(void* ctx);
+
+// Send queue test
+int test_tx_queue();
+
+// Cross thread queue test
+int test_spsc();
+void* test_spsc_producer(void* ctx);
+
+// Many producer queue test
+int test_mpsc();
+void* test_mpsc_producer(void* ctx);
+
+// Timer test
+int test_timer();
+void test_timer_on_fire(void* ctx);
+
+// Loop wakeup test
+int test_wake();
+void* test_wake_thread(void* ctx);
+
+// Batched datagram test
+int test_udp();
+void test_udp_on_recv(void* ctx, const usys_dgram* d, uint32_t n);
+
+// Asynchronous logger test
+int test_log();
+void* test_log_thread(void* ctx);
+#define TEST_LOG_D7 "%d%d%d%d%d%d%d"
+#define TEST_LOG_0x7 0, 0, 0, 0, 0, 0, 0
+#define TEST_LOG_28 "0000000000000000000000000000"
+
+// Metrics test
+int test_metrics();
+void test_metrics_fill(void* ctx, usys_metrics_text* text);
+
+// Trace test
+int test_trace();
+
+// Cached clock test
+int test_clock();
+void* test_clock_thread(void* ctx);
+
+// File mapping test
+int test_map();
 
 typedef struct
 {
@@ -49,6 +120,37 @@ typedef struct
     async_io_settings* settings;
 } io_test_settings;
 
+typedef struct
+{
+    async_io io;
+    usys_socket_fd fd; /*!< last accepted */
+    int n;             /*!< accepted */
+} io_test_listener;
+
+typedef struct
+{
+    async_timer t;
+    async_wheel* w;
+    int id;
+    int rearm;         /*!< restart this many times from the callback */
+    async_timer* stop; /*!< stopped from the callback */
+} io_test_timer;
+
+typedef struct
+{
+    async_mpsc* q;
+    uint32_t id; /*!< tag in the top byte of each element */
+} io_test_producer;
+
+typedef struct
+{
+    async_udp u;
+    int n;       /*!< datagrams echoed */
+    int batches; /*!< on_recv calls */
+} io_test_udp;
+
+int g_timer_fired[8], g_timer_n = 0;
+
 async_io_settings g_io_settings_all = {.on_connect = io_on_connect,
                                        .on_accept = io_on_accept,
                                        .on_erro = io_on_erro,
@@ -115,6 +217,512 @@ main(int argc, char* argv[])
         // Test receive.
         async_io_deinit(&io);
     }
+    if (!err) err = test_loop();
+    if (!err) err = test_eof();
+    if (!err) err = test_listen();
+    if (!err) err = test_tx_queue();
+    if (!err) err = test_spsc();
+    if (!err) err = test_mpsc();
+    if (!err) err = test_timer();
+    if (!err) err = test_wake();
+    if (!err) err = test_udp();
+    if (!err) err = test_log();
+    if (!err) err = test_metrics();
+    if (!err) err = test_trace();
+    if (!err) err = test_clock();
+    if (!err) err = test_map();
+    return err;
+}
+
+int
+test_loop()
+{
+    int err = -1, sv[2], c, n = 0, sent = 1;
+    async_loop loop;
+    async_io a, b;
+    async_io_settings settings = {.on_recv = io_on_recv_loop };
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) return -1;
+    async_loop_init(&loop);
+    async_io_init(&a, &n, &settings);
+    async_io_init(&b, &n, &settings);
+    a.sock = sv[0];
+    b.sock = sv[1];
+    ASYNC_IO_SET_READY(&a);
+    ASYNC_IO_SET_READY(&b);
+    async_io_recv(&a);
+    async_io_recv(&b);
+    async_loop_add(&loop, &a);
+    async_loop_add(&loop, &b);
+
+    // Nothing to do
+    if (async_loop_poll(&loop, 0)) goto EXIT;
+
+    // Ping pong a few times, each side writes after the other side recvs
+    async_io_print(&a, 0, "%s", g_lorem);
+    async_io_send(&a);
+    for (c = 0; c < 20 && n < 4; c++) {
+        async_loop_poll(&loop, 10);
+        if (n == sent) {
+            sent++;
+            if (n & 0x01) {
+                async_io_print(&b, 0, "%s", g_lorem);
+                async_io_send(&b);
+            } else {
+                async_io_print(&a, 0, "%s", g_lorem);
+                async_io_send(&a);
+            }
+        }
+    }
+    err = (n == 4) ? 0 : -1;
+
+EXIT:
+    async_io_deinit(&a);
+    async_io_deinit(&b);
+    async_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_eof()
+{
+    int err = -1, sv[2], c, n = 0;
+    async_loop loop;
+    async_io a;
+    async_io_settings settings = {.on_recv = io_on_recv_loop,
+                                  .on_erro = io_on_erro_loop };
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) return -1;
+    async_loop_init(&loop);
+    async_io_init(&a, &n, &settings);
+    a.sock = sv[0];
+    ASYNC_IO_SET_READY(&a);
+    async_io_recv(&a);
+    async_loop_add(&loop, &a);
+
+    // Data and fin before the first wait, no later edge reports the eof
+    if (write(sv[1], g_lorem, strlen(g_lorem)) < 0) goto EXIT;
+    shutdown(sv[1], SHUT_WR);
+    for (c = 0; c < 5 && n != 101; c++) async_loop_poll(&loop, 10);
+    err = (n == 101) ? 0 : -1;
+
+EXIT:
+    async_io_deinit(&a);
+    async_loop_deinit(&loop);
+    close(sv[1]);
+    return err;
+}
+
+int
+test_listen()
+{
+    int err = -1, n = 0, c;
+    usys_socket_fd fds[4];
+    async_loop loop;
+    async_io a, b;
+    io_test_listener l = {.n = 0 };
+    async_io_settings settings = {.on_accept = io_on_accept_loop,
+                                  .on_recv = io_on_recv_loop };
+
+    async_loop_init(&loop);
+    async_io_init(&l.io, &l, &settings);
+    async_io_init(&a, &n, &settings);
+    async_io_init(&b, &n, &settings);
+    if (async_io_listen(&l.io, 40321)) goto EXIT;
+    async_loop_add(&loop, &l.io);
+    async_loop_add(&loop, &b);
+
+    // Accept the connection from the loop and read what it sends
+    if (async_io_connect(&a, "127.0.0.1", 40321) < 0) goto EXIT;
+    async_loop_add(&loop, &a);
+    for (c = 0; c < 20 && !l.n; c++) async_loop_poll(&loop, 10);
+    if (!(l.n == 1)) goto EXIT;
+    async_io_open(&b, l.fd);
+    async_io_print(&a, 0, "%s", g_lorem);
+    async_io_send(&a);
+    for (c = 0; c < 20 && !n; c++) async_loop_poll(&loop, 10);
+
+    // Nothing else pending
+    err = (n == 1 && !async_io_accept(&l.io, fds, 4)) ? 0 : -1;
+
+EXIT:
+    async_io_deinit(&a);
+    async_io_deinit(&b);
+    async_io_deinit(&l.io);
+    async_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_tx_queue()
+{
+    int err = -1, sv[2], c, n = 0, sz = 4096, r, full = 0;
+    uint32_t i, l, sent = 0, got = 0;
+    uint8_t* mem;
+    uint8_t in[4096];
+    async_loop loop;
+    async_io a;
+    async_io_settings settings = {.on_send = io_on_send_count,
+                                  .on_recv = io_on_recv_loop };
+
+    // Small socket buffers so the queue has to resume partial writes
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) return -1;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    async_loop_init(&loop);
+    async_io_init(&a, &n, &settings);
+    async_io_open(&a, sv[0]);
+    async_loop_add(&loop, &a);
+
+    // Queue frames of odd sizes until the budget refuses one
+    for (i = 0; i < 1000; i++) {
+        if (!(mem = async_io_tx_reserve(&a, &l))) goto EXIT;
+        l = 100 + (i % 7) * 100;
+        for (c = 0; c < (int)l; c++) mem[c] = (uint8_t)(sent + c);
+        r = async_io_tx_commit(&a, l);
+        if (r < 0) break;
+        if (r > 0) full = 1;
+        sent += l;
+    }
+    if (!(full && sent <= ASYNC_IO_TX_MAX && async_io_tx_full(&a))) goto EXIT;
+
+    // Still reading while the queue waits on the peer
+    if (!(send(sv[1], g_lorem, strlen(g_lorem), 0) == (int)strlen(g_lorem))) {
+        goto EXIT;
+    }
+    for (c = 0; c < 100 && !n; c++) async_loop_poll(&loop, 1);
+    if (!(n == 1 && async_io_tx_pending(&a))) goto EXIT;
+
+    // Peer reads it all back in order, on_send once the queue drains
+    for (c = 0; c < 1000 && got < sent; c++) {
+        async_loop_poll(&loop, 1);
+        while ((r = recv(sv[1], in, sizeof(in), 0)) > 0) {
+            for (i = 0; i < (uint32_t)r; i++) {
+                if (!(in[i] == (uint8_t)(got + i))) goto EXIT;
+            }
+            got += r;
+        }
+    }
+    async_loop_poll(&loop, 0);
+    err = (got == sent && n == 2 && !async_io_tx_pending(&a)) ? 0 : -1;
+
+EXIT:
+    async_io_deinit(&a);
+    async_loop_deinit(&loop);
+    usys_close_fd(sv[1]);
+    async_io_tx_cache_deinit();
+    return err;
+}
+
+void*
+test_spsc_producer(void* ctx)
+{
+    async_spsc* q = ctx;
+    for (uint32_t i = 0; i < 10000; i++) {
+        while (async_spsc_push(q, &i)) usys_msleep(0);
+    }
+    return NULL;
+}
+
+int
+test_spsc()
+{
+    int err = -1;
+    uint32_t i, e;
+    async_spsc q;
+    usys_thread t;
+
+    if (async_spsc_init(&q, sizeof(uint32_t), 5)) return -1;
+
+    // Capacity rounds up to 8, then full
+    for (i = 0; i < 8; i++) {
+        if (async_spsc_push(&q, &i)) goto EXIT;
+    }
+    if (!async_spsc_push(&q, &i)) goto EXIT;
+    if (!(async_spsc_count(&q) == 8)) goto EXIT;
+    for (i = 0; i < 8; i++) {
+        if (async_spsc_pop(&q, &e) || !(e == i)) goto EXIT;
+    }
+    if (!async_spsc_pop(&q, &e)) goto EXIT;
+
+    // Elements arrive in order from another thread
+    if (usys_thread_create(&t, test_spsc_producer, &q)) goto EXIT;
+    for (i = 0; i < 10000;) {
+        if (async_spsc_pop(&q, &e)) {
+            usys_msleep(0);
+        } else if (!(e == i++)) {
+            break;
+        }
+    }
+    usys_thread_join(&t);
+    err = (i == 10000 && e == 9999) ? 0 : -1;
+
+EXIT:
+    async_spsc_deinit(&q);
+    return err;
+}
+
+void*
+test_mpsc_producer(void* ctx)
+{
+    io_test_producer* p = ctx;
+    for (uint32_t i = 0; i < 10000; i++) {
+        uint32_t e = (p->id << 24) | i;
+        while (async_mpsc_push(p->q, &e)) usys_msleep(0);
+    }
+    return NULL;
+}
+
+int
+test_mpsc()
+{
+    int err = -1, c;
+    uint32_t i, e, next[3] = { 0, 0, 0 };
+    async_mpsc q;
+    usys_thread t[3];
+    io_test_producer p[3];
+
+    if (async_mpsc_init(&q, sizeof(uint32_t), 5)) return -1;
+
+    // Capacity rounds up to 8, then full
+    for (i = 0; i < 8; i++) {
+        if (async_mpsc_push(&q, &i)) goto EXIT;
+    }
+    if (!async_mpsc_push(&q, &i)) goto EXIT;
+    if (!(async_mpsc_count(&q) == 8)) goto EXIT;
+    for (i = 0; i < 8; i++) {
+        if (async_mpsc_pop(&q, &e) || !(e == i)) goto EXIT;
+    }
+    if (!async_mpsc_pop(&q, &e)) goto EXIT;
+
+    // Each producer's elements arrive in its order, none lost
+    for (c = 0; c < 3; c++) {
+        p[c].q = &q;
+        p[c].id = c;
+        if (usys_thread_create(&t[c], test_mpsc_producer, &p[c])) {
+            while (c--) usys_thread_join(&t[c]);
+            goto EXIT;
+        }
+    }
+    for (i = 0; i < 30000;) {
+        if (async_mpsc_pop(&q, &e)) {
+            usys_msleep(0);
+        } else if ((e >> 24) < 3 && (e & 0xffffff) == next[e >> 24]) {
+            next[e >> 24]++;
+            i++;
+        } else {
+            break;
+        }
+    }
+    for (c = 0; c < 3; c++) usys_thread_join(&t[c]);
+    err = (i == 30000 && async_mpsc_pop(&q, &e)) ? 0 : -1;
+
+EXIT:
+    async_mpsc_deinit(&q);
+    return err;
+}
+
+void
+test_timer_on_fire(void* ctx)
+{
+    io_test_timer* x = ctx;
+    g_timer_fired[g_timer_n++ & 7] = x->id;
+    if (x->stop) async_timer_stop(x->stop);
+    if (x->rearm) {
+        x->rearm--;
+        async_wheel_start(x->w, &x->t, x->w->now + 5);
+    }
+}
+
+int
+test_timer()
+{
+    int err = -1, i;
+    int64_t now;
+    async_wheel w;
+    async_loop loop;
+    io_test_timer t[4];
+
+    async_wheel_init(&w, 1000);
+    for (i = 0; i < 4; i++) {
+        memset(&t[i], 0, sizeof(io_test_timer));
+        async_timer_init(&t[i].t, test_timer_on_fire, &t[i]);
+        t[i].w = &w;
+        t[i].id = i;
+    }
+
+    // Deadlines out of order, t2 shares a bucket with t3 a revolution later
+    async_wheel_start(&w, &t[0].t, 1010);
+    async_wheel_start(&w, &t[1].t, 1005);
+    async_wheel_start(&w, &t[2].t, 1003 + ASYNC_TIMER_SLOTS);
+    async_wheel_start(&w, &t[3].t, 1003);
+    if (!(async_wheel_wait(&w, 100, 1000) == 3)) goto EXIT;
+    async_timer_stop(&t[3].t);
+    if (!(async_wheel_wait(&w, 100, 1000) == 5)) goto EXIT;
+    if (!(async_wheel_run(&w, 1003) == 0)) goto EXIT;
+
+    // t1 fires first, cancels t0 (due in the same run) and restarts itself
+    t[1].stop = &t[0].t;
+    t[1].rearm = 1;
+    if (!(async_wheel_run(&w, 1010) == 1)) goto EXIT;
+    if (!(g_timer_n == 1 && g_timer_fired[0] == 1)) goto EXIT;
+    if (async_timer_active(&t[0].t)) goto EXIT;
+    if (!(async_wheel_wait(&w, 100, 1010) == 5)) goto EXIT;
+    if (!(async_wheel_run(&w, 1015) == 1)) goto EXIT;
+
+    // t2 survives the pass over its bucket on the first revolution
+    if (!(async_wheel_wait(&w, 5000, 1015) == ASYNC_TIMER_SLOTS - 12)) {
+        goto EXIT;
+    }
+    if (!(async_wheel_run(&w, 1002 + ASYNC_TIMER_SLOTS) == 0)) goto EXIT;
+    if (!(async_wheel_run(&w, 1003 + ASYNC_TIMER_SLOTS) == 1)) goto EXIT;
+    if (!(g_timer_n == 3 && g_timer_fired[2] == 2 && w.n == 0)) goto EXIT;
+    async_wheel_deinit(&w);
+
+    // An idle loop wakes for its timer instead of sleeping the full wait
+    if (async_loop_init(&loop)) return -1;
+    async_loop_timer(&loop, &t[0].t, 20);
+    async_loop_timer(&loop, &t[1].t, 10000);
+    now = usys_now();
+    while (async_timer_active(&t[0].t) && usys_now() - now < 1000) {
+        async_loop_poll(&loop, 1000);
+    }
+    if (!(g_timer_n == 4 && g_timer_fired[3] == 0)) goto LOOP_EXIT;
+    if (!(usys_now() - now < 500)) goto LOOP_EXIT;
+    err = 0;
+
+LOOP_EXIT:
+    // Timers left on a loop are stopped with it
+    async_loop_deinit(&loop);
+    if (async_timer_active(&t[1].t)) err = -1;
+    return err;
+
+EXIT:
+    async_wheel_deinit(&w);
+    return err;
+}
+
+void*
+test_wake_thread(void* ctx)
+{
+    usys_msleep(20);
+    async_loop_wake(ctx);
+    return NULL;
+}
+
+int
+test_wake()
+{
+    int err = -1;
+    int64_t now;
+    async_loop loop;
+    usys_thread t;
+
+    if (async_loop_init(&loop)) return -1;
+
+    // Wakeups coalesce and one wait uses them up
+    async_loop_wake(&loop);
+    async_loop_wake(&loop);
+    now = usys_now();
+    async_loop_poll(&loop, 1000);
+    if (!(usys_now() - now < 500)) goto EXIT;
+    now = usys_now();
+    async_loop_poll(&loop, 50);
+    if (!(usys_now() - now >= 40)) goto EXIT;
+
+    // Another thread ends a wait that has no timeout
+    if (usys_thread_create(&t, test_wake_thread, &loop)) goto EXIT;
+    async_loop_poll(&loop, ASYNC_LOOP_FOREVER);
+    usys_thread_join(&t);
+    err = 0;
+
+EXIT:
+    async_loop_deinit(&loop);
+    return err;
+}
+
+void
+test_udp_on_recv(void* ctx, const usys_dgram* d, uint32_t n)
+{
+    io_test_udp* t = ctx;
+    t->batches++;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!async_udp_tx(&t->u, d[i].b, d[i].len, &d[i].addr)) t->n++;
+    }
+}
+
+int
+test_udp()
+{
+    int err = -1, c, r, n = 0;
+    uint32_t i;
+    usys_socket_fd s = -1;
+    uint8_t b[64 * 8];
+    usys_dgram d[64];
+    async_loop loop;
+    async_udp bad;
+    io_test_udp t = {.n = 0, .batches = 0 };
+    int fds[2] = { -1, -1 };
+
+    async_loop_init(&loop);
+    async_udp_init(&bad, NULL, test_udp_on_recv);
+    if (async_udp_init(&t.u, &t, test_udp_on_recv) ||
+        async_udp_listen(&t.u, &loop, 40322) || usys_listen_udp(&s, 40323)) {
+        goto EXIT;
+    }
+
+    // One sys call for 64 datagrams
+    for (i = 0; i < 64; i++) {
+        memset(&b[i * 8], i, 8);
+        d[i].b = &b[i * 8];
+        d[i].len = 8;
+        d[i].addr.ip = htonl(INADDR_LOOPBACK);
+        d[i].addr.port = htons(40322);
+    }
+    if (!(usys_send_mmsg(s, d, 64) == 64)) goto EXIT;
+
+    // The loop reports the socket, the engine reads batches and echoes them
+    for (c = 0; c < 20 && t.n < 64; c++) {
+        async_loop_poll(&loop, async_udp_busy(&t.u) ? 0 : 10);
+        if (async_udp_busy(&t.u)) async_udp_poll(&t.u);
+    }
+    if (!(t.n == 64 && t.batches < t.n && !async_udp_tx_pending(&t.u))) {
+        goto EXIT;
+    }
+
+    // Echoes come back from the engine port, in order
+    memset(b, 0xff, sizeof(b));
+    for (c = 0; c < 20 && n < 64; c++) {
+        for (i = n; i < 64; i++) d[i].len = 8;
+        if ((r = usys_recv_mmsg(s, &d[n], 64 - n)) > 0) {
+            n += r;
+        } else {
+            usys_msleep(5);
+        }
+    }
+    for (i = 0; i < (uint32_t)n; i++) {
+        if (!(d[i].len == 8 && d[i].b[0] == i && d[i].b[7] == i &&
+              d[i].addr.port == htons(40322))) {
+            break;
+        }
+    }
+    if (!(n == 64 && i == 64 && t.u.nsent == 64)) goto EXIT;
+
+    // A read error that won't clear (not a socket) ends the poll
+    if (pipe(fds)) goto EXIT;
+    bad.io.sock = fds[0];
+    fds[0] = -1;
+    err = (async_udp_poll(&bad) < 0 && !async_udp_busy(&bad) && bad.nerr == 1)
+              ? 0
+              : -1;
+
+EXIT:
+    if (s >= 0) usys_close(&s);
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    async_udp_deinit(&bad);
+    async_udp_deinit(&t.u);
+    async_loop_deinit(&loop);
     return err;
 }
 
@@ -221,6 +829,39 @@ io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l)
     return 0;
 }
 
+int
+io_on_recv_loop(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    if (!err && l == strlen(g_lorem) && !memcmp(b, g_lorem, l)) {
+        (*(int*)ctx)++;
+    }
+    return 0;
+}
+
+int
+io_on_erro_loop(void* ctx)
+{
+    *(int*)ctx += 100;
+    return 0;
+}
+
+int
+io_on_send_count(void* ctx, int err, const uint8_t* b, uint32_t l)
+{
+    ((void)b);
+    ((void)l);
+    if (!err) (*(int*)ctx)++;
+    return 0;
+}
+
+int
+io_on_accept_loop(void* ctx)
+{
+    io_test_listener* l = ctx;
+    while (async_io_accept(&l->io, &l->fd, 1)) l->n++;
+    return 0;
+}
+
 int
 io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
 {
@@ -230,3 +871,263 @@ io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
     ((void)l);
     return 0;
 }
+void*
+test_log_thread(void* ctx)
+{
+    int i;
+    for (i = 0; i < 5000; i++) usys_log_warn("burst %d %s", i, "of records");
+    *(int*)ctx = i;
+    return NULL;
+}
+
+int
+test_log()
+{
+    int err = -1, fd, sent = 0, i;
+    char *buf = NULL, *at;
+    uint64_t written, dropped;
+    off_t l;
+    usys_thread t;
+    FILE* f = tmpfile();
+    if (!f) return -1;
+    fd = fileno(f);
+
+    if (usys_log_init(fd)) goto EXIT;
+    if (!usys_log_init(fd)) goto EXIT;
+    usys_log_err("%s=%d %5.2f %x %c%%", "key", -42, 3.14159, 0xbeef, 'z');
+    usys_log_err("[%*d|%-6s|%lld|%zu]", 4, 7, "ab", -5000000000LL, (size_t)9);
+
+    // A string in the last slots is cut short, or left out when only its
+    // length would still fit
+    usys_log_err(TEST_LOG_D7 TEST_LOG_D7 TEST_LOG_D7 TEST_LOG_D7 "%s|",
+                 TEST_LOG_0x7, TEST_LOG_0x7, TEST_LOG_0x7, TEST_LOG_0x7,
+                 "abcdefghijkl");
+    usys_log_err(TEST_LOG_D7 TEST_LOG_D7 TEST_LOG_D7 TEST_LOG_D7 "%d%s|",
+                 TEST_LOG_0x7, TEST_LOG_0x7, TEST_LOG_0x7, TEST_LOG_0x7,
+                 0, "abcdefghijkl");
+
+    // Burst from a thread that exits before the writer drains it
+    if (usys_thread_create(&t, test_log_thread, &sent)) {
+        usys_log_deinit();
+        goto EXIT;
+    }
+    usys_thread_join(&t);
+    for (i = 0; i < 100; i++) usys_log_err("tail %d", i);
+    usys_log_deinit();
+
+    // Every record is either written or counted
+    usys_log_stats(&written, &dropped);
+    if (!(written + dropped == 4 + 100 + (uint64_t)sent)) goto EXIT;
+    if (!(written >= 104)) goto EXIT;
+
+    // Formatted like printf would (threads interleave in any order)
+    if ((l = lseek(fd, 0, SEEK_END)) <= 0) goto EXIT;
+    if (!(buf = usys_malloc(l + 1))) goto EXIT;
+    if (!(pread(fd, buf, l, 0) == l)) goto EXIT;
+    buf[l] = 0;
+    if (!(at = strstr(buf, "key=-42  3.14 beef z%\n"))) goto EXIT;
+    if (!strstr(at, "[   7|ab    |-5000000000|9]\n")) goto EXIT;
+    if (!strstr(at, TEST_LOG_28 "abcdefg|\n")) goto EXIT;
+    if (!strstr(at, TEST_LOG_28 "0|\n")) goto EXIT;
+    err = 0;
+
+EXIT:
+    if (buf) usys_free(buf);
+    fclose(f);
+    return err;
+}
+
+void
+test_metrics_fill(void* ctx, usys_metrics_text* text)
+{
+    usys_metrics_text_family(text, "test_total", "counter", "Test");
+    usys_metrics_text_sample(text, "test_total", "a=\"1\"", *(uint64_t*)ctx);
+}
+
+int
+test_metrics()
+{
+    int err = -1, fd = -1, c = -1;
+    char buf[2048], path[64];
+    uint64_t n = 0;
+    usys_metrics_hist h, acc;
+    usys_metrics_text t = {.b = buf, .len = 0, .cap = sizeof(buf) };
+    usys_metrics_exporter e;
+    struct sockaddr_un addr;
+    FILE* f;
+    ssize_t l, r;
+
+    // Bucket i holds values below 2^i, cumulative when rendered
+    memset(&h, 0, sizeof(h));
+    memset(&acc, 0, sizeof(acc));
+    usys_metrics_observe(&h, 0);
+    usys_metrics_observe(&h, 1);
+    usys_metrics_observe(&h, 5);
+    usys_metrics_observe(&h, 7);
+    usys_metrics_observe(&h, 0xffffffff);
+    if (!(h.n[0] == 1 && h.n[1] == 1 && h.n[3] == 2)) return -1;
+    if (!(h.n[USYS_METRICS_BUCKETS - 1] == 1)) return -1;
+    usys_metrics_hist_sum(&acc, &h);
+    usys_metrics_hist_sum(&acc, &h);
+    usys_metrics_text_hist(&t, "lat", "Latency", &acc);
+    if (!strstr(buf, "# TYPE lat histogram\n")) return -1;
+    if (!strstr(buf, "lat_bucket{le=\"3\"} 4\nlat_bucket{le=\"7\"} 8\n")) {
+        return -1;
+    }
+    if (!strstr(buf, "lat_bucket{le=\"+Inf\"} 10\n")) return -1;
+    if (!strstr(buf, "lat_sum 8589934616\nlat_count 10\n")) return -1;
+
+    // Output that doesn't fit is cut at a line
+    t.len = 0;
+    t.cap = 40;
+    test_metrics_fill(&n, &t);
+    if (!(t.len == strlen("# HELP test_total Test\n"))) return -1;
+
+    // File is replaced whole
+    snprintf(path, sizeof(path), "/tmp/usys_metrics_%d", (int)getpid());
+    if (usys_metrics_exporter_init(&e, path, 0, test_metrics_fill, &n)) {
+        return -1;
+    }
+    n = 42;
+    if (usys_metrics_export(&e)) goto EXIT;
+    if (!(f = fopen(path, "r"))) goto EXIT;
+    l = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    unlink(path);
+    buf[l < 0 ? 0 : l] = 0;
+    if (!strstr(buf, "\ntest_total{a=\"1\"} 42\n")) goto EXIT;
+
+    // Or sent to whoever listens on a local socket
+    usys_metrics_exporter_deinit(&e);
+    snprintf(path, sizeof(path), "unix:/tmp/usys_metrics_%d", (int)getpid());
+    if (usys_metrics_exporter_init(&e, path, 20, test_metrics_fill, &n)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, &path[5]);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) goto EXIT;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr))) goto EXIT;
+    if (listen(fd, 4)) goto EXIT;
+    if ((c = accept(fd, NULL, NULL)) < 0) goto EXIT;
+    for (l = 0; (r = read(c, &buf[l], sizeof(buf) - 1 - l)) > 0;) l += r;
+    buf[l] = 0;
+    if (!strstr(buf, "\ntest_total{a=\"1\"} 42\n")) goto EXIT;
+    err = 0;
+
+EXIT:
+    usys_metrics_exporter_deinit(&e);
+    if (c >= 0) close(c);
+    if (fd >= 0) {
+        close(fd);
+        unlink(addr.sun_path);
+    }
+    return err;
+}
+
+int
+test_trace()
+{
+    int err = -1, fd, i, n = 0;
+    char *buf = NULL, *at;
+    off_t l;
+    FILE* f = tmpfile();
+    if (!f) return -1;
+    fd = fileno(f);
+
+    // Oldest spans are overwritten when the ring wraps
+    for (i = 0; i < USYS_TRACE_RING; i++) {
+        usys_trace_record("test_b", usys_trace_now());
+    }
+    usys_trace_record("test_a", usys_trace_now() - 1500);
+    if (!(usys_trace_dump(fd) >= USYS_TRACE_RING - 1)) goto EXIT;
+
+    // Chrome trace events, microseconds
+    if ((l = lseek(fd, 0, SEEK_END)) <= 0) goto EXIT;
+    if (!(buf = usys_malloc(l + 1))) goto EXIT;
+    if (!(pread(fd, buf, l, 0) == l)) goto EXIT;
+    buf[l] = 0;
+    if (strncmp(buf, "{\"traceEvents\":[{", 16)) goto EXIT;
+    if (strcmp(&buf[l - 3], "]}\n")) goto EXIT;
+    for (at = buf; (at = strstr(at, "\"name\":\"test_b\",\"ph\"")); at++) n++;
+    if (!(n == USYS_TRACE_RING - 2)) goto EXIT;
+    if (!(at = strstr(buf, "{\"name\":\"test_a\",\"ph\":\"X\",\"ts\":"))) {
+        goto EXIT;
+    }
+    if (!(at = strstr(at, "\"dur\":")) || !(atof(&at[6]) >= 1.5)) goto EXIT;
+    err = 0;
+
+EXIT:
+    if (buf) usys_free(buf);
+    fclose(f);
+    return err;
+}
+
+void*
+test_clock_thread(void* ctx)
+{
+    // No loop here, the cached clock still moves
+    uint64_t a = usys_now_cached_ns();
+    usys_msleep(2);
+    *(int*)ctx = usys_now_cached_ns() - a >= 2000000 ? 0 : -1;
+    return NULL;
+}
+
+int
+test_clock()
+{
+    int err = -1, moved = -1;
+    uint64_t a, b;
+    usys_thread t;
+    async_loop loop;
+    if (usys_thread_create(&t, test_clock_thread, &moved)) return -1;
+    usys_thread_join(&t);
+    if (moved) return -1;
+    if (async_loop_init(&loop)) return -1;
+
+    // Cache holds still between ticks
+    a = usys_tick();
+    usys_msleep(2);
+    if (!(usys_now_cached_ns() == a)) goto EXIT;
+    if (!(usys_now_ns() - a >= 2000000)) goto EXIT;
+    if (!(usys_now_cached() == (int64_t)(a / 1000000))) goto EXIT;
+
+    // Loop ticks when it wakes
+    async_loop_poll(&loop, 2);
+    b = usys_now_cached_ns();
+    if (!(b - a >= 4000000 && b <= usys_now_ns())) goto EXIT;
+    err = 0;
+
+EXIT:
+    async_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_map()
+{
+    int err = -1, fd, i;
+    char path[] = "/tmp/usys_test_map.XXXXXX";
+    usys_map m;
+    if ((fd = mkstemp(path)) < 0) return -1;
+    close(fd);
+
+    // Stores outlive the mapping
+    if (usys_map_open(&m, path, 4096)) goto EXIT;
+    memcpy(&m.b[4000], g_lorem, 56);
+    if (usys_map_sync(&m, 0)) goto EXIT;
+    usys_map_close(&m);
+
+    // Growing keeps them and reads zero past the old end
+    if (usys_map_open(&m, path, 8192)) goto EXIT;
+    if (memcmp(&m.b[4000], g_lorem, 56)) goto EXIT;
+    for (i = 4096; i < 8192; i++) {
+        if (m.b[i]) goto EXIT;
+    }
+    err = 0;
+
+EXIT:
+    if (m.b) usys_map_close(&m);
+    unlink(path);
+    return err;
+}
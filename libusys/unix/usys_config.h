@@ -29,4 +29,9 @@
 #include "usys_config_unix.h"
 #endif
 
+// Storage class for per thread globals (empty when single threaded)
+#ifndef usys_thread_local
+#define usys_thread_local
+#endif
+
 #endif
@@ -36,4 +36,11 @@
 #define usys_free_fn free
 #define usys_free(x) usys_free_fn(x)
 
+#define usys_thread_local __thread
+
+// Pending connections queued by the kernel on a tcp listener
+#ifndef USYS_CONFIG_BACKLOG
+#define USYS_CONFIG_BACKLOG 511
+#endif
+
 #endif
@@ -19,16 +19,26 @@
  * @date 2017
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4
+#endif
+
 #include "usys_io.h"
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 int
 usys_connect(usys_socket_fd* sock_p, const char* host, int port)
@@ -62,7 +72,7 @@ usys_connect(usys_socket_fd* sock_p, const char* host, int port)
 int
 usys_listen_udp(usys_socket_fd* sock_p, int port)
 {
-    int ret = 0;
+    int ret = 0, on = 1;
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -70,6 +80,10 @@ usys_listen_udp(usys_socket_fd* sock_p, int port)
     addr.sin_addr.s_addr = INADDR_ANY;
     *sock_p = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
     if (*sock_p < 0) return -1;
+#ifdef SO_REUSEPORT
+    // Each reactor shard binds the same port, kernel spreads datagrams
+    setsockopt(*sock_p, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
     if (bind(*sock_p, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
         usys_close(sock_p);
         return -1;
@@ -77,6 +91,54 @@ usys_listen_udp(usys_socket_fd* sock_p, int port)
     return ret;
 }
 
+int
+usys_listen_tcp(usys_socket_fd* sock_p, int port)
+{
+    int on = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    *sock_p = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (*sock_p < 0) return -1;
+    setsockopt(*sock_p, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    // Each reactor shard listens on the same port, kernel spreads connections
+    setsockopt(*sock_p, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+    if (bind(*sock_p, (const struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(*sock_p, USYS_CONFIG_BACKLOG) == -1) {
+        usys_close(sock_p);
+        return -1;
+    }
+    return 0;
+}
+
+int
+usys_accept_fd(usys_socket_fd s, usys_socket_fd* fds, uint32_t n)
+{
+    uint32_t c = 0;
+    usys_socket_fd fd;
+    while (c < n) {
+#ifdef __linux__
+        fd = accept4(s, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        if ((fd = accept(s, NULL, NULL)) >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+#endif
+        if (fd >= 0) {
+            fds[c++] = fd;
+        } else if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        } else {
+            break; // EAGAIN (drained) or out of descriptors
+        }
+    }
+    return c;
+}
+
 int
 usys_recv_fd(int sockfd, byte* b, size_t len)
 {
@@ -136,6 +198,8 @@ usys_send_to_fd(
     socklen_t dlen = sizeof(dest);
 
     if (addr) {
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
         dest.sin_addr.s_addr = addr->ip;
         dest.sin_port = addr->port;
         bytes = sendto(sockfd, (char*)b, len, 0, (struct sockaddr*)&dest, dlen);
@@ -151,6 +215,98 @@ usys_send_to_fd(
     return bytes;
 }
 
+int
+usys_recv_mmsg(usys_socket_fd s, usys_dgram* d, uint32_t n)
+{
+    struct sockaddr_in from[n ? n : 1];
+    uint32_t i;
+    int r;
+    if (!n) return 0;
+#ifdef __linux__
+    struct mmsghdr m[n];
+    struct iovec iov[n];
+    memset(m, 0, sizeof(struct mmsghdr) * n);
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = d[i].b;
+        iov[i].iov_len = d[i].len;
+        m[i].msg_hdr.msg_iov = &iov[i];
+        m[i].msg_hdr.msg_iovlen = 1;
+        m[i].msg_hdr.msg_name = &from[i];
+        m[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+    do {
+        r = recvmmsg(s, m, n, MSG_DONTWAIT, NULL);
+    } while (r < 0 && errno == EINTR);
+    for (i = 0; r > 0 && i < (uint32_t)r; i++) {
+        d[i].len = (m[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : m[i].msg_len;
+    }
+#else
+    // One sys call per datagram (truncation is not reported here)
+    socklen_t l;
+    ssize_t x = 0;
+    for (r = 0; r < (int)n; r++) {
+        l = sizeof(from[r]);
+        x = recvfrom(s, d[r].b, d[r].len, 0, (struct sockaddr*)&from[r], &l);
+        if (x < 0) break;
+        d[r].len = x;
+    }
+    if (!r && x < 0) r = -1;
+#endif
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    for (i = 0; i < (uint32_t)r; i++) {
+        d[i].addr.ip = from[i].sin_addr.s_addr;
+        d[i].addr.port = from[i].sin_port;
+    }
+    return r;
+}
+
+int
+usys_send_mmsg(usys_socket_fd s, const usys_dgram* d, uint32_t n)
+{
+    struct sockaddr_in to[n ? n : 1];
+    uint32_t i;
+    int r;
+    if (!n) return 0;
+    memset(to, 0, sizeof(struct sockaddr_in) * n);
+    for (i = 0; i < n; i++) {
+        to[i].sin_family = AF_INET;
+        to[i].sin_addr.s_addr = d[i].addr.ip;
+        to[i].sin_port = d[i].addr.port;
+    }
+#ifdef __linux__
+    struct mmsghdr m[n];
+    struct iovec iov[n];
+    memset(m, 0, sizeof(struct mmsghdr) * n);
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = d[i].b;
+        iov[i].iov_len = d[i].len;
+        m[i].msg_hdr.msg_iov = &iov[i];
+        m[i].msg_hdr.msg_iovlen = 1;
+        m[i].msg_hdr.msg_name = &to[i];
+        m[i].msg_hdr.msg_namelen = sizeof(to[i]);
+    }
+    do {
+        r = sendmmsg(s, m, n, MSG_DONTWAIT);
+    } while (r < 0 && errno == EINTR);
+#else
+    // One sys call per datagram
+    for (r = 0; r < (int)n; r++) {
+        if (sendto(
+                s,
+                d[r].b,
+                d[r].len,
+                0,
+                (struct sockaddr*)&to[r],
+                sizeof(to[r])) < 0) {
+            if (!r) r = -1;
+            break;
+        }
+    }
+#endif
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return r;
+}
+
 void
 usys_close(usys_socket_fd* ctx)
 {
@@ -174,47 +330,93 @@ usys_select(
     int* writes,
     int nwrites)
 {
-    int *sock_p, max_fd, err;
+    int *sock_p, max_fd = -1, err;
     fd_set readfds, writefds;
     struct timeval tv;
 
     // Init stack
     FD_ZERO(&readfds);
     FD_ZERO(&writefds);
-    tv.tv_sec = 0;
-    tv.tv_usec = (time * 1000);
+    tv.tv_sec = time / 1000;
+    tv.tv_usec = (time % 1000) * 1000;
 
     // Get highest socket number (for select)
     sock_p = reads;
-    max_fd = *sock_p;
     for (int i = 0; i < nreads; i++) {
-        if (*sock_p >= 0) FD_SET(*sock_p, &readfds);
+        if (*sock_p >= 0 && *sock_p < FD_SETSIZE) FD_SET(*sock_p, &readfds);
         if (*sock_p > max_fd) max_fd = *sock_p;
         sock_p++;
     }
     sock_p = writes;
     for (int i = 0; i < nwrites; i++) {
-        if (*sock_p >= 0) FD_SET(*sock_p, &writefds);
+        if (*sock_p >= 0 && *sock_p < FD_SETSIZE) FD_SET(*sock_p, &writefds);
         if (*sock_p > max_fd) max_fd = *sock_p;
         sock_p++;
     }
-    err = select(max_fd + 1, &readfds, &writefds, NULL, &tv);
-    if (err < 0) return 0;
-    sock_p = reads;
+    if (max_fd >= FD_SETSIZE) max_fd = FD_SETSIZE - 1;
+    err = select(
+        max_fd + 1, &readfds, &writefds, NULL, time < 0 ? NULL : &tv);
+    if (err <= 0) return 0;
 
-    // Set mask for sockets that have activity
+    // Set mask for sockets that have activity (masks are arrays of words)
+    sock_p = reads;
     for (int i = 0; i < nreads; i++) {
-        if (FD_ISSET(*sock_p, &readfds)) *rmask |= (0x01 << i);
+        if (*sock_p >= 0 && *sock_p < FD_SETSIZE &&
+            FD_ISSET(*sock_p, &readfds)) {
+            rmask[i / 32] |= (0x01 << (i % 32));
+        }
         sock_p++;
     }
     sock_p = writes;
     for (int i = 0; i < nwrites; i++) {
-        if (FD_ISSET(*sock_p, &writefds)) *wmask |= (0x01 << i);
+        if (*sock_p >= 0 && *sock_p < FD_SETSIZE &&
+            FD_ISSET(*sock_p, &writefds)) {
+            wmask[i / 32] |= (0x01 << (i % 32));
+        }
         sock_p++;
     }
     return 0;
 }
 
+int
+usys_map_open(usys_map* m, const char* path, uint32_t len)
+{
+    struct stat st;
+    void* b;
+    memset(m, 0, sizeof(usys_map));
+    m->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m->fd < 0) return -1;
+    if (fstat(m->fd, &st) ||
+        (!(st.st_size == len) && ftruncate(m->fd, len)) ||
+        (b = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0)) ==
+            MAP_FAILED) {
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+    m->b = b;
+    m->len = len;
+    return 0;
+}
+
+int
+usys_map_sync(usys_map* m, int wait)
+{
+    return msync(m->b, m->len, wait ? MS_SYNC : MS_ASYNC) ? -1 : 0;
+}
+
+void
+usys_map_close(usys_map* m)
+{
+    if (m->b) {
+        msync(m->b, m->len, MS_SYNC);
+        munmap(m->b, m->len);
+    }
+    if (m->fd >= 0) close(m->fd);
+    memset(m, 0, sizeof(usys_map));
+    m->fd = -1;
+}
+
 int
 usys_sock_error(usys_socket_fd* sock)
 {
@@ -236,6 +438,60 @@ usys_sock_ready(usys_socket_fd* sock)
     return err ? err : (optval == EINPROGRESS) ? 0 : optval ? -1 : 1;
 }
 
+int
+usys_wake_open(usys_file_fd fds[2])
+{
+#ifdef __linux__
+    fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fds[0] < 0 ? -1 : 0;
+#else
+    if (pipe(fds)) {
+        fds[0] = fds[1] = -1;
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+void
+usys_wake_close(usys_file_fd fds[2])
+{
+    if (fds[1] >= 0 && !(fds[1] == fds[0])) close(fds[1]);
+    if (fds[0] >= 0) close(fds[0]);
+    fds[0] = fds[1] = -1;
+}
+
+int
+usys_wake_signal(usys_file_fd fd)
+{
+    // eventfd wants 8 bytes. A full pipe already holds a wakeup.
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && !(errno == EAGAIN)) return -1;
+    return 0;
+}
+
+void
+usys_wake_drain(usys_file_fd fd)
+{
+    uint64_t b[8];
+    while (read(fd, b, sizeof(b)) > 0) {
+    }
+}
+
+int
+usys_wake_wait(usys_file_fd fd, int ms)
+{
+    uint32_t mask = 0;
+    usys_select(&mask, &mask, ms, &fd, 1, NULL, 0);
+    if (!mask) return 0;
+    usys_wake_drain(fd);
+    return 1;
+}
+
 //
 //
 //
@@ -37,18 +37,46 @@ extern "C" {
 typedef int usys_socket_fd;
 typedef int usys_file_fd;
 typedef unsigned char byte;
+// ip and port are kept in network order
 typedef struct
 {
     uint32_t ip;
     uint32_t port;
 } usys_sockaddr;
 
+// One datagram of a batch (see usys_recv_mmsg)
+typedef struct
+{
+    byte* b;            /*!< payload */
+    uint32_t len;       /*!< recv: capacity in, bytes out. send: bytes */
+    usys_sockaddr addr; /*!< source (recv) or destination (send) */
+} usys_dgram;
+
 // File sys call abstraction layer
 usys_file_fd usys_file_open(const char* path);
 int usys_file_write(usys_file_fd* fd, int offset, const char* data, uint32_t l);
 int usys_file_read(usys_file_fd* fd, int offset, char* data, uint32_t l);
 int usys_file_close(usys_file_fd* fd);
 
+// File mapped into memory (see usys_map_open)
+typedef struct
+{
+    byte* b;         /*!< mapping */
+    uint32_t len;    /*!< bytes mapped */
+    usys_file_fd fd; /*!< backing file */
+} usys_map;
+
+/**
+ * @brief Map len bytes of path shared read/write. The file is created (or
+ * resized) to len, new bytes read as zero. Stores go to the page cache,
+ * usys_map_sync schedules the write back (wait 0) or waits for it.
+ *
+ * @return 0 ok, -1 error
+ */
+int usys_map_open(usys_map* m, const char* path, uint32_t len);
+int usys_map_sync(usys_map* m, int wait);
+void usys_map_close(usys_map* m);
+
 // Networking sys call abstraction layer
 typedef int (*usys_io_send_fn)(usys_socket_fd*, const byte*, uint32_t);
 typedef int (*usys_io_send_to_fn)(
@@ -64,14 +92,39 @@ typedef int (*usys_io_ready_fn)(usys_socket_fd*);
 typedef void (*usys_io_close_fn)(usys_socket_fd*);
 int usys_connect(usys_socket_fd* fd, const char* host, int port);
 int usys_listen_udp(usys_socket_fd* sock_p, int port);
+int usys_listen_tcp(usys_socket_fd* sock_p, int port);
+
+/**
+ * @brief Accept up to n pending connections from a non blocking listener.
+ * Accepted sockets are non blocking.
+ *
+ * @return number of sockets written to fds (less than n when drained)
+ */
+int usys_accept_fd(usys_socket_fd s, usys_socket_fd* fds, uint32_t n);
 int usys_send_fd(usys_socket_fd fd, const byte* b, uint32_t len);
 int usys_send_to_fd(usys_socket_fd, const byte*, uint32_t, usys_sockaddr*);
 int usys_recv_fd(int sockfd, byte* b, size_t len);
 int usys_recv_from_fd(int sockfd, byte* b, size_t len, usys_sockaddr*);
+
+/**
+ * @brief Read up to n datagrams from a non blocking socket with one sys call
+ * (recvmmsg on linux). Datagrams longer than their buffer are dropped (len 0).
+ * Send n datagrams from d with one sys call (sendmmsg on linux).
+ *
+ * @return datagrams read/sent, 0 would block, -1 error (the error belongs to
+ * the first datagram, callers skip it and try the rest)
+ */
+int usys_recv_mmsg(usys_socket_fd s, usys_dgram* d, uint32_t n);
+int usys_send_mmsg(usys_socket_fd s, const usys_dgram* d, uint32_t n);
 void usys_close(usys_socket_fd* fd);
 void usys_close_fd(usys_socket_fd s);
 int usys_sock_error(usys_socket_fd* fd);
 int usys_sock_ready(usys_socket_fd* fd);
+
+/**
+ * @brief select() wrapper. rmask/wmask are bit arrays of (n + 31) / 32 words
+ * where bit i is set when reads[i]/writes[i] has activity.
+ */
 uint32_t usys_select(
     uint32_t* rmask,
     uint32_t* wmask,
@@ -80,6 +133,25 @@ uint32_t usys_select(
     int nreads,
     int* writes,
     int nwrites);
+
+/**
+ * @brief Wakeup descriptor for a blocked reactor. Linux uses one eventfd
+ * (fds[0] == fds[1]), elsewhere a non blocking pipe. Signal the write end
+ * fds[1], wait on and drain the read end fds[0]. usys_wake_signal is safe
+ * from any thread and from signal handlers.
+ */
+int usys_wake_open(usys_file_fd fds[2]);
+void usys_wake_close(usys_file_fd fds[2]);
+int usys_wake_signal(usys_file_fd fd);
+void usys_wake_drain(usys_file_fd fd);
+
+/**
+ * @brief Block up to ms (negative is forever) for a wakeup and drain it.
+ *
+ * @return 1 woken, 0 timeout
+ */
+int usys_wake_wait(usys_file_fd fd, int ms);
+
 static inline int
 usys_send(usys_socket_fd* fd, const byte* b, uint32_t len)
 {
@@ -108,6 +180,25 @@ usys_recv_from(usys_socket_fd* fd, byte* b, uint32_t len, usys_sockaddr* addr)
     return usys_recv_from_fd(*(usys_socket_fd*)fd, b, len, addr);
 }
 
+static inline uint16_t
+usys_sockaddr_port(const usys_sockaddr* addr)
+{
+    uint16_t n = (uint16_t)addr->port;
+    const uint8_t* b = (const uint8_t*)&n;
+    return (uint16_t)(b[0] << 8 | b[1]);
+}
+
+static inline void
+usys_sockaddr_init(usys_sockaddr* addr, const uint8_t* ip4, uint16_t port)
+{
+    uint16_t n;
+    uint8_t* b = (uint8_t*)&n;
+    b[0] = port >> 8;
+    b[1] = port;
+    memcpy(&addr->ip, ip4, 4);
+    addr->port = n;
+}
+
 #ifdef __cplusplus
 }
 #endif
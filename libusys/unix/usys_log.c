@@ -20,21 +20,557 @@
  */
 
 #include "usys_log.h"
+#include "usys_io.h"
+#include "usys_thread.h"
+
+#include <errno.h>
+
+// Record header, followed by 8 byte argument slots (strings inline)
+typedef struct
+{
+    const char* fmt; /*!< NULL pads the ring to its end */
+    uint32_t len;    /*!< bytes including header (multiple of 16) */
+    uint32_t lvl;    /*!< USYS_LOG_LEVEL */
+} usys_log_rec;
+
+// One per logging thread, single producer / single consumer (the writer)
+typedef struct usys_log_ring
+{
+    struct usys_log_ring* next; /*!< registry (see g_usys_log_rings) */
+    uint32_t head;              /*!< next record to write out (writer) */
+    uint8_t pad0[64 - sizeof(void*) - sizeof(uint32_t)];
+    uint32_t tail;    /*!< next free byte (logging thread) */
+    uint32_t chead;   /*!< logging thread copy of head */
+    uint32_t dropped; /*!< records lost to a full ring (atomic) */
+    uint32_t dead;    /*!< thread exited, free once drained (atomic) */
+    uint8_t pad1[64 - 4 * sizeof(uint32_t)];
+    uint8_t mem[USYS_LOG_RING];
+} usys_log_ring;
+
+// Length modifiers we keep apart
+#define USYS_LOG_LM_NONE 0
+#define USYS_LOG_LM_HH 1
+#define USYS_LOG_LM_H 2
+#define USYS_LOG_LM_L 3
+#define USYS_LOG_LM_LL 4
+#define USYS_LOG_LM_SIZE 5 /*!< z j t */
+#define USYS_LOG_LM_LD 6
+
+// Private
+void usys_log_print(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap);
+void usys_log_push(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap);
+uint32_t usys_log_pack(uint8_t* b, const char* fmt, va_list ap);
+uint32_t usys_log_end(uint8_t* b, uint32_t n);
+uint32_t usys_log_format(const usys_log_rec* rec, char* out, uint32_t cap);
+const char* usys_log_spec(const char* p, int* lm, char* conv);
+usys_log_ring* usys_log_ring_get();
+uint32_t usys_log_drain();
+void usys_log_write(const char* b, uint32_t l);
+void usys_log_on_exit(void* ring);
+void* usys_log_main(void* ctx);
+
+// Writer state. The registry lock is only taken by a thread's first record
+// and by the writer, never per record.
+pthread_mutex_t g_usys_log_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t g_usys_log_key;
+usys_log_ring* g_usys_log_rings = NULL;
+usys_thread g_usys_log_thread;
+usys_file_fd g_usys_log_wake[2] = { -1, -1 };
+int g_usys_log_fd = -1;
+uint32_t g_usys_log_on = 0;  /*!< writer running (atomic) */
+uint32_t g_usys_log_gen = 0; /*!< bumped by each usys_log_init */
+uint64_t g_usys_log_written = 0, g_usys_log_dropped = 0;
+
+// Calling thread's ring, valid while its gen matches
+usys_thread_local usys_log_ring* g_usys_log_ring = NULL;
+usys_thread_local uint32_t g_usys_log_ring_gen = 0;
 
 void
 usys_log_(USYS_LOG_LEVEL lvl, const char* fmt, ...)
 {
-    char* usys_colors[] = USYS_LOG_COLORS;
     va_list ap;
+    va_start(ap, fmt);
+    if (__atomic_load_n(&g_usys_log_on, __ATOMIC_ACQUIRE)) {
+        usys_log_push(lvl, fmt, ap);
+    } else {
+        usys_log_print(lvl, fmt, ap);
+    }
+    va_end(ap);
+}
+
+int
+usys_log_init(int fd)
+{
+    if (__atomic_load_n(&g_usys_log_on, __ATOMIC_ACQUIRE)) return -1;
+    if (usys_wake_open(g_usys_log_wake)) return -1;
+    if (pthread_key_create(&g_usys_log_key, usys_log_on_exit)) {
+        usys_wake_close(g_usys_log_wake);
+        return -1;
+    }
+    g_usys_log_fd = fd;
+    g_usys_log_written = g_usys_log_dropped = 0;
+    __atomic_add_fetch(&g_usys_log_gen, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_usys_log_on, 1, __ATOMIC_RELEASE);
+    if (usys_thread_create(&g_usys_log_thread, usys_log_main, NULL)) {
+        __atomic_store_n(&g_usys_log_on, 0, __ATOMIC_RELEASE);
+        pthread_key_delete(g_usys_log_key);
+        usys_wake_close(g_usys_log_wake);
+        return -1;
+    }
+    return 0;
+}
+
+void
+usys_log_deinit()
+{
+    usys_log_ring* r;
+    if (!__atomic_load_n(&g_usys_log_on, __ATOMIC_ACQUIRE)) return;
+
+    // New records print synchronously, the writer empties the rings and exits
+    __atomic_store_n(&g_usys_log_on, 0, __ATOMIC_RELEASE);
+    usys_wake_signal(g_usys_log_wake[1]);
+    usys_thread_join(&g_usys_log_thread);
+    pthread_mutex_lock(&g_usys_log_lock);
+    while ((r = g_usys_log_rings)) {
+        g_usys_log_rings = r->next;
+        usys_free(r);
+    }
+    pthread_mutex_unlock(&g_usys_log_lock);
+    pthread_key_delete(g_usys_log_key);
+    usys_wake_close(g_usys_log_wake);
+}
+
+void
+usys_log_stats(uint64_t* written, uint64_t* dropped)
+{
+    *written = __atomic_load_n(&g_usys_log_written, __ATOMIC_RELAXED);
+    *dropped = __atomic_load_n(&g_usys_log_dropped, __ATOMIC_RELAXED);
+}
+
+void
+usys_log_print(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap)
+{
+    char* usys_colors[] = USYS_LOG_COLORS;
 
     // Switch font color
     printf("%s", usys_colors[lvl]);
 
     // print user
-    va_start(ap, fmt);
     vprintf(fmt, ap);
-    va_end(ap);
 
     // newline
     printf("\n" USYS_LOG_RESET);
 }
+
+void
+usys_log_push(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap)
+{
+    uint64_t mem[USYS_LOG_RECORD / 8];
+    usys_log_rec* rec = (usys_log_rec*)mem;
+    usys_log_ring* r = usys_log_ring_get();
+    uint32_t tail, off, room, need;
+    if (!r) return;
+
+    // Pack on the stack, then copy in one go
+    rec->fmt = fmt;
+    rec->lvl = lvl;
+    rec->len = usys_log_pack((uint8_t*)mem, fmt, ap);
+
+    // Records don't wrap, a pad record fills the end of the ring
+    tail = r->tail;
+    off = tail & (USYS_LOG_RING - 1);
+    room = USYS_LOG_RING - off;
+    need = rec->len + (room < rec->len ? room : 0);
+    if (USYS_LOG_RING - (tail - r->chead) < need) {
+        r->chead = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (USYS_LOG_RING - (tail - r->chead) < need) {
+            __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    if (room < rec->len) {
+        ((usys_log_rec*)&r->mem[off])->fmt = NULL;
+        ((usys_log_rec*)&r->mem[off])->len = room;
+        tail += room;
+        off = 0;
+    }
+    memcpy(&r->mem[off], mem, rec->len);
+    __atomic_store_n(&r->tail, tail + rec->len, __ATOMIC_RELEASE);
+}
+
+uint32_t
+usys_log_pack(uint8_t* b, const char* fmt, va_list ap)
+{
+    uint32_t n = sizeof(usys_log_rec), l;
+    const char* p = fmt;
+    const char* s;
+    int64_t i;
+    uint64_t u;
+    double d;
+    int lm;
+    char conv;
+
+    // One 8 byte slot per argument ('*' width/precision included), a string
+    // is its length then its bytes. Whatever doesn't fit is left out.
+    while ((p = strchr(p, '%')) && n + 8 <= USYS_LOG_RECORD) {
+        if (*++p == '%') {
+            p++;
+            continue;
+        }
+        while (*p && strchr("-+ #0", *p)) p++;
+        if (*p == '*') {
+            i = va_arg(ap, int);
+            memcpy(&b[n], &i, 8);
+            n += 8;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == '.' && *++p == '*') {
+            i = va_arg(ap, int);
+            if (n + 8 > USYS_LOG_RECORD) break;
+            memcpy(&b[n], &i, 8);
+            n += 8;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') p++;
+        if (n + 8 > USYS_LOG_RECORD) break;
+        p = usys_log_spec(p, &lm, &conv);
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (lm == USYS_LOG_LM_L) {
+                    i = va_arg(ap, long);
+                } else if (lm == USYS_LOG_LM_LL) {
+                    i = va_arg(ap, long long);
+                } else if (lm == USYS_LOG_LM_SIZE) {
+                    i = (int64_t)va_arg(ap, size_t);
+                } else {
+                    i = va_arg(ap, int);
+                    if (lm == USYS_LOG_LM_HH) i = (signed char)i;
+                    if (lm == USYS_LOG_LM_H) i = (short)i;
+                }
+                memcpy(&b[n], &i, 8);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c':
+                if (lm == USYS_LOG_LM_L) {
+                    u = va_arg(ap, unsigned long);
+                } else if (lm == USYS_LOG_LM_LL) {
+                    u = va_arg(ap, unsigned long long);
+                } else if (lm == USYS_LOG_LM_SIZE) {
+                    u = va_arg(ap, size_t);
+                } else {
+                    u = va_arg(ap, unsigned int);
+                    if (lm == USYS_LOG_LM_HH) u = (unsigned char)u;
+                    if (lm == USYS_LOG_LM_H) u = (unsigned short)u;
+                }
+                memcpy(&b[n], &u, 8);
+                break;
+            case 'p':
+                u = (uintptr_t)va_arg(ap, void*);
+                memcpy(&b[n], &u, 8);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (lm == USYS_LOG_LM_LD) {
+                    d = (double)va_arg(ap, long double);
+                } else {
+                    d = va_arg(ap, double);
+                }
+                memcpy(&b[n], &d, 8);
+                break;
+            case 's':
+                // Its length and the nul at least, else the record ends
+                if (n + 16 > USYS_LOG_RECORD) return usys_log_end(b, n);
+                s = va_arg(ap, const char*);
+                if (!s) s = "(null)";
+                l = strlen(s);
+                if (l > USYS_LOG_RECORD - n - 9) l = USYS_LOG_RECORD - n - 9;
+                u = l;
+                memcpy(&b[n], &u, 8);
+                memcpy(&b[n + 8], s, l);
+                b[n + 8 + l] = 0;
+                n += (l + 8) & ~7u; // slot for the length, string padded
+                break;
+            default: return usys_log_end(b, n); // %n or unknown, stop here
+        }
+        n += 8;
+    }
+    return usys_log_end(b, n);
+}
+
+uint32_t
+usys_log_end(uint8_t* b, uint32_t n)
+{
+    // Records are 16 byte aligned, the padding reads as no more arguments
+    uint32_t len = (n + 15) & ~15u;
+    memset(&b[n], 0, len - n);
+    return len;
+}
+
+uint32_t
+usys_log_format(const usys_log_rec* rec, char* out, uint32_t cap)
+{
+    char* usys_colors[] = USYS_LOG_COLORS;
+    const uint8_t *a = (const uint8_t*)&rec[1], *end = (uint8_t*)rec + rec->len;
+    const char *p = rec->fmt, *q;
+    char spec[48], conv;
+    uint32_t n = 0, sn;
+    int64_t i;
+    uint64_t u;
+    double d;
+    int lm, r;
+
+    // Mirror usys_log_pack, one snprintf per conversion
+    r = snprintf(out, cap, "%s", usys_colors[rec->lvl % 5]);
+    n = r < 0 ? 0 : (uint32_t)r;
+    while (*p && n < cap) {
+        if (!(q = strchr(p, '%'))) q = p + strlen(p);
+        sn = q - p;
+        if (sn > cap - n) sn = cap - n;
+        memcpy(&out[n], p, sn);
+        n += sn;
+        if (!*(p = q)) break;
+        if (p[1] == '%') {
+            if (n < cap) out[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Spec with '*' replaced by the packed value
+        sn = 0;
+        spec[sn++] = *p++;
+        while (*p && strchr("-+ #0", *p) && sn < 8) spec[sn++] = *p++;
+        if (*p == '*' && a + 8 <= end) {
+            memcpy(&i, a, 8);
+            a += 8;
+            sn += snprintf(&spec[sn], 12, "%d", (int)i);
+            p++;
+        }
+        while (*p >= '0' && *p <= '9' && sn < 20) spec[sn++] = *p++;
+        if (*p == '.') {
+            spec[sn++] = *p++;
+            if (*p == '*' && a + 8 <= end) {
+                memcpy(&i, a, 8);
+                a += 8;
+                sn += snprintf(&spec[sn], 12, "%d", (int)i);
+                p++;
+            }
+            while (*p >= '0' && *p <= '9' && sn < 36) spec[sn++] = *p++;
+        }
+        p = usys_log_spec(p, &lm, &conv);
+        if (a + 8 > end) break; // left out by usys_log_pack
+
+        // Integers were widened when packed
+        if (strchr("diuoxX", conv)) {
+            spec[sn++] = 'l';
+            spec[sn++] = 'l';
+        }
+        spec[sn++] = conv;
+        spec[sn] = 0;
+        r = 0;
+        switch (conv) {
+            case 'd':
+            case 'i':
+                memcpy(&i, a, 8);
+                r = snprintf(&out[n], cap - n, spec, (long long)i);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                memcpy(&u, a, 8);
+                r = snprintf(&out[n], cap - n, spec, (unsigned long long)u);
+                break;
+            case 'c':
+                memcpy(&u, a, 8);
+                r = snprintf(&out[n], cap - n, spec, (int)u);
+                break;
+            case 'p':
+                memcpy(&u, a, 8);
+                r = snprintf(&out[n], cap - n, spec, (void*)(uintptr_t)u);
+                break;
+            case 's':
+                memcpy(&u, a, 8);
+                if (a + 9 > end || u > (uint64_t)(end - a - 9)) break;
+                r = snprintf(&out[n], cap - n, spec, (const char*)&a[8]);
+                a += (u + 8) & ~7u;
+                break;
+            default:
+                memcpy(&d, a, 8);
+                r = snprintf(&out[n], cap - n, spec, d);
+                break;
+        }
+        a += 8;
+        if (r > 0) n += (uint32_t)r < cap - n ? (uint32_t)r : cap - n;
+    }
+
+    // Reset and newline always fit
+    if (n > cap - sizeof(USYS_LOG_RESET)) n = cap - sizeof(USYS_LOG_RESET);
+    memcpy(&out[n], "\n" USYS_LOG_RESET, sizeof(USYS_LOG_RESET));
+    return n + sizeof(USYS_LOG_RESET);
+}
+
+const char*
+usys_log_spec(const char* p, int* lm, char* conv)
+{
+    *lm = USYS_LOG_LM_NONE;
+    if (p[0] == 'h' && p[1] == 'h') {
+        *lm = USYS_LOG_LM_HH;
+        p += 2;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        *lm = USYS_LOG_LM_LL;
+        p += 2;
+    } else if (*p == 'h') {
+        *lm = USYS_LOG_LM_H;
+        p++;
+    } else if (*p == 'l') {
+        *lm = USYS_LOG_LM_L;
+        p++;
+    } else if (*p == 'z' || *p == 'j' || *p == 't') {
+        *lm = USYS_LOG_LM_SIZE;
+        p++;
+    } else if (*p == 'L') {
+        *lm = USYS_LOG_LM_LD;
+        p++;
+    }
+    *conv = *p;
+    return *p ? p + 1 : p;
+}
+
+usys_log_ring*
+usys_log_ring_get()
+{
+    usys_log_ring* r = g_usys_log_ring;
+    uint32_t gen = __atomic_load_n(&g_usys_log_gen, __ATOMIC_RELAXED);
+    if (r && g_usys_log_ring_gen == gen) return r;
+
+    // First record from this thread since usys_log_init
+    if (!(r = usys_malloc(sizeof(usys_log_ring)))) return NULL;
+    memset(r, 0, sizeof(usys_log_ring) - USYS_LOG_RING);
+    pthread_mutex_lock(&g_usys_log_lock);
+    r->next = g_usys_log_rings;
+    g_usys_log_rings = r;
+    pthread_mutex_unlock(&g_usys_log_lock);
+    pthread_setspecific(g_usys_log_key, r);
+    g_usys_log_ring = r;
+    g_usys_log_ring_gen = gen;
+    return r;
+}
+
+uint32_t
+usys_log_drain()
+{
+    static char out[16 * 1024];
+    usys_log_ring **pp, *r, *first, *gone = NULL;
+    usys_log_rec* rec;
+    uint32_t head, tail, n = 0, l = 0, dropped, total = 0;
+
+    // Rings are only prepended and only we unlink them, so the list from
+    // here on can be walked (and written out) without the lock
+    pthread_mutex_lock(&g_usys_log_lock);
+    first = g_usys_log_rings;
+    pthread_mutex_unlock(&g_usys_log_lock);
+    for (r = first; r; r = r->next) {
+        head = r->head;
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            rec = (usys_log_rec*)&r->mem[head & (USYS_LOG_RING - 1)];
+            if (rec->fmt) {
+                if (sizeof(out) - l < 1024) {
+                    usys_log_write(out, l);
+                    l = 0;
+                }
+                l += usys_log_format(rec, &out[l], 1024);
+                n++;
+            }
+            head += rec->len;
+            __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+        }
+
+        // Say what we missed
+        if ((dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED))) {
+            if (sizeof(out) - l < 1024) {
+                usys_log_write(out, l);
+                l = 0;
+            }
+            l += snprintf(
+                &out[l],
+                1024,
+                "%s[LOG] %u records dropped\n" USYS_LOG_RESET,
+                ((char* [])USYS_LOG_COLORS)[USYS_LOG_WARN],
+                dropped);
+            total += dropped;
+        }
+    }
+    usys_log_write(out, l);
+
+    // Threads that are gone and had everything written out
+    pthread_mutex_lock(&g_usys_log_lock);
+    for (pp = &g_usys_log_rings; (r = *pp);) {
+        if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) &&
+            r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+            *pp = r->next;
+            r->next = gone;
+            gone = r;
+        } else {
+            pp = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&g_usys_log_lock);
+    while ((r = gone)) {
+        gone = r->next;
+        usys_free(r);
+    }
+    __atomic_add_fetch(&g_usys_log_written, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_usys_log_dropped, total, __ATOMIC_RELAXED);
+    return n + total;
+}
+
+void
+usys_log_write(const char* b, uint32_t l)
+{
+    ssize_t r;
+    while (l) {
+        if ((r = write(g_usys_log_fd, b, l)) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        b += r;
+        l -= r;
+    }
+}
+
+void
+usys_log_on_exit(void* ring)
+{
+    __atomic_store_n(&((usys_log_ring*)ring)->dead, 1, __ATOMIC_RELEASE);
+}
+
+void*
+usys_log_main(void* ctx)
+{
+    ((void)ctx);
+    while (__atomic_load_n(&g_usys_log_on, __ATOMIC_ACQUIRE)) {
+        if (!usys_log_drain()) {
+            usys_wake_wait(g_usys_log_wake[0], USYS_LOG_FLUSH_MS);
+        }
+    }
+
+    // Whatever was queued before usys_log_deinit
+    usys_log_drain();
+    return NULL;
+}
+
+//
+//
+//
@@ -19,6 +19,19 @@
  * @date 2017
  */
 
+/**
+ * @file usys_log.h
+ *
+ * @brief Leveled logging. After usys_log_init a call site only packs the
+ * format pointer and its arguments (strings are copied) into a ring owned by
+ * the calling thread; a background thread formats and writes them. When a
+ * ring is full the record is dropped and counted, the writer reports drops.
+ * Before usys_log_init (and after usys_log_deinit) records are printed
+ * synchronously.
+ *
+ * Levels below USYS_LOG_MIN are removed at compile time, their arguments are
+ * not evaluated.
+ */
 #ifndef USYS_LOG_H_
 #define USYS_LOG_H_
 #ifdef __cplusplus
@@ -27,18 +40,63 @@ extern "C" {
 
 #include "usys_config.h"
 
-// TODO fix debug switch (not catcing from cmake)
-#if NDEBUG
-#define usys_log_fn usys_log_
+// Lowest level compiled in: 0 all, 1 no info (per packet traces), 2 warnings
+// and errors, 3 errors, 4 nothing
+#ifndef USYS_LOG_MIN
+#ifdef NDEBUG
+#define USYS_LOG_MIN 1
 #else
-#define usys_log_fn usys_log_
+#define USYS_LOG_MIN 0
+#endif
+#endif
+
+// Bytes of records a thread may have waiting on the writer (power of 2)
+#ifndef USYS_LOG_RING
+#define USYS_LOG_RING (64 * 1024)
+#endif
+
+// Largest packed record (header, arguments and copied strings)
+#ifndef USYS_LOG_RECORD
+#define USYS_LOG_RECORD 256
 #endif
 
+// Longest the writer sleeps between looking at the rings
+#ifndef USYS_LOG_FLUSH_MS
+#define USYS_LOG_FLUSH_MS 10
+#endif
+
+#define usys_log_fn usys_log_
+
+// Filtered call sites still type check (and use) their arguments
+static inline void
+usys_log_off(const char* fmt, ...)
+{
+    ((void)fmt);
+}
+#define usys_log_off_fn(...) ((void)(0 && (usys_log_off(__VA_ARGS__), 0)))
+
+#if USYS_LOG_MIN <= 0
+#define usys_log_info(...) usys_log_fn(USYS_LOG_INFO, __VA_ARGS__)
+#else
+#define usys_log_info(...) usys_log_off_fn(__VA_ARGS__)
+#endif
+#if USYS_LOG_MIN <= 1
 #define usys_log_ok(...) usys_log_fn(USYS_LOG_OK, __VA_ARGS__)
 #define usys_log_note(...) usys_log_fn(USYS_LOG_NOTE, __VA_ARGS__)
-#define usys_log_info(...) usys_log_fn(USYS_LOG_INFO, __VA_ARGS__)
+#else
+#define usys_log_ok(...) usys_log_off_fn(__VA_ARGS__)
+#define usys_log_note(...) usys_log_off_fn(__VA_ARGS__)
+#endif
+#if USYS_LOG_MIN <= 2
 #define usys_log_warn(...) usys_log_fn(USYS_LOG_WARN, __VA_ARGS__)
+#else
+#define usys_log_warn(...) usys_log_off_fn(__VA_ARGS__)
+#endif
+#if USYS_LOG_MIN <= 3
 #define usys_log_err(...) usys_log_fn(USYS_LOG_ERRO, __VA_ARGS__)
+#else
+#define usys_log_err(...) usys_log_off_fn(__VA_ARGS__)
+#endif
 #define usys_log(...) usys_log_info(__VA_ARGS__)
 
 // clang-format off
@@ -62,6 +120,24 @@ typedef enum {
 
 void usys_log_(USYS_LOG_LEVEL lvl, const char* fmt, ...);
 
+/**
+ * @brief Start the writer thread, records go to fd (ie: STDOUT_FILENO).
+ * Formats must stay valid until they are written (string literals).
+ * Conversions are those of printf, except %n.
+ */
+int usys_log_init(int fd);
+
+/**
+ * @brief Write what is queued and stop the writer. Call once other threads
+ * are done logging.
+ */
+void usys_log_deinit();
+
+/**
+ * @brief Records written and dropped (ring full) since usys_log_init.
+ */
+void usys_log_stats(uint64_t* written, uint64_t* dropped);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,254 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usys_metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Elsewhere usys_install_signal_handlers ignores SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Private
+void usys_metrics_text_printf(usys_metrics_text* t, const char* fmt, ...);
+int usys_metrics_write_file(const char* path, const char* b, uint32_t l);
+int usys_metrics_write_sock(const char* path, const char* b, uint32_t l);
+int usys_metrics_write_fd(int fd, const char* b, uint32_t l, int flags);
+void* usys_metrics_main(void* ctx);
+
+void
+usys_metrics_hist_sum(usys_metrics_hist* acc, const usys_metrics_hist* h)
+{
+    for (uint32_t i = 0; i < USYS_METRICS_BUCKETS; i++) {
+        acc->n[i] += usys_metrics_get(&h->n[i]);
+    }
+    acc->sum += usys_metrics_get(&h->sum);
+}
+
+void
+usys_metrics_text_family(
+    usys_metrics_text* t,
+    const char* name,
+    const char* type,
+    const char* help)
+{
+    usys_metrics_text_printf(t, "# HELP %s %s\n", name, help);
+    usys_metrics_text_printf(t, "# TYPE %s %s\n", name, type);
+}
+
+void
+usys_metrics_text_sample(
+    usys_metrics_text* t,
+    const char* name,
+    const char* labels,
+    uint64_t v)
+{
+    if (labels) {
+        usys_metrics_text_printf(
+            t, "%s{%s} %llu\n", name, labels, (unsigned long long)v);
+    } else {
+        usys_metrics_text_printf(t, "%s %llu\n", name, (unsigned long long)v);
+    }
+}
+
+void
+usys_metrics_text_hist(
+    usys_metrics_text* t,
+    const char* name,
+    const char* help,
+    const usys_metrics_hist* h)
+{
+    uint64_t n = 0;
+    uint32_t i;
+
+    // Bucket i holds values up to 2^i - 1, Prometheus wants them cumulative
+    usys_metrics_text_family(t, name, "histogram", help);
+    for (i = 0; i < USYS_METRICS_BUCKETS - 1; i++) {
+        n += h->n[i];
+        usys_metrics_text_printf(
+            t,
+            "%s_bucket{le=\"%u\"} %llu\n",
+            name,
+            (1u << i) - 1,
+            (unsigned long long)n);
+    }
+    n += h->n[i];
+    usys_metrics_text_printf(
+        t, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)n);
+    usys_metrics_text_printf(
+        t, "%s_sum %llu\n", name, (unsigned long long)h->sum);
+    usys_metrics_text_printf(t, "%s_count %llu\n", name, (unsigned long long)n);
+}
+
+int
+usys_metrics_exporter_init(
+    usys_metrics_exporter* e,
+    const char* path,
+    uint32_t ms,
+    usys_metrics_fill_fn fill,
+    void* ctx)
+{
+    memset(e, 0, sizeof(usys_metrics_exporter));
+    e->path = path;
+    e->ms = ms;
+    e->fill = fill;
+    e->ctx = ctx;
+    e->wake[0] = e->wake[1] = -1;
+    e->text.cap = USYS_METRICS_TEXT_MAX;
+    if (!(e->text.b = usys_malloc(e->text.cap))) return -1;
+    if (!ms) return 0;
+
+    // Exports on its own thread, a slow disk or reader doesn't stall a shard
+    if (usys_wake_open(e->wake)) {
+        usys_free(e->text.b);
+        return -1;
+    }
+    __atomic_store_n(&e->on, 1, __ATOMIC_RELEASE);
+    if (usys_thread_create(&e->thread, usys_metrics_main, e)) {
+        e->on = 0;
+        usys_wake_close(e->wake);
+        usys_free(e->text.b);
+        return -1;
+    }
+    return 0;
+}
+
+void
+usys_metrics_exporter_deinit(usys_metrics_exporter* e)
+{
+    if (__atomic_load_n(&e->on, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&e->on, 0, __ATOMIC_RELEASE);
+        usys_wake_signal(e->wake[1]);
+        usys_thread_join(&e->thread);
+        usys_wake_close(e->wake);
+    }
+    if (e->text.b) usys_free(e->text.b);
+    e->text.b = NULL;
+}
+
+int
+usys_metrics_export(usys_metrics_exporter* e)
+{
+    int err;
+    e->text.len = 0;
+    e->text.cap = USYS_METRICS_TEXT_MAX;
+    e->fill(e->ctx, &e->text);
+    if (!strncmp(e->path, "unix:", 5)) {
+        err = usys_metrics_write_sock(&e->path[5], e->text.b, e->text.len);
+    } else {
+        err = usys_metrics_write_file(e->path, e->text.b, e->text.len);
+    }
+    if (!err) __atomic_add_fetch(&e->exports, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+void
+usys_metrics_text_printf(usys_metrics_text* t, const char* fmt, ...)
+{
+    int r;
+    va_list ap;
+    if (t->len >= t->cap) return;
+    va_start(ap, fmt);
+    r = vsnprintf(&t->b[t->len], t->cap - t->len, fmt, ap);
+    va_end(ap);
+
+    // A cut line is left out rather than exported half written
+    if (r > 0 && (uint32_t)r < t->cap - t->len) {
+        t->len += r;
+    } else {
+        t->b[t->len] = 0;
+        t->cap = t->len;
+    }
+}
+
+int
+usys_metrics_write_file(const char* path, const char* b, uint32_t l)
+{
+    char tmp[256];
+    int fd, err;
+
+    // Readers see the old export or the new one, never part of one
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+    err = usys_metrics_write_fd(fd, b, l, -1);
+    close(fd);
+    if (!err) err = rename(tmp, path) ? -1 : 0;
+    if (err) unlink(tmp);
+    return err;
+}
+
+int
+usys_metrics_write_sock(const char* path, const char* b, uint32_t l)
+{
+    struct sockaddr_un addr;
+    int fd, err = -1;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // One connection per export, the reader sees it end at close
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    if (!connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        err = usys_metrics_write_fd(fd, b, l, MSG_NOSIGNAL);
+    }
+    close(fd);
+    return err;
+}
+
+int
+usys_metrics_write_fd(int fd, const char* b, uint32_t l, int flags)
+{
+    // flags < 0 for a file, else send() flags (a reader going away is not a
+    // SIGPIPE)
+    ssize_t r;
+    while (l) {
+        r = flags < 0 ? write(fd, b, l) : send(fd, b, l, flags);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        b += r;
+        l -= r;
+    }
+    return 0;
+}
+
+void*
+usys_metrics_main(void* ctx)
+{
+    usys_metrics_exporter* e = ctx;
+    while (__atomic_load_n(&e->on, __ATOMIC_ACQUIRE)) {
+        usys_wake_wait(e->wake[0], e->ms);
+        usys_metrics_export(e); // last one on the way out
+    }
+    return NULL;
+}
+
+//
+//
+//
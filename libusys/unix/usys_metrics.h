@@ -0,0 +1,157 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file usys_metrics.h
+ *
+ * @brief Counters and fixed bucket histograms cheap enough to leave on. A
+ * counter has one writer (the thread owning it) that publishes with a relaxed
+ * atomic store, no locked instruction, and any thread may read it. Process
+ * wide totals are kept as one cache line padded block per writing thread and
+ * summed when read (see rlpx_metrics.h).
+ *
+ * usys_metrics_text renders Prometheus text format, usys_metrics_exporter
+ * writes it to a file (replaced atomically) or a local socket on an interval.
+ */
+#ifndef USYS_METRICS_H_
+#define USYS_METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+#include "usys_io.h"
+#include "usys_thread.h"
+
+// Histogram buckets. Bucket i holds values below 2^i, the last one the rest
+// (24 covers microseconds up to 8s).
+#ifndef USYS_METRICS_BUCKETS
+#define USYS_METRICS_BUCKETS 24
+#endif
+
+// Largest rendered export
+#ifndef USYS_METRICS_TEXT_MAX
+#define USYS_METRICS_TEXT_MAX (32 * 1024)
+#endif
+
+typedef struct
+{
+    uint64_t n[USYS_METRICS_BUCKETS]; /*!< values in [2^(i-1), 2^i) */
+    uint64_t sum;                     /*!< of every value observed */
+} usys_metrics_hist;
+
+typedef struct
+{
+    char* b;
+    uint32_t len; /*!< bytes written */
+    uint32_t cap; /*!< size of b, output past it is cut */
+} usys_metrics_text;
+
+typedef void (*usys_metrics_fill_fn)(void* ctx, usys_metrics_text* text);
+
+typedef struct
+{
+    const char* path;          /*!< file, or "unix:" and a socket path */
+    uint32_t ms;               /*!< interval */
+    usys_metrics_fill_fn fill; /*!< renders the export */
+    void* ctx;                 /*!< fill context */
+    usys_thread thread;        /*!< calls fill every ms */
+    usys_file_fd wake[2];      /*!< ends the interval early (deinit) */
+    uint32_t on;               /*!< thread running (atomic) */
+    uint32_t exports;          /*!< successful writes (atomic) */
+    usys_metrics_text text;    /*!< render buffer */
+} usys_metrics_exporter;
+
+static inline void
+usys_metrics_add(uint64_t* c, uint64_t n)
+{
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED); // single writer
+}
+
+static inline uint64_t
+usys_metrics_get(const uint64_t* c)
+{
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+static inline void
+usys_metrics_observe(usys_metrics_hist* h, uint32_t v)
+{
+    uint32_t i = v ? 32 - __builtin_clz(v) : 0;
+    if (i >= USYS_METRICS_BUCKETS) i = USYS_METRICS_BUCKETS - 1;
+    usys_metrics_add(&h->n[i], 1);
+    usys_metrics_add(&h->sum, v);
+}
+
+/**
+ * @brief Add h (published by another thread) to acc.
+ */
+void usys_metrics_hist_sum(usys_metrics_hist* acc, const usys_metrics_hist* h);
+
+/**
+ * @brief Append # HELP and # TYPE lines, then samples of that family.
+ * labels is NULL or the inside of the braces (ie: shard="1").
+ */
+void usys_metrics_text_family(
+    usys_metrics_text* t,
+    const char* name,
+    const char* type,
+    const char* help);
+void usys_metrics_text_sample(
+    usys_metrics_text* t,
+    const char* name,
+    const char* labels,
+    uint64_t v);
+
+/**
+ * @brief Append a histogram family (cumulative buckets, sum and count).
+ */
+void usys_metrics_text_hist(
+    usys_metrics_text* t,
+    const char* name,
+    const char* help,
+    const usys_metrics_hist* h);
+
+/**
+ * @brief Start a thread calling fill and writing what it rendered to path
+ * every ms. With ms 0 there is no thread, call usys_metrics_export.
+ */
+int usys_metrics_exporter_init(
+    usys_metrics_exporter* e,
+    const char* path,
+    uint32_t ms,
+    usys_metrics_fill_fn fill,
+    void* ctx);
+void usys_metrics_exporter_deinit(usys_metrics_exporter* e);
+
+/**
+ * @brief Render and write once (only from the exporter thread if there is
+ * one).
+ *
+ * @return 0 ok, -1 could not write
+ */
+int usys_metrics_export(usys_metrics_exporter* e);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
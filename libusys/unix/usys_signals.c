@@ -20,17 +20,23 @@
  */
 
 #include "usys_signals.h"
+#include "usys_io.h"
+#include <errno.h>
 #include <signal.h>
 
 int s_usys_interrupted = 0;
+int s_usys_wake_fd = -1;
 void s_usys_signal_handler(int x);
 void s_usys_signal_catch(void);
 
 void
 s_usys_signal_handler(int x)
 {
+    int err = errno;
     ((void)x);
     s_usys_interrupted = 1;
+    if (s_usys_wake_fd >= 0) usys_wake_signal(s_usys_wake_fd);
+    errno = err;
 }
 
 void
@@ -62,3 +68,9 @@ usys_shutdown()
 {
     s_usys_interrupted = 1;
 }
+
+void
+usys_signal_wake(int fd)
+{
+    s_usys_wake_fd = fd;
+}
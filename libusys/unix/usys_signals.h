@@ -32,6 +32,13 @@ void usys_install_signal_handlers();
 int usys_running();
 void usys_shutdown();
 
+/**
+ * @brief Also signal a wakeup descriptor (see usys_wake_open) on SIGINT and
+ * SIGTERM, so a loop blocked without a timeout sees usys_running() change.
+ * -1 to stop.
+ */
+void usys_signal_wake(int fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,64 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "usys_thread.h"
+#include <sched.h>
+
+int
+usys_thread_create(usys_thread* t, usys_thread_fn fn, void* arg)
+{
+    return pthread_create(t, NULL, fn, arg) ? -1 : 0;
+}
+
+int
+usys_thread_join(usys_thread* t)
+{
+    return pthread_join(*t, NULL) ? -1 : 0;
+}
+
+int
+usys_thread_pin(uint32_t core)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % usys_cpu_count(), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) ? -1 : 0;
+#else
+    ((void)core);
+    return -1;
+#endif
+}
+
+uint32_t
+usys_cpu_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+//
+//
+//
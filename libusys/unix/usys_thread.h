@@ -0,0 +1,60 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file usys_thread.h
+ *
+ * @brief Thin wrapper around the OS thread primitives (create, join, pin to a
+ * core) so the reactor shards do not depend on pthreads directly.
+ */
+#ifndef USYS_THREAD_H_
+#define USYS_THREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#include <pthread.h>
+
+typedef pthread_t usys_thread;
+typedef void* (*usys_thread_fn)(void*);
+
+int usys_thread_create(usys_thread* t, usys_thread_fn fn, void* arg);
+int usys_thread_join(usys_thread* t);
+
+/**
+ * @brief Pin the calling thread to a core (modulo number of online cores).
+ *
+ * @return 0 ok, -1 if the platform refused (thread keeps running unpinned)
+ */
+int usys_thread_pin(uint32_t core);
+
+/**
+ * @brief Number of online cores (at least 1)
+ */
+uint32_t usys_cpu_count();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -28,6 +28,8 @@ usys_msleep(uint32_t ms)
     usleep(ms * 1000);
 }
 
+usys_thread_local uint64_t g_usys_tick = 0;
+
 int64_t
 usys_now()
 {
@@ -35,3 +37,23 @@ usys_now()
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (int64_t)((int64_t)ts.tv_sec * 1000 + (int64_t)ts.tv_nsec / 1000000);
 }
+
+uint64_t
+usys_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int64_t
+usys_epoch()
+{
+    return (int64_t)time(NULL);
+}
+
+uint64_t
+usys_tick()
+{
+    return g_usys_tick = usys_now_ns();
+}
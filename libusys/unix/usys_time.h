@@ -29,7 +29,43 @@ extern "C" {
 #include "usys_config.h"
 
 void usys_msleep(uint32_t ms);
+
+/**
+ * @brief Read the monotonic clock (ms, ns).
+ */
 int64_t usys_now();
+uint64_t usys_now_ns();
+
+/**
+ * @brief Wall clock (seconds since the epoch), for timestamps peers check.
+ */
+int64_t usys_epoch();
+
+/**
+ * @brief Refresh the calling thread's cached clock. Reactors tick once per
+ * loop iteration so timers, metrics and latency share one clock read.
+ *
+ * @return now (ns)
+ */
+uint64_t usys_tick();
+
+extern usys_thread_local uint64_t g_usys_tick;
+
+/**
+ * @brief Cached clock (ns, ms) as of the last usys_tick on this thread.
+ * Threads without a loop never tick and read the clock instead.
+ */
+static inline uint64_t
+usys_now_cached_ns()
+{
+    return g_usys_tick ? g_usys_tick : usys_now_ns();
+}
+
+static inline int64_t
+usys_now_cached()
+{
+    return (int64_t)(usys_now_cached_ns() / 1000000);
+}
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,177 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usys_trace.h"
+
+#include <errno.h>
+
+// Dump output is written in blocks of
+#define USYS_TRACE_BLOCK 4096
+
+// One per thread that recorded a span, kept for the life of the process
+typedef struct usys_trace_ring
+{
+    struct usys_trace_ring* next; /*!< every thread's ring */
+    const char* name;             /*!< usys_trace_thread */
+    uint32_t tid;                 /*!< registration order */
+    uint64_t n;                   /*!< spans ever recorded (atomic) */
+    usys_trace_span spans[USYS_TRACE_RING];
+} usys_trace_ring;
+
+// Private
+usys_trace_ring* usys_trace_ring_get();
+int usys_trace_write(int fd, char* b, uint32_t* l, uint32_t room);
+
+usys_thread_local usys_trace_ring* g_usys_trace_ring = NULL;
+usys_trace_ring* g_usys_trace_rings = NULL;
+uint32_t g_usys_trace_tids = 0;
+
+void
+usys_trace_record(const char* name, uint64_t start)
+{
+    usys_trace_ring* r = g_usys_trace_ring;
+    usys_trace_span* s;
+    uint64_t n;
+    if (!r && !(r = usys_trace_ring_get())) return;
+    n = r->n;
+    s = &r->spans[n & (USYS_TRACE_RING - 1)];
+    s->name = name;
+    s->start = start;
+    s->dur = usys_trace_now() - start;
+    __atomic_store_n(&r->n, n + 1, __ATOMIC_RELEASE);
+}
+
+void
+usys_trace_thread(const char* name)
+{
+#if USYS_TRACE
+    // Named threads get their ring up front (spans only when enabled)
+    usys_trace_ring* r = g_usys_trace_ring;
+    if (r || (r = usys_trace_ring_get())) r->name = name;
+#else
+    ((void)name);
+#endif
+}
+
+int
+usys_trace_dump(int fd)
+{
+    usys_trace_ring* r = __atomic_load_n(&g_usys_trace_rings, __ATOMIC_ACQUIRE);
+    usys_trace_span* spans = usys_malloc(sizeof(r->spans));
+    char b[USYS_TRACE_BLOCK];
+    uint32_t l = 0, k, n = 0, c = 0;
+    uint64_t first, last, seen;
+    int pid = (int)getpid(), err = 0;
+    if (!spans) return -1;
+
+    l = snprintf(b, sizeof(b), "{\"traceEvents\":[");
+    for (; r && !err; r = r->next) {
+        // Copy, then keep only what wasn't overwritten meanwhile
+        last = __atomic_load_n(&r->n, __ATOMIC_ACQUIRE);
+        first = last > USYS_TRACE_RING ? last - USYS_TRACE_RING : 0;
+        memcpy(spans, r->spans, sizeof(r->spans));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seen = __atomic_load_n(&r->n, __ATOMIC_RELAXED);
+        if (seen + 1 > first + USYS_TRACE_RING) {
+            first = seen + 1 - USYS_TRACE_RING; // slot being written is lost
+        }
+
+        if (r->name) {
+            l += snprintf(
+                &b[l],
+                sizeof(b) - l,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                n++ ? "," : "",
+                pid,
+                r->tid,
+                r->name);
+        }
+        for (; first < last && !err; first++) {
+            k = first & (USYS_TRACE_RING - 1);
+            err = usys_trace_write(fd, b, &l, 256);
+            c++;
+            l += snprintf(
+                &b[l],
+                sizeof(b) - l,
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,"
+                "\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%u}",
+                n++ ? "," : "",
+                spans[k].name,
+                (unsigned long long)(spans[k].start / 1000),
+                (uint32_t)(spans[k].start % 1000),
+                (unsigned long long)(spans[k].dur / 1000),
+                (uint32_t)(spans[k].dur % 1000),
+                pid,
+                r->tid);
+        }
+        if (!err) err = usys_trace_write(fd, b, &l, 256);
+    }
+    if (!err) {
+        l += snprintf(&b[l], sizeof(b) - l, "]}\n");
+        err = usys_trace_write(fd, b, &l, sizeof(b));
+    }
+    usys_free(spans);
+    return err ? -1 : (int)c;
+}
+
+usys_trace_ring*
+usys_trace_ring_get()
+{
+    usys_trace_ring* r = usys_malloc(sizeof(usys_trace_ring));
+    if (!r) return NULL;
+    memset(r, 0, sizeof(usys_trace_ring) - sizeof(r->spans));
+    r->tid = __atomic_add_fetch(&g_usys_trace_tids, 1, __ATOMIC_RELAXED);
+
+    // Rings are only ever pushed, usys_trace_dump walks them without a lock
+    r->next = __atomic_load_n(&g_usys_trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+        &g_usys_trace_rings,
+        &r->next,
+        r,
+        1,
+        __ATOMIC_RELEASE,
+        __ATOMIC_RELAXED)) {
+    }
+    return g_usys_trace_ring = r;
+}
+
+int
+usys_trace_write(int fd, char* b, uint32_t* l, uint32_t room)
+{
+    // Flush once less than room is left
+    uint32_t c = 0;
+    ssize_t r;
+    if (USYS_TRACE_BLOCK - *l >= room) return 0;
+    while (c < *l) {
+        if ((r = write(fd, &b[c], *l - c)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c += r;
+    }
+    *l = 0;
+    return 0;
+}
+
+//
+//
+//
@@ -0,0 +1,110 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file usys_trace.h
+ *
+ * @brief Trace spans for timelines of a live node. Build with USYS_TRACE=1
+ * (cmake -DUETH_USE_TRACE=ON), otherwise trace points compile to nothing.
+ *
+ *     usys_trace_begin(t);
+ *     ...
+ *     usys_trace_end(t, "frame_egress");
+ *
+ *     usys_trace("uecc_agree", err = uecc_agree(...));
+ *
+ * Spans (monotonic ns) go to a ring owned by the calling thread, the oldest
+ * are overwritten. usys_trace_dump writes every ring as Chrome trace event
+ * JSON (chrome://tracing, ui.perfetto.dev) from any thread.
+ */
+#ifndef USYS_TRACE_H_
+#define USYS_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+#include "usys_time.h"
+
+#ifndef USYS_TRACE
+#define USYS_TRACE 0
+#endif
+
+// Spans kept per thread (power of 2)
+#ifndef USYS_TRACE_RING
+#define USYS_TRACE_RING (16 * 1024)
+#endif
+
+#if USYS_TRACE
+#define usys_trace_begin(t) uint64_t t = usys_trace_now()
+#define usys_trace_end(t, name) usys_trace_record(name, t)
+#define usys_trace(name, stmt)                                                 \
+    do {                                                                       \
+        uint64_t usys_trace_t_ = usys_trace_now();                             \
+        stmt;                                                                  \
+        usys_trace_record(name, usys_trace_t_);                                \
+    } while (0)
+#else
+#define usys_trace_begin(t)
+#define usys_trace_end(t, name)
+#define usys_trace(name, stmt)                                                 \
+    do {                                                                       \
+        stmt;                                                                  \
+    } while (0)
+#endif
+
+typedef struct
+{
+    const char* name; /*!< string literal */
+    uint64_t start;   /*!< ns (usys_trace_now) */
+    uint64_t dur;     /*!< ns */
+} usys_trace_span;
+
+static inline uint64_t
+usys_trace_now()
+{
+    return usys_now_ns();
+}
+
+/**
+ * @brief Record a span from start to now on the calling thread's ring.
+ */
+void usys_trace_record(const char* name, uint64_t start);
+
+/**
+ * @brief Name the calling thread in dumps (string literal). Nothing unless
+ * built with USYS_TRACE.
+ */
+void usys_trace_thread(const char* name);
+
+/**
+ * @brief Write the spans of every thread to fd as Chrome trace JSON. Up to
+ * USYS_TRACE_RING - 1 per thread, spans overwritten while read are left out.
+ *
+ * @return spans written, -1 error
+ */
+int usys_trace_dump(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif